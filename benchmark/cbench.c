@@ -0,0 +1,593 @@
+/*
+ * cbench.c
+ *
+ * Microbenchmarks of cookfs internals. This is a standalone program that
+ * is linked with cookfs objects directly, so the measurements don't include
+ * the overhead of Tcl commands and Tcl VFS layer.
+ *
+ * Each benchmark is run with increasing number of operations until its
+ * duration reaches the specified time. The result is reported as
+ * nanoseconds per operation and, where applicable, as throughput in MB/s.
+ *
+ * Usage: make bench-c [BENCH_ARGS="?-time <msec>? ?-filter <pattern>?
+ *     ?-csv <file>? ?-file <file>?"]
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+// The benchmark driver calls Tcl directly, while cookfs objects use
+// the stubs table initialized in Cookfs_Init().
+#undef USE_TCL_STUBS
+
+#include "cookfs.h"
+#include "pages.h"
+#include "pagesInt.h"
+#include "pagesCompr.h"
+#include "fsindex.h"
+#include "fsindexIO.h"
+#include "writer.h"
+
+// Returns the duration of the measured part in nanoseconds, or -1 in case
+// of an error.
+typedef Tcl_WideInt (CookfsBenchProc)(void *data, Tcl_WideInt ops);
+
+static struct {
+    Tcl_WideInt minTime;
+    const char *filter;
+    FILE *csv;
+    Tcl_Obj *fileName;
+    Tcl_Interp *interp;
+} options;
+
+static void CookfsBenchFatal(const char *message, Tcl_Obj *err) {
+    fprintf(stderr, "ERROR: %s%s%s\n", message, (err == NULL ? "" : ": "),
+        (err == NULL ? "" : Tcl_GetString(err)));
+    exit(1);
+}
+
+static void CookfsBenchRun(const char *name, CookfsBenchProc *proc,
+    void *data, Tcl_WideInt bytesPerOp)
+{
+    if (options.filter != NULL && !Tcl_StringMatch(name, options.filter)) {
+        return;
+    }
+
+    // Warm up caches and lazy initializations
+    if (proc(data, 1) < 0) {
+        CookfsBenchFatal(name, NULL);
+    }
+
+    Tcl_WideInt ops = 1;
+    Tcl_WideInt time;
+    for (;;) {
+        time = proc(data, ops);
+        if (time < 0) {
+            CookfsBenchFatal(name, NULL);
+        }
+        if (time >= options.minTime || ops >= ((Tcl_WideInt)1 << 40)) {
+            break;
+        }
+        // Try to reach the target time with the next run, but don't
+        // increase the number of operations more than 10 times.
+        Tcl_WideInt next = (time <= 0 ? ops * 10 :
+            (Tcl_WideInt)((double)ops * options.minTime * 1.2 / time));
+        ops = (next > ops * 10 ? ops * 10 : (next <= ops ? ops * 2 : next));
+    }
+
+    double nsPerOp = (double)time / ops;
+    // 1 byte per nanosecond is 1000 MB/s
+    double mbps = (bytesPerOp ? bytesPerOp * 1000.0 / nsPerOp : 0);
+
+    if (bytesPerOp) {
+        printf("%-40s %12" TCL_LL_MODIFIER "d %14.1f ns/op %10.2f MB/s\n",
+            name, ops, nsPerOp, mbps);
+    } else {
+        printf("%-40s %12" TCL_LL_MODIFIER "d %14.1f ns/op\n", name, ops,
+            nsPerOp);
+    }
+    fflush(stdout);
+
+    if (options.csv != NULL) {
+        fprintf(options.csv, "%s,%" TCL_LL_MODIFIER "d,%.1f,%.2f\n", name,
+            ops, nsPerOp, mbps);
+    }
+}
+
+// Generates a buffer with data that looks like a text, so that it can
+// be compressed by all compression methods. The seed makes the content
+// unique to avoid deduplication of pages.
+static unsigned char *CookfsBenchGenData(int size, unsigned int seed) {
+    static const char *const words[] = {
+        "cookfs", "page", "index", "archive", "file", "directory", "mount",
+        "read", "write", "compress", "cache", "block", "offset", "size"
+    };
+    unsigned char *buffer = (unsigned char *)ckalloc(size);
+    unsigned int x = seed * 2654435761U + 1;
+    int pos = 0;
+    while (pos < size) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const char *word = words[x % (sizeof(words) / sizeof(words[0]))];
+        for (; *word != '\0' && pos < size; word++) {
+            buffer[pos++] = *word;
+        }
+        if (pos < size) {
+            buffer[pos++] = (x & 0x700) ? ' ' : '\n';
+        }
+    }
+    return buffer;
+}
+
+static Cookfs_Pages *CookfsBenchPagesInit(void) {
+    Tcl_Obj *err = NULL;
+    Tcl_FSDeleteFile(options.fileName);
+    Cookfs_Pages *p = Cookfs_PagesInit(options.interp, options.fileName, 0,
+        COOKFS_COMPRESSION_NONE, -1, COOKFS_COMPRESSION_NONE, -1, NULL, 0, -1,
+        NULL, 0, 0, 0,
+#if defined(COOKFS_USECALLBACKS)
+        0, NULL, NULL, NULL, NULL,
+#endif /* COOKFS_USECALLBACKS */
+        &err);
+    if (p == NULL) {
+        CookfsBenchFatal("failed to create pages", err);
+    }
+    return p;
+}
+
+static void CookfsBenchPagesFini(Cookfs_Pages *p) {
+    Cookfs_PagesFini(p);
+    Tcl_FSDeleteFile(options.fileName);
+}
+
+/* Pages */
+
+typedef struct {
+    Cookfs_Pages *p;
+    int index;
+    unsigned char *data;
+    int dataSize;
+} CookfsBenchPages;
+
+static Tcl_WideInt CookfsBenchPageGet(void *data, Tcl_WideInt ops) {
+    CookfsBenchPages *b = (CookfsBenchPages *)data;
+    Tcl_Obj *err = NULL;
+    if (!Cookfs_PagesLockRead(b->p, &err)) {
+        return -1;
+    }
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt i = 0; i < ops; i++) {
+        Cookfs_PageObj pg = Cookfs_PageGet(b->p, b->index, 1000, &err);
+        if (pg == NULL) {
+            Cookfs_PagesUnlock(b->p);
+            return -1;
+        }
+        Cookfs_PageObjDecrRefCount(pg);
+    }
+    Tcl_WideInt time = Cookfs_LatencyGetTime() - start;
+    Cookfs_PagesUnlock(b->p);
+    return time;
+}
+
+static Tcl_WideInt CookfsBenchReadPage(void *data, Tcl_WideInt ops) {
+    CookfsBenchPages *b = (CookfsBenchPages *)data;
+    Cookfs_Pages *p = b->p;
+    Tcl_Obj *err = NULL;
+    if (!Cookfs_PagesLockRead(p, &err)) {
+        return -1;
+    }
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt i = 0; i < ops; i++) {
+#ifdef TCL_THREADS
+        Cookfs_MutexLock(&p->mxIO, &p->statsIO);
+#endif /* TCL_THREADS */
+        Cookfs_PageObj pg = Cookfs_ReadPage(p,
+            Cookfs_PagesGetPageOffset(p, b->index),
+            Cookfs_PgIndexGetCompression(p->pagesIndex, b->index),
+            Cookfs_PgIndexGetSizeCompressed(p->pagesIndex, b->index),
+            Cookfs_PgIndexGetSizeUncompressed(p->pagesIndex, b->index),
+            Cookfs_PgIndexGetHashMD5(p->pagesIndex, b->index),
+            1, 0, &err);
+#ifdef TCL_THREADS
+        Cookfs_MutexUnlock(&p->mxIO, &p->statsIO);
+#endif /* TCL_THREADS */
+        if (pg == NULL) {
+            Cookfs_PagesUnlock(p);
+            return -1;
+        }
+        Cookfs_PageObjDecrRefCount(pg);
+    }
+    Tcl_WideInt time = Cookfs_LatencyGetTime() - start;
+    Cookfs_PagesUnlock(p);
+    return time;
+}
+
+static Tcl_WideInt CookfsBenchPageAddDedup(void *data, Tcl_WideInt ops) {
+    CookfsBenchPages *b = (CookfsBenchPages *)data;
+    Tcl_Obj *err = NULL;
+    if (!Cookfs_PagesLockWrite(b->p, &err)) {
+        return -1;
+    }
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt i = 0; i < ops; i++) {
+        if (Cookfs_PageAddRaw(b->p, b->data, b->dataSize, &err) != b->index) {
+            Cookfs_PagesUnlock(b->p);
+            return -1;
+        }
+    }
+    Tcl_WideInt time = Cookfs_LatencyGetTime() - start;
+    Cookfs_PagesUnlock(b->p);
+    return time;
+}
+
+static int CookfsBenchPageAdd(CookfsBenchPages *b, int size,
+    unsigned int seed)
+{
+    Tcl_Obj *err = NULL;
+    b->dataSize = size;
+    b->data = CookfsBenchGenData(size, seed);
+    if (!Cookfs_PagesLockWrite(b->p, &err)) {
+        CookfsBenchFatal("failed to lock pages", err);
+    }
+    b->index = Cookfs_PageAddRaw(b->p, b->data, size, &err);
+    Cookfs_PagesUnlock(b->p);
+    if (b->index < 0) {
+        CookfsBenchFatal("failed to add page", err);
+    }
+    return b->index;
+}
+
+static void CookfsBenchSuitePages(void) {
+
+    CookfsBenchPages b;
+    char name[128];
+    b.p = CookfsBenchPagesInit();
+
+    int size = 256 * 1024;
+    CookfsBenchPageAdd(&b, size, 1);
+
+    Cookfs_PagesSetCacheSize(b.p, 4);
+    CookfsBenchRun("pages/get/hit", CookfsBenchPageGet, &b, size);
+    Cookfs_PagesSetCacheSize(b.p, 0);
+    CookfsBenchRun("pages/get/miss", CookfsBenchPageGet, &b, size);
+
+    CookfsBenchRun("pages/addraw/dedup/256k", CookfsBenchPageAddDedup, &b,
+        size);
+    ckfree(b.data);
+
+    CookfsBenchPageAdd(&b, 4096, 2);
+    CookfsBenchRun("pages/addraw/dedup/4k", CookfsBenchPageAddDedup, &b,
+        4096);
+    ckfree(b.data);
+
+    for (int i = 0; cookfsCompressionOptions[i] != NULL; i++) {
+#if defined(COOKFS_USECALLBACKS)
+        if (cookfsCompressionOptionMap[i] == COOKFS_COMPRESSION_CUSTOM) {
+            continue;
+        }
+#endif /* COOKFS_USECALLBACKS */
+        Cookfs_CompressionType compression;
+        int level;
+        Tcl_Obj *compressionObj =
+            Tcl_NewStringObj(cookfsCompressionOptions[i], -1);
+        Tcl_IncrRefCount(compressionObj);
+        if (Cookfs_CompressionFromObj(NULL, compressionObj, &compression,
+            &level) != TCL_OK)
+        {
+            CookfsBenchFatal("failed to get compression", compressionObj);
+        }
+        Tcl_DecrRefCount(compressionObj);
+
+        Tcl_Obj *err = NULL;
+        if (!Cookfs_PagesLockWrite(b.p, &err)) {
+            CookfsBenchFatal("failed to lock pages", err);
+        }
+        Cookfs_PagesSetCompression(b.p, compression, level);
+        Cookfs_PagesUnlock(b.p);
+
+        CookfsBenchPageAdd(&b, size, 100 + i);
+        ckfree(b.data);
+
+        sprintf(name, "pages/readpage/%s", cookfsCompressionOptions[i]);
+        CookfsBenchRun(name, CookfsBenchReadPage, &b, size);
+    }
+
+    CookfsBenchPagesFini(b.p);
+
+}
+
+/* Fsindex */
+
+typedef struct {
+    Cookfs_Fsindex *i;
+    Cookfs_PathObj *pathObj;
+    Tcl_Obj *exportObj;
+} CookfsBenchFsindex;
+
+static Cookfs_PathObj *CookfsBenchPath(const char *format, int a, int b) {
+    char buffer[64];
+    sprintf(buffer, format, a, b);
+    Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromStr(buffer, -1);
+    Cookfs_PathObjIncrRefCount(pathObj);
+    return pathObj;
+}
+
+static void CookfsBenchFsindexAdd(Cookfs_Fsindex *i, Cookfs_PathObj *pathObj,
+    int isDirectory)
+{
+    Cookfs_FsindexEntry *e;
+    if (isDirectory) {
+        e = Cookfs_FsindexSetDirectory(i, pathObj);
+    } else {
+        e = Cookfs_FsindexSet(i, pathObj, 1);
+        if (e != NULL) {
+            Cookfs_FsindexEntrySetBlock(e, 0, 0, 0, 1024);
+            Cookfs_FsindexEntrySetFileSize(e, 1024);
+        }
+    }
+    if (e == NULL) {
+        CookfsBenchFatal("failed to add an entry to fsindex",
+            Cookfs_PathObjGetFullnameObj(pathObj));
+    }
+    Cookfs_PathObjDecrRefCount(pathObj);
+}
+
+// Creates a chain of directories of the specified depth. Each directory
+// contains the specified number of entries. Returns the path to the file
+// in the deepest directory.
+static Cookfs_PathObj *CookfsBenchFsindexTree(Cookfs_Fsindex *i, int depth,
+    int fanout)
+{
+    Tcl_DString path;
+    Tcl_DStringInit(&path);
+    char buffer[32];
+    for (int level = 0; level < depth; level++) {
+        int prefixLength = Tcl_DStringLength(&path);
+        for (int n = 0; n < fanout; n++) {
+            sprintf(buffer, "%se%04d", (prefixLength ? "/" : ""), n);
+            Tcl_DStringAppend(&path, buffer, -1);
+            Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromStr(
+                Tcl_DStringValue(&path), Tcl_DStringLength(&path));
+            Cookfs_PathObjIncrRefCount(pathObj);
+            // The first entry is a directory that contains the next level
+            CookfsBenchFsindexAdd(i, pathObj, (n == 0 && level < depth - 1));
+            Tcl_DStringSetLength(&path, prefixLength);
+        }
+        sprintf(buffer, "%se%04d", (prefixLength ? "/" : ""),
+            (level < depth - 1 ? 0 : fanout - 1));
+        Tcl_DStringAppend(&path, buffer, -1);
+    }
+    Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromStr(
+        Tcl_DStringValue(&path), Tcl_DStringLength(&path));
+    Cookfs_PathObjIncrRefCount(pathObj);
+    Tcl_DStringFree(&path);
+    return pathObj;
+}
+
+static Tcl_WideInt CookfsBenchFsindexGet(void *data, Tcl_WideInt ops) {
+    CookfsBenchFsindex *b = (CookfsBenchFsindex *)data;
+    if (!Cookfs_FsindexLockRead(b->i, NULL)) {
+        return -1;
+    }
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt n = 0; n < ops; n++) {
+        if (Cookfs_FsindexGet(b->i, b->pathObj) == NULL) {
+            Cookfs_FsindexUnlock(b->i);
+            return -1;
+        }
+    }
+    Tcl_WideInt time = Cookfs_LatencyGetTime() - start;
+    Cookfs_FsindexUnlock(b->i);
+    return time;
+}
+
+static Tcl_WideInt CookfsBenchFsindexExport(void *data, Tcl_WideInt ops) {
+    CookfsBenchFsindex *b = (CookfsBenchFsindex *)data;
+    if (!Cookfs_FsindexLockRead(b->i, NULL)) {
+        return -1;
+    }
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt n = 0; n < ops; n++) {
+        Tcl_Obj *obj = Cookfs_FsindexToObject(b->i);
+        if (obj == NULL) {
+            Cookfs_FsindexUnlock(b->i);
+            return -1;
+        }
+        Tcl_IncrRefCount(obj);
+        Tcl_DecrRefCount(obj);
+    }
+    Tcl_WideInt time = Cookfs_LatencyGetTime() - start;
+    Cookfs_FsindexUnlock(b->i);
+    return time;
+}
+
+static Tcl_WideInt CookfsBenchFsindexImport(void *data, Tcl_WideInt ops) {
+    CookfsBenchFsindex *b = (CookfsBenchFsindex *)data;
+    Tcl_Size size;
+    unsigned char *bytes = Tcl_GetByteArrayFromObj(b->exportObj, &size);
+    Tcl_WideInt start = Cookfs_LatencyGetTime();
+    for (Tcl_WideInt n = 0; n < ops; n++) {
+        Cookfs_Fsindex *i = Cookfs_FsindexFromBytes(NULL, NULL, bytes, size);
+        if (i == NULL) {
+            return -1;
+        }
+        Cookfs_FsindexFini(i);
+    }
+    return Cookfs_LatencyGetTime() - start;
+}
+
+static void CookfsBenchSuiteFsindex(void) {
+
+    static const int depths[] = { 1, 4, 16 };
+    static const int fanouts[] = { 8, 64, 1024 };
+    char name[128];
+    CookfsBenchFsindex b;
+
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        for (size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); f++) {
+            b.i = Cookfs_FsindexInit(NULL, NULL);
+            b.pathObj = CookfsBenchFsindexTree(b.i, depths[d], fanouts[f]);
+            sprintf(name, "fsindex/get/depth%d/fanout%d", depths[d],
+                fanouts[f]);
+            CookfsBenchRun(name, CookfsBenchFsindexGet, &b, 0);
+            Cookfs_PathObjDecrRefCount(b.pathObj);
+            Cookfs_FsindexFini(b.i);
+        }
+    }
+
+    // Large index: 100 directories with 1000 files in each
+    b.i = Cookfs_FsindexInit(NULL, NULL);
+    for (int d = 0; d < 100; d++) {
+        CookfsBenchFsindexAdd(b.i, CookfsBenchPath("dir%03d", d, 0), 1);
+        for (int f = 0; f < 1000; f++) {
+            CookfsBenchFsindexAdd(b.i,
+                CookfsBenchPath("dir%03d/file%04d.txt", d, f), 0);
+        }
+    }
+    b.exportObj = Cookfs_FsindexToObject(b.i);
+    Tcl_IncrRefCount(b.exportObj);
+    Tcl_Size size;
+    Tcl_GetByteArrayFromObj(b.exportObj, &size);
+    CookfsBenchRun("fsindex/export/100000", CookfsBenchFsindexExport, &b,
+        size);
+    CookfsBenchRun("fsindex/import/100000", CookfsBenchFsindexImport, &b,
+        size);
+    Tcl_DecrRefCount(b.exportObj);
+    Cookfs_FsindexFini(b.i);
+
+}
+
+/* Writer */
+
+#define COOKFS_BENCH_WRITER_BATCH 1000
+#define COOKFS_BENCH_WRITER_FILESIZE 1024
+
+typedef struct {
+    Cookfs_Writer *w;
+    unsigned int round;
+} CookfsBenchWriter;
+
+// Adds small files in batches and measures the time of Cookfs_WriterPurge()
+// for each batch. Adding files is not measured.
+static Tcl_WideInt CookfsBenchWriterPurge(void *data, Tcl_WideInt ops) {
+    CookfsBenchWriter *b = (CookfsBenchWriter *)data;
+    Tcl_Obj *err = NULL;
+    Tcl_WideInt time = 0;
+    for (Tcl_WideInt n = 0; n < ops;) {
+        if (!Cookfs_WriterLockWrite(b->w, &err)) {
+            return -1;
+        }
+        b->round++;
+        for (int f = 0; f < COOKFS_BENCH_WRITER_BATCH && n < ops; f++, n++) {
+            // Use unique content for each file to avoid deduplication
+            Cookfs_PathObj *pathObj = CookfsBenchPath("file%05d.%d", f,
+                b->round);
+            unsigned char *buffer = CookfsBenchGenData(
+                COOKFS_BENCH_WRITER_FILESIZE, b->round * 100000 + f);
+            int rc = Cookfs_WriterAddFile(b->w, pathObj, NULL,
+                COOKFS_WRITER_SOURCE_BUFFER, buffer,
+                COOKFS_BENCH_WRITER_FILESIZE, &err);
+            Cookfs_PathObjDecrRefCount(pathObj);
+            if (rc != TCL_OK) {
+                Cookfs_WriterUnlock(b->w);
+                return -1;
+            }
+        }
+        Tcl_WideInt start = Cookfs_LatencyGetTime();
+        int rc = Cookfs_WriterPurge(b->w, 1, &err);
+        time += Cookfs_LatencyGetTime() - start;
+        Cookfs_WriterUnlock(b->w);
+        if (rc != TCL_OK) {
+            return -1;
+        }
+    }
+    return time;
+}
+
+static void CookfsBenchSuiteWriter(void) {
+
+    CookfsBenchWriter b;
+    b.round = 0;
+
+    Cookfs_Pages *p = CookfsBenchPagesInit();
+    Cookfs_Fsindex *i = Cookfs_FsindexInit(NULL, NULL);
+
+    // The buffer is large enough to keep the whole batch, so files
+    // are written only by explicit purges.
+    b.w = Cookfs_WriterInit(options.interp, p, i, 64 * 1024 * 1024,
+        COOKFS_BENCH_WRITER_FILESIZE, 1024 * 1024, 0);
+    if (b.w == NULL) {
+        CookfsBenchFatal("failed to create writer", NULL);
+    }
+
+    CookfsBenchRun("writer/purge/1k", CookfsBenchWriterPurge, &b,
+        COOKFS_BENCH_WRITER_FILESIZE);
+
+    Cookfs_WriterFini(b.w);
+    Cookfs_FsindexFini(i);
+    CookfsBenchPagesFini(p);
+
+}
+
+int main(int argc, char **argv) {
+
+    options.minTime = 1000;
+    options.filter = NULL;
+    options.csv = NULL;
+    const char *fileName = "cbench.cfs";
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "ERROR: option \"%s\" requires a value\n",
+                argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-time") == 0) {
+            options.minTime = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-filter") == 0) {
+            options.filter = argv[i + 1];
+        } else if (strcmp(argv[i], "-file") == 0) {
+            fileName = argv[i + 1];
+        } else if (strcmp(argv[i], "-csv") == 0) {
+            options.csv = fopen(argv[i + 1], "w");
+            if (options.csv == NULL) {
+                fprintf(stderr, "ERROR: could not open \"%s\"\n",
+                    argv[i + 1]);
+                return 1;
+            }
+            fprintf(options.csv, "name,ops,ns/op,MB/s\n");
+        } else {
+            fprintf(stderr, "ERROR: unknown option \"%s\": must be -time,"
+                " -filter, -file or -csv\n", argv[i]);
+            return 1;
+        }
+    }
+    // -time is in milliseconds
+    options.minTime *= 1000000;
+
+    Tcl_FindExecutable(argv[0]);
+    options.interp = Tcl_CreateInterp();
+    if (Cookfs_Init(options.interp) != TCL_OK) {
+        CookfsBenchFatal("failed to initialize cookfs",
+            Tcl_GetObjResult(options.interp));
+    }
+
+    options.fileName = Tcl_NewStringObj(fileName, -1);
+    Tcl_IncrRefCount(options.fileName);
+
+    printf("%-40s %12s %20s %15s\n", "benchmark", "ops", "time", "throughput");
+
+    CookfsBenchSuitePages();
+    CookfsBenchSuiteFsindex();
+    CookfsBenchSuiteWriter();
+
+    Tcl_DecrRefCount(options.fileName);
+    if (options.csv != NULL) {
+        fclose(options.csv);
+    }
+    Tcl_DeleteInterp(options.interp);
+    Tcl_Finalize();
+
+    return 0;
+
+}
@@ -0,0 +1,385 @@
+# cookfs benchmark
+#
+# Copyright (C) 2024 Konstantin Kushnir <chpock@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# Measures archive operations on synthetic corpora. Unlike refs-gen.tcl,
+# it doesn't need network access or external utilities. The corpora are
+# generated by a seeded pseudo-random generator, so the same seed and
+# scale always produce the same files.
+#
+# Corpora:
+#   text   - many small text files in nested directories
+#   binary - binary files with repeating structures and random fields
+#   dups   - a small set of files copied to many directories
+#   random - incompressible blobs
+#
+# For each corpus and each available compression method the following
+# is measured:
+#   build      - copying the corpus into a new archive and unmounting it
+#   size       - size of the archive
+#   mount      - mounting the archive (median of several mounts)
+#   coldread   - reading random files right after mount
+#   warmread   - reading the same files again
+#   seqread    - reading all files in directory order
+#   stat       - glob of all directories and stat of all files
+#   threadread - reading random files from multiple threads (requires
+#                the Thread package, skipped otherwise)
+#
+# Results are printed as a table and written to a CSV file with columns
+# "corpus,codec,metric,value,unit" for regression tracking.
+#
+# Usage: make bench-synthetic [BENCH_ARGS="?-scale <n>? ?-seed <n>?
+#     ?-codecs <list>? ?-corpora <list>? ?-threads <n>? ?-output <file>?"]
+
+package require cookfs
+
+set options {
+    -scale   1
+    -seed    1
+    -codecs  {}
+    -corpora {text binary dups random}
+    -threads 4
+    -output  bench-synthetic.csv
+}
+
+if { [llength $argv] % 2 } {
+    return -code error "wrong # args: options must be specified as\
+        option-value pairs"
+}
+foreach { opt val } $argv {
+    if { ![dict exists $options $opt] } {
+        return -code error "unknown option \"$opt\": must be one of\
+            [join [dict keys $options] {, }]"
+    }
+    dict set options $opt $val
+}
+dict with options {}
+
+foreach corpus ${-corpora} {
+    if { $corpus ni {text binary dups random} } {
+        return -code error "unknown corpus \"$corpus\": must be one of\
+            text, binary, dups or random"
+    }
+}
+
+# Use all compression methods available in this build by default
+if { ![llength ${-codecs}] } {
+    set -codecs {none zlib}
+    foreach codec {bzip2 lzma zstd brotli} {
+        if { [::cookfs::pkgconfig get feature-$codec] } {
+            lappend -codecs $codec
+        }
+    }
+}
+
+set hasThreads [expr { ${-threads} > 0 && \
+    ![catch { package require Thread }] }]
+
+close [file tempfile tempdir]
+file delete -force -- $tempdir
+set tempdir [file join [file dirname $tempdir] cookfs-bench-synthetic]
+file delete -force -- $tempdir
+file mkdir $tempdir
+
+# Pseudo-random generator (xorshift32). Tcl's rand() is not used, since
+# its sequence is not guaranteed to be the same across Tcl versions.
+
+proc srnd { seed } {
+    set ::rndState [expr { ($seed * 2654435761 + 1) & 0xFFFFFFFF }]
+    if { !$::rndState } { set ::rndState 1 }
+}
+
+proc rnd { max } {
+    set x $::rndState
+    set x [expr { ($x ^ ($x << 13)) & 0xFFFFFFFF }]
+    set x [expr { $x ^ ($x >> 17) }]
+    set x [expr { ($x ^ ($x << 5)) & 0xFFFFFFFF }]
+    set ::rndState $x
+    return [expr { $x % $max }]
+}
+
+proc rndbytes { size } {
+    set words [list]
+    for { set i [expr { ($size + 3) / 4 }] } { $i > 0 } { incr i -1 } {
+        lappend words [rnd 0x100000000]
+    }
+    return [string range [binary format i* $words] 0 $size-1]
+}
+
+proc rndtext { size } {
+    set result ""
+    while { [string length $result] < $size } {
+        append result [lindex $::words [rnd [llength $::words]]]
+        append result [expr { [rnd 12] ? " " : "\n" }]
+    }
+    return [string range $result 0 $size-1]
+}
+
+proc writefile { file data } {
+    file mkdir [file dirname $file]
+    set fd [open $file wb]
+    puts -nonewline $fd $data
+    close $fd
+    # Use a fixed mtime so that archives are the same for the same seed
+    file mtime $file 1700000000
+}
+
+# Create a dictionary of words that look like a natural language text
+srnd ${-seed}
+set words [list]
+set syllables {ka to ri en ma lo su ne di ar po vi tu se ol im}
+for { set i 0 } { $i < 512 } { incr i } {
+    set word ""
+    for { set j [expr { 1 + [rnd 4] }] } { $j > 0 } { incr j -1 } {
+        append word [lindex $syllables [rnd [llength $syllables]]]
+    }
+    lappend words $word
+}
+
+proc gen_text { dir scale } {
+    for { set i 0 } { $i < 2000 * $scale } { incr i } {
+        set file [file join $dir \
+            [format "d%02d/s%02d/f%05d.txt" [rnd 10] [rnd 10] $i]]
+        writefile $file [rndtext [expr { 256 + [rnd 4096] }]]
+    }
+}
+
+proc gen_binary { dir scale } {
+    for { set i 0 } { $i < 200 * $scale } { incr i } {
+        # Records with a fixed layout: a magic, a counter, a few random
+        # fields and zero padding.
+        set data ""
+        set records [expr { 64 + [rnd 2048] }]
+        for { set r 0 } { $r < $records } { incr r } {
+            append data [binary format a4isc2x6 "REC\0" $r [rnd 0x10000] \
+                [list [rnd 256] [rnd 4]]]
+        }
+        # Some files have random tails
+        if { [rnd 4] == 0 } {
+            append data [rndbytes [rnd 16384]]
+        }
+        writefile [file join $dir [format "b%02d/f%04d.bin" [rnd 8] $i]] $data
+    }
+}
+
+proc gen_dups { dir scale } {
+    set unique [list]
+    for { set i 0 } { $i < 50 } { incr i } {
+        if { $i % 2 } {
+            lappend unique [rndtext [expr { 1024 + [rnd 32768] }]]
+        } else {
+            lappend unique [rndbytes [expr { 1024 + [rnd 32768] }]]
+        }
+    }
+    for { set i 0 } { $i < 1000 * $scale } { incr i } {
+        writefile [file join $dir [format "c%03d/f%04d.dat" [rnd 40] $i]] \
+            [lindex $unique [rnd [llength $unique]]]
+    }
+}
+
+proc gen_random { dir scale } {
+    for { set i 0 } { $i < 16 * $scale } { incr i } {
+        writefile [file join $dir [format "r%03d.bin" $i]] \
+            [rndbytes [expr { 65536 + [rnd 262144] }]]
+    }
+}
+
+# Returns a list of files and a list of directories in the directory
+# relative to the directory.
+proc listdir { dir { prefix {} } } {
+    set files [list]
+    set dirs [list $prefix]
+    foreach name [lsort [glob -nocomplain -tails -directory $dir *]] {
+        set rel [expr { $prefix eq "" ? $name : "$prefix/$name" }]
+        if { [file isdirectory [file join $dir $name]] } {
+            lassign [listdir [file join $dir $name] $rel] subfiles subdirs
+            lappend files {*}$subfiles
+            lappend dirs {*}$subdirs
+        } else {
+            lappend files $rel
+        }
+    }
+    return [list $files $dirs]
+}
+
+proc readfiles { root files } {
+    set bytes 0
+    foreach file $files {
+        set fd [open [file join $root $file] rb]
+        incr bytes [string length [read $fd]]
+        close $fd
+    }
+    return $bytes
+}
+
+proc usec { script } {
+    set start [clock microseconds]
+    uplevel 1 $script
+    return [expr { [clock microseconds] - $start }]
+}
+
+set results [list]
+
+proc result { corpus codec metric value unit } {
+    lappend ::results [list $corpus $codec $metric $value $unit]
+    puts [format "%-8s %-8s %-12s %14s %s" $corpus $codec $metric $value $unit]
+}
+
+proc mbps { bytes usec } {
+    return [format %.2f [expr { $usec ? 1.0 * $bytes / $usec : 0 }]]
+}
+
+set threadScript {
+    package require cookfs
+    proc run { root files } {
+        set start [clock microseconds]
+        set bytes 0
+        foreach file $files {
+            set fd [open [file join $root $file] rb]
+            incr bytes [string length [read $fd]]
+            close $fd
+        }
+        return [list $bytes [expr { [clock microseconds] - $start }]]
+    }
+}
+
+puts "Working directory: $tempdir"
+puts "Codecs: ${-codecs}"
+if { !$hasThreads } {
+    puts "Thread package is not available, threadread is skipped"
+}
+puts ""
+puts [format "%-8s %-8s %-12s %14s %s" corpus codec metric value unit]
+
+foreach corpus ${-corpora} {
+
+    set src [file join $tempdir $corpus]
+    srnd [expr { ${-seed} + [lsearch {text binary dups random} $corpus] }]
+    gen_$corpus $src ${-scale}
+
+    lassign [listdir $src] files dirs
+    set total 0
+    foreach file $files {
+        incr total [file size [file join $src $file]]
+    }
+
+    # The same random sample of files is used for all codecs
+    set sample [list]
+    for { set i [expr { min(500, [llength $files]) }] } { $i > 0 } { incr i -1 } {
+        lappend sample [lindex $files [rnd [llength $files]]]
+    }
+    set sampleBytes 0
+    foreach file $sample {
+        incr sampleBytes [file size [file join $src $file]]
+    }
+
+    result $corpus - files [llength $files] count
+    result $corpus - bytes $total bytes
+
+    foreach codec ${-codecs} {
+
+        set archive [file join $tempdir $corpus-$codec.cfs]
+        file delete -force -- $archive
+
+        set time [usec {
+            cookfs::Mount $archive $archive -compression $codec
+            foreach name [glob -tails -directory $src *] {
+                file copy [file join $src $name] [file join $archive $name]
+            }
+        }]
+        # Directories get the current time when created, reset it to get
+        # the same archive for the same seed
+        foreach dir $dirs {
+            file mtime [file join $archive $dir] 1700000000
+        }
+        incr time [usec { cookfs::Unmount $archive }]
+        result $corpus $codec build $time usec
+        result $corpus $codec size [file size $archive] bytes
+
+        set times [list]
+        for { set i 0 } { $i < 5 } { incr i } {
+            lappend times [usec { cookfs::Mount $archive $archive -readonly }]
+            cookfs::Unmount $archive
+        }
+        result $corpus $codec mount [lindex [lsort -integer $times] 2] usec
+
+        cookfs::Mount $archive $archive -readonly
+        set time [usec { readfiles $archive $sample }]
+        result $corpus $codec coldread [mbps $sampleBytes $time] MB/s
+        set time [usec { readfiles $archive $sample }]
+        result $corpus $codec warmread [mbps $sampleBytes $time] MB/s
+        cookfs::Unmount $archive
+
+        cookfs::Mount $archive $archive -readonly
+        set time [usec { readfiles $archive $files }]
+        result $corpus $codec seqread [mbps $total $time] MB/s
+
+        set ops 0
+        set time [usec {
+            for { set i 0 } { $i < 3 } { incr i } {
+                foreach dir $dirs {
+                    glob -nocomplain -directory [file join $archive $dir] *
+                    incr ops
+                }
+                foreach file $files {
+                    file stat [file join $archive $file] stat
+                    incr ops
+                }
+            }
+        }]
+        result $corpus $codec stat \
+            [format %.0f [expr { 1000000.0 * $ops / $time }]] ops/s
+        cookfs::Unmount $archive
+
+        if { $hasThreads } {
+            cookfs::Mount $archive $archive -readonly -shared
+            set tids [list]
+            for { set i 0 } { $i < ${-threads} } { incr i } {
+                set tid [thread::create thread::wait]
+                thread::send $tid $threadScript
+                lappend tids $tid
+            }
+            set time [usec {
+                foreach tid $tids {
+                    thread::send -async $tid [list run $archive $sample] \
+                        threadResult($tid)
+                }
+                foreach tid $tids {
+                    if { ![info exists threadResult($tid)] } {
+                        vwait threadResult($tid)
+                    }
+                }
+            }]
+            array unset threadResult
+            foreach tid $tids {
+                thread::release $tid
+            }
+            cookfs::Unmount $archive
+            result $corpus $codec threadread \
+                [mbps [expr { $sampleBytes * ${-threads} }] $time] MB/s
+        }
+
+        file delete -force -- $archive
+
+    }
+
+    file delete -force -- $src
+
+}
+
+file delete -force -- $tempdir
+
+set fd [open ${-output} w]
+puts $fd "corpus,codec,metric,value,unit"
+foreach row $results {
+    puts $fd [join $row ,]
+}
+close $fd
+
+puts ""
+puts "Results are written to: [file normalize ${-output}]"
@@ -0,0 +1,93 @@
+# cookfs benchmark
+#
+# Copyright (C) 2024 Konstantin Kushnir <chpock@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# Measures reads of the same file from multiple threads. All threads hit
+# the same cached page, the same fsindex entry and parse the same path.
+# The "stat" operation only requests file metadata and mostly measures
+# read locks of fsindex.
+#
+# Usage: make bench-threads [BENCH_ARGS="<iterations> <max threads> <read|stat>"]
+
+package require Thread
+package require cookfs
+
+lassign $argv iterations maxthreads op
+if { $iterations eq "" } { set iterations 20000 }
+if { $maxthreads eq "" } { set maxthreads 8 }
+if { $op eq "" } { set op "read" }
+if { $op ni {read stat} } {
+    return -code error "unknown operation \"$op\": must be read or stat"
+}
+
+set archive [file join [pwd] bench-threads.cfs]
+file delete -force $archive
+
+cookfs::Mount $archive $archive -smallfilesize 0 -compression none -shared
+set fd [open [file join $archive hot.bin] wb]
+puts -nonewline $fd [string repeat "cookfs" 1024]
+close $fd
+# write the file to the pages
+cookfs::Unmount $archive
+cookfs::Mount $archive $archive -readonly -shared
+
+set script {
+    proc run { file iterations op } {
+        set start [clock microseconds]
+        if { $op eq "stat" } {
+            for { set i 0 } { $i < $iterations } { incr i } {
+                file stat $file stat
+            }
+        } else {
+            for { set i 0 } { $i < $iterations } { incr i } {
+                set fd [open $file rb]
+                read $fd
+                close $fd
+            }
+        }
+        return [expr { [clock microseconds] - $start }]
+    }
+}
+
+puts [format "%7s %12s %12s" threads "ops/sec" "usec/op"]
+
+for { set count 1 } { $count <= $maxthreads } { set count [expr { $count * 2 }] } {
+
+    set tids [list]
+    for { set i 0 } { $i < $count } { incr i } {
+        set tid [thread::create thread::wait]
+        thread::send $tid [list package require cookfs]
+        thread::send $tid $script
+        lappend tids $tid
+    }
+
+    set start [clock microseconds]
+    foreach tid $tids {
+        thread::send -async $tid \
+            [list run [file join $archive hot.bin] $iterations $op] result($tid)
+    }
+    foreach tid $tids {
+        if { ![info exists result($tid)] } {
+            vwait result($tid)
+        }
+    }
+    set elapsed [expr { [clock microseconds] - $start }]
+    array unset result
+
+    foreach tid $tids {
+        thread::release $tid
+    }
+
+    set ops [expr { $count * $iterations }]
+    puts [format "%7d %12.0f %12.2f" $count \
+        [expr { 1000000.0 * $ops / $elapsed }] [expr { 1.0 * $elapsed / $ops }]]
+
+}
+
+cookfs::Unmount $archive
+file delete -force $archive
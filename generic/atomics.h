@@ -0,0 +1,67 @@
+/*
+   (c) 2024 Konstantin Kushnir
+*/
+
+#ifndef COOKFS_ATOMICS_H
+#define COOKFS_ATOMICS_H 1
+
+// Publication of data that is built once under a mutex and then read by
+// other threads without locks. The thread that builds the data stores
+// the flag or the pointer that makes it visible with release semantics.
+// Readers load that flag or pointer with acquire semantics. Thus, a reader
+// that sees the flag or the pointer also sees the completely built data.
+//
+// If atomic operations are not available, the values are accessed under
+// a global mutex (see Cookfs_AtomicIntAccess() in threads.c).
+
+#if !defined(TCL_THREADS)
+
+#define Cookfs_AtomicLoadAcquireInt(p)     (*(p))
+#define Cookfs_AtomicStoreReleaseInt(p, v) ((void)(*(p) = (v)))
+#define Cookfs_AtomicLoadAcquirePtr(p)     (*(p))
+#define Cookfs_AtomicStoreReleasePtr(p, v) ((void)(*(p) = (v)))
+
+#elif defined(__GNUC__)
+
+#define Cookfs_AtomicLoadAcquireInt(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define Cookfs_AtomicStoreReleaseInt(p, v) \
+    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define Cookfs_AtomicLoadAcquirePtr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define Cookfs_AtomicStoreReleasePtr(p, v) \
+    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+// Interlocked functions are full barriers, which is stronger than needed.
+// These operations are only used on slow paths and for flags that are
+// read once per lookup.
+
+#define Cookfs_AtomicLoadAcquireInt(p) \
+    ((int)_InterlockedOr((volatile long *)(p), 0))
+#define Cookfs_AtomicStoreReleaseInt(p, v) \
+    ((void)_InterlockedExchange((volatile long *)(p), (long)(v)))
+#define Cookfs_AtomicLoadAcquirePtr(p) \
+    _InterlockedCompareExchangePointer((void *volatile *)(p), NULL, NULL)
+#define Cookfs_AtomicStoreReleasePtr(p, v) \
+    ((void)_InterlockedExchangePointer((void *volatile *)(p), (void *)(v)))
+
+#else
+
+#define COOKFS_ATOMICS_USEMUTEX 1
+
+int Cookfs_AtomicIntAccess(int *p, int v, int store);
+void *Cookfs_AtomicPtrAccess(void **p, void *v, int store);
+
+#define Cookfs_AtomicLoadAcquireInt(p) Cookfs_AtomicIntAccess((p), 0, 0)
+#define Cookfs_AtomicStoreReleaseInt(p, v) \
+    ((void)Cookfs_AtomicIntAccess((p), (v), 1))
+#define Cookfs_AtomicLoadAcquirePtr(p) \
+    Cookfs_AtomicPtrAccess((void **)(p), NULL, 0)
+#define Cookfs_AtomicStoreReleasePtr(p, v) \
+    ((void)Cookfs_AtomicPtrAccess((void **)(p), (void *)(v), 1))
+
+#endif /* TCL_THREADS */
+
+#endif /* COOKFS_ATOMICS_H */
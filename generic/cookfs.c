@@ -28,6 +28,8 @@
 
 #ifdef COOKFS_USECVFS
 #include "vfsCmd.h"
+#include "vfsOptimize.h"
+#include "vfsWalk.h"
 #endif /* COOKFS_USECVFS */
 
 #ifdef COOKFS_USECWRITERCHAN
@@ -164,6 +166,14 @@ Cookfs_Init(Tcl_Interp *interp) // cppcheck-suppress unusedFunction
     if (Cookfs_InitVfsMountCmd(interp) != TCL_OK) {
         return TCL_ERROR;
     }
+
+    if (Cookfs_InitVfsOptimizeCmd(interp) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    if (Cookfs_InitVfsWalkCmd(interp) != TCL_OK) {
+        return TCL_ERROR;
+    }
 #endif
 
 #if defined(COOKFS_USECPKGCONFIG)
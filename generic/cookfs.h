@@ -189,6 +189,10 @@ static inline void __cookfs_debug_dump(unsigned char *data, Tcl_Size size) {
 #include "common.h"
 #include "bindata.h"
 #include "hashes.h"
+#include "refcount.h"
+#include "counter.h"
+#include "atomics.h"
+#include "latency.h"
 #include "pathObj.h"
 #include "tclCookfs.h"
 
@@ -0,0 +1,68 @@
+/*
+   (c) 2024 Konstantin Kushnir
+*/
+
+#ifndef COOKFS_COUNTER_H
+#define COOKFS_COUNTER_H 1
+
+// 64-bit statistics counters that can be updated by several threads.
+// Counters are only used for statistics, thus relaxed atomic operations
+// are used. If atomic operations are not available, counters are protected
+// by a global mutex (see Cookfs_CounterAdd() in threads.c).
+
+#if !defined(TCL_THREADS)
+
+typedef Tcl_WideInt Cookfs_Counter;
+
+#define Cookfs_CounterInit(p)   (*(p) = 0)
+#define Cookfs_CounterGet(p)    (*(p))
+#define Cookfs_CounterAdd(p, v) ((void)(*(p) += (v)))
+#define Cookfs_CounterReset(p)  (*(p) = 0)
+
+#elif defined(__GNUC__)
+
+typedef Tcl_WideInt Cookfs_Counter;
+
+#define Cookfs_CounterInit(p) (*(p) = 0)
+#define Cookfs_CounterGet(p)  __atomic_load_n((p), __ATOMIC_RELAXED)
+#define Cookfs_CounterAdd(p, v) \
+    ((void)__atomic_fetch_add((p), (v), __ATOMIC_RELAXED))
+#define Cookfs_CounterReset(p) __atomic_store_n((p), 0, __ATOMIC_RELAXED)
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+typedef volatile __int64 Cookfs_Counter;
+
+#define Cookfs_CounterInit(p) (*(p) = 0)
+#define Cookfs_CounterGet(p)  ((Tcl_WideInt)_InterlockedOr64((p), 0))
+#define Cookfs_CounterAdd(p, v) \
+    ((void)_InterlockedExchangeAdd64((p), (__int64)(v)))
+#define Cookfs_CounterReset(p) ((void)_InterlockedExchange64((p), 0))
+
+#else
+
+#define COOKFS_COUNTER_USEMUTEX 1
+
+typedef Tcl_WideInt Cookfs_Counter;
+
+Tcl_WideInt Cookfs_CounterAddInt(Cookfs_Counter *p, Tcl_WideInt delta,
+    int reset);
+
+#define Cookfs_CounterInit(p)   (*(p) = 0)
+#define Cookfs_CounterGet(p)    Cookfs_CounterAddInt((p), 0, 0)
+#define Cookfs_CounterAdd(p, v) ((void)Cookfs_CounterAddInt((p), (v), 0))
+#define Cookfs_CounterReset(p)  ((void)Cookfs_CounterAddInt((p), 0, 1))
+
+#endif /* TCL_THREADS */
+
+// Returns the current time in microseconds, it is used to measure
+// the duration of operations
+static inline Tcl_WideInt Cookfs_CounterGetTime(void) {
+    Tcl_Time now;
+    Tcl_GetTime(&now);
+    return (Tcl_WideInt)now.sec * 1000000 + now.usec;
+}
+
+#endif /* COOKFS_COUNTER_H */
@@ -16,6 +16,23 @@
 #define COOKFSFSINDEX_FIND_DELETE           2
 #define COOKFSFSINDEX_FIND_DELETE_RECURSIVE 3
 
+/* initial number of slots in the map of children */
+#define COOKFS_FSINDEX_MAP_MINSIZE 16
+
+/* the slots of children in a directory entry, either the map
+ * or the static array */
+#define CookfsFsindexEntryChildSlots(e) ((e)->data.dirInfo.isHash ? \
+    (e)->data.dirInfo.dirData.children.slots : \
+    (e)->data.dirInfo.dirData.childTable)
+#define CookfsFsindexEntryChildSlotsCount(e) ((e)->data.dirInfo.isHash ? \
+    (int)((e)->data.dirInfo.dirData.children.mask + 1) : \
+    COOKFS_FSINDEX_TABLE_MAXENTRIES)
+
+/* checks whether the entry has the specified name */
+#define CookfsFsindexEntryIsName(e, name, length, hash) \
+    ((e)->fileNameHash == (hash) && (e)->fileNameLen == (length) && \
+    memcmp((e)->fileName, (name), (length)) == 0)
+
 const char *filesetMetadataKey = "cookfs.fileset";
 const char *fileset_platform = COOKFS_PLATFORM;
 const char *fileset_tcl_version = "tcl" STRINGIFY(TCL_MAJOR_VERSION)
@@ -39,14 +56,28 @@ static const struct {
 
 /* declarations of static and/or internal functions */
 static Cookfs_FsindexEntry *CookfsFsindexFind(Cookfs_Fsindex *i, Cookfs_FsindexEntry **dirPtr, Cookfs_PathObj *pathObj, int command, Cookfs_FsindexEntry *newFileNode);
-static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *currentNode, const char *pathTailStr, int command, Cookfs_FsindexEntry *newFileNode);
-static void CookfsFsindexChildtableToHash(Cookfs_FsindexEntry *e);
+static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *currentNode, const char *pathTailStr, int pathTailLen, unsigned int pathTailHash, int command, Cookfs_FsindexEntry *newFileNode);
+static void CookfsFsindexChildtableToMap(Cookfs_FsindexEntry *e);
+static Cookfs_FsindexEntry **CookfsFsindexChildMapLookup(Cookfs_FsindexEntry *e, const char *name, int length, unsigned int hash);
+static void CookfsFsindexChildMapResize(Cookfs_FsindexEntry *e, unsigned int size);
+static void CookfsFsindexChildMapRemove(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry **slot);
+static void CookfsFsindexEntryResetSorted(Cookfs_FsindexEntry *e);
+static Cookfs_FsindexEntry **CookfsFsindexEntrySorted(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry **buffer, int *countPtr);
+static void CookfsFsindexBloomAdd(Cookfs_Fsindex *i, unsigned int pathHash);
+static int CookfsFsindexBloomTest(const Cookfs_FsindexBloom *bloom, unsigned int pathHash);
+static void CookfsFsindexBloomBuild(Cookfs_Fsindex *i);
 static void Cookfs_FsindexFree(Cookfs_Fsindex *i);
-static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, int fileNameLength, int numBlocks, int useHash);
 static void Cookfs_FsindexEntryFree(Cookfs_FsindexEntry *e);
 
 int Cookfs_FsindexLockRW(int isWrite, Cookfs_Fsindex *i, Tcl_Obj **err) {
     int ret = 1;
+    if (isWrite && i->isSealed) {
+        CookfsLog(printf("FAILED to WRITE lock, fsindex is sealed"));
+        if (err != NULL) {
+            *err = Tcl_NewStringObj("fsindex is sealed", -1);
+        }
+        return 0;
+    }
 #ifdef TCL_THREADS
     CookfsLog(printf("try to %s lock...", isWrite ? "WRITE" : "READ"));
     if (isWrite) {
@@ -138,6 +169,26 @@ void Cookfs_FsindexLockExclusive(Cookfs_Fsindex *i) {
 #endif /* TCL_THREADS */
 }
 
+#ifdef TCL_THREADS
+Cookfs_LockStats *Cookfs_FsindexGetLockStats(Cookfs_Fsindex *i) {
+    return Cookfs_RWMutexGetStats(i->mx);
+}
+#endif /* TCL_THREADS */
+
+Tcl_Obj *Cookfs_FsindexGetStatsObj(Cookfs_Fsindex *i) {
+    Tcl_Obj *result = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("misses", -1),
+        Tcl_NewWideIntObj(Cookfs_CounterGet(&i->statsMisses)));
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("filtered", -1),
+        Tcl_NewWideIntObj(Cookfs_CounterGet(&i->statsFiltered)));
+    return result;
+}
+
+void Cookfs_FsindexResetStats(Cookfs_Fsindex *i) {
+    Cookfs_CounterReset(&i->statsMisses);
+    Cookfs_CounterReset(&i->statsFiltered);
+}
+
 Tcl_WideInt Cookfs_FsindexEntryGetFilesize(Cookfs_FsindexEntry *e) {
     Cookfs_FsindexEntryWantRead(e);
     return e->data.fileInfo.fileSize;
@@ -149,27 +200,16 @@ int Cookfs_FsindexEntryGetBlockCount(Cookfs_FsindexEntry *e) {
 }
 
 int Cookfs_FsindexEntryLock(Cookfs_FsindexEntry *e) {
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&e->mxRefCount);
-#endif /* TCL_THREADS */
-    e->refcount++;
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&e->mxRefCount);
-#endif /* TCL_THREADS */
+    Cookfs_RefCountIncr(&e->refcount);
     return 1;
 }
 
 int Cookfs_FsindexEntryUnlock(Cookfs_FsindexEntry *e) {
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&e->mxRefCount);
-#endif /* TCL_THREADS */
-    e->refcount--;
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&e->mxRefCount);
-#endif /* TCL_THREADS */
+    int refcount = Cookfs_RefCountDecr(&e->refcount);
     // If refcount < 0, there is an Unlock() without a corresponding Lock().
     // Treat this as an error.
-    assert(e->refcount >= 0);
+    assert(refcount >= 0);
+    UNUSED(refcount);
     return 1;
 }
 
@@ -342,6 +382,7 @@ static int Cookfs_FsindexFileSetCreateAndSet(Cookfs_Fsindex *i,
     }
 
     i->rootItemVirtual = fileset_node;
+    i->generation++;
 
     return TCL_OK;
 
@@ -498,6 +539,7 @@ int Cookfs_FsindexFileSetSelect(Cookfs_Fsindex *i, const char *typeStr,
                 " the first available fileset"));
 
             i->rootItemVirtual = Cookfs_FsindexFileSetLookup(i, NULL);
+            i->generation++;
 
             CookfsLog(printf("activate custom fileset: [%s]",
                 i->rootItemVirtual->fileName));
@@ -547,6 +589,7 @@ int Cookfs_FsindexFileSetSelect(Cookfs_Fsindex *i, const char *typeStr,
         CookfsLog(printf("required fileset has been found, set it and"
             " return"));
         i->rootItemVirtual = e;
+        i->generation++;
         return TCL_OK;
     }
 
@@ -611,6 +654,7 @@ void Cookfs_FsindexEntrySetFileSize(Cookfs_FsindexEntry *e,
 {
     Cookfs_FsindexEntryWantWrite(e);
     e->data.fileInfo.fileSize = fileSize;
+    e->isDirty = 1;
     return;
 }
 
@@ -619,6 +663,7 @@ void Cookfs_FsindexEntrySetFileTime(Cookfs_FsindexEntry *e,
 {
     Cookfs_FsindexEntryWantWrite(e);
     e->fileTime = fileTime;
+    e->isDirty = 1;
     return;
 }
 
@@ -644,6 +689,7 @@ void Cookfs_FsindexEntryIncrBlockPageIndex(Cookfs_FsindexEntry *e,
     Cookfs_FsindexEntryWantWrite(e);
     int blockIndexOffset = blockNumber * 3 + 0;
     e->data.fileInfo.fileBlockOffsetSize[blockIndexOffset + 0] += change;
+    e->isDirty = 1;
     return;
 }
 
@@ -687,6 +733,7 @@ void Cookfs_FsindexEntrySetBlock(Cookfs_FsindexEntry *e, int blockNumber,
     }
     // Increase block utilization for the new block index
     Cookfs_FsindexModifyBlockUsage(i, pageIndex, 1);
+    e->isDirty = 1;
     // Register new change in the change counter
     Cookfs_FsindexIncrChangeCount(i, 1);
     return ;
@@ -745,7 +792,7 @@ int Cookfs_FsindexEntryIsDirectory(Cookfs_FsindexEntry *e) {
 
 int Cookfs_FsindexEntryIsEmptyDirectory(Cookfs_FsindexEntry *e) {
     Cookfs_FsindexEntryWantRead(e);
-    return (e->data.dirInfo.childCount ? 1 : 0);
+    return (e->data.dirInfo.childCount ? 0 : 1);
 }
 
 /*
@@ -792,6 +839,31 @@ void Cookfs_FsindexResetChangeCount(Cookfs_Fsindex *i) {
     return;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexGetGeneration --
+ *
+ *      Returns the generation of the fsindex tree. The generation changes
+ *      each time an entry is added, removed or replaced, a fileset is
+ *      selected, or the fsindex is cleaned up. Callers can cache entries
+ *      returned by Cookfs_FsindexGet() and use them while the generation
+ *      remains the same.
+ *
+ * Results:
+ *      Current generation
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_WideInt Cookfs_FsindexGetGeneration(Cookfs_Fsindex *i) {
+    Cookfs_FsindexWantRead(i);
+    return i->generation;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -940,11 +1012,25 @@ Cookfs_Fsindex *Cookfs_FsindexInit(Tcl_Interp *interp, Cookfs_Fsindex *i) {
         rc->lockSoft = 0;
         rc->lockHard = 0;
         rc->inactiveItems = NULL;
+        rc->generation = 0;
+        rc->arenaChunks = NULL;
+        rc->arenaPtr = NULL;
+        rc->arenaAvail = 0;
+        rc->arenaChunkSize = COOKFS_FSINDEX_ARENA_MINCHUNK;
+        for (int c = 0; c < COOKFS_FSINDEX_ARENA_CLASSES; c++) {
+            rc->arenaFree[c] = NULL;
+        }
+        rc->bloom = NULL;
+        Cookfs_RefCountInit(&rc->bloomMisses, 0);
+        Cookfs_CounterInit(&rc->statsMisses);
+        Cookfs_CounterInit(&rc->statsFiltered);
+        rc->isSealed = 0;
 #ifdef TCL_THREADS
         /* initialize thread locks */
         rc->mx = Cookfs_RWMutexInit();
         rc->threadId = Tcl_GetCurrentThread();
         rc->mxLockSoft = NULL;
+        rc->mxLazy = NULL;
 #endif /* TCL_THREADS */
     } else {
         rc = i;
@@ -955,6 +1041,10 @@ Cookfs_Fsindex *Cookfs_FsindexInit(Tcl_Interp *interp, Cookfs_Fsindex *i) {
     rc->blockIndexSize = 0;
     rc->blockIndex = NULL;
     rc->changeCount = 0;
+    rc->lazyData = NULL;
+    rc->lazyDirs = NULL;
+    rc->lazyDirsCount = 0;
+    rc->lazyFormat = 0;
     Tcl_InitHashTable(&rc->metadataHash, TCL_STRING_KEYS);
     return rc;
 }
@@ -988,6 +1078,26 @@ void Cookfs_FsindexCleanup(Cookfs_Fsindex *i) {
 
     /* free up root entry and memory for storing fsindex */
     Cookfs_FsindexEntryFree(i->rootItem);
+    i->generation++;
+
+    /* free up the filter of existing paths */
+    if (i->bloom != NULL) {
+        ckfree(i->bloom);
+        i->bloom = NULL;
+    }
+    Cookfs_RefCountInit(&i->bloomMisses, 0);
+
+    /* free up raw index data, it is not needed anymore */
+    if (i->lazyData != NULL) {
+        ckfree(i->lazyData);
+        i->lazyData = NULL;
+    }
+    if (i->lazyDirs != NULL) {
+        ckfree(i->lazyDirs);
+        i->lazyDirs = NULL;
+    }
+    i->lazyDirsCount = 0;
+    i->lazyFormat = 0;
 
     /* free all entries in hash table */
     for (hashEntry = Tcl_FirstHashEntry(&i->metadataHash, &hashSearch); hashEntry != NULL; hashEntry = Tcl_NextHashEntry(&hashSearch)) {
@@ -1022,16 +1132,23 @@ static void Cookfs_FsindexFree(Cookfs_Fsindex *i) {
         i->inactiveItems = e->next;
         CookfsLog(printf("release inactive entry %p",
             (void *)e));
-#ifdef TCL_THREADS
-        Tcl_MutexFinalize(&e->mxRefCount);
-#endif /* TCL_THREADS */
-        ckfree((void *) e);
+        /* entries from the arena are released along with its chunks */
+        if (!e->allocClass) {
+            ckfree((void *) e);
+        }
+    }
+    CookfsLog(printf("Releasing entry arena"));
+    while (i->arenaChunks != NULL) {
+        void *chunk = i->arenaChunks;
+        i->arenaChunks = *((void **) chunk);
+        ckfree(chunk);
     }
 #ifdef TCL_THREADS
     CookfsLog(printf("Cleaning up thread locks"));
     Cookfs_RWMutexFini(i->mx);
     Tcl_MutexUnlock(&i->mxLockSoft);
     Tcl_MutexFinalize(&i->mxLockSoft);
+    Tcl_MutexFinalize(&i->mxLazy);
 #endif /* TCL_THREADS */
     /* clean up storage */
     CookfsLog(printf("Releasing fsindex"));
@@ -1110,11 +1227,48 @@ Cookfs_FsindexEntry *Cookfs_FsindexGet(Cookfs_Fsindex *i, Cookfs_PathObj *pathOb
 
     CookfsLog(printf("start"))
 
+    /* check the filter of existing paths first, if the path is not there,
+     * there is no need to walk the tree */
+    Cookfs_FsindexBloom *bloom = Cookfs_AtomicLoadAcquirePtr(&i->bloom);
+    if (bloom != NULL && pathObj->elementCount > 0) {
+        unsigned int pathHash = i->rootItemVirtual->pathHash;
+        int idx;
+        for (idx = 0; idx < pathObj->elementCount; idx++) {
+            /* the filter has no entries below directories that were not
+             * loaded when it was created, it can't be used for such paths */
+            if (CookfsFsindexBloomTest(bloom,
+                COOKFS_FSINDEX_BLOOM_LAZYKEY(pathHash)))
+            {
+                break;
+            }
+            pathHash = COOKFS_FSINDEX_PATHHASH(pathHash,
+                pathObj->element[idx].hash);
+        }
+        if (idx == pathObj->elementCount &&
+            !CookfsFsindexBloomTest(bloom, pathHash))
+        {
+            Cookfs_CounterAdd(&i->statsMisses, 1);
+            Cookfs_CounterAdd(&i->statsFiltered, 1);
+            CookfsLog(printf("return: NULL (rejected by filter)"))
+            return NULL;
+        }
+    }
+
     /* run FIND command to get existing entry */
     fileNode = CookfsFsindexFind(i, NULL, pathObj, COOKFSFSINDEX_FIND_FIND, NULL);
 
     /* return NULL if not found */
     if (fileNode == NULL) {
+        Cookfs_CounterAdd(&i->statsMisses, 1);
+        /* create the filter if nonexistent paths are often requested */
+        if (bloom == NULL) {
+            Cookfs_RefCountIncr(&i->bloomMisses);
+            if (Cookfs_RefCountGet(&i->bloomMisses) >=
+                COOKFS_FSINDEX_BLOOM_MISSES)
+            {
+                CookfsFsindexBloomBuild(i);
+            }
+        }
         CookfsLog(printf("return: NULL"))
         return NULL;
     }
@@ -1219,7 +1373,9 @@ Cookfs_FsindexEntry *Cookfs_FsindexSetInDirectory(Cookfs_FsindexEntry *currentNo
     memcpy(fileNode->fileName, pathTailStr, pathTailLen + 1);
 
     CookfsLog(printf("fileNode=%p", (void *)fileNode))
-    foundFileNode = CookfsFsindexFindInDirectory(currentNode, pathTailStr, COOKFSFSINDEX_FIND_CREATE, fileNode);
+    foundFileNode = CookfsFsindexFindInDirectory(currentNode, pathTailStr,
+        pathTailLen, Cookfs_PathObjNameHash(pathTailStr, pathTailLen),
+        COOKFSFSINDEX_FIND_CREATE, fileNode);
     if (foundFileNode == NULL) {
         CookfsLog(printf("NULL"))
         Cookfs_FsindexEntryFree(fileNode);
@@ -1340,31 +1496,22 @@ Cookfs_FsindexEntry **Cookfs_FsindexListEntry(Cookfs_FsindexEntry *dirNode, int
         return NULL;
     }
 
+    Cookfs_FsindexEntryWantChildren(dirNode);
+
     CookfsLog(printf("childCount = %d", dirNode->data.dirInfo.childCount))
     result = (Cookfs_FsindexEntry **) ckalloc((dirNode->data.dirInfo.childCount + 1) * sizeof(Cookfs_FsindexEntry *));
 
     CookfsLog(printf("isHash=%d", dirNode->data.dirInfo.isHash))
-    if (dirNode->data.dirInfo.isHash) {
-        Tcl_HashSearch hashSearch;
-        Tcl_HashEntry *hashEntry = Tcl_FirstHashEntry(&dirNode->data.dirInfo.dirData.children, &hashSearch);
-        while (hashEntry != NULL) {
-            itemNode = (Cookfs_FsindexEntry *) Tcl_GetHashValue(hashEntry);
+    Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(dirNode);
+    int slotsCount = CookfsFsindexEntryChildSlotsCount(dirNode);
+    for (int i = 0; i < slotsCount; i++) {
+        itemNode = slots[i];
+        if (itemNode != NULL) {
             result[idx] = itemNode;
             idx++;
-            hashEntry = Tcl_NextHashEntry(&hashSearch);
-        }
-
-        result[idx] = NULL;
-    }  else  {
-        int i;
-        for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-            if (dirNode->data.dirInfo.dirData.childTable[i] != NULL) {
-                result[idx] = dirNode->data.dirInfo.dirData.childTable[i];
-                idx++;
-            }
         }
-        result[idx] = NULL;
     }
+    result[idx] = NULL;
 
     if (itemCountPtr != NULL) {
         *itemCountPtr = dirNode->data.dirInfo.childCount;
@@ -1424,6 +1571,150 @@ void Cookfs_FsindexListFree(Cookfs_FsindexEntry **items) {
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexEntryMatch --
+ *
+ *      Calls the specified procedure for each child of the directory entry
+ *      whose name matches the glob pattern. Children are visited in order
+ *      of their names.
+ *
+ *      If the pattern has no special characters, the child is looked up
+ *      by name. Otherwise, only the children whose names start with
+ *      the literal prefix of the pattern are checked. They are found
+ *      by binary search in the sorted list of children.
+ *
+ *      The fsindex must be locked by the caller at least for reading.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      The sorted list of children can be created for the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_FsindexEntryMatch(Cookfs_FsindexEntry *dirNode,
+    const char *pattern, Cookfs_FsindexForeachProc *proc,
+    ClientData clientData)
+{
+    Cookfs_FsindexEntryWantRead(dirNode);
+
+    if (dirNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+        CookfsLog(printf("return: not directory"));
+        return;
+    }
+
+    int prefixLen = (int)strcspn(pattern, "*?[\\");
+
+    if (pattern[prefixLen] == '\0') {
+        CookfsLog(printf("lookup the literal name [%s]", pattern));
+        if (prefixLen > 255) {
+            return;
+        }
+        Cookfs_FsindexEntry *itemNode = CookfsFsindexFindInDirectory(dirNode,
+            pattern, prefixLen, Cookfs_PathObjNameHash(pattern, prefixLen),
+            COOKFSFSINDEX_FIND_FIND, NULL);
+        if (itemNode != NULL) {
+            proc(itemNode, clientData);
+        }
+        return;
+    }
+
+    Cookfs_FsindexEntryWantChildren(dirNode);
+
+    Cookfs_FsindexEntry *buffer[COOKFS_FSINDEX_TABLE_MAXENTRIES];
+    int count;
+    Cookfs_FsindexEntry **sorted = CookfsFsindexEntrySorted(dirNode, buffer,
+        &count);
+
+    /* find the first child that is not less than the literal prefix */
+    int lo = 0;
+    int hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Cookfs_FsindexEntry *itemNode = sorted[mid];
+        int len = itemNode->fileNameLen < prefixLen ?
+            itemNode->fileNameLen : prefixLen;
+        int cmp = memcmp(itemNode->fileName, pattern, len);
+        if (cmp < 0 || (cmp == 0 && itemNode->fileNameLen < prefixLen)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    CookfsLog(printf("check children from %d of %d for pattern [%s],"
+        " literal prefix length: %d", lo, count, pattern, prefixLen));
+
+    for (int i = lo; i < count; i++) {
+        Cookfs_FsindexEntry *itemNode = sorted[i];
+        if (itemNode->fileNameLen < prefixLen ||
+            memcmp(itemNode->fileName, pattern, prefixLen) != 0)
+        {
+            break;
+        }
+        if (Tcl_StringCaseMatch(itemNode->fileName, pattern, 0)) {
+            proc(itemNode, clientData);
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexArenaAlloc --
+ *
+ *      Allocates memory for an entry of the specified size class from
+ *      the fsindex arena. A previously released entry of the same size
+ *      class is reused if available. Otherwise, memory is taken from
+ *      the current arena chunk; a new chunk is allocated when
+ *      the current one is exhausted. Chunk size doubles with each new chunk
+ *      up to COOKFS_FSINDEX_ARENA_MAXCHUNK, so that importing a large index
+ *      results in few large allocations.
+ *
+ *      The caller must hold a write lock on fsindex, or mxLazy lock while
+ *      materializing directories.
+ *
+ * Results:
+ *      Pointer to allocated memory
+ *
+ * Side effects:
+ *      May allocate a new arena chunk
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *CookfsFsindexArenaAlloc(Cookfs_Fsindex *i, int allocClass) {
+    Cookfs_FsindexEntry *e = i->arenaFree[allocClass];
+    if (e != NULL) {
+        i->arenaFree[allocClass] = e->next;
+        return e;
+    }
+    int size = allocClass * COOKFS_FSINDEX_ARENA_ALIGN;
+    if (i->arenaAvail < size) {
+        /* the chunk starts with a pointer to the previous chunk, keep
+         * entries aligned after it */
+        char *chunk = ckalloc(i->arenaChunkSize);
+        *((void **) chunk) = i->arenaChunks;
+        i->arenaChunks = chunk;
+        i->arenaPtr = chunk + COOKFS_FSINDEX_ARENA_ALIGN;
+        i->arenaAvail = i->arenaChunkSize - COOKFS_FSINDEX_ARENA_ALIGN;
+        CookfsLog(printf("new arena chunk %p with size %d", (void *)chunk,
+            i->arenaChunkSize));
+        if (i->arenaChunkSize < COOKFS_FSINDEX_ARENA_MAXCHUNK) {
+            i->arenaChunkSize *= 2;
+        }
+    }
+    void *rc = i->arenaPtr;
+    i->arenaPtr += size;
+    i->arenaAvail -= size;
+    return rc;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1448,7 +1739,7 @@ void Cookfs_FsindexListFree(Cookfs_FsindexEntry **items) {
  *----------------------------------------------------------------------
  */
 
-static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, int fileNameLength, int numBlocks, int useHash) {
+Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, int fileNameLength, int numBlocks, int useHash) {
     int size0 = sizeof(Cookfs_FsindexEntry);
     int fileNameBytes;
 
@@ -1461,24 +1752,33 @@ static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, in
     }
     fileNameBytes = (fileNameLength + 8) & 0xf8;
 
-    /* use single alloc for everything to limit number of memory allocations */
-    e = (Cookfs_FsindexEntry *) ckalloc(size0 + fileNameBytes);
+    /* use single alloc for everything to limit number of memory allocations,
+     * small entries are allocated from the arena */
+    int allocClass = (size0 + fileNameBytes + COOKFS_FSINDEX_ARENA_ALIGN - 1)
+        / COOKFS_FSINDEX_ARENA_ALIGN;
+    if (allocClass < COOKFS_FSINDEX_ARENA_CLASSES) {
+        e = (Cookfs_FsindexEntry *) CookfsFsindexArenaAlloc(fsindex,
+            allocClass);
+        e->allocClass = allocClass;
+    } else {
+        e = (Cookfs_FsindexEntry *) ckalloc(size0 + fileNameBytes);
+        e->allocClass = 0;
+    }
     e->fileName = ((char *) e) + size0;
     e->fileBlocks = numBlocks;
     e->fileNameLen = fileNameLength;
+    e->isDirty = 1;
+    e->fileNameHash = 0;
+    e->pathHash = 0;
     e->isFileBlocksInitialized = NULL;
     e->fsindex = fsindex;
-    e->refcount = 0;
+    Cookfs_RefCountInit(&e->refcount, 0);
     e->isInactive = 0;
-#ifdef TCL_THREADS
-    e->mxRefCount = NULL;
-#endif /* TCL_THREADS */
     if (numBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
         /* create directory structure - either a hash table or static child array */
         CookfsLog(printf("directory, useHash=%d", useHash))
         if (useHash) {
-            Tcl_InitHashTable(&e->data.dirInfo.dirData.children, TCL_STRING_KEYS);
-            e->data.dirInfo.isHash = 1;
+            Cookfs_FsindexEntryInitChildMap(e, 0);
         }  else  {
             int i;
             for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
@@ -1487,6 +1787,7 @@ static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, in
             e->data.dirInfo.isHash = 0;
         }
         e->data.dirInfo.childCount = 0;
+        e->data.dirInfo.lazyIndex = -1;
     }  else  {
         /* for files, block information is filled by caller */
 
@@ -1501,6 +1802,34 @@ static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, in
     return e;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexEntryDealloc --
+ *
+ *      Releases memory of the entry allocated by Cookfs_FsindexEntryAlloc().
+ *      Entries from the arena are put to the free list of their size class
+ *      and reused by subsequent allocations. Child entries are not touched.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_FsindexEntryDealloc(Cookfs_FsindexEntry *e) {
+    if (e->allocClass) {
+        Cookfs_Fsindex *i = e->fsindex;
+        e->next = i->arenaFree[e->allocClass];
+        i->arenaFree[e->allocClass] = e;
+    } else {
+        ckfree((void *) e);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1520,29 +1849,25 @@ static Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, in
 static void Cookfs_FsindexEntryFree(Cookfs_FsindexEntry *e) {
     //CookfsLog(printf("%p with fileBlocks [%d]", e, e->fileBlocks));
     if (e->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+        /* children of a directory that has not been materialized yet still
+         * use their blocks. Load them to release the block usage. This is
+         * not needed when the whole fsindex is released. */
+        if (e->fsindex->blockIndex != NULL) {
+            Cookfs_FsindexEntryWantChildren(e);
+        }
         /* for directory, recursively free all children */
-        if (e->data.dirInfo.isHash) {
-            Tcl_HashSearch hashSearch;
-            Tcl_HashEntry *hashEntry;
-            /* iterate over hash table for all children */
-            hashEntry = Tcl_FirstHashEntry(&e->data.dirInfo.dirData.children, &hashSearch);
-            while (hashEntry != NULL) {
-                Cookfs_FsindexEntry *itemNode = (Cookfs_FsindexEntry *) Tcl_GetHashValue(hashEntry);
-                hashEntry = Tcl_NextHashEntry(&hashSearch);
-                Cookfs_FsindexEntryFree(itemNode);
-            }
-
-            /* clean hash table */
-            Tcl_DeleteHashTable(&e->data.dirInfo.dirData.children);
-        }  else  {
-            int i;
-            /* iterate through children and free them */
-            for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-                if (e->data.dirInfo.dirData.childTable[i] != NULL) {
-                    Cookfs_FsindexEntryFree(e->data.dirInfo.dirData.childTable[i]);
-                }
+        Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(e);
+        int slotsCount = CookfsFsindexEntryChildSlotsCount(e);
+        for (int i = 0; i < slotsCount; i++) {
+            if (slots[i] != NULL) {
+                Cookfs_FsindexEntryFree(slots[i]);
             }
         }
+        /* release the map of children */
+        if (e->data.dirInfo.isHash) {
+            CookfsFsindexEntryResetSorted(e);
+            ckfree(slots);
+        }
     } else if (e->isFileBlocksInitialized != NULL && e->fileBlocks > 0) {
         for (e->fileBlocks--; e->fileBlocks >= 0; e->fileBlocks--) {
             //CookfsLog(printf("modify block#%d", e->fileBlocks));
@@ -1551,17 +1876,14 @@ static void Cookfs_FsindexEntryFree(Cookfs_FsindexEntry *e) {
     }
 
     /* free entry structure itself */
-    if (e->refcount) {
+    if (Cookfs_RefCountGet(&e->refcount)) {
         CookfsLog(printf("move entry %p to inactive list", (void *)e));
         e->isInactive = 1;
         e->next = e->fsindex->inactiveItems;
         e->fsindex->inactiveItems = e;
     } else {
         // CookfsLog(printf("release entry %p", (void *)e));
-#ifdef TCL_THREADS
-        Tcl_MutexFinalize(&e->mxRefCount);
-#endif /* TCL_THREADS */
-        ckfree((void *) e);
+        Cookfs_FsindexEntryDealloc(e);
     }
 }
 
@@ -1574,23 +1896,14 @@ static void Cookfs_FsindexEntryForeach(Cookfs_FsindexEntry *e, Cookfs_FsindexFor
         return;
     }
 
-    // for directory, recursively free all children
-    if (e->data.dirInfo.isHash) {
-        Tcl_HashSearch hashSearch;
-        Tcl_HashEntry *hashEntry;
-        // iterate over hash table for all children
-        hashEntry = Tcl_FirstHashEntry(&e->data.dirInfo.dirData.children, &hashSearch);
-        while (hashEntry != NULL) {
-            Cookfs_FsindexEntry *itemNode = (Cookfs_FsindexEntry *)Tcl_GetHashValue(hashEntry);
-            Cookfs_FsindexEntryForeach(itemNode, proc, clientData);
-            hashEntry = Tcl_NextHashEntry(&hashSearch);
-        }
-    } else {
-        // iterate through children and free them */
-        for (int i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-            if (e->data.dirInfo.dirData.childTable[i] != NULL) {
-                Cookfs_FsindexEntryForeach(e->data.dirInfo.dirData.childTable[i], proc, clientData);
-            }
+    Cookfs_FsindexEntryWantChildren(e);
+
+    // for directory, recursively process all children
+    Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(e);
+    int slotsCount = CookfsFsindexEntryChildSlotsCount(e);
+    for (int i = 0; i < slotsCount; i++) {
+        if (slots[i] != NULL) {
+            Cookfs_FsindexEntryForeach(slots[i], proc, clientData);
         }
     }
 
@@ -1791,7 +2104,6 @@ int Cookfs_FsindexUnsetMetadata(Cookfs_Fsindex *i, const char *paramName) {
 Cookfs_FsindexEntry *CookfsFsindexFindElement(const Cookfs_Fsindex *i, Cookfs_PathObj *pathObj, int listSize) {
     Cookfs_FsindexWantRead(i);
     int idx;
-    Tcl_HashEntry *hashEntry;
     Cookfs_FsindexEntry *currentNode;
     Cookfs_FsindexEntry *nextNode;
 
@@ -1811,34 +2123,37 @@ Cookfs_FsindexEntry *CookfsFsindexFindElement(const Cookfs_Fsindex *i, Cookfs_Pa
             return NULL;
         }
 
-        char *currentPathStr = pathObj->element[idx].name0;
+        Cookfs_PathObjElement *element = &pathObj->element[idx];
+
+        Cookfs_FsindexEntryWantChildren(currentNode);
 
         if (currentNode->data.dirInfo.isHash) {
-            /* if current entry is a hash table, locate child using Tcl_FindHashEntry () */
-            hashEntry = Tcl_FindHashEntry(&currentNode->data.dirInfo.dirData.children, currentPathStr);
-            if (hashEntry == NULL) {
-                CookfsLog(printf("Unable to find item"));
-                return NULL;
-            }
-            currentNode = (Cookfs_FsindexEntry *) Tcl_GetHashValue(hashEntry);
+            /* if current entry is a map, locate child by its hash */
+            nextNode = *CookfsFsindexChildMapLookup(currentNode, element->name,
+                element->length, element->hash);
         }  else  {
             /* if it is an array of children, iterate and find matching child */
             nextNode = NULL;
-            CookfsLog(printf("Iterating over childTable to find %s", currentPathStr));
+            CookfsLog(printf("Iterating over childTable to find %.*s",
+                element->length, element->name));
             for (int j = 0 ; j < COOKFS_FSINDEX_TABLE_MAXENTRIES; j++) {
-                if ((currentNode->data.dirInfo.dirData.childTable[j] != NULL) && (strcmp(currentNode->data.dirInfo.dirData.childTable[j]->fileName, currentPathStr) == 0)) {
-                    nextNode = currentNode->data.dirInfo.dirData.childTable[j];
-                    CookfsLog(printf("Iterating over childTable to find %s - FOUND", currentPathStr));
+                Cookfs_FsindexEntry *itemNode =
+                    currentNode->data.dirInfo.dirData.childTable[j];
+                if (itemNode != NULL && CookfsFsindexEntryIsName(itemNode,
+                    element->name, element->length, element->hash))
+                {
+                    nextNode = itemNode;
+                    CookfsLog(printf("Iterating over childTable - FOUND"));
                     break;
                 }
             }
+        }
 
-            /* check if entry was found - if not, return NULL */
-            currentNode = nextNode;
-            if (currentNode == NULL) {
-                CookfsLog(printf("Unable to find item"));
-                return NULL;
-            }
+        /* check if entry was found - if not, return NULL */
+        currentNode = nextNode;
+        if (currentNode == NULL) {
+            CookfsLog(printf("Unable to find item"));
+            return NULL;
         }
     }
 
@@ -1905,8 +2220,13 @@ static Cookfs_FsindexEntry *CookfsFsindexFind(Cookfs_Fsindex *i, Cookfs_FsindexE
      * and invoke CookfsFsindexFindInDirectory() */
     CookfsLog(printf("path tail: %s", pathObj->tailName));
 
-    Cookfs_FsindexEntry *rc = CookfsFsindexFindInDirectory(currentNode, pathObj->tailName, command, newFileNode);
+    Cookfs_FsindexEntry *rc = CookfsFsindexFindInDirectory(currentNode,
+        pathObj->tailName, pathObj->tailNameLength,
+        pathObj->element[pathObj->elementCount - 1].hash, command,
+        newFileNode);
     if (command != COOKFSFSINDEX_FIND_FIND && rc != NULL) {
+        // The list of children in the parent directory has changed
+        currentNode->isDirty = 1;
         Cookfs_FsindexIncrChangeCount(i, 1);
     }
     return rc;
@@ -1968,162 +2288,130 @@ error:
  *----------------------------------------------------------------------
  */
 
-static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *currentNode, const char *pathTailStr, int command, Cookfs_FsindexEntry *newFileNode) {
+static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *currentNode, const char *pathTailStr, int pathTailLen, unsigned int pathTailHash, int command, Cookfs_FsindexEntry *newFileNode) {
     /* the main iteration occurs until the process has completed
      * usually either entry or NULL is returned in first iteration,
-     * however if static array is converted into a hash table,
+     * however if static array is converted into a map,
      * second iteration occurs in order to actually perform operation */
+    Cookfs_FsindexEntryWantChildren(currentNode);
+    if (newFileNode != NULL) {
+        newFileNode->fileNameHash = pathTailHash;
+        newFileNode->pathHash = COOKFS_FSINDEX_PATHHASH(currentNode->pathHash,
+            pathTailHash);
+    }
     while (1) {
-        if (currentNode->data.dirInfo.isHash) {
-            /* currentNode is using hash table */
-            Cookfs_FsindexEntry *fileNode = NULL;
-            Tcl_HashEntry *hashEntry;
-            int isNew;
-
-            /* depending on whether we are willing to create new entry, call proper hash function */
-            if (command == COOKFSFSINDEX_FIND_CREATE) {
-                hashEntry = Tcl_CreateHashEntry(&currentNode->data.dirInfo.dirData.children, pathTailStr, &isNew);
-            }  else  {
-                hashEntry = Tcl_FindHashEntry(&currentNode->data.dirInfo.dirData.children, pathTailStr);
-                isNew = 0;
-            }
-
-            /* if entry has been found/created */
-            if (hashEntry != NULL) {
-                CookfsLog(printf("found in hash table (isNew=%d; cmd=%d)", isNew, command))
-                /* if entry exists or has just been created */
-                fileNode = Tcl_GetHashValue(hashEntry);
-
-                CookfsLog(printf("fileNode=%p", (void *)fileNode))
-
-                /* if we are to create a new entry, set new value */
-                if (command == COOKFSFSINDEX_FIND_CREATE) {
-                    if (!isNew) {
-                        /* if entry exists already, check if both are of same type */
-                        if (((fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY))
-                            || ((fileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY))) {
-                            /* if entry type does not match, free newFileNode and return NULL */
-                            CookfsLog(printf("type mismatch"))
-                            Cookfs_FsindexEntryFree(newFileNode);
-                            return NULL;
-                        }
-
-                        /* if type matches, free previous node */
-                        Cookfs_FsindexEntryFree(fileNode);
-                    }  else  {
-                        /* if it is a new entry, increment counter */
-                        currentNode->data.dirInfo.childCount++;
-                    }
-
-                    /* set new value for specified hash table entry */
-                    CookfsLog(printf("setting as newFileNode = %p", (void *)newFileNode))
-                    Tcl_SetHashValue(hashEntry, newFileNode);
-                    CookfsLog(printf("setting as newFileNode done"))
-                    return newFileNode;
-                }  else if ((command == COOKFSFSINDEX_FIND_DELETE) || (command == COOKFSFSINDEX_FIND_DELETE_RECURSIVE)) {
-                    /* if deleting current node, check if it can be deleted */
-                    if ((command == COOKFSFSINDEX_FIND_DELETE)
-                        && (fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY)
-                        && (fileNode->data.dirInfo.childCount > 0)) {
-                        /* if it is a non-empty directory, disallow unsetting it */
-                        return NULL;
-                    }
-
-                    /* decrement childCount, free the entry */
-                    currentNode->data.dirInfo.childCount--;
-                    Tcl_DeleteHashEntry(hashEntry);
-                    Cookfs_FsindexEntryFree(fileNode);
-                }
+        Cookfs_FsindexEntry *fileNode = NULL;
+        Cookfs_FsindexEntry **fileNodePtr = NULL;
 
-                /* return node, if found */
-                return fileNode;
-            }
+        if (currentNode->data.dirInfo.isHash) {
+            /* currentNode is using a map, find the slot of the entry */
+            fileNodePtr = CookfsFsindexChildMapLookup(currentNode,
+                pathTailStr, pathTailLen, pathTailHash);
+            fileNode = *fileNodePtr;
+            CookfsLog(printf("looking in map, fileNode=%p", (void *)fileNode))
         }  else  {
-            /* if currentNode is not using hash table */
-            Cookfs_FsindexEntry *fileNode = NULL;
-            Cookfs_FsindexEntry **fileNodePtr = NULL;
             int i;
 
             /* iterate over children array and find matching node */
             CookfsLog(printf("looking in childTable"))
             for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-                if ((currentNode->data.dirInfo.dirData.childTable[i] != NULL) && (strcmp(currentNode->data.dirInfo.dirData.childTable[i]->fileName, pathTailStr) == 0)) {
-                    fileNode = currentNode->data.dirInfo.dirData.childTable[i];
+                Cookfs_FsindexEntry *itemNode =
+                    currentNode->data.dirInfo.dirData.childTable[i];
+                if (itemNode != NULL && CookfsFsindexEntryIsName(itemNode,
+                    pathTailStr, pathTailLen, pathTailHash))
+                {
+                    fileNode = itemNode;
                     fileNodePtr = &currentNode->data.dirInfo.dirData.childTable[i];
                     CookfsLog(printf("found at %d", i))
                     break;
                 }
-
             }
+        }
+
+        /* if found, perform specified command */
+        if (fileNode != NULL) {
+            CookfsLog(printf("found cmd=%d", command))
+            if ((command == COOKFSFSINDEX_FIND_DELETE) || (command == COOKFSFSINDEX_FIND_DELETE_RECURSIVE)) {
+                /* if deleting current node, check if it can be deleted */
+                if ((command == COOKFSFSINDEX_FIND_DELETE)
+                    && (fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY)
+                    && (fileNode->data.dirInfo.childCount > 0)) {
+                    /* if it is a non-empty directory, disallow unsetting it */
+                    return NULL;
+                }
 
-            /* if found, perform specified command */
-            if (fileNode != NULL) {
-                CookfsLog(printf("found in table cmd=%d", command))
-                if ((command == COOKFSFSINDEX_FIND_DELETE) || (command == COOKFSFSINDEX_FIND_DELETE_RECURSIVE)) {
-                    /* if deleting current node, check if it can be deleted */
-                    if ((command == COOKFSFSINDEX_FIND_DELETE)
-                        && (fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY)
-                        && (fileNode->data.dirInfo.childCount > 0)) {
-                        /* if it is a non-empty directory, disallow unsetting it */
-                        return NULL;
-                    }
-
-                    /* free current node, set this element of the array to NULL */
-                    currentNode->data.dirInfo.childCount--;
-                    Cookfs_FsindexEntryFree(fileNode);
+                /* free current node, remove it from the array or the map */
+                currentNode->fsindex->generation++;
+                CookfsFsindexEntryResetSorted(currentNode);
+                currentNode->data.dirInfo.childCount--;
+                Cookfs_FsindexEntryFree(fileNode);
+                if (currentNode->data.dirInfo.isHash) {
+                    CookfsFsindexChildMapRemove(currentNode, fileNodePtr);
+                } else {
                     *fileNodePtr = NULL;
-                    CookfsLog(printf("deleted"))
-                }  else if (command == COOKFSFSINDEX_FIND_CREATE) {
-                    /* if entry exists already, check if both are of same type */
-                    CookfsLog(printf("updating..."))
-                    if (((fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY))
-                        || ((fileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY))) {
-                        /* if entry type does not match, free newFileNode and return NULL */
-                        CookfsLog(printf("update failed - type mismatch"))
-                        Cookfs_FsindexEntryFree(newFileNode);
-                        return NULL;
-                    }
-
-                    /* if types match, overwrite entry with new value */
-                    CookfsLog(printf("updated"))
-                    Cookfs_FsindexEntryFree(fileNode);
-                    *fileNodePtr = newFileNode;
-                    return newFileNode;
                 }
-                return fileNode;
-            }  else  {
-                CookfsLog(printf("not found"));
-                /* if entry was not found */
-                if (command == COOKFSFSINDEX_FIND_CREATE) {
-                    /* for create operation, add new child to static array */
-                    CookfsLog(printf("creating (%d)", currentNode->data.dirInfo.childCount))
-                    if (currentNode->data.dirInfo.childCount >= (COOKFS_FSINDEX_TABLE_MAXENTRIES - 1)) {
-                        /* if we ran out of entries in the array, convert to hash table and try again */
-                        CookfsLog(printf("converting to hash"))
-                        CookfsFsindexChildtableToHash(currentNode);
-                        continue;
-                    }  else  {
-                        /* if we have any spots available, update first free one */
-                        for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-                            if (currentNode->data.dirInfo.dirData.childTable[i] == NULL) {
-                                CookfsLog(printf("create - adding at %d", i))
-                                currentNode->data.dirInfo.dirData.childTable[i] = newFileNode;
-                                break;
-                            }
-                        }
-                        currentNode->data.dirInfo.childCount++;
-                    }
-                    /* return newFileNode */
-                    return newFileNode;
-                }  else  {
-                    /* entry was not found, return NULL */
+                CookfsLog(printf("deleted"))
+            }  else if (command == COOKFSFSINDEX_FIND_CREATE) {
+                /* if entry exists already, check if both are of same type */
+                CookfsLog(printf("updating..."))
+                if (((fileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY))
+                    || ((fileNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) && (newFileNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY))) {
+                    /* if entry type does not match, free newFileNode and return NULL */
+                    CookfsLog(printf("update failed - type mismatch"))
+                    Cookfs_FsindexEntryFree(newFileNode);
                     return NULL;
                 }
+
+                /* if types match, overwrite entry with new value */
+                CookfsLog(printf("updated"))
+                currentNode->fsindex->generation++;
+                CookfsFsindexEntryResetSorted(currentNode);
+                Cookfs_FsindexEntryFree(fileNode);
+                *fileNodePtr = newFileNode;
+                return newFileNode;
             }
+            return fileNode;
         }
 
-        /* unless we did continue somewhere above, return NULL */
-        return NULL;
+        CookfsLog(printf("not found"));
+        /* if entry was not found */
+        if (command != COOKFSFSINDEX_FIND_CREATE) {
+            /* entry was not found, return NULL */
+            return NULL;
+        }
+
+        /* for create operation, add new child to the map or static array */
+        CookfsLog(printf("creating (%d)", currentNode->data.dirInfo.childCount))
+        if (currentNode->data.dirInfo.isHash) {
+            /* grow the map if it is filled more than 3/4 */
+            unsigned int size = currentNode->data.dirInfo.dirData.children.mask + 1;
+            if (((unsigned int)currentNode->data.dirInfo.childCount + 1) * 4 > size * 3) {
+                CookfsLog(printf("growing the map"))
+                CookfsFsindexChildMapResize(currentNode, size * 2);
+                continue;
+            }
+            *fileNodePtr = newFileNode;
+        }  else if (currentNode->data.dirInfo.childCount >= (COOKFS_FSINDEX_TABLE_MAXENTRIES - 1)) {
+            /* if we ran out of entries in the array, convert to map and try again */
+            CookfsLog(printf("converting to map"))
+            CookfsFsindexChildtableToMap(currentNode);
+            continue;
+        }  else  {
+            /* if we have any spots available, update first free one */
+            for (int i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
+                if (currentNode->data.dirInfo.dirData.childTable[i] == NULL) {
+                    CookfsLog(printf("create - adding at %d", i))
+                    currentNode->data.dirInfo.dirData.childTable[i] = newFileNode;
+                    break;
+                }
+            }
+        }
+        currentNode->data.dirInfo.childCount++;
+        currentNode->fsindex->generation++;
+        CookfsFsindexEntryResetSorted(currentNode);
+        CookfsFsindexBloomAdd(currentNode->fsindex, newFileNode->pathHash);
+        /* return newFileNode */
+        return newFileNode;
     }
 }
 
@@ -2131,10 +2419,10 @@ static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *cu
 /*
  *----------------------------------------------------------------------
  *
- * CookfsFsindexChildtableToHash --
+ * CookfsFsindexChildtableToMap --
  *
  *      Converts directory fsindex entry from using static array of
- *      children into hash table based.
+ *      children into map based.
  *
  * Results:
  *      None
@@ -2145,27 +2433,24 @@ static Cookfs_FsindexEntry *CookfsFsindexFindInDirectory(Cookfs_FsindexEntry *cu
  *----------------------------------------------------------------------
  */
 
-static void CookfsFsindexChildtableToHash(Cookfs_FsindexEntry *e) {
+static void CookfsFsindexChildtableToMap(Cookfs_FsindexEntry *e) {
     Cookfs_FsindexEntry *childTable[COOKFS_FSINDEX_TABLE_MAXENTRIES];
     int i;
-    Tcl_HashEntry *hashEntry;
-    int isNew;
 
     CookfsLog(printf("enter"))
 
-    /* copy previous values to temporary table and initialize hash table for storage */
+    /* copy previous values to temporary table and initialize map for storage */
     memcpy(childTable, e->data.dirInfo.dirData.childTable, sizeof(childTable));
 
-    e->data.dirInfo.isHash = 1;
-    Tcl_InitHashTable(&e->data.dirInfo.dirData.children, TCL_STRING_KEYS);
+    Cookfs_FsindexEntryInitChildMap(e, COOKFS_FSINDEX_TABLE_MAXENTRIES);
 
-    /* copy old entries to hash table */
+    /* copy old entries to the map */
     for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
         if (childTable[i] != NULL) {
             CookfsLog(printf("copying %s", childTable[i]->fileName))
-            hashEntry = Tcl_CreateHashEntry(&e->data.dirInfo.dirData.children, childTable[i]->fileName, &isNew);
-
-            Tcl_SetHashValue(hashEntry, childTable[i]);
+            *CookfsFsindexChildMapLookup(e, childTable[i]->fileName,
+                childTable[i]->fileNameLen, childTable[i]->fileNameHash) =
+                childTable[i];
         }
     }
 
@@ -2173,3 +2458,712 @@ static void CookfsFsindexChildtableToHash(Cookfs_FsindexEntry *e) {
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexEntryInitChildMap --
+ *
+ *      Initializes an empty map of children for a directory entry that
+ *      has no children. The map is created with enough slots to store
+ *      the specified number of children without growing.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      The directory entry is switched to map mode
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_FsindexEntryInitChildMap(Cookfs_FsindexEntry *e, int count) {
+    unsigned int size = COOKFS_FSINDEX_MAP_MINSIZE;
+    while (size * 3 < (unsigned int)count * 4) {
+        size *= 2;
+    }
+    e->data.dirInfo.dirData.children.slots = (Cookfs_FsindexEntry **)
+        ckalloc(size * sizeof(Cookfs_FsindexEntry *));
+    memset(e->data.dirInfo.dirData.children.slots, 0,
+        size * sizeof(Cookfs_FsindexEntry *));
+    e->data.dirInfo.dirData.children.mask = size - 1;
+    e->data.dirInfo.dirData.children.sorted = NULL;
+    e->data.dirInfo.isHash = 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexEntryAddChild --
+ *
+ *      Adds a new child to a directory entry. The name hash of the child is
+ *      calculated here. This is used to create children from raw index
+ *      data, the map of children should be initialized in advance by
+ *      Cookfs_FsindexEntryInitChildMap() if the number of children is known.
+ *
+ * Results:
+ *      1 if the entry was added; 0 if an entry with the same name already
+ *      exists in the directory. In this case, the entry is not added and
+ *      it is caller responsibility to release it.
+ *
+ * Side effects:
+ *      Can convert static array of children into a map
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_FsindexEntryAddChild(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry *itemNode) {
+    Cookfs_FsindexEntry **slot = NULL;
+
+    itemNode->fileNameHash = Cookfs_PathObjNameHash(itemNode->fileName,
+        itemNode->fileNameLen);
+    itemNode->pathHash = COOKFS_FSINDEX_PATHHASH(e->pathHash,
+        itemNode->fileNameHash);
+
+    if (!e->data.dirInfo.isHash) {
+        for (int i = 0; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
+            Cookfs_FsindexEntry *childNode =
+                e->data.dirInfo.dirData.childTable[i];
+            if (childNode == NULL) {
+                if (slot == NULL) {
+                    slot = &e->data.dirInfo.dirData.childTable[i];
+                }
+            } else if (CookfsFsindexEntryIsName(childNode, itemNode->fileName,
+                itemNode->fileNameLen, itemNode->fileNameHash))
+            {
+                return 0;
+            }
+        }
+        if (e->data.dirInfo.childCount < (COOKFS_FSINDEX_TABLE_MAXENTRIES - 1)) {
+            *slot = itemNode;
+            e->data.dirInfo.childCount++;
+            return 1;
+        }
+        CookfsFsindexChildtableToMap(e);
+    }
+
+    unsigned int size = e->data.dirInfo.dirData.children.mask + 1;
+    if (((unsigned int)e->data.dirInfo.childCount + 1) * 4 > size * 3) {
+        CookfsFsindexChildMapResize(e, size * 2);
+    }
+    slot = CookfsFsindexChildMapLookup(e, itemNode->fileName,
+        itemNode->fileNameLen, itemNode->fileNameHash);
+    if (*slot != NULL) {
+        return 0;
+    }
+    CookfsFsindexEntryResetSorted(e);
+    *slot = itemNode;
+    e->data.dirInfo.childCount++;
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexChildMapLookup --
+ *
+ *      Finds the slot for the specified name in the map of children.
+ *      The map always has empty slots, so the search is finite.
+ *
+ * Results:
+ *      Pointer to the slot with the entry of the specified name, or
+ *      pointer to the empty slot where the entry should be added
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Cookfs_FsindexEntry **CookfsFsindexChildMapLookup(Cookfs_FsindexEntry *e, const char *name, int length, unsigned int hash) {
+    Cookfs_FsindexEntry **slots = e->data.dirInfo.dirData.children.slots;
+    unsigned int mask = e->data.dirInfo.dirData.children.mask;
+    unsigned int idx = hash & mask;
+    while (slots[idx] != NULL && !CookfsFsindexEntryIsName(slots[idx], name,
+        length, hash))
+    {
+        idx = (idx + 1) & mask;
+    }
+    return &slots[idx];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexChildMapResize --
+ *
+ *      Moves all children to the new map with the specified number
+ *      of slots, the number must be a power of 2
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Pointers to slots of the previous map become invalid
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexChildMapResize(Cookfs_FsindexEntry *e, unsigned int size) {
+    Cookfs_FsindexEntry **oldSlots = e->data.dirInfo.dirData.children.slots;
+    unsigned int oldSize = e->data.dirInfo.dirData.children.mask + 1;
+
+    CookfsLog(printf("resize map from %u to %u slots", oldSize, size));
+
+    e->data.dirInfo.dirData.children.slots = (Cookfs_FsindexEntry **)
+        ckalloc(size * sizeof(Cookfs_FsindexEntry *));
+    memset(e->data.dirInfo.dirData.children.slots, 0,
+        size * sizeof(Cookfs_FsindexEntry *));
+    e->data.dirInfo.dirData.children.mask = size - 1;
+
+    for (unsigned int i = 0; i < oldSize; i++) {
+        if (oldSlots[i] != NULL) {
+            *CookfsFsindexChildMapLookup(e, oldSlots[i]->fileName,
+                oldSlots[i]->fileNameLen, oldSlots[i]->fileNameHash) =
+                oldSlots[i];
+        }
+    }
+
+    ckfree(oldSlots);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexChildMapRemove --
+ *
+ *      Removes the entry in specified slot from the map of children.
+ *      Subsequent entries in the probe sequence are shifted back to keep
+ *      them reachable, so no deleted markers are needed.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Entries can be moved to other slots
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexChildMapRemove(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry **slot) {
+    Cookfs_FsindexEntry **slots = e->data.dirInfo.dirData.children.slots;
+    unsigned int mask = e->data.dirInfo.dirData.children.mask;
+    unsigned int i = slot - slots;
+    unsigned int j = i;
+
+    slots[i] = NULL;
+    while (1) {
+        j = (j + 1) & mask;
+        if (slots[j] == NULL) {
+            break;
+        }
+        /* the entry can stay in its slot if its home slot is cyclically
+         * in (i, j] range */
+        unsigned int k = slots[j]->fileNameHash & mask;
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+            continue;
+        }
+        slots[i] = slots[j];
+        slots[j] = NULL;
+        i = j;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexEntryCompareNames --
+ *
+ *      Compares names of two entries, it is used by qsort()
+ *
+ * Results:
+ *      Negative, zero or positive value, as memcmp()
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexEntryCompareNames(const void *a, const void *b) {
+    const Cookfs_FsindexEntry *e1 = *(Cookfs_FsindexEntry * const *)a;
+    const Cookfs_FsindexEntry *e2 = *(Cookfs_FsindexEntry * const *)b;
+    int len = e1->fileNameLen < e2->fileNameLen ?
+        e1->fileNameLen : e2->fileNameLen;
+    int cmp = memcmp(e1->fileName, e2->fileName, len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (int)e1->fileNameLen - (int)e2->fileNameLen;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexEntrySorted --
+ *
+ *      Returns children of the directory entry sorted by name. Children
+ *      in the static array are sorted in the specified buffer, which must
+ *      have COOKFS_FSINDEX_TABLE_MAXENTRIES elements. For the map of
+ *      children, the sorted list is kept in the directory entry until
+ *      the list of children is changed.
+ *
+ *      This function can be called when only read lock is acquired for
+ *      the fsindex. The fsindex mutex ensures that the sorted list is
+ *      created only once. The list is published with release semantics
+ *      after it is filled, and is read without the mutex with acquire
+ *      semantics.
+ *
+ * Results:
+ *      Array of children, the number of children is put in countPtr
+ *
+ * Side effects:
+ *      The sorted list of children can be created for the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Cookfs_FsindexEntry **CookfsFsindexEntrySorted(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry **buffer, int *countPtr) {
+    int count = e->data.dirInfo.childCount;
+    *countPtr = count;
+
+    if (!e->data.dirInfo.isHash) {
+        int idx = 0;
+        for (int i = 0; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
+            if (e->data.dirInfo.dirData.childTable[i] != NULL) {
+                buffer[idx++] = e->data.dirInfo.dirData.childTable[i];
+            }
+        }
+        qsort(buffer, count, sizeof(Cookfs_FsindexEntry *),
+            CookfsFsindexEntryCompareNames);
+        return buffer;
+    }
+
+    Cookfs_FsindexEntry **sorted = Cookfs_AtomicLoadAcquirePtr(
+        &e->data.dirInfo.dirData.children.sorted);
+    if (sorted != NULL) {
+        return sorted;
+    }
+
+#ifdef TCL_THREADS
+    Tcl_MutexLock(&e->fsindex->mxLazy);
+#endif /* TCL_THREADS */
+
+    // Check the state again, the list could be created by another
+    // thread while we were waiting for the mutex.
+    sorted = e->data.dirInfo.dirData.children.sorted;
+    if (sorted == NULL) {
+        CookfsLog(printf("create sorted list of %d children for [%s]",
+            count, e->fileName));
+        sorted = (Cookfs_FsindexEntry **)ckalloc(
+            (count > 0 ? count : 1) * sizeof(Cookfs_FsindexEntry *));
+        Cookfs_FsindexEntry **slots = e->data.dirInfo.dirData.children.slots;
+        unsigned int size = e->data.dirInfo.dirData.children.mask + 1;
+        int idx = 0;
+        for (unsigned int i = 0; i < size; i++) {
+            if (slots[i] != NULL) {
+                sorted[idx++] = slots[i];
+            }
+        }
+        qsort(sorted, count, sizeof(Cookfs_FsindexEntry *),
+            CookfsFsindexEntryCompareNames);
+        Cookfs_AtomicStoreReleasePtr(
+            &e->data.dirInfo.dirData.children.sorted, sorted);
+    }
+
+#ifdef TCL_THREADS
+    Tcl_MutexUnlock(&e->fsindex->mxLazy);
+#endif /* TCL_THREADS */
+
+    return sorted;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexEntryResetSorted --
+ *
+ *      Releases the sorted list of children of the directory entry. It
+ *      must be called when children are added to or removed from
+ *      the directory, or replaced.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexEntryResetSorted(Cookfs_FsindexEntry *e) {
+    if (e->data.dirInfo.isHash &&
+        e->data.dirInfo.dirData.children.sorted != NULL)
+    {
+        ckfree(e->data.dirInfo.dirData.children.sorted);
+        e->data.dirInfo.dirData.children.sorted = NULL;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomBits --
+ *
+ *      Calculates the first bit position and the step between bit
+ *      positions in the filter of existing paths for the path hash
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexBloomBits(unsigned int pathHash, unsigned int *bitPtr,
+    unsigned int *stepPtr)
+{
+    /* the path hash is mixed to spread its bits, two values are
+     * derived from it for double hashing */
+    unsigned int h = pathHash;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    *bitPtr = h;
+    *stepPtr = ((h >> 17) | (h << 15)) | 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomSet --
+ *
+ *      Sets the bits for the path hash in the filter of existing paths
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexBloomSet(Cookfs_FsindexBloom *bloom,
+    unsigned int pathHash)
+{
+    unsigned int bit, step;
+    CookfsFsindexBloomBits(pathHash, &bit, &step);
+    for (int k = 0; k < COOKFS_FSINDEX_BLOOM_HASHES; k++) {
+        bloom->bits[(bit & bloom->mask) >> 3] |=
+            (unsigned char)(1 << (bit & 7));
+        bit += step;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomTest --
+ *
+ *      Checks whether the path hash can be in the filter of existing paths
+ *
+ * Results:
+ *      0 if there is no entry with such path hash; 1 otherwise
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexBloomTest(const Cookfs_FsindexBloom *bloom,
+    unsigned int pathHash)
+{
+    unsigned int bit, step;
+    CookfsFsindexBloomBits(pathHash, &bit, &step);
+    for (int k = 0; k < COOKFS_FSINDEX_BLOOM_HASHES; k++) {
+        unsigned int pos = bit & bloom->mask;
+        if (!(bloom->bits[pos >> 3] & (1 << (pos & 7)))) {
+            return 0;
+        }
+        bit += step;
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomAdd --
+ *
+ *      Adds the path hash of a new entry to the filter of existing paths.
+ *      If the filter has too many entries for its size, it is released.
+ *      It will be created again with a proper size when nonexistent paths
+ *      are requested.
+ *
+ *      The caller must hold a write lock on fsindex.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      The filter can be released
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexBloomAdd(Cookfs_Fsindex *i, unsigned int pathHash) {
+    Cookfs_FsindexBloom *bloom = i->bloom;
+    if (bloom == NULL) {
+        return;
+    }
+    bloom->count++;
+    if ((unsigned int)bloom->count * (COOKFS_FSINDEX_BLOOM_BITS / 2) >
+        bloom->mask + 1)
+    {
+        CookfsLog(printf("release the filter, too many entries: %d",
+            bloom->count));
+        i->bloom = NULL;
+        ckfree(bloom);
+        Cookfs_RefCountInit(&i->bloomMisses, 0);
+        return;
+    }
+    CookfsFsindexBloomSet(bloom, pathHash);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomCount --
+ *
+ *      Counts the keys for the entry and all its child entries. Children
+ *      of directories that are not loaded from the raw index data yet are
+ *      not counted, such directories have an additional key.
+ *
+ * Results:
+ *      Number of keys
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexBloomCount(Cookfs_FsindexEntry *e) {
+    int count = 1;
+    if (e->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+        if (Cookfs_FsindexEntryIsLazy(e)) {
+            return count + 1;
+        }
+        Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(e);
+        int slotsCount = CookfsFsindexEntryChildSlotsCount(e);
+        for (int idx = 0; idx < slotsCount; idx++) {
+            if (slots[idx] != NULL) {
+                count += CookfsFsindexBloomCount(slots[idx]);
+            }
+        }
+    }
+    return count;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomFill --
+ *
+ *      Adds the entry and all its child entries to the filter. For
+ *      directories that are not loaded from the raw index data yet,
+ *      the key COOKFS_FSINDEX_BLOOM_LAZYKEY() is added instead of their
+ *      children. Lookups below such directories don't use the filter.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexBloomFill(Cookfs_FsindexEntry *e,
+    Cookfs_FsindexBloom *bloom)
+{
+    CookfsFsindexBloomSet(bloom, e->pathHash);
+    if (e->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+        if (Cookfs_FsindexEntryIsLazy(e)) {
+            CookfsFsindexBloomSet(bloom,
+                COOKFS_FSINDEX_BLOOM_LAZYKEY(e->pathHash));
+            return;
+        }
+        Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(e);
+        int slotsCount = CookfsFsindexEntryChildSlotsCount(e);
+        for (int idx = 0; idx < slotsCount; idx++) {
+            if (slots[idx] != NULL) {
+                CookfsFsindexBloomFill(slots[idx], bloom);
+            }
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexBloomBuild --
+ *
+ *      Creates the filter of existing paths from the entries that are
+ *      already loaded. Directories are not loaded from the raw index data,
+ *      so the cost does not depend on the number of files in the archive.
+ *
+ *      This function can be called when only read lock is acquired for
+ *      the fsindex. The fsindex mutex ensures that the filter is set only
+ *      once. The filter is published with release semantics after it is
+ *      filled, and readers load it with acquire semantics.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexBloomBuild(Cookfs_Fsindex *i) {
+    int count = CookfsFsindexBloomCount(i->rootItem);
+
+    unsigned int bits = 1024;
+    while (bits < (unsigned int)count * COOKFS_FSINDEX_BLOOM_BITS) {
+        bits *= 2;
+    }
+
+    CookfsLog(printf("create the filter for %d keys, %u bits", count,
+        bits));
+
+    Cookfs_FsindexBloom *bloom = (Cookfs_FsindexBloom *)ckalloc(
+        sizeof(Cookfs_FsindexBloom) + bits / 8);
+    memset(bloom->bits, 0, bits / 8);
+    bloom->mask = bits - 1;
+    bloom->count = count;
+    CookfsFsindexBloomFill(i->rootItem, bloom);
+
+#ifdef TCL_THREADS
+    Tcl_MutexLock(&i->mxLazy);
+#endif /* TCL_THREADS */
+
+    // Check the state again, the filter could be created by another
+    // thread while we were building it.
+    if (i->bloom == NULL) {
+        Cookfs_AtomicStoreReleasePtr(&i->bloom, bloom);
+        bloom = NULL;
+    }
+
+#ifdef TCL_THREADS
+    Tcl_MutexUnlock(&i->mxLazy);
+#endif /* TCL_THREADS */
+
+    if (bloom != NULL) {
+        ckfree(bloom);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexSealEntry --
+ *
+ *      Loads children of the directory entry and all its subdirectories
+ *      from the raw index data, and creates sorted lists of children
+ *      for directories with the map of children.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Directories are materialized
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexSealEntry(Cookfs_FsindexEntry *e) {
+    if (e->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+        return;
+    }
+    Cookfs_FsindexEntryWantChildren(e);
+    if (e->data.dirInfo.isHash) {
+        int count;
+        CookfsFsindexEntrySorted(e, NULL, &count);
+    }
+    Cookfs_FsindexEntry **slots = CookfsFsindexEntryChildSlots(e);
+    int slotsCount = CookfsFsindexEntryChildSlotsCount(e);
+    for (int idx = 0; idx < slotsCount; idx++) {
+        if (slots[idx] != NULL) {
+            CookfsFsindexSealEntry(slots[idx]);
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexSeal --
+ *
+ *      Freezes fsindex. All data that is normally created on first access
+ *      (directory children, sorted lists of children and the filter of
+ *      existing paths) is created now, and write locks are not allowed
+ *      after that. Thus, readers do not modify a sealed fsindex and do not
+ *      need to synchronize with each other.
+ *
+ *      Read locks are still used to wait for readers when fsindex is
+ *      terminated.
+ *
+ *      The caller must hold a write lock on fsindex.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Directories are materialized
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_FsindexSeal(Cookfs_Fsindex *i) {
+    Cookfs_FsindexWantWrite(i);
+    if (i->isSealed) {
+        return;
+    }
+    CookfsLog(printf("seal fsindex [%p]", (void *)i));
+    CookfsFsindexSealEntry(i->rootItemVirtual);
+    // The existing filter could be created when some directories were
+    // not loaded yet. Create it again to cover all entries.
+    if (i->bloom != NULL) {
+        ckfree(i->bloom);
+        i->bloom = NULL;
+    }
+    CookfsFsindexBloomBuild(i);
+    i->isSealed = 1;
+}
+
+int Cookfs_FsindexIsSealed(Cookfs_Fsindex *i) {
+    return i->isSealed;
+}
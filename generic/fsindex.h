@@ -27,6 +27,9 @@ int Cookfs_FsindexUnsetRecursive(Cookfs_Fsindex *i, Cookfs_PathObj *pathObj);
 Cookfs_FsindexEntry **Cookfs_FsindexList(Cookfs_Fsindex *i, Cookfs_PathObj *pathObj, int *itemCountPtr);
 Cookfs_FsindexEntry **Cookfs_FsindexListEntry(Cookfs_FsindexEntry *dirNode, int *itemCountPtr);
 void Cookfs_FsindexListFree(Cookfs_FsindexEntry **items);
+void Cookfs_FsindexEntryMatch(Cookfs_FsindexEntry *dirNode,
+    const char *pattern, Cookfs_FsindexForeachProc *proc,
+    ClientData clientData);
 
 // Tcl_Obj *Cookfs_FsindexGetMetadataAll(Cookfs_Fsindex *i);
 Tcl_Obj *Cookfs_FsindexGetMetadataAllKeys(Cookfs_Fsindex *i);
@@ -43,6 +46,7 @@ Cookfs_FsindexEntry *CookfsFsindexFindElement(const Cookfs_Fsindex *i, Cookfs_Pa
 
 Tcl_WideInt Cookfs_FsindexIncrChangeCount(Cookfs_Fsindex *i, int count);
 void Cookfs_FsindexResetChangeCount(Cookfs_Fsindex *i);
+Tcl_WideInt Cookfs_FsindexGetGeneration(Cookfs_Fsindex *i);
 
 int Cookfs_FsindexEntryIsPending(Cookfs_FsindexEntry *e);
 int Cookfs_FsindexEntryIsDirectory(Cookfs_FsindexEntry *e);
@@ -92,4 +96,14 @@ int Cookfs_FsindexUnlockSoft(Cookfs_Fsindex *i);
 
 void Cookfs_FsindexLockExclusive(Cookfs_Fsindex *i);
 
+void Cookfs_FsindexSeal(Cookfs_Fsindex *i);
+int Cookfs_FsindexIsSealed(Cookfs_Fsindex *i);
+
+Tcl_Obj *Cookfs_FsindexGetStatsObj(Cookfs_Fsindex *i);
+void Cookfs_FsindexResetStats(Cookfs_Fsindex *i);
+
+#ifdef TCL_THREADS
+Cookfs_LockStats *Cookfs_FsindexGetLockStats(Cookfs_Fsindex *i);
+#endif /* TCL_THREADS */
+
 #endif /* COOKFS_FSINDEX_H */
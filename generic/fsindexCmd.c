@@ -417,7 +417,8 @@ static int CookfsFsindexCmdGetBlockUsage(Cookfs_Fsindex *fsIndex, Tcl_Interp *in
  * CookfsFsindexCmdExport --
  *
  *      Exports fsindex internal storage to binary, platform-independant
- *      format.
+ *      format. If the -compact option is specified, the compact format
+ *      is used.
  *
  * Results:
  *      Returns TCL_OK on success; TCL_ERROR on error
@@ -431,11 +432,18 @@ static int CookfsFsindexCmdGetBlockUsage(Cookfs_Fsindex *fsIndex, Tcl_Interp *in
  */
 
 static int CookfsFsindexCmdExport(Cookfs_Fsindex *fsIndex, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = { "-compact", NULL };
     Tcl_Obj *exportObj;
+    int opt;
 
     /* check arguments */
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 2, objv, "");
+    if (objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-compact?");
+        return TCL_ERROR;
+    }
+    if (objc == 3 && Tcl_GetIndexFromObj(interp, objv[2], options, "option",
+        0, &opt) != TCL_OK)
+    {
         return TCL_ERROR;
     }
 
@@ -443,7 +451,7 @@ static int CookfsFsindexCmdExport(Cookfs_Fsindex *fsIndex, Tcl_Interp *interp, i
         return TCL_ERROR;
     }
     /* export to Tcl_Obj */
-    exportObj = Cookfs_FsindexToObject(fsIndex);
+    exportObj = Cookfs_FsindexToObject(fsIndex, (objc == 3 ? 1 : 0));
     Cookfs_FsindexUnlock(fsIndex);
 
     if (exportObj == NULL) {
@@ -600,6 +608,7 @@ static int CookfsFsindexCmdSetmtime(Cookfs_Fsindex *fsIndex, Tcl_Interp *interp,
 
     /* update mtime */
     entry->fileTime = fileTime;
+    entry->isDirty = 1;
     Cookfs_FsindexIncrChangeCount(fsIndex, 1);
 
     Cookfs_FsindexUnlock(fsIndex);
@@ -13,19 +13,91 @@
 #include "fsindexInt.h"
 #include "fsindexIO.h"
 
-#define COOKFS_FSINDEX_MAXENTRYSIZE 8192
 #define COOKFS_FSINDEX_BUFFERINCREASE 65536
 
-#define COOKFS_FSINDEX_HEADERSTRING "CFS2.200"
+#define COOKFS_FSINDEX_HEADERSTRING "CFS2.300"
 #define COOKFS_FSINDEX_HEADERLENGTH 8
 
+/* the previous format of the index. It is exported by default, as it can be
+ * read by older versions of cookfs. */
+#define COOKFS_FSINDEX_V2_HEADERSTRING "CFS2.200"
+
+#define COOKFS_FSINDEX_DELTA_HEADERSTRING "CFS2.2D0"
+
+/* maximum length of varint-encoded 64-bit value */
+#define COOKFS_FSINDEX_VARINT_MAXSIZE 10
+
+/* state of the index export */
+typedef struct CookfsFsindexExport {
+    /* directory records */
+    Tcl_DString records;
+    /* table of directories, 2 values for each directory: size of
+     * the directory record and number of directories in its subtree */
+    Tcl_WideUInt *table;
+    int tableCount;
+    int tableSize;
+} CookfsFsindexExport;
+
 /* declarations of static and/or internal functions */
-static int CookfsFsindexExportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, Tcl_Obj *result, int objOffset);
-static int CookfsFsindexImportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, unsigned char *bytes, int objLength, int objOffset);
+static int CookfsFsindexExportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, CookfsFsindexExport *ex);
+static int CookfsFsindexExportDirectoryV2(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, Tcl_Obj *result, int objOffset);
+static int CookfsFsindexImportTables(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset);
+static int CookfsFsindexScanDirectory(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset, int *lazyDirsSizePtr);
+static void CookfsFsindexMaterializeV2(Cookfs_FsindexEntry *e);
+static int CookfsFsindexReadRecordV3(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int dirIndex, Cookfs_FsindexEntry *e);
+static void CookfsFsindexMaterializeV3(Cookfs_FsindexEntry *e);
 static int CookfsFsindexExportMetadata(Cookfs_Fsindex *fsIndex, Tcl_Obj *result, int objOffset);
 static int CookfsFsindexImportMetadata(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset);
+static int CookfsFsindexExportDelta(Cookfs_FsindexEntry *entry, Tcl_DString *path, Tcl_Obj *result, int objOffset, int *countPtr);
+static int CookfsFsindexImportDelta(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset);
+static void CookfsFsindexResetDirty(Cookfs_FsindexEntry *entry);
+
+/* binary data format:
+ *  <8:header>
+ *  <varint:blockUsageCount>
+ *    <varint:blockUsage> * blockUsageCount
+ *  <varint:numDirectories>
+ *    <varint:recordSize><varint:subtreeDirectories> * numDirectories
+ *  <directory records>
+ *  <metadata>
+ *
+ *  the block usage table contains the number of file blocks that refer to
+ *  each page, so it is not necessary to read all the files on import
+ *
+ *  the directory table and the directory records are stored in pre-order,
+ *  i.e. each directory is followed by its subdirectories, subtreeDirectories
+ *  includes the directory itself. This allows to find the record for any
+ *  directory without parsing the records of other directories.
+ *
+ *  directory record format:
+ *  <varint:numChildren>
+ *    <varint:sharedPrefixLength><varint:suffixLength><X:suffix>
+ *    <zigzag varint:fileTime delta>
+ *    <varint:numBlocks + 1>
+ *    file: (<zigzag varint:block delta><varint:offset><varint:size>) * numBlocks
+ *
+ *  children of large directories are sorted by their names, small
+ *  directories keep the order of their children. The name of a child is
+ *  stored as the number of leading bytes shared with the name of
+ *  the previous child and the rest of the name. All file names are
+ *  exported as UTF-8 string.
+ *
+ *  the modification time is stored as a difference from the time of
+ *  the previous child, the block number is stored as a difference from
+ *  the previous block in the directory record. The value numBlocks + 1
+ *  is 0 for directories.
+ *
+ *  varint is an unsigned value stored as 7 bits per byte, low bits first,
+ *  the high bit is set for all bytes except the last one. Signed values are
+ *  zigzag-encoded: 0, -1, 1, -2, 2 ... are stored as 0, 1, 2, 3, 4 ...
+ */
 
-/* binary data directory format:
+/* binary data format of the previous version (CFS2.200):
+ *  <8:header>
+ *  <root directory>
+ *  <metadata>
+ *
+ *  directory format:
  *  <4:numChildren>
  *    <1:fileNameLength><X:fileName><1:null>
  *    <8:fileTime>
@@ -38,6 +110,90 @@ static int CookfsFsindexImportMetadata(Cookfs_Fsindex *fsIndex, unsigned char *b
  *  subdirectories are inlined completely and recursively
  */
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexPutVarint --
+ *
+ *      Appends the specified unsigned value to the string as varint
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexPutVarint(Tcl_DString *ds, Tcl_WideUInt value) {
+    char buf[COOKFS_FSINDEX_VARINT_MAXSIZE];
+    int len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (char)value;
+    Tcl_DStringAppend(ds, buf, len);
+}
+
+static void CookfsFsindexPutZigzag(Tcl_DString *ds, Tcl_WideInt value) {
+    CookfsFsindexPutVarint(ds, value < 0 ?
+        ((~(Tcl_WideUInt)value) << 1) | 1 : ((Tcl_WideUInt)value) << 1);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexGetVarint --
+ *
+ *      Reads varint from the buffer and moves the buffer pointer
+ *
+ * Results:
+ *      1 on success; 0 if the end of buffer is reached or the value
+ *      is malformed
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexGetVarint(unsigned char **pPtr, unsigned char *end, Tcl_WideUInt *valuePtr) {
+    unsigned char *p = *pPtr;
+    Tcl_WideUInt value = 0;
+    int shift = 0;
+    do {
+        if (p >= end || shift >= (COOKFS_FSINDEX_VARINT_MAXSIZE * 7)) {
+            return 0;
+        }
+        value |= ((Tcl_WideUInt)(*p & 0x7F)) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *pPtr = p;
+    *valuePtr = value;
+    return 1;
+}
+
+static int CookfsFsindexGetZigzag(unsigned char **pPtr, unsigned char *end, Tcl_WideInt *valuePtr) {
+    Tcl_WideUInt value;
+    if (!CookfsFsindexGetVarint(pPtr, end, &value)) {
+        return 0;
+    }
+    *valuePtr = (Tcl_WideInt)((value & 1) ? ~(value >> 1) : (value >> 1));
+    return 1;
+}
+
+/* reads varint that must not exceed the specified limit */
+static int CookfsFsindexGetVarintInt(unsigned char **pPtr, unsigned char *end, Tcl_WideUInt limit, int *valuePtr) {
+    Tcl_WideUInt value;
+    if (!CookfsFsindexGetVarint(pPtr, end, &value) || value > limit) {
+        return 0;
+    }
+    *valuePtr = (int)value;
+    return 1;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -46,6 +202,10 @@ static int CookfsFsindexImportMetadata(Cookfs_Fsindex *fsIndex, unsigned char *b
  *      Creates a byte array object with fsindex information
  *      stored as platform-independant binary data
  *
+ *      If isCompact is true, the compact format (CFS2.300) is used.
+ *      Otherwise, the index is exported in the previous format (CFS2.200)
+ *      that can be read by older versions of cookfs.
+ *
  * Results:
  *      Binary data as Tcl_Obj; NULL in case of error
  *
@@ -55,19 +215,73 @@ static int CookfsFsindexImportMetadata(Cookfs_Fsindex *fsIndex, unsigned char *b
  *----------------------------------------------------------------------
  */
 
-Tcl_Obj *Cookfs_FsindexToObject(Cookfs_Fsindex *fsindex) {
+Tcl_Obj *Cookfs_FsindexToObject(Cookfs_Fsindex *fsindex, int isCompact) {
+    CookfsFsindexExport ex;
+    Tcl_DString tables;
     Tcl_Obj *result;
+    unsigned char *bytes;
     int objSize;
+    int blockIndexSize;
+    int i;
 
-    /* create initial byte array object with header string and
-     * extend its size specified buffer increase */
-    result = Tcl_NewByteArrayObj((unsigned char *) COOKFS_FSINDEX_HEADERSTRING, COOKFS_FSINDEX_HEADERLENGTH);
-    Tcl_SetByteArrayLength(result, COOKFS_FSINDEX_BUFFERINCREASE);
+    if (!isCompact) {
+        result = Tcl_NewByteArrayObj(
+            (unsigned char *)COOKFS_FSINDEX_V2_HEADERSTRING,
+            COOKFS_FSINDEX_HEADERLENGTH);
+        /* export root entry; all subdirectories are inlined recursively */
+        objSize = CookfsFsindexExportDirectoryV2(fsindex, fsindex->rootItem,
+            result, COOKFS_FSINDEX_HEADERLENGTH);
+        Tcl_SetByteArrayLength(result, objSize);
+        goto exportMetadata;
+    }
 
-    /* export root entry into newly created object; all subdirectories
-     * are created recursively */
-    objSize = CookfsFsindexExportDirectory(fsindex, fsindex->rootItem, result, COOKFS_FSINDEX_HEADERLENGTH);
-    Tcl_SetByteArrayLength(result, objSize);
+    /* export root entry; all subdirectories are exported recursively */
+    Tcl_DStringInit(&ex.records);
+    ex.table = NULL;
+    ex.tableCount = 0;
+    ex.tableSize = 0;
+    CookfsFsindexExportDirectory(fsindex, fsindex->rootItem, &ex);
+
+    /* export block usage, trailing unused blocks are not stored */
+    Tcl_DStringInit(&tables);
+    blockIndexSize = fsindex->blockIndexSize;
+    while (blockIndexSize > 0 && fsindex->blockIndex[blockIndexSize - 1] <= 0) {
+        blockIndexSize--;
+    }
+    CookfsFsindexPutVarint(&tables, blockIndexSize);
+    for (i = 0; i < blockIndexSize; i++) {
+        CookfsFsindexPutVarint(&tables, fsindex->blockIndex[i] < 0 ? 0 :
+            fsindex->blockIndex[i]);
+    }
+
+    /* export the table of directories */
+    CookfsFsindexPutVarint(&tables, ex.tableCount / 2);
+    for (i = 0; i < ex.tableCount; i++) {
+        CookfsFsindexPutVarint(&tables, ex.table[i]);
+    }
+
+    CookfsLog(printf("exported %d directories, tables: %d bytes,"
+        " records: %d bytes", ex.tableCount / 2, Tcl_DStringLength(&tables),
+        Tcl_DStringLength(&ex.records)));
+
+    objSize = COOKFS_FSINDEX_HEADERLENGTH + Tcl_DStringLength(&tables) +
+        Tcl_DStringLength(&ex.records);
+    result = Tcl_NewByteArrayObj(NULL, 0);
+    bytes = Tcl_SetByteArrayLength(result, objSize);
+    memcpy(bytes, COOKFS_FSINDEX_HEADERSTRING, COOKFS_FSINDEX_HEADERLENGTH);
+    bytes += COOKFS_FSINDEX_HEADERLENGTH;
+    memcpy(bytes, Tcl_DStringValue(&tables), Tcl_DStringLength(&tables));
+    bytes += Tcl_DStringLength(&tables);
+    memcpy(bytes, Tcl_DStringValue(&ex.records),
+        Tcl_DStringLength(&ex.records));
+
+    Tcl_DStringFree(&tables);
+    Tcl_DStringFree(&ex.records);
+    if (ex.table != NULL) {
+        ckfree(ex.table);
+    }
+
+exportMetadata:
 
     /* export metadata */
     objSize = CookfsFsindexExportMetadata(fsindex, result, objSize);
@@ -119,31 +333,64 @@ Cookfs_Fsindex *Cookfs_FsindexFromBytes(Tcl_Interp *interp, Cookfs_Fsindex *fsin
     // If no destination index is specified, we create a new index.
     // In this case, lock it. Otherwise, it is caller responsability
     // to lock the index.
-    if (fsindex == NULL) {
-        if (!Cookfs_FsindexLockWrite(result, NULL)) {
-            goto error;
-        }
-    }
-
     if (result == NULL) {
         CookfsLog(printf("unable to initialize Fsindex object"))
         goto error;
     }
 
+    if (fsindex == NULL) {
+        if (!Cookfs_FsindexLockWrite(result, NULL)) {
+            Cookfs_FsindexFini(result);
+            return NULL;
+        }
+    }
+
     if (size < COOKFS_FSINDEX_HEADERLENGTH) {
         CookfsLog(printf("unable to compare header 1"))
         goto error;
     }
-    if (memcmp(bytes, COOKFS_FSINDEX_HEADERSTRING, COOKFS_FSINDEX_HEADERLENGTH) != 0) {
+    if (memcmp(bytes, COOKFS_FSINDEX_HEADERSTRING,
+        COOKFS_FSINDEX_HEADERLENGTH) == 0)
+    {
+        /* read block usage and the table of directories; directory
+         * entries are created on first access by
+         * Cookfs_FsindexEntryMaterialize() */
+        i = CookfsFsindexImportTables(result, bytes, size,
+            COOKFS_FSINDEX_HEADERLENGTH);
+        if (i < 0) {
+            CookfsLog(printf("failed to import directory table"));
+            goto error;
+        }
+        result->lazyFormat = 3;
+    } else if (memcmp(bytes, COOKFS_FSINDEX_V2_HEADERSTRING,
+        COOKFS_FSINDEX_HEADERLENGTH) == 0)
+    {
+        /* scan all directories to build the table of their offsets and
+         * to calculate the block usage */
+        int lazyDirsSize = 0;
+        i = CookfsFsindexScanDirectory(result, bytes, size,
+            COOKFS_FSINDEX_HEADERLENGTH, &lazyDirsSize);
+        if (i < 0) {
+            CookfsLog(printf("failed to scan directories"));
+            goto error;
+        }
+        Cookfs_Binary2Int(bytes + COOKFS_FSINDEX_HEADERLENGTH,
+            &result->rootItem->data.dirInfo.childCount, 1);
+        result->lazyFormat = 2;
+    } else {
         CookfsLog(printf("unable to compare header 2"))
         goto error;
     }
 
-    /* import root entry; import of subdirectories happens recursively */
-    i = CookfsFsindexImportDirectory(result, result->rootItem, bytes, size, 8);
+    /* keep a copy of the directory data for materialization */
+    result->lazyData = (unsigned char *)ckalloc(i);
+    memcpy(result->lazyData, bytes, i);
 
-    CookfsLog(printf("Import directory done - %d vs %" TCL_SIZE_MODIFIER "d",
-        i, size));
+    result->rootItem->data.dirInfo.lazyIndex = 0;
+    result->rootItem->isDirty = 0;
+
+    CookfsLog(printf("Scan of %d directories done - %d vs %"
+        TCL_SIZE_MODIFIER "d", result->lazyDirsCount, i, size));
     if (i < size) {
         i = CookfsFsindexImportMetadata(result, bytes, size, i);
     }
@@ -155,283 +402,1036 @@ Cookfs_Fsindex *Cookfs_FsindexFromBytes(Tcl_Interp *interp, Cookfs_Fsindex *fsin
 
     CookfsLog(printf("END"))
 
-    goto done;
-
-error:
-    result = NULL;
-
-done:
     // Unlock the index if it was created by this function.
     if (fsindex == NULL) {
         Cookfs_FsindexUnlock(result);
     }
     /* return imported fsindex */
     return result;
+
+error:
+    // Release the index if it was created by this function.
+    if (fsindex == NULL && result != NULL) {
+        Cookfs_FsindexUnlock(result);
+        Cookfs_FsindexFini(result);
+    }
+    return NULL;
 }
 
-/* definitions of static and/or internal functions */
+/* binary data delta format:
+ *  <8:header>
+ *  <4:numDirectories>
+ *    <4:pathLength><X:path><1:null>
+ *    <4:numChildren>
+ *      <1:fileNameLength><X:fileName><1:null>
+ *      <8:fileTime>
+ *      <4:numBlocks>
+ *      file: <12*numBlocks:data>
+ *  <metadata>
+ *
+ *  path is relative to the root directory, its elements are separated
+ *  by "/"; the root directory has an empty path
+ *
+ *  each directory record contains the complete list of its children, but
+ *  subdirectories are not inlined; a changed subdirectory has its own record
+ *  that follows the record of its parent directory
+ *
+ *  metadata is stored completely in the same format as in the full export
+ */
 
 /*
  *----------------------------------------------------------------------
  *
- * CookfsFsindexExportDirectory --
+ * Cookfs_FsindexToDeltaObject --
  *
- *      Exports a single directory to byte array object at specified offset
+ *      Creates a byte array object with the directories that have been
+ *      changed since the last export or import of fsindex. The object can
+ *      be applied to the previous state of fsindex by
+ *      Cookfs_FsindexApplyDelta()
  *
  * Results:
- *      Offset pointing to end of binary data in the result object
- *      This can be used to appending subsequent entries
- *      by parent directory export
+ *      Binary data as Tcl_Obj
  *
  * Side effects:
- *      Byte array may have its size changed, therefore depending on
- *      location of bytes (such as from Tcl_GetByteArrayFromObj())
- *      is not recommended
+ *      Resets the change flags for all entries and the change counter
  *
  *----------------------------------------------------------------------
  */
 
-static int CookfsFsindexExportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, Tcl_Obj *result, int objOffset) {
-    Cookfs_FsindexEntry *itemNode;
+Tcl_Obj *Cookfs_FsindexToDeltaObject(Cookfs_Fsindex *fsindex) {
+    Tcl_Obj *result;
+    Tcl_DString path;
+    int objSize;
+    int count = 0;
 
-    unsigned char *bytes;
-    Tcl_Size objLength;
+    result = Tcl_NewByteArrayObj((unsigned char *)
+        COOKFS_FSINDEX_DELTA_HEADERSTRING, COOKFS_FSINDEX_HEADERLENGTH);
+    Tcl_SetByteArrayLength(result, COOKFS_FSINDEX_BUFFERINCREASE);
 
-    /* get pointer to bytes in memory */
-    bytes = Tcl_GetByteArrayFromObj(result, &objLength);
+    /* export changed directories starting from the root entry; the number
+     * of exported directories is stored after the header */
+    Tcl_DStringInit(&path);
+    objSize = CookfsFsindexExportDelta(fsindex->rootItem, &path, result,
+        COOKFS_FSINDEX_HEADERLENGTH + 4, &count);
+    Tcl_DStringFree(&path);
 
-    Cookfs_Int2Binary(&entry->data.dirInfo.childCount, bytes + objOffset, 1);
-    objOffset += 4;
+    Cookfs_Int2Binary(&count, Tcl_GetByteArrayFromObj(result, NULL) +
+        COOKFS_FSINDEX_HEADERLENGTH, 1);
+    Tcl_SetByteArrayLength(result, objSize);
 
-    if (entry->data.dirInfo.isHash) {
-        Tcl_HashSearch hashSearch;
-        /* iterate using hash table */
-        Tcl_HashEntry *hashEntry = Tcl_FirstHashEntry(&entry->data.dirInfo.dirData.children, &hashSearch);
-        while (hashEntry != NULL) {
-            /* get next item in hash table */
-            itemNode = (Cookfs_FsindexEntry *) Tcl_GetHashValue(hashEntry);
-            hashEntry = Tcl_NextHashEntry(&hashSearch);
-
-            /* if size of object might not be sufficient to store current page */
-            if (objLength < (objOffset + COOKFS_FSINDEX_MAXENTRYSIZE)) {
-                objLength += COOKFS_FSINDEX_BUFFERINCREASE;
-                bytes = Tcl_SetByteArrayLength(result, objLength);
-            }
+    CookfsLog(printf("exported %d directories, %d bytes", count, objSize));
 
-            /* copy filename to binary data; append \0 */
-            bytes[objOffset] = itemNode->fileNameLen;
-            objOffset++;
+    /* export metadata */
+    objSize = CookfsFsindexExportMetadata(fsindex, result, objSize);
+    Tcl_SetByteArrayLength(result, objSize);
 
-            CookfsLog(printf("Copying filename \"%s\" (%d bytes at %d)",
-                itemNode->fileName, ((int) itemNode->fileNameLen), objOffset));
+    Cookfs_FsindexResetChangeCount(fsindex);
 
-            memcpy(bytes + objOffset, itemNode->fileName, itemNode->fileNameLen);
-            objOffset += itemNode->fileNameLen;
-            bytes[objOffset] = 0;
-            objOffset ++;
+    return result;
+}
 
-            /* add file modification time and number of blocks */
-            // CookfsLog(printf("DEBUG 1 - %d", objOffset))
-            Cookfs_WideInt2Binary(&itemNode->fileTime, bytes + objOffset, 1);
-            objOffset += 8;
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexIsDelta --
+ *
+ *      Checks whether the specified binary data was created by
+ *      Cookfs_FsindexToDeltaObject()
+ *
+ * Results:
+ *      1 if the data contains fsindex delta; 0 otherwise
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
 
-            // CookfsLog(printf("DEBUG 2 - %d", objOffset))
-            Cookfs_Int2Binary(&itemNode->fileBlocks, bytes + objOffset, 1);
-            objOffset += 4;
+int Cookfs_FsindexIsDelta(unsigned char *bytes, Tcl_Size size) {
+    if (size < COOKFS_FSINDEX_HEADERLENGTH) {
+        return 0;
+    }
+    return memcmp(bytes, COOKFS_FSINDEX_DELTA_HEADERSTRING,
+        COOKFS_FSINDEX_HEADERLENGTH) == 0 ? 1 : 0;
+}
 
-            // CookfsLog(printf("DEBUG 3 - %d", objOffset))
-            if (itemNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
-                /* add child directory's structure inlined; append
-                 * rest of current directory after child's export data */
-                objOffset = CookfsFsindexExportDirectory(fsIndex, itemNode, result, objOffset);
-                bytes = Tcl_GetByteArrayFromObj(result, &objLength);
-            }  else  {
-                /* reallocate memory if will not store all block-offset-size triplets */
-                if (objLength < (objOffset + (itemNode->fileBlocks * 12))) {
-                    objLength += COOKFS_FSINDEX_BUFFERINCREASE;
-                    bytes = Tcl_SetByteArrayLength(result, objLength);
-                }
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexApplyDelta --
+ *
+ *      Updates fsindex with the directories and metadata from
+ *      the binary data created by Cookfs_FsindexToDeltaObject()
+ *
+ * Results:
+ *      1 on success; 0 if the data could not be parsed
+ *
+ * Side effects:
+ *      Entries that are not listed in the changed directories are removed
+ *      from fsindex. The change counter is reset.
+ *
+ *----------------------------------------------------------------------
+ */
 
-                /* add block-offset-size triplets and increase offset*/
-                Cookfs_Int2Binary(itemNode->data.fileInfo.fileBlockOffsetSize, bytes + objOffset, itemNode->fileBlocks * 3);
-                objOffset += itemNode->fileBlocks * 12;
-            }
-            // CookfsLog(printf("DEBUG 4 - %d", objOffset))
+int Cookfs_FsindexApplyDelta(Cookfs_Fsindex *fsindex, unsigned char *bytes,
+    Tcl_Size size)
+{
+    int count;
+    int objOffset;
+    Tcl_HashEntry *hashEntry;
+    Tcl_HashSearch hashSearch;
+
+    if (!Cookfs_FsindexIsDelta(bytes, size)
+        || size < (COOKFS_FSINDEX_HEADERLENGTH + 4))
+    {
+        CookfsLog(printf("return: ERROR (wrong header)"));
+        return 0;
+    }
+
+    Cookfs_Binary2Int(bytes + COOKFS_FSINDEX_HEADERLENGTH, &count, 1);
+    objOffset = COOKFS_FSINDEX_HEADERLENGTH + 4;
+
+    CookfsLog(printf("apply %d directories", count));
+    for (int i = 0; i < count; i++) {
+        objOffset = CookfsFsindexImportDelta(fsindex, bytes, size, objOffset);
+        if (objOffset < 0) {
+            CookfsLog(printf("return: ERROR (failed to import directory)"));
+            return 0;
         }
-    }  else  {
-        int i;
-        for (i = 0 ; i < COOKFS_FSINDEX_TABLE_MAXENTRIES; i++) {
-            itemNode = entry->data.dirInfo.dirData.childTable[i];
-            if (itemNode != NULL) {
-                /* if size of object might not be sufficient to store current page */
-                if (objLength < (objOffset + COOKFS_FSINDEX_MAXENTRYSIZE)) {
-                    objLength += COOKFS_FSINDEX_BUFFERINCREASE;
-                    bytes = Tcl_SetByteArrayLength(result, objLength);
-                }
+    }
 
-                /* copy filename to binary data; append \0 */
-                bytes[objOffset] = itemNode->fileNameLen;
-                objOffset++;
-
-                CookfsLog(printf("Copying filename \"%s\" (%d bytes at %d)",
-                    itemNode->fileName, ((int) itemNode->fileNameLen), objOffset))
-
-                memcpy(bytes + objOffset, itemNode->fileName, itemNode->fileNameLen);
-                objOffset += itemNode->fileNameLen;
-                bytes[objOffset] = 0;
-                objOffset ++;
-
-                /* add file modification time and number of blocks */
-                CookfsLog(printf("DEBUG 1 - %d", objOffset))
-                Cookfs_WideInt2Binary(&itemNode->fileTime, bytes + objOffset, 1);
-                objOffset += 8;
-
-                CookfsLog(printf("DEBUG 2 - %d", objOffset))
-                Cookfs_Int2Binary(&itemNode->fileBlocks, bytes + objOffset, 1);
-                objOffset += 4;
-
-                CookfsLog(printf("DEBUG 3 - %d", objOffset))
-                if (itemNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
-                    /* add child directory's structure inlined; append
-                     * rest of current directory after child's export data */
-                    objOffset = CookfsFsindexExportDirectory(fsIndex, itemNode, result, objOffset);
-                    bytes = Tcl_GetByteArrayFromObj(result, &objLength);
-                }  else  {
-                    /* reallocate memory if will not store all block-offset-size triplets */
-                    if (objLength < (objOffset + (itemNode->fileBlocks * 12))) {
-                        objLength += COOKFS_FSINDEX_BUFFERINCREASE;
-                        bytes = Tcl_SetByteArrayLength(result, objLength);
-                    }
+    /* metadata is stored completely, replace the existing keys */
+    for (hashEntry = Tcl_FirstHashEntry(&fsindex->metadataHash, &hashSearch);
+        hashEntry != NULL; hashEntry = Tcl_NextHashEntry(&hashSearch))
+    {
+        ckfree(Tcl_GetHashValue(hashEntry));
+        Tcl_DeleteHashEntry(hashEntry);
+    }
 
-                    /* add block-offset-size triplets and increase offset*/
-                    Cookfs_Int2Binary(itemNode->data.fileInfo.fileBlockOffsetSize, bytes + objOffset, itemNode->fileBlocks * 3);
-                    objOffset += itemNode->fileBlocks * 12;
-                }
-                CookfsLog(printf("DEBUG 4 - %d", objOffset))
-            }
+    if (objOffset < size) {
+        objOffset = CookfsFsindexImportMetadata(fsindex, bytes, size,
+            objOffset);
+        if (objOffset < 0) {
+            CookfsLog(printf("return: ERROR (failed to import metadata)"));
+            return 0;
         }
     }
 
-    return objOffset;
+    /* the current state matches the stored data, reset the change flags
+     * that were set when entries were updated */
+    CookfsFsindexResetDirty(fsindex->rootItem);
+    Cookfs_FsindexResetChangeCount(fsindex);
+
+    CookfsLog(printf("return: ok"));
+    return 1;
 }
 
+/* definitions of static and/or internal functions */
 
 /*
  *----------------------------------------------------------------------
  *
- * CookfsFsindexImportDirectory --
- *
- *      Imports a directory from specified bytes array
- *      starting at specified offset
+ * CookfsFsindexCompareEntries --
  *
- *      TODO: protect against malicious index information
+ *      Compares names of 2 fsindex entries, used to sort children
+ *      of a directory on export
  *
  * Results:
- *      Offset specifying end of imported data; can be used by parent
- *      entry import to continue processing its data
- *      -1 in case of import error
+ *      Negative, zero or positive value as for strcmp()
  *
  * Side effects:
- *      TODO
+ *      None
  *
  *----------------------------------------------------------------------
  */
 
-static int CookfsFsindexImportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, unsigned char *bytes, int objLength, int objOffset) {
-    /*  */
-    int childCount;
+static int CookfsFsindexCompareEntries(const void *a, const void *b) {
+    return strcmp((*(Cookfs_FsindexEntry * const *)a)->fileName,
+        (*(Cookfs_FsindexEntry * const *)b)->fileName);
+}
 
-    /* get number of children */
-    Cookfs_Binary2Int(bytes + objOffset, &childCount, 1);
-    objOffset += 4;
-    CookfsLog(printf("init"))
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexExportDirectory --
+ *
+ *      Exports a directory record and adds the directory to the table of
+ *      directories. Then exports child directories recursively.
+ *
+ *      If the directory has not been materialized since the import of
+ *      the index in the current format, its subtree has not been changed
+ *      and the raw data of the subtree is copied as is.
+ *
+ * Results:
+ *      Number of exported directories including the specified one
+ *
+ * Side effects:
+ *      Resets the change flags for the directory and all its children
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /* TODO: optimize to skip static array if child count is big enough */
+static int CookfsFsindexExportDirectory(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, CookfsFsindexExport *ex) {
+    Cookfs_FsindexEntry **items;
+    Cookfs_FsindexEntry *itemNode;
+    int itemCount;
+    int dirCount;
+    int tableIndex;
+    int i, j;
+
+    /* the directory is completely exported, reset its change flag */
+    entry->isDirty = 0;
+
+    // The directory can be materialized by a reader at the same time,
+    // read its lazy index only once.
+    int lazyIndex = Cookfs_AtomicLoadAcquireInt(
+        &entry->data.dirInfo.lazyIndex);
+    if (lazyIndex >= 0 && fsIndex->lazyFormat == 3) {
+        Cookfs_FsindexLazyDir *lazyDir = &fsIndex->lazyDirs[lazyIndex];
+        Cookfs_FsindexLazyDir *lastDir = lazyDir + lazyDir->dirCount - 1;
+        dirCount = lazyDir->dirCount;
+        CookfsLog(printf("copy %d unchanged directories from [%s]", dirCount,
+            entry->fileName));
+        if (ex->tableSize < (ex->tableCount + dirCount * 2)) {
+            while (ex->tableSize < (ex->tableCount + dirCount * 2)) {
+                ex->tableSize = (ex->tableSize == 0 ? 256 : ex->tableSize * 2);
+            }
+            ex->table = (Tcl_WideUInt *)ckrealloc(ex->table,
+                ex->tableSize * sizeof(Tcl_WideUInt));
+        }
+        for (i = 0; i < dirCount; i++) {
+            ex->table[ex->tableCount++] = lazyDir[i].endOffset -
+                lazyDir[i].offset;
+            ex->table[ex->tableCount++] = lazyDir[i].dirCount;
+        }
+        Tcl_DStringAppend(&ex->records, (char *)fsIndex->lazyData +
+            lazyDir->offset, lastDir->endOffset - lazyDir->offset);
+        return dirCount;
+    }
 
-    /* import all children in current directory */
-    CookfsLog(printf("IMPORT BEGIN (%d childCount)", childCount))
-    for (int fileId = 0; fileId < childCount; fileId++) {
-        char *fileName;
-        int fileNameLength;
-        int fileBlocks;
-        Tcl_WideInt fileTime;
-        Cookfs_FsindexEntry *itemNode;
+    /* this materializes directories imported from the previous format */
+    items = Cookfs_FsindexListEntry(entry, &itemCount);
 
-        CookfsLog(printf("IMPORT ITER %d/%d", fileId, childCount))
-        /* get file name from binary data */
-        fileNameLength = bytes[objOffset];
-        objOffset++;
-        fileName = (char *) (bytes + objOffset);
-        objOffset += fileNameLength + 1;
+    /* sort children to share more name prefixes. Children in the static
+     * array are kept in their order, as the order of filesets in the root
+     * directory depends on it. */
+    if (entry->data.dirInfo.isHash) {
+        qsort(items, itemCount, sizeof(Cookfs_FsindexEntry *),
+            CookfsFsindexCompareEntries);
+    }
 
-        /* get file modification time and number of blocks */
-        Cookfs_Binary2WideInt(bytes + objOffset, &fileTime, 1);
-        objOffset += 8;
-        Cookfs_Binary2Int(bytes + objOffset, &fileBlocks, 1);
-        objOffset += 4;
-        CookfsLog(printf("importing %s (%d blocks)", fileName, fileBlocks))
+    /* reserve space in the table for the directory */
+    if (ex->tableSize < (ex->tableCount + 2)) {
+        ex->tableSize = (ex->tableSize == 0 ? 256 : ex->tableSize * 2);
+        ex->table = (Tcl_WideUInt *)ckrealloc(ex->table,
+            ex->tableSize * sizeof(Tcl_WideUInt));
+    }
+    tableIndex = ex->tableCount;
+    ex->tableCount += 2;
+
+    int recordOffset = Tcl_DStringLength(&ex->records);
+    const char *prevName = "";
+    int prevNameLen = 0;
+    Tcl_WideInt prevTime = 0;
+    Tcl_WideInt prevBlock = 0;
+
+    CookfsFsindexPutVarint(&ex->records, itemCount);
+
+    for (i = 0; i < itemCount; i++) {
+        itemNode = items[i];
+
+        /* store the name as a prefix shared with the previous name
+         * and the rest of the name */
+        int prefixLen = 0;
+        while (prefixLen < prevNameLen && prefixLen < itemNode->fileNameLen
+            && prevName[prefixLen] == itemNode->fileName[prefixLen])
+        {
+            prefixLen++;
+        }
+        CookfsFsindexPutVarint(&ex->records, prefixLen);
+        CookfsFsindexPutVarint(&ex->records, itemNode->fileNameLen -
+            prefixLen);
+        Tcl_DStringAppend(&ex->records, itemNode->fileName + prefixLen,
+            itemNode->fileNameLen - prefixLen);
+        prevName = itemNode->fileName;
+        prevNameLen = itemNode->fileNameLen;
+
+        CookfsFsindexPutZigzag(&ex->records, (Tcl_WideInt)(
+            (Tcl_WideUInt)itemNode->fileTime - (Tcl_WideUInt)prevTime));
+        prevTime = itemNode->fileTime;
+
+        if (itemNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            CookfsFsindexPutVarint(&ex->records, 0);
+            continue;
+        }
 
-        /* create fsindex entry and set its modification time */
-        itemNode = Cookfs_FsindexSetInDirectory(entry, fileName, fileNameLength, fileBlocks);
-        itemNode->fileTime = fileTime;
+        itemNode->isDirty = 0;
+        CookfsFsindexPutVarint(&ex->records, itemNode->fileBlocks + 1);
+        int *blockOffsetSize = itemNode->data.fileInfo.fileBlockOffsetSize;
+        for (j = 0; j < itemNode->fileBlocks; j++, blockOffsetSize += 3) {
+            CookfsFsindexPutZigzag(&ex->records, blockOffsetSize[0] -
+                prevBlock);
+            prevBlock = blockOffsetSize[0];
+            CookfsFsindexPutVarint(&ex->records,
+                (unsigned int)blockOffsetSize[1]);
+            CookfsFsindexPutVarint(&ex->records,
+                (unsigned int)blockOffsetSize[2]);
+        }
+    }
 
-        if (fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
-            /* for directory, import child recursively and get offset to continue import from */
-            objOffset = CookfsFsindexImportDirectory(fsIndex, itemNode, bytes, objLength, objOffset);
+    ex->table[tableIndex] = Tcl_DStringLength(&ex->records) - recordOffset;
 
-            /* if child import failed, pass the error to caller */
-            if (objOffset < 0) {
-                CookfsLog(printf("failure - rolling back"))
-                return objOffset;
-            }
-        }  else  {
-            /* copy all block-offset-size triplets from binary data to newly created entry */
-            Tcl_WideInt fileSize = 0;
-            Cookfs_Binary2Int(bytes + objOffset, itemNode->data.fileInfo.fileBlockOffsetSize, fileBlocks * 3);
-            objOffset += fileBlocks * 12;
-            for (int i = 0; i < fileBlocks; i++) {
-                fileSize += itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 2];
-                Cookfs_FsindexModifyBlockUsage(fsIndex, itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 0], 1);
-                CookfsLog(printf("%d/%d/%d",
-                    itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 0],
-                    itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 1],
-                    itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 2]))
-            }
-            /* calculate and store file size */
-            itemNode->data.fileInfo.fileSize = fileSize;
-            itemNode->isFileBlocksInitialized = fsIndex;
+    /* child directories follow the current one */
+    dirCount = 1;
+    for (i = 0; i < itemCount; i++) {
+        if (items[i]->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            dirCount += CookfsFsindexExportDirectory(fsIndex, items[i], ex);
         }
     }
 
-    /* return current offset to caller */
-    CookfsLog(printf("IMPORT END"))
-    return objOffset;
-}
+    ex->table[tableIndex + 1] = dirCount;
+
+    Cookfs_FsindexListFree(items);
 
+    return dirCount;
+}
 
 /*
  *----------------------------------------------------------------------
  *
- * CookfsFsindexExportMetadata --
+ * CookfsFsindexExportDirectoryV2 --
  *
- *      Exports metadata from fsindex into a binary object
- *      starting at specified offset
+ *      Exports a directory in the previous format (CFS2.200) to byte array
+ *      object at specified offset. Child directories are inlined
+ *      recursively.
  *
- *      TODO: protect against malicious index information
+ *      If the directory has not been materialized since the import of
+ *      the index in the previous format, its raw data is copied as is.
  *
  * Results:
- *      Offset specifying end of imported data; can be used by
- *      export to continue processing its data
- *      -1 in case of import error
+ *      Offset pointing to end of binary data in the result object
  *
  * Side effects:
- *      TODO
+ *      Resets the change flags for the directory and all its children.
+ *      Byte array may have its size changed.
  *
  *----------------------------------------------------------------------
  */
 
-static int CookfsFsindexExportMetadata(Cookfs_Fsindex *fsIndex, Tcl_Obj *result, int objOffset) {
-    Tcl_HashEntry *hashEntry;
+static int CookfsFsindexExportDirectoryV2(Cookfs_Fsindex *fsIndex, Cookfs_FsindexEntry *entry, Tcl_Obj *result, int objOffset) {
+    Cookfs_FsindexEntry **items;
+    Cookfs_FsindexEntry *itemNode;
+    unsigned char *bytes;
+    Tcl_Size objLength;
+    int itemCount;
+    int requiredSize;
+    int i;
+
+    bytes = Tcl_GetByteArrayFromObj(result, &objLength);
+
+    /* the directory is completely exported, reset its change flag */
+    entry->isDirty = 0;
+
+    // The directory can be materialized by a reader at the same time,
+    // read its lazy index only once.
+    int lazyIndex = Cookfs_AtomicLoadAcquireInt(
+        &entry->data.dirInfo.lazyIndex);
+    if (lazyIndex >= 0 && fsIndex->lazyFormat == 2) {
+        Cookfs_FsindexLazyDir *lazyDir = &fsIndex->lazyDirs[lazyIndex];
+        int size = lazyDir->endOffset - lazyDir->offset;
+        CookfsLog(printf("copy %d bytes of unchanged directory [%s]", size,
+            entry->fileName));
+        if (objLength < (objOffset + size)) {
+            while (objLength < (objOffset + size)) {
+                objLength += COOKFS_FSINDEX_BUFFERINCREASE;
+            }
+            bytes = Tcl_SetByteArrayLength(result, objLength);
+        }
+        memcpy(bytes + objOffset, fsIndex->lazyData + lazyDir->offset, size);
+        return objOffset + size;
+    }
+
+    /* this materializes directories imported from the compact format */
+    items = Cookfs_FsindexListEntry(entry, &itemCount);
+
+    if (objLength < (objOffset + 4)) {
+        objLength += COOKFS_FSINDEX_BUFFERINCREASE;
+        bytes = Tcl_SetByteArrayLength(result, objLength);
+    }
+    Cookfs_Int2Binary(&itemCount, bytes + objOffset, 1);
+    objOffset += 4;
+
+    for (i = 0; i < itemCount; i++) {
+        itemNode = items[i];
+
+        requiredSize = objOffset + 1 + itemNode->fileNameLen + 1 + 8 + 4;
+        if (itemNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+            requiredSize += itemNode->fileBlocks * 12;
+        }
+        if (objLength < requiredSize) {
+            while (objLength < requiredSize) {
+                objLength += COOKFS_FSINDEX_BUFFERINCREASE;
+            }
+            bytes = Tcl_SetByteArrayLength(result, objLength);
+        }
+
+        /* copy filename to binary data; append \0 */
+        bytes[objOffset] = itemNode->fileNameLen;
+        objOffset++;
+        memcpy(bytes + objOffset, itemNode->fileName, itemNode->fileNameLen);
+        objOffset += itemNode->fileNameLen;
+        bytes[objOffset] = 0;
+        objOffset++;
+
+        /* add file modification time and number of blocks */
+        Cookfs_WideInt2Binary(&itemNode->fileTime, bytes + objOffset, 1);
+        objOffset += 8;
+        Cookfs_Int2Binary(&itemNode->fileBlocks, bytes + objOffset, 1);
+        objOffset += 4;
+
+        if (itemNode->fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            /* add child directory's structure inlined; append
+             * rest of current directory after child's export data */
+            objOffset = CookfsFsindexExportDirectoryV2(fsIndex, itemNode,
+                result, objOffset);
+            bytes = Tcl_GetByteArrayFromObj(result, &objLength);
+        } else {
+            itemNode->isDirty = 0;
+            /* add block-offset-size triplets */
+            Cookfs_Int2Binary(itemNode->data.fileInfo.fileBlockOffsetSize,
+                bytes + objOffset, itemNode->fileBlocks * 3);
+            objOffset += itemNode->fileBlocks * 12;
+        }
+    }
+
+    Cookfs_FsindexListFree(items);
+
+    return objOffset;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexImportTables --
+ *
+ *      Imports the block usage and the table of directories from specified
+ *      bytes array starting at specified offset. The directory records are
+ *      validated, but entries are not created for them.
+ *
+ *      The directory table is converted to the lazyDirs table of
+ *      the fsindex. It is used by Cookfs_FsindexEntryMaterialize() to create
+ *      children of a directory.
+ *
+ * Results:
+ *      Offset specifying end of directory records; -1 in case of
+ *      malformed data
+ *
+ * Side effects:
+ *      Sets the block usage of the fsindex
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexImportTables(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset) {
+    unsigned char *p = bytes + objOffset;
+    unsigned char *end = bytes + objLength;
+    int blockIndexSize;
+    int dirCount;
+    int i;
+
+    /* each value takes at least 1 byte, so the number of values
+     * cannot exceed the size of the data */
+    if (!CookfsFsindexGetVarintInt(&p, end, end - p, &blockIndexSize)) {
+        return -1;
+    }
+    if (blockIndexSize > 0) {
+        fsIndex->blockIndex = (int *)ckalloc(blockIndexSize * sizeof(int));
+        fsIndex->blockIndexSize = blockIndexSize;
+        for (i = 0; i < blockIndexSize; i++) {
+            if (!CookfsFsindexGetVarintInt(&p, end, INT_MAX,
+                &fsIndex->blockIndex[i]))
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (!CookfsFsindexGetVarintInt(&p, end, (end - p) / 2, &dirCount)
+        || dirCount < 1)
+    {
+        return -1;
+    }
+
+    CookfsLog(printf("block usage table: %d, directories: %d",
+        blockIndexSize, dirCount));
+
+    fsIndex->lazyDirs = (Cookfs_FsindexLazyDir *)ckalloc(
+        sizeof(Cookfs_FsindexLazyDir) * dirCount);
+    fsIndex->lazyDirsCount = dirCount;
+
+    /* records are located after the table, calculate their offsets */
+    for (i = 0; i < dirCount; i++) {
+        int recordSize;
+        if (!CookfsFsindexGetVarintInt(&p, end, INT_MAX, &recordSize)
+            || !CookfsFsindexGetVarintInt(&p, end, dirCount - i,
+            &fsIndex->lazyDirs[i].dirCount)
+            || fsIndex->lazyDirs[i].dirCount < 1)
+        {
+            return -1;
+        }
+        /* use the endOffset field to store the size temporary */
+        fsIndex->lazyDirs[i].endOffset = recordSize;
+    }
+
+    objOffset = p - bytes;
+    for (i = 0; i < dirCount; i++) {
+        int recordSize = fsIndex->lazyDirs[i].endOffset;
+        if (recordSize > (objLength - objOffset)) {
+            return -1;
+        }
+        fsIndex->lazyDirs[i].offset = objOffset;
+        objOffset += recordSize;
+        fsIndex->lazyDirs[i].endOffset = objOffset;
+    }
+
+    /* validate all directory records, so that a malformed index is
+     * rejected on import instead of losing entries on materialization */
+    for (i = 0; i < dirCount; i++) {
+        if (!CookfsFsindexReadRecordV3(fsIndex, bytes, i, NULL)) {
+            CookfsLog(printf("malformed record of directory #%d", i));
+            return -1;
+        }
+    }
+
+    /* get the number of children in the root directory */
+    p = bytes + fsIndex->lazyDirs[0].offset;
+    if (!CookfsFsindexGetVarintInt(&p, bytes + fsIndex->lazyDirs[0].endOffset,
+        INT_MAX, &fsIndex->rootItem->data.dirInfo.childCount))
+    {
+        return -1;
+    }
+
+    return objOffset;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexScanDirectory --
+ *
+ *      Scans a directory from specified bytes array starting at specified
+ *      offset without creating fsindex entries. Subdirectories are scanned
+ *      recursively.
+ *
+ *      Each scanned directory is added to the lazyDirs table of the fsindex
+ *      in pre-order. The table is used by Cookfs_FsindexEntryMaterialize()
+ *      to create children of a directory without parsing its subdirectories.
+ *
+ *      The size of lazyDirs table is tracked in lazyDirsSizePtr.
+ *
+ * Results:
+ *      Offset specifying end of scanned data; can be used by parent
+ *      entry scan to continue processing its data
+ *      -1 in case of malformed data
+ *
+ * Side effects:
+ *      Updates the block usage for all files in the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexScanDirectory(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset, int *lazyDirsSizePtr) {
+    int childCount;
+
+    if ((objOffset + 4) > objLength) {
+        return -1;
+    }
+
+    /* add the directory to the table */
+    if (fsIndex->lazyDirsCount == *lazyDirsSizePtr) {
+        *lazyDirsSizePtr = (*lazyDirsSizePtr == 0 ? 64 : *lazyDirsSizePtr * 2);
+        fsIndex->lazyDirs = (Cookfs_FsindexLazyDir *)ckrealloc(
+            fsIndex->lazyDirs, sizeof(Cookfs_FsindexLazyDir) *
+            *lazyDirsSizePtr);
+    }
+    int dirIndex = fsIndex->lazyDirsCount++;
+    fsIndex->lazyDirs[dirIndex].offset = objOffset;
+
+    /* get number of children */
+    Cookfs_Binary2Int(bytes + objOffset, &childCount, 1);
+    objOffset += 4;
+    if (childCount < 0) {
+        return -1;
+    }
+
+    for (int fileId = 0; fileId < childCount; fileId++) {
+        int fileNameLength;
+        int fileBlocks;
+
+        /* skip file name and modification time, get number of blocks */
+        if ((objOffset + 1) > objLength) {
+            return -1;
+        }
+        fileNameLength = bytes[objOffset];
+        objOffset += 1 + fileNameLength + 1 + 8;
+        if ((objOffset + 4) > objLength) {
+            return -1;
+        }
+        Cookfs_Binary2Int(bytes + objOffset, &fileBlocks, 1);
+        objOffset += 4;
+
+        if (fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            objOffset = CookfsFsindexScanDirectory(fsIndex, bytes, objLength,
+                objOffset, lazyDirsSizePtr);
+            if (objOffset < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (fileBlocks < 0 || (objOffset + fileBlocks * 12) > objLength) {
+            return -1;
+        }
+        for (int i = 0; i < fileBlocks; i++) {
+            int blockIndex;
+            Cookfs_Binary2Int(bytes + objOffset, &blockIndex, 1);
+            Cookfs_FsindexModifyBlockUsage(fsIndex, blockIndex, 1);
+            objOffset += 12;
+        }
+    }
+
+    fsIndex->lazyDirs[dirIndex].endOffset = objOffset;
+    fsIndex->lazyDirs[dirIndex].dirCount = fsIndex->lazyDirsCount - dirIndex;
+
+    return objOffset;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_FsindexEntryMaterialize --
+ *
+ *      Creates children of a directory entry from the raw index data
+ *      saved by Cookfs_FsindexFromBytes(). Child directories are created
+ *      without their children, which are loaded on first access to them.
+ *
+ *      This function can be called when only read lock is acquired for
+ *      the fsindex. The fsindex mutex ensures that the directory is
+ *      materialized only once. The lazyIndex of the entry is reset with
+ *      release semantics after the children are created, so readers that
+ *      see it reset also see the children.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Creates child entries in the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_FsindexEntryMaterialize(Cookfs_FsindexEntry *e) {
+    Cookfs_Fsindex *fsIndex = e->fsindex;
+
+#ifdef TCL_THREADS
+    Tcl_MutexLock(&fsIndex->mxLazy);
+#endif /* TCL_THREADS */
+
+    // Check the state again, the directory could be materialized by another
+    // thread while we were waiting for the mutex.
+    if (e->data.dirInfo.lazyIndex >= 0) {
+        if (fsIndex->lazyFormat == 3) {
+            CookfsFsindexMaterializeV3(e);
+        } else {
+            CookfsFsindexMaterializeV2(e);
+        }
+        // Readers check lazyIndex without the mutex. Publish it only after
+        // all children are created.
+        Cookfs_AtomicStoreReleaseInt(&e->data.dirInfo.lazyIndex, -1);
+    }
+
+#ifdef TCL_THREADS
+    Tcl_MutexUnlock(&fsIndex->mxLazy);
+#endif /* TCL_THREADS */
+
+    return;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexMaterializeV2 --
+ *
+ *      Creates children of a directory entry from the raw index data
+ *      in the previous format. The data has been validated by
+ *      CookfsFsindexScanDirectory().
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Creates child entries in the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexMaterializeV2(Cookfs_FsindexEntry *e) {
+    Cookfs_Fsindex *fsIndex = e->fsindex;
+    int dirIndex = e->data.dirInfo.lazyIndex;
+    int objOffset = fsIndex->lazyDirs[dirIndex].offset;
+    unsigned char *bytes = fsIndex->lazyData;
+    int childCount;
+
+    Cookfs_Binary2Int(bytes + objOffset, &childCount, 1);
+    objOffset += 4;
+
+    CookfsLog(printf("materialize directory [%s] with %d children",
+        e->fileName, childCount));
+
+    /* use map for directories that do not fit in static array */
+    if (childCount > (COOKFS_FSINDEX_TABLE_MAXENTRIES - 1)) {
+        Cookfs_FsindexEntryInitChildMap(e, childCount);
+    }
+    e->data.dirInfo.childCount = 0;
+
+    /* child directories follow the current one in the table */
+    int childDirIndex = dirIndex + 1;
+
+    for (int fileId = 0; fileId < childCount; fileId++) {
+        char *fileName;
+        int fileNameLength;
+        int fileBlocks;
+        Cookfs_FsindexEntry *itemNode;
+
+        /* get file name from binary data */
+        fileNameLength = bytes[objOffset];
+        objOffset++;
+        fileName = (char *) (bytes + objOffset);
+        objOffset += fileNameLength + 1;
+
+        /* create fsindex entry and set its modification time */
+        Cookfs_Binary2Int(bytes + objOffset + 8, &fileBlocks, 1);
+        itemNode = Cookfs_FsindexEntryAlloc(fsIndex, fileNameLength,
+            fileBlocks, COOKFS_USEHASH_DEFAULT);
+        memcpy(itemNode->fileName, fileName, fileNameLength);
+        itemNode->fileName[fileNameLength] = '\0';
+        Cookfs_Binary2WideInt(bytes + objOffset, &itemNode->fileTime, 1);
+        objOffset += 12;
+        itemNode->isDirty = 0;
+
+        if (fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            /* child directory will be materialized on first access */
+            Cookfs_FsindexLazyDir *lazyDir = &fsIndex->lazyDirs[childDirIndex];
+            Cookfs_Binary2Int(bytes + objOffset,
+                &itemNode->data.dirInfo.childCount, 1);
+            itemNode->data.dirInfo.lazyIndex = childDirIndex;
+            objOffset = lazyDir->endOffset;
+            childDirIndex += lazyDir->dirCount;
+        }  else  {
+            /* copy all block-offset-size triplets from binary data; block
+             * usage has already been counted by CookfsFsindexScanDirectory() */
+            Tcl_WideInt fileSize = 0;
+            Cookfs_Binary2Int(bytes + objOffset,
+                itemNode->data.fileInfo.fileBlockOffsetSize, fileBlocks * 3);
+            objOffset += fileBlocks * 12;
+            for (int i = 0; i < fileBlocks; i++) {
+                fileSize += itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 2];
+            }
+            itemNode->data.fileInfo.fileSize = fileSize;
+            itemNode->isFileBlocksInitialized = fsIndex;
+        }
+
+        if (!Cookfs_FsindexEntryAddChild(e, itemNode)) {
+            CookfsLog(printf("duplicate entry [%s], ignore it",
+                itemNode->fileName));
+            Cookfs_FsindexEntryDealloc(itemNode);
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexReadRecordV3 --
+ *
+ *      Reads the record of the specified directory from the raw index data
+ *      in the compact format. All values are checked against the bounds of
+ *      the record and the subtree of the directory in the directory table.
+ *
+ *      If e is NULL, the record is only validated. Otherwise, children
+ *      of the directory entry are created.
+ *
+ * Results:
+ *      1 on success; 0 if the record is malformed
+ *
+ * Side effects:
+ *      Creates child entries in the directory if e is not NULL
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexReadRecordV3(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int dirIndex, Cookfs_FsindexEntry *e) {
+    Cookfs_FsindexLazyDir *lazyDir = &fsIndex->lazyDirs[dirIndex];
+    unsigned char *p = bytes + lazyDir->offset;
+    unsigned char *end = bytes + lazyDir->endOffset;
+    char fileName[256];
+    int fileNameLength = 0;
+    Tcl_WideInt fileTime = 0;
+    Tcl_WideInt blockNumber = 0;
+    int blockOffsetSizeTmp[3];
+    int childCount;
+
+    /* each child takes at least 4 bytes */
+    if (!CookfsFsindexGetVarintInt(&p, end, (end - p) / 4, &childCount)) {
+        return 0;
+    }
+
+    if (e != NULL) {
+        CookfsLog(printf("materialize directory [%s] with %d children",
+            e->fileName, childCount));
+        e->data.dirInfo.childCount = 0;
+        /* use map for directories that do not fit in static array */
+        if (childCount > (COOKFS_FSINDEX_TABLE_MAXENTRIES - 1)) {
+            Cookfs_FsindexEntryInitChildMap(e, childCount);
+        }
+    }
+
+    /* child directories follow the current one in the table */
+    int childDirIndex = dirIndex + 1;
+    int subtreeEnd = dirIndex + lazyDir->dirCount;
+
+    for (int fileId = 0; fileId < childCount; fileId++) {
+        Cookfs_FsindexEntry *itemNode = NULL;
+        Tcl_WideInt timeDelta;
+        int prefixLength;
+        int suffixLength;
+        int fileBlocks;
+
+        /* get file name */
+        if (!CookfsFsindexGetVarintInt(&p, end, fileNameLength, &prefixLength)
+            || !CookfsFsindexGetVarintInt(&p, end, 255 - prefixLength,
+            &suffixLength) || suffixLength > (end - p))
+        {
+            return 0;
+        }
+        memcpy(fileName + prefixLength, p, suffixLength);
+        p += suffixLength;
+        fileNameLength = prefixLength + suffixLength;
+
+        /* get modification time and number of blocks; each block takes
+         * at least 3 bytes */
+        if (!CookfsFsindexGetZigzag(&p, end, &timeDelta)
+            || !CookfsFsindexGetVarintInt(&p, end, (end - p) / 3 + 1,
+            &fileBlocks))
+        {
+            return 0;
+        }
+        fileTime = (Tcl_WideInt)((Tcl_WideUInt)fileTime +
+            (Tcl_WideUInt)timeDelta);
+        fileBlocks--;
+
+        if (fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            /* the child directory and its subtree must be inside
+             * the subtree of the current directory */
+            if (childDirIndex >= subtreeEnd || (childDirIndex +
+                fsIndex->lazyDirs[childDirIndex].dirCount) > subtreeEnd)
+            {
+                return 0;
+            }
+            Cookfs_FsindexLazyDir *childDir = &fsIndex->lazyDirs[childDirIndex];
+            unsigned char *childP = bytes + childDir->offset;
+            int childChildCount;
+            if (!CookfsFsindexGetVarintInt(&childP, bytes +
+                childDir->endOffset, INT_MAX, &childChildCount))
+            {
+                return 0;
+            }
+            if (e != NULL) {
+                itemNode = Cookfs_FsindexEntryAlloc(fsIndex, fileNameLength,
+                    fileBlocks, COOKFS_USEHASH_DEFAULT);
+                /* child directory will be materialized on first access */
+                itemNode->data.dirInfo.childCount = childChildCount;
+                itemNode->data.dirInfo.lazyIndex = childDirIndex;
+            }
+            childDirIndex += childDir->dirCount;
+        } else {
+            /* block usage has already been imported from the block
+             * usage table */
+            int *blockOffsetSize = blockOffsetSizeTmp;
+            Tcl_WideInt fileSize = 0;
+            if (e != NULL) {
+                itemNode = Cookfs_FsindexEntryAlloc(fsIndex, fileNameLength,
+                    fileBlocks, COOKFS_USEHASH_DEFAULT);
+                blockOffsetSize = itemNode->data.fileInfo.fileBlockOffsetSize;
+            }
+            for (int i = 0; i < fileBlocks; i++) {
+                Tcl_WideInt blockDelta;
+                if (!CookfsFsindexGetZigzag(&p, end, &blockDelta)
+                    || !CookfsFsindexGetVarintInt(&p, end, UINT_MAX,
+                    &blockOffsetSize[1])
+                    || !CookfsFsindexGetVarintInt(&p, end, UINT_MAX,
+                    &blockOffsetSize[2]))
+                {
+                    if (itemNode != NULL) {
+                        Cookfs_FsindexEntryDealloc(itemNode);
+                    }
+                    return 0;
+                }
+                blockNumber += blockDelta;
+                blockOffsetSize[0] = (int)blockNumber;
+                fileSize += blockOffsetSize[2];
+                if (itemNode != NULL) {
+                    blockOffsetSize += 3;
+                }
+            }
+            if (itemNode != NULL) {
+                itemNode->data.fileInfo.fileSize = fileSize;
+                itemNode->isFileBlocksInitialized = fsIndex;
+            }
+        }
+
+        if (itemNode == NULL) {
+            continue;
+        }
+
+        memcpy(itemNode->fileName, fileName, fileNameLength);
+        itemNode->fileName[fileNameLength] = '\0';
+        itemNode->fileTime = fileTime;
+        itemNode->isDirty = 0;
+
+        if (!Cookfs_FsindexEntryAddChild(e, itemNode)) {
+            CookfsLog(printf("duplicate entry [%s], ignore it",
+                itemNode->fileName));
+            Cookfs_FsindexEntryDealloc(itemNode);
+        }
+    }
+
+    /* the record must be read completely, and the children must cover
+     * the whole subtree of the directory */
+    if (p != end || childDirIndex != subtreeEnd) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexMaterializeV3 --
+ *
+ *      Creates children of a directory entry from its record in the raw
+ *      index data in the compact format. All records have been validated
+ *      by CookfsFsindexImportTables().
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Creates child entries in the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexMaterializeV3(Cookfs_FsindexEntry *e) {
+    Cookfs_Fsindex *fsIndex = e->fsindex;
+    if (!CookfsFsindexReadRecordV3(fsIndex, fsIndex->lazyData,
+        e->data.dirInfo.lazyIndex, e))
+    {
+        // This should not happen, as all records are validated on import
+        CookfsLog(printf("ERROR: malformed directory [%s]", e->fileName));
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexExportMetadata --
+ *
+ *      Exports metadata from fsindex into a binary object
+ *      starting at specified offset
+ *
+ *      TODO: protect against malicious index information
+ *
+ * Results:
+ *      Offset specifying end of imported data; can be used by
+ *      export to continue processing its data
+ *      -1 in case of import error
+ *
+ * Side effects:
+ *      TODO
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexExportMetadata(Cookfs_Fsindex *fsIndex, Tcl_Obj *result, int objOffset) {
+    Tcl_HashEntry *hashEntry;
     Tcl_HashSearch hashSearch;
     Tcl_Size objSize;
     int objInitialOffset = objOffset;
@@ -555,3 +1555,366 @@ static int CookfsFsindexImportMetadata(Cookfs_Fsindex *fsIndex, unsigned char *b
     return objOffset;
 }
 
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexExportDelta --
+ *
+ *      Exports the specified directory to byte array object at specified
+ *      offset if the directory or any of its children has been changed.
+ *      Then processes child directories recursively.
+ *
+ *      The path argument contains the path of the specified directory and
+ *      is used as a buffer to build paths for child directories.
+ *
+ * Results:
+ *      Offset pointing to end of binary data in the result object
+ *
+ * Side effects:
+ *      Resets the change flags for the directory and all its children.
+ *      Increases the counter in countPtr for each exported directory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexExportDelta(Cookfs_FsindexEntry *entry, Tcl_DString *path, Tcl_Obj *result, int objOffset, int *countPtr) {
+    Cookfs_FsindexEntry **items;
+    Cookfs_FsindexEntry *itemNode;
+    unsigned char *bytes;
+    Tcl_Size objLength;
+    int itemCount;
+    int isChanged;
+    int i;
+
+    /* a directory that has not been materialized has not been changed */
+    if (Cookfs_AtomicLoadAcquireInt(&entry->data.dirInfo.lazyIndex) >= 0) {
+        entry->isDirty = 0;
+        return objOffset;
+    }
+
+    items = Cookfs_FsindexListEntry(entry, &itemCount);
+
+    isChanged = entry->isDirty;
+    for (i = 0; !isChanged && i < itemCount; i++) {
+        isChanged = items[i]->isDirty;
+    }
+
+    if (isChanged) {
+
+        int pathLength = Tcl_DStringLength(path);
+        int requiredSize = objOffset + 4 + pathLength + 1 + 4;
+
+        CookfsLog(printf("export directory [%s] with %d children",
+            Tcl_DStringValue(path), itemCount));
+
+        bytes = Tcl_GetByteArrayFromObj(result, &objLength);
+        if (objLength < requiredSize) {
+            while (objLength < requiredSize) {
+                objLength += COOKFS_FSINDEX_BUFFERINCREASE;
+            }
+            bytes = Tcl_SetByteArrayLength(result, objLength);
+        }
+
+        Cookfs_Int2Binary(&pathLength, bytes + objOffset, 1);
+        objOffset += 4;
+        memcpy(bytes + objOffset, Tcl_DStringValue(path), pathLength);
+        objOffset += pathLength;
+        bytes[objOffset] = 0;
+        objOffset++;
+
+        Cookfs_Int2Binary(&itemCount, bytes + objOffset, 1);
+        objOffset += 4;
+
+        for (i = 0; i < itemCount; i++) {
+            itemNode = items[i];
+
+            requiredSize = objOffset + 1 + itemNode->fileNameLen + 1 + 8 + 4;
+            if (itemNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+                requiredSize += itemNode->fileBlocks * 12;
+            }
+            if (objLength < requiredSize) {
+                while (objLength < requiredSize) {
+                    objLength += COOKFS_FSINDEX_BUFFERINCREASE;
+                }
+                bytes = Tcl_SetByteArrayLength(result, objLength);
+            }
+
+            /* copy filename to binary data; append \0 */
+            bytes[objOffset] = itemNode->fileNameLen;
+            objOffset++;
+            memcpy(bytes + objOffset, itemNode->fileName,
+                itemNode->fileNameLen);
+            objOffset += itemNode->fileNameLen;
+            bytes[objOffset] = 0;
+            objOffset++;
+
+            /* add file modification time and number of blocks */
+            Cookfs_WideInt2Binary(&itemNode->fileTime, bytes + objOffset, 1);
+            objOffset += 8;
+            Cookfs_Int2Binary(&itemNode->fileBlocks, bytes + objOffset, 1);
+            objOffset += 4;
+
+            /* add block-offset-size triplets for files */
+            if (itemNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+                Cookfs_Int2Binary(itemNode->data.fileInfo.fileBlockOffsetSize,
+                    bytes + objOffset, itemNode->fileBlocks * 3);
+                objOffset += itemNode->fileBlocks * 12;
+            }
+        }
+
+        (*countPtr)++;
+
+    }
+
+    entry->isDirty = 0;
+
+    /* process child directories; reset the change flag for files */
+    for (i = 0; i < itemCount; i++) {
+        itemNode = items[i];
+        if (itemNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+            itemNode->isDirty = 0;
+            continue;
+        }
+        int pathLength = Tcl_DStringLength(path);
+        if (pathLength) {
+            Tcl_DStringAppend(path, "/", 1);
+        }
+        Tcl_DStringAppend(path, itemNode->fileName, itemNode->fileNameLen);
+        objOffset = CookfsFsindexExportDelta(itemNode, path, result,
+            objOffset, countPtr);
+        Tcl_DStringSetLength(path, pathLength);
+    }
+
+    Cookfs_FsindexListFree(items);
+
+    return objOffset;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexImportDelta --
+ *
+ *      Imports a single directory record created by
+ *      CookfsFsindexExportDelta() starting at specified offset. Children
+ *      that are not present in the record are removed from the directory.
+ *      Existing child directories are kept along with their contents.
+ *
+ * Results:
+ *      Offset specifying end of imported data; -1 in case of import error
+ *
+ * Side effects:
+ *      Creates, replaces or removes entries in the directory
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsFsindexImportDelta(Cookfs_Fsindex *fsIndex, unsigned char *bytes, int objLength, int objOffset) {
+    Cookfs_FsindexEntry **items;
+    Cookfs_FsindexEntry *dirNode;
+    Cookfs_FsindexEntry *itemNode;
+    Cookfs_PathObj *pathObj;
+    Tcl_HashTable existingItems;
+    Tcl_HashEntry *hashEntry;
+    Tcl_HashSearch hashSearch;
+    Tcl_DString childPath;
+    const char *pathStr;
+    int pathLength;
+    int childCount;
+    int isNew;
+    int i;
+
+    if ((objOffset + 4) > objLength) {
+        return -1;
+    }
+    Cookfs_Binary2Int(bytes + objOffset, &pathLength, 1);
+    objOffset += 4;
+    if (pathLength < 0 || (objOffset + pathLength + 1 + 4) > objLength
+        || bytes[objOffset + pathLength] != 0)
+    {
+        return -1;
+    }
+    pathStr = (const char *)bytes + objOffset;
+    objOffset += pathLength + 1;
+    Cookfs_Binary2Int(bytes + objOffset, &childCount, 1);
+    objOffset += 4;
+
+    CookfsLog(printf("import directory [%s] with %d children", pathStr,
+        childCount));
+
+    pathObj = Cookfs_PathObjNewFromStr(pathStr, pathLength);
+    Cookfs_PathObjIncrRefCount(pathObj);
+
+    dirNode = CookfsFsindexFindElement(fsIndex, pathObj, pathObj->elementCount);
+    if (dirNode == NULL || dirNode->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY) {
+        CookfsLog(printf("directory is not found"));
+        Cookfs_PathObjDecrRefCount(pathObj);
+        return -1;
+    }
+
+    /* remember existing children to detect removed entries */
+    Tcl_InitHashTable(&existingItems, TCL_STRING_KEYS);
+    items = Cookfs_FsindexListEntry(dirNode, NULL);
+    for (i = 0; items[i] != NULL; i++) {
+        hashEntry = Tcl_CreateHashEntry(&existingItems, items[i]->fileName,
+            &isNew);
+        Tcl_SetHashValue(hashEntry, items[i]);
+    }
+    Cookfs_FsindexListFree(items);
+
+    Tcl_DStringInit(&childPath);
+    Tcl_DStringAppend(&childPath, pathStr, pathLength);
+    if (pathLength) {
+        Tcl_DStringAppend(&childPath, "/", 1);
+    }
+    pathLength = Tcl_DStringLength(&childPath);
+
+    for (int fileId = 0; fileId < childCount; fileId++) {
+        char *fileName;
+        int fileNameLength;
+        int fileBlocks;
+        Tcl_WideInt fileTime;
+
+        /* get file name, modification time and number of blocks */
+        if ((objOffset + 1) > objLength) {
+            goto error;
+        }
+        fileNameLength = bytes[objOffset];
+        objOffset++;
+        if ((objOffset + fileNameLength + 1 + 8 + 4) > objLength
+            || bytes[objOffset + fileNameLength] != 0)
+        {
+            goto error;
+        }
+        fileName = (char *) (bytes + objOffset);
+        objOffset += fileNameLength + 1;
+        Cookfs_Binary2WideInt(bytes + objOffset, &fileTime, 1);
+        objOffset += 8;
+        Cookfs_Binary2Int(bytes + objOffset, &fileBlocks, 1);
+        objOffset += 4;
+        if (fileBlocks < COOKFS_NUMBLOCKS_DIRECTORY || (fileBlocks > 0
+            && (objOffset + fileBlocks * 12) > objLength))
+        {
+            goto error;
+        }
+
+        hashEntry = Tcl_FindHashEntry(&existingItems, fileName);
+        if (hashEntry == NULL) {
+            itemNode = NULL;
+        } else {
+            itemNode = (Cookfs_FsindexEntry *)Tcl_GetHashValue(hashEntry);
+            Tcl_DeleteHashEntry(hashEntry);
+        }
+
+        /* if the entry type has changed, remove the existing entry */
+        if (itemNode != NULL && ((itemNode->fileBlocks ==
+            COOKFS_NUMBLOCKS_DIRECTORY) != (fileBlocks ==
+            COOKFS_NUMBLOCKS_DIRECTORY)))
+        {
+            Tcl_DStringSetLength(&childPath, pathLength);
+            Tcl_DStringAppend(&childPath, fileName, fileNameLength);
+            Cookfs_PathObj *childPathObj = Cookfs_PathObjNewFromStr(
+                Tcl_DStringValue(&childPath), Tcl_DStringLength(&childPath));
+            Cookfs_PathObjIncrRefCount(childPathObj);
+            Cookfs_FsindexUnsetRecursive(fsIndex, childPathObj);
+            Cookfs_PathObjDecrRefCount(childPathObj);
+            itemNode = NULL;
+        }
+
+        if (fileBlocks == COOKFS_NUMBLOCKS_DIRECTORY) {
+            /* existing directories are kept with their contents */
+            if (itemNode == NULL) {
+                itemNode = Cookfs_FsindexSetInDirectory(dirNode, fileName,
+                    fileNameLength, fileBlocks);
+            }
+            if (itemNode == NULL) {
+                goto error;
+            }
+            itemNode->fileTime = fileTime;
+            continue;
+        }
+
+        /* files are always replaced with new entries */
+        itemNode = Cookfs_FsindexSetInDirectory(dirNode, fileName,
+            fileNameLength, fileBlocks);
+        if (itemNode == NULL) {
+            goto error;
+        }
+        itemNode->fileTime = fileTime;
+
+        Tcl_WideInt fileSize = 0;
+        Cookfs_Binary2Int(bytes + objOffset,
+            itemNode->data.fileInfo.fileBlockOffsetSize, fileBlocks * 3);
+        objOffset += fileBlocks * 12;
+        for (i = 0; i < fileBlocks; i++) {
+            fileSize += itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 2];
+            Cookfs_FsindexModifyBlockUsage(fsIndex,
+                itemNode->data.fileInfo.fileBlockOffsetSize[i*3 + 0], 1);
+        }
+        itemNode->data.fileInfo.fileSize = fileSize;
+        itemNode->isFileBlocksInitialized = fsIndex;
+    }
+
+    /* remove children that are not in the directory record */
+    for (hashEntry = Tcl_FirstHashEntry(&existingItems, &hashSearch);
+        hashEntry != NULL; hashEntry = Tcl_NextHashEntry(&hashSearch))
+    {
+        const char *fileName = Tcl_GetHashKey(&existingItems, hashEntry);
+        CookfsLog(printf("remove [%s]", fileName));
+        Tcl_DStringSetLength(&childPath, pathLength);
+        Tcl_DStringAppend(&childPath, fileName, -1);
+        Cookfs_PathObj *childPathObj = Cookfs_PathObjNewFromStr(
+            Tcl_DStringValue(&childPath), Tcl_DStringLength(&childPath));
+        Cookfs_PathObjIncrRefCount(childPathObj);
+        Cookfs_FsindexUnsetRecursive(fsIndex, childPathObj);
+        Cookfs_PathObjDecrRefCount(childPathObj);
+    }
+
+    Tcl_DStringFree(&childPath);
+    Tcl_DeleteHashTable(&existingItems);
+    Cookfs_PathObjDecrRefCount(pathObj);
+    return objOffset;
+
+error:
+
+    CookfsLog(printf("return: ERROR"));
+    Tcl_DStringFree(&childPath);
+    Tcl_DeleteHashTable(&existingItems);
+    Cookfs_PathObjDecrRefCount(pathObj);
+    return -1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsFsindexResetDirty --
+ *
+ *      Resets the change flag for the specified entry and, if it is
+ *      a directory, for all its children recursively
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void CookfsFsindexResetDirty(Cookfs_FsindexEntry *entry) {
+    entry->isDirty = 0;
+    if (entry->fileBlocks != COOKFS_NUMBLOCKS_DIRECTORY
+        || Cookfs_AtomicLoadAcquireInt(&entry->data.dirInfo.lazyIndex) >= 0)
+    {
+        return;
+    }
+    Cookfs_FsindexEntry **items = Cookfs_FsindexListEntry(entry, NULL);
+    for (int i = 0; items[i] != NULL; i++) {
+        CookfsFsindexResetDirty(items[i]);
+    }
+    Cookfs_FsindexListFree(items);
+}
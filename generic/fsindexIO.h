@@ -3,9 +3,13 @@
 #ifndef COOKFS_FSINDEX_IO_H
 #define COOKFS_FSINDEX_IO_H 1
 
-Tcl_Obj *Cookfs_FsindexToObject(Cookfs_Fsindex *fsindex);
+Tcl_Obj *Cookfs_FsindexToObject(Cookfs_Fsindex *fsindex, int isCompact);
 Cookfs_Fsindex *Cookfs_FsindexFromBytes(Tcl_Interp *interp, Cookfs_Fsindex *fsindex, unsigned char *bytes, Tcl_Size size);
 Cookfs_Fsindex *Cookfs_FsindexFromTclObj(Tcl_Interp *interp, Cookfs_Fsindex *fsindex, Tcl_Obj *o);
 
+Tcl_Obj *Cookfs_FsindexToDeltaObject(Cookfs_Fsindex *fsindex);
+int Cookfs_FsindexIsDelta(unsigned char *bytes, Tcl_Size size);
+int Cookfs_FsindexApplyDelta(Cookfs_Fsindex *fsindex, unsigned char *bytes, Tcl_Size size);
+
 #endif /* COOKFS_FSINDEX_IO_H */
 
@@ -11,6 +11,30 @@
 
 #define COOKFS_USEHASH_DEFAULT 0
 
+/* entries are allocated from the fsindex arena in size classes of
+ * COOKFS_FSINDEX_ARENA_ALIGN bytes, larger entries are allocated by
+ * ckalloc() */
+#define COOKFS_FSINDEX_ARENA_ALIGN 16
+#define COOKFS_FSINDEX_ARENA_CLASSES 64
+#define COOKFS_FSINDEX_ARENA_MINCHUNK 65536
+#define COOKFS_FSINDEX_ARENA_MAXCHUNK 4194304
+
+/* the filter of existing paths is created after this number of lookups
+ * for nonexistent paths; the filter uses COOKFS_FSINDEX_BLOOM_BITS bits
+ * per entry and COOKFS_FSINDEX_BLOOM_HASHES bits are set for each path */
+#define COOKFS_FSINDEX_BLOOM_MISSES 64
+#define COOKFS_FSINDEX_BLOOM_BITS 16
+#define COOKFS_FSINDEX_BLOOM_HASHES 4
+
+/* key in the filter of existing paths for a directory whose children
+ * were not loaded from the raw index data when the filter was created */
+#define COOKFS_FSINDEX_BLOOM_LAZYKEY(pathHash) ((pathHash) ^ 0x9e3779b9U)
+
+/* hash of the path of an entry, calculated from the hash of the parent
+ * path and the hash of the entry name */
+#define COOKFS_FSINDEX_PATHHASH(parentHash, nameHash) \
+    (((parentHash) ^ (nameHash)) * 16777619U)
+
 typedef enum {
     COOKFS_FSINDEX_FILESET_NONE,
     COOKFS_FSINDEX_FILESET_AUTO,
@@ -19,18 +43,47 @@ typedef enum {
     COOKFS_FSINDEX_FILESET_CUSTOM
 } Cookfs_FsindexFileSetType;
 
+/* position of a directory in the raw index data that has not been
+ * materialized yet; directories are stored in pre-order */
+typedef struct Cookfs_FsindexLazyDir {
+    /* offset of the <numChildren> field of the directory */
+    int offset;
+    /* offset of the end of the directory including all its children
+     * for the previous format, or the end of the directory record */
+    int endOffset;
+    /* number of directories in the subtree including the directory itself */
+    int dirCount;
+} Cookfs_FsindexLazyDir;
+
+/* filter of existing paths, the number of bits is a power of 2 */
+typedef struct Cookfs_FsindexBloom {
+    unsigned int mask;
+    /* number of entries added to the filter */
+    int count;
+    unsigned char bits[1];
+} Cookfs_FsindexBloom;
+
 /* all filenames are stored in UTF-8 */
 struct _Cookfs_FsindexEntry {
     char *fileName;
     unsigned char fileNameLen;
+    /* set when the entry, or the list of children for a directory, has been
+     * changed since the last export; used to write only changed directories
+     * to the index journal */
+    unsigned char isDirty;
+    /* size class of the entry in the fsindex arena; 0 if the entry
+     * is allocated by ckalloc() */
+    unsigned char allocClass;
+    /* hash of the file name, it is set when the entry is added
+     * to a directory */
+    unsigned int fileNameHash;
     Tcl_WideInt fileTime;
     int fileBlocks;
+    /* hash of the full path of the entry, see COOKFS_FSINDEX_PATHHASH() */
+    unsigned int pathHash;
     Cookfs_Fsindex *isFileBlocksInitialized;
     Cookfs_Fsindex *fsindex;
-    int refcount;
-#ifdef TCL_THREADS
-    Tcl_Mutex mxRefCount;
-#endif /* TCL_THREADS */
+    Cookfs_RefCount refcount;
     int isInactive;
     Cookfs_FsindexEntry *next;
     union {
@@ -40,11 +93,23 @@ struct _Cookfs_FsindexEntry {
         } fileInfo;
         struct {
             union {
-                Tcl_HashTable children;
+                /* open-addressing hash map with linear probing, the number
+                 * of slots is a power of 2; empty slots are NULL */
+                struct {
+                    Cookfs_FsindexEntry **slots;
+                    unsigned int mask;
+                    /* children sorted by name, it is built on first
+                     * pattern match and released when the list of
+                     * children is changed; NULL if not built */
+                    Cookfs_FsindexEntry **sorted;
+                } children;
                 Cookfs_FsindexEntry *childTable[COOKFS_FSINDEX_TABLE_MAXENTRIES];
             } dirData;
             char isHash;
             int childCount;
+            /* index in fsindex->lazyDirs if children of the directory have
+             * not been loaded from the raw index data yet; -1 otherwise */
+            int lazyIndex;
         } dirInfo;
     } data;
     /* this stores series of 3 values: block number, block offset, size of element */
@@ -58,6 +123,9 @@ struct _Cookfs_Fsindex {
     int *blockIndex;
     int blockIndexSize;
     Tcl_WideInt changeCount;
+    /* incremented when entries are added, removed or replaced, or when
+     * another fileset is selected, see Cookfs_FsindexGetGeneration() */
+    Tcl_WideInt generation;
     Tcl_Interp *interp;
     Tcl_Command commandToken;
     int isDead;
@@ -68,10 +136,46 @@ struct _Cookfs_Fsindex {
 #endif /* TCL_THREADS */
     int lockHard;
     int lockSoft;
+    /* raw index data and the table of its directories, used to materialize
+     * directory children on first access */
+    unsigned char *lazyData;
+    Cookfs_FsindexLazyDir *lazyDirs;
+    int lazyDirsCount;
+    /* version of the raw index data format: 2 or 3 */
+    int lazyFormat;
+#ifdef TCL_THREADS
+    Tcl_Mutex mxLazy;
+#endif /* TCL_THREADS */
+    /* arena for entries: the list of allocated chunks, free space in
+     * the current chunk and lists of released entries by size class */
+    void *arenaChunks;
+    char *arenaPtr;
+    int arenaAvail;
+    int arenaChunkSize;
+    Cookfs_FsindexEntry *arenaFree[COOKFS_FSINDEX_ARENA_CLASSES];
+    /* Bloom filter of path hashes of all entries, NULL if it has not
+     * been created yet. Removed entries are not cleared from the filter,
+     * it is only used to detect nonexistent paths. Readers load it with
+     * acquire semantics, see CookfsFsindexBloomBuild(). */
+    Cookfs_FsindexBloom *bloom;
+    /* number of lookups for nonexistent paths while there is no filter */
+    Cookfs_RefCount bloomMisses;
+    /* statistics, see Cookfs_FsindexGetStatsObj(). Successful lookups are
+     * not counted to avoid updating a shared counter by concurrent
+     * readers. */
+    Cookfs_Counter statsMisses;
+    Cookfs_Counter statsFiltered;
+    /* non-zero if fsindex is frozen by Cookfs_FsindexSeal() */
+    int isSealed;
 };
 
 #ifdef TCL_THREADS
-#define Cookfs_FsindexWantRead(i) Cookfs_RWMutexWantRead((i)->mx);
+/* sealed fsindex is not changed and can be read without locks */
+#define Cookfs_FsindexWantRead(i) { \
+    if (!(i)->isSealed) { \
+        Cookfs_RWMutexWantRead((i)->mx); \
+    } \
+}
 #define Cookfs_FsindexWantWrite(i) Cookfs_RWMutexWantWrite((i)->mx);
 #define Cookfs_FsindexEntryWantRead(e) Cookfs_FsindexWantRead((e)->fsindex)
 #define Cookfs_FsindexEntryWantWrite(e) Cookfs_FsindexWantWrite((e)->fsindex)
@@ -82,4 +186,22 @@ struct _Cookfs_Fsindex {
 #define Cookfs_FsindexEntryWantWrite(e) {}
 #endif
 
+/* non-zero if children of the directory entry are not loaded yet; lazyIndex
+ * is published by Cookfs_FsindexEntryMaterialize() with release semantics */
+#define Cookfs_FsindexEntryIsLazy(e) \
+    (Cookfs_AtomicLoadAcquireInt(&(e)->data.dirInfo.lazyIndex) >= 0)
+
+/* ensures that children of the directory entry are loaded */
+#define Cookfs_FsindexEntryWantChildren(e) { \
+    if (Cookfs_FsindexEntryIsLazy(e)) { \
+        Cookfs_FsindexEntryMaterialize(e); \
+    } \
+}
+
+Cookfs_FsindexEntry *Cookfs_FsindexEntryAlloc(Cookfs_Fsindex *fsindex, int fileNameLength, int numBlocks, int useHash);
+void Cookfs_FsindexEntryDealloc(Cookfs_FsindexEntry *e);
+void Cookfs_FsindexEntryMaterialize(Cookfs_FsindexEntry *e);
+void Cookfs_FsindexEntryInitChildMap(Cookfs_FsindexEntry *e, int count);
+int Cookfs_FsindexEntryAddChild(Cookfs_FsindexEntry *e, Cookfs_FsindexEntry *itemNode);
+
 #endif /* COOKFS_FSINDEXINT_H */
@@ -0,0 +1,235 @@
+/*
+ * latency.c
+ *
+ * Provides latency histograms of filesystem operations
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+#include "cookfs.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef STRICT
+#define STRICT // See MSDN Article Q83456
+#endif
+#include <windows.h>
+#undef WIN32_LEAN_AND_MEAN
+#else
+#include <time.h>
+#endif /* _WIN32 */
+
+typedef struct Cookfs_LatencyHistogram {
+    Cookfs_Counter buckets[COOKFS_LATENCY_BUCKETS];
+    Cookfs_Counter totalTime;
+} Cookfs_LatencyHistogram;
+
+struct _Cookfs_Latency {
+    Cookfs_RefCount refCount;
+    volatile int enabled;
+    Cookfs_LatencyHistogram ops[COOKFS_LATENCY_OPS_COUNT];
+};
+
+static const char *const cookfsLatencyOpNames[] = {
+    "stat", "access", "open", "match", "read", "purge"
+};
+
+// The number of mounts with enabled histograms
+volatile int cookfsLatencyActive = 0;
+
+#ifdef TCL_THREADS
+static Tcl_Mutex latencyMutex = NULL;
+#endif /* TCL_THREADS */
+
+Tcl_WideInt Cookfs_LatencyGetTime(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (Tcl_WideInt)((double)counter.QuadPart * 1e9 /
+        (double)frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (Tcl_WideInt)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+    Tcl_Time now;
+    Tcl_GetTime(&now);
+    return ((Tcl_WideInt)now.sec * 1000000 + now.usec) * 1000;
+#endif /* _WIN32 */
+}
+
+static int CookfsLatencyGetBucket(Tcl_WideInt value) {
+    if (value < COOKFS_LATENCY_SUB_BUCKETS) {
+        return (value < 0 ? 0 : (int)value);
+    }
+    int msb = 0;
+    for (Tcl_WideInt v = value; v > 1; v >>= 1) {
+        msb++;
+    }
+    int sub = (int)(value >> (msb - COOKFS_LATENCY_SUB_BUCKETS_BITS)) &
+        (COOKFS_LATENCY_SUB_BUCKETS - 1);
+    int idx = (msb - COOKFS_LATENCY_SUB_BUCKETS_BITS + 1) *
+        COOKFS_LATENCY_SUB_BUCKETS + sub;
+    return (idx >= COOKFS_LATENCY_BUCKETS ? COOKFS_LATENCY_BUCKETS - 1 : idx);
+}
+
+// Returns the lowest value that is counted in the bucket
+static Tcl_WideInt CookfsLatencyGetBucketLow(int idx) {
+    if (idx < COOKFS_LATENCY_SUB_BUCKETS) {
+        return idx;
+    }
+    return (Tcl_WideInt)(COOKFS_LATENCY_SUB_BUCKETS +
+        idx % COOKFS_LATENCY_SUB_BUCKETS) <<
+        (idx / COOKFS_LATENCY_SUB_BUCKETS - 1);
+}
+
+// Returns the highest value that is counted in the bucket
+static Tcl_WideInt CookfsLatencyGetBucketHigh(int idx) {
+    if (idx < COOKFS_LATENCY_SUB_BUCKETS) {
+        return idx;
+    }
+    return CookfsLatencyGetBucketLow(idx) +
+        ((Tcl_WideInt)1 << (idx / COOKFS_LATENCY_SUB_BUCKETS - 1)) - 1;
+}
+
+void Cookfs_LatencyRecord(Cookfs_Latency *lat, Cookfs_LatencyOp op,
+    Tcl_WideInt start)
+{
+    if (lat == NULL || !lat->enabled) {
+        return;
+    }
+    Tcl_WideInt duration = Cookfs_LatencyGetTime() - start;
+    Cookfs_LatencyHistogram *h = &lat->ops[op];
+    Cookfs_CounterAdd(&h->buckets[CookfsLatencyGetBucket(duration)], 1);
+    Cookfs_CounterAdd(&h->totalTime, duration);
+}
+
+Cookfs_Latency *Cookfs_LatencyInit(void) {
+    Cookfs_Latency *lat = (Cookfs_Latency *)ckalloc(sizeof(Cookfs_Latency));
+    Cookfs_RefCountInit(&lat->refCount, 1);
+    lat->enabled = 0;
+    for (int op = 0; op < COOKFS_LATENCY_OPS_COUNT; op++) {
+        Cookfs_LatencyHistogram *h = &lat->ops[op];
+        for (int i = 0; i < COOKFS_LATENCY_BUCKETS; i++) {
+            Cookfs_CounterInit(&h->buckets[i]);
+        }
+        Cookfs_CounterInit(&h->totalTime);
+    }
+    CookfsLog(printf("return: %p", (void *)lat));
+    return lat;
+}
+
+void Cookfs_LatencyIncrRefCount(Cookfs_Latency *lat) {
+    Cookfs_RefCountIncr(&lat->refCount);
+}
+
+void Cookfs_LatencyDecrRefCount(Cookfs_Latency *lat) {
+    if (Cookfs_RefCountDecr(&lat->refCount)) {
+        return;
+    }
+    CookfsLog(printf("release %p", (void *)lat));
+    Cookfs_LatencySetEnabled(lat, 0);
+    ckfree(lat);
+}
+
+void Cookfs_LatencySetEnabled(Cookfs_Latency *lat, int enabled) {
+#ifdef TCL_THREADS
+    Tcl_MutexLock(&latencyMutex);
+#endif /* TCL_THREADS */
+    if (lat->enabled != enabled) {
+        lat->enabled = enabled;
+        cookfsLatencyActive += (enabled ? 1 : -1);
+        CookfsLog(printf("%p: %s, active mounts: %d", (void *)lat,
+            (enabled ? "enabled" : "disabled"), cookfsLatencyActive));
+    }
+#ifdef TCL_THREADS
+    Tcl_MutexUnlock(&latencyMutex);
+#endif /* TCL_THREADS */
+}
+
+void Cookfs_LatencyReset(Cookfs_Latency *lat) {
+    for (int op = 0; op < COOKFS_LATENCY_OPS_COUNT; op++) {
+        Cookfs_LatencyHistogram *h = &lat->ops[op];
+        for (int i = 0; i < COOKFS_LATENCY_BUCKETS; i++) {
+            Cookfs_CounterReset(&h->buckets[i]);
+        }
+        Cookfs_CounterReset(&h->totalTime);
+    }
+}
+
+static void CookfsLatencyAppend(Tcl_Obj *list, const char *key,
+    Tcl_Obj *value)
+{
+    Tcl_ListObjAppendElement(NULL, list, Tcl_NewStringObj(key, -1));
+    Tcl_ListObjAppendElement(NULL, list, value);
+}
+
+static Tcl_Obj *CookfsLatencyHistogramGetObj(Cookfs_LatencyHistogram *h) {
+
+    // Take a snapshot of the counters first, as they can be updated
+    // by other threads while we calculate percentiles.
+    Tcl_WideInt buckets[COOKFS_LATENCY_BUCKETS];
+    Tcl_WideInt count = 0;
+    int i;
+    for (i = 0; i < COOKFS_LATENCY_BUCKETS; i++) {
+        buckets[i] = Cookfs_CounterGet(&h->buckets[i]);
+        count += buckets[i];
+    }
+    Tcl_WideInt totalTime = Cookfs_CounterGet(&h->totalTime);
+
+    // Percentiles are reported as the highest value of the bucket where
+    // the corresponding rank is located.
+    static const int percentiles[] = { 50, 90, 99 };
+    static const char *const percentileNames[] = { "p50", "p90", "p99" };
+    Tcl_WideInt percentileValues[] = { 0, 0, 0 };
+    Tcl_WideInt max = 0;
+
+    Tcl_Obj *bucketsObj = Tcl_NewListObj(0, NULL);
+    Tcl_WideInt seen = 0;
+    size_t p = 0;
+    for (i = 0; i < COOKFS_LATENCY_BUCKETS; i++) {
+        if (!buckets[i]) {
+            continue;
+        }
+        seen += buckets[i];
+        for (; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+            // rank = ceil(count * percentile / 100)
+            if (seen * 100 < count * percentiles[p]) {
+                break;
+            }
+            percentileValues[p] = CookfsLatencyGetBucketHigh(i);
+        }
+        max = CookfsLatencyGetBucketHigh(i);
+        Tcl_ListObjAppendElement(NULL, bucketsObj,
+            Tcl_NewWideIntObj(CookfsLatencyGetBucketLow(i)));
+        Tcl_ListObjAppendElement(NULL, bucketsObj,
+            Tcl_NewWideIntObj(buckets[i]));
+    }
+
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    CookfsLatencyAppend(result, "count", Tcl_NewWideIntObj(count));
+    CookfsLatencyAppend(result, "total", Tcl_NewWideIntObj(totalTime));
+    CookfsLatencyAppend(result, "mean",
+        Tcl_NewWideIntObj(count ? totalTime / count : 0));
+    for (p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+        CookfsLatencyAppend(result, percentileNames[p],
+            Tcl_NewWideIntObj(percentileValues[p]));
+    }
+    CookfsLatencyAppend(result, "max", Tcl_NewWideIntObj(max));
+    CookfsLatencyAppend(result, "buckets", bucketsObj);
+    return result;
+
+}
+
+Tcl_Obj *Cookfs_LatencyGetObj(Cookfs_Latency *lat) {
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (int op = 0; op < COOKFS_LATENCY_OPS_COUNT; op++) {
+        CookfsLatencyAppend(result, cookfsLatencyOpNames[op],
+            CookfsLatencyHistogramGetObj(&lat->ops[op]));
+    }
+    return result;
+}
@@ -11,42 +11,23 @@
 
 void Cookfs_PageObjIncrRefCount(Cookfs_PageObj pg) {
     // CookfsLog(printf("%p (buffer at %p)", (void *)pg, (void *)pg->buf));
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&pg->mx);
-#endif /* TCL_THREADS */
-    pg->refCount++;
-    // CookfsLog(printf("%p - count:%d", (void *)pg, pg->refCount));
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&pg->mx);
-#endif /* TCL_THREADS */
+    Cookfs_RefCountIncr(&pg->refCount);
 }
 
 void Cookfs_PageObjDecrRefCount(Cookfs_PageObj pg) {
     // CookfsLog(printf("%p (buffer at %p)", (void *)pg, (void *)pg->buf));
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&pg->mx);
-#endif /* TCL_THREADS */
+    // We need to know what refCount value was at the time of decrement.
+    // We cannot rely on the value of pg->refCount after that, because
+    // it is possible that another thread decreased pg->refCount after us,
+    // but before we check if pg->refCount is 0. This will mean that these
+    // 2 threads will think that pg->refCount is 0, and these 2 threads will
+    // try to free the page. This will cause memory to be double freed.
+    int refCount = Cookfs_RefCountDecr(&pg->refCount);
     // There should not be Cookfs_PageObjDecrRefCount() without
     // a corresponding Cookfs_PageObjIncrRefCount() that was called before it.
-    // Throw an error if refcount is less than or equal to zero.
-    assert(pg->refCount > 0);
-    // We need to know what refCount value was at the time the mutex was
-    // locked. Thus, we make a local copy of this value. We cannot rely on
-    // the value of pg->refCount after unlocking the mutex, because
-    // it is possible that another thread decreased pg->refCount after we
-    // did the unlock, but before we check if pg->refCount is 0.
-    // This will mean that these 2 threads will think that pg->refCount is 0,
-    // and these 2 threads will try to free the page. This will cause memory
-    // to be double freed.
-    int refCount = --pg->refCount;
-    // CookfsLog(printf("%p - count:%d", (void *)pg, pg->refCount));
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&pg->mx);
-#endif /* TCL_THREADS */
+    // Throw an error if refcount was less than or equal to zero.
+    assert(refCount >= 0);
     if (!refCount) {
-#ifdef TCL_THREADS
-        Tcl_MutexFinalize(&pg->mx);
-#endif /* TCL_THREADS */
         // CookfsLog(printf("release %p", (void *)pg));
         ckfree(pg);
     }
@@ -71,11 +52,8 @@ Cookfs_PageObj Cookfs_PageObjAlloc(Tcl_Size size) {
     if (pg != NULL) {
         pg->bufferSize = bufferSize;
         pg->effectiveSize = size;
-        pg->refCount = 0;
+        Cookfs_RefCountInit(&pg->refCount, 0);
         pg->buf = ((unsigned char *)pg) + sizeof(Cookfs_PageObjStruct);
-#ifdef TCL_THREADS
-        pg->mx = NULL;
-#endif /* TCL_THREADS */
 #ifdef COOKFS_USECCRYPTO
         memset(pg->IV, 0, COOKFS_PAGEOBJ_BLOCK_SIZE);
 #endif /* COOKFS_USECCRYPTO */
@@ -91,11 +69,8 @@ Cookfs_PageObj Cookfs_PageObjNewWithoutAlloc(const unsigned char *bytes,
     if (pg != NULL) {
         pg->bufferSize = size;
         pg->effectiveSize = size;
-        pg->refCount = 0;
+        Cookfs_RefCountInit(&pg->refCount, 0);
         pg->buf = (unsigned char *)bytes;
-#ifdef TCL_THREADS
-        pg->mx = NULL;
-#endif /* TCL_THREADS */
 #ifdef COOKFS_USECCRYPTO
         memset(pg->IV, 0, COOKFS_PAGEOBJ_BLOCK_SIZE);
 #endif /* COOKFS_USECCRYPTO */
@@ -141,7 +116,7 @@ Cookfs_PageObj Cookfs_PageObjNewFromByteArrayIV(Tcl_Obj *obj) {
 // must not be used for pageobjs that may be shared across threads.
 
 static void Cookfs_PageObjEnsureNotShared(Cookfs_PageObj pg) {
-    if (pg->refCount) {
+    if (Cookfs_RefCountGet(&pg->refCount)) {
         Tcl_Panic("Critical error: attempt to use shared PageObj where it"
             " is not allowed.");
     }
@@ -25,11 +25,8 @@
 typedef struct Cookfs_PageObjStruct {
     Tcl_Size bufferSize;
     Tcl_Size effectiveSize;
-    int refCount;
+    Cookfs_RefCount refCount;
     unsigned char *buf;
-#ifdef TCL_THREADS
-    Tcl_Mutex mx;
-#endif /* TCL_THREADS */
     // This structure member should be at the end. We will use IV as
     // a pointer to get a pointer to the area (IV+data).
 #ifdef COOKFS_USECCRYPTO
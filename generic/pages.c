@@ -11,6 +11,7 @@
 #include "pages.h"
 #include "pagesInt.h"
 #include "pagesCompr.h"
+#include "pagesTrace.h"
 #if defined(COOKFS_USECALLBACKS)
 #include "pagesAsync.h"
 #endif /* COOKFS_USECALLBACKS */
@@ -18,6 +19,19 @@
 // For ptrdiff_t type
 #include <stddef.h>
 
+#ifndef _WIN32
+// For posix_fadvise() and sysconf()
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#ifdef __linux__
+// For kernel-side copy of stored pages
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif /* __linux__ */
+
 // 1  byte  - base compression
 // 1  byte  - base compression level
 // 1  byte  - encryption
@@ -163,6 +177,155 @@ void Cookfs_PagesLockExclusive(Cookfs_Pages *p) {
 #endif /* TCL_THREADS */
 }
 
+#ifdef TCL_THREADS
+Cookfs_LockStats *Cookfs_PagesGetLockStats(Cookfs_Pages *p,
+    Cookfs_PagesLockType type)
+{
+    switch (type) {
+    case COOKFS_PAGES_LOCK_CACHE:
+        return &p->statsCache;
+    case COOKFS_PAGES_LOCK_IO:
+        return &p->statsIO;
+    case COOKFS_PAGES_LOCK_PAGES:
+        break;
+    }
+    return Cookfs_RWMutexGetStats(p->mx);
+}
+#endif /* TCL_THREADS */
+
+static void CookfsPagesStatsInit(Cookfs_PagesStats *s, int reset) {
+    if (reset) {
+        Cookfs_CounterReset(&s->cacheHits);
+        Cookfs_CounterReset(&s->cacheMisses);
+        Cookfs_CounterReset(&s->pagesRead);
+        Cookfs_CounterReset(&s->bytesRead);
+        Cookfs_CounterReset(&s->hashTime);
+        Cookfs_CounterReset(&s->dedupHits);
+        Cookfs_CounterReset(&s->readaheadBytes);
+        for (int i = 0; i < COOKFS_PAGES_STATS_CODECS; i++) {
+            Cookfs_CounterReset(&s->decompressBytes[i]);
+            Cookfs_CounterReset(&s->decompressTime[i]);
+        }
+    } else {
+        Cookfs_CounterInit(&s->cacheHits);
+        Cookfs_CounterInit(&s->cacheMisses);
+        Cookfs_CounterInit(&s->pagesRead);
+        Cookfs_CounterInit(&s->bytesRead);
+        Cookfs_CounterInit(&s->hashTime);
+        Cookfs_CounterInit(&s->dedupHits);
+        Cookfs_CounterInit(&s->readaheadBytes);
+        for (int i = 0; i < COOKFS_PAGES_STATS_CODECS; i++) {
+            Cookfs_CounterInit(&s->decompressBytes[i]);
+            Cookfs_CounterInit(&s->decompressTime[i]);
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesGetStatsObj --
+ *
+ *      Returns runtime statistics of the pages object and its aside pages
+ *      object, if any
+ *
+ * Results:
+ *      Dict with statistics
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *Cookfs_PagesGetStatsObj(Cookfs_Pages *p) {
+    Cookfs_PagesWantRead(p);
+
+    Tcl_WideInt values[7];
+    Tcl_WideInt decompressBytes[COOKFS_PAGES_STATS_CODECS];
+    Tcl_WideInt decompressTime[COOKFS_PAGES_STATS_CODECS];
+
+    static const char *const names[] = {
+        "cachehits", "cachemisses", "pagesread", "bytesread", "hashtime",
+        "deduphits", "readaheadbytes"
+    };
+
+    memset(values, 0, sizeof(values));
+    memset(decompressBytes, 0, sizeof(decompressBytes));
+    memset(decompressTime, 0, sizeof(decompressTime));
+
+    // Pages that were added to aside pages are read by the aside object,
+    // include its statistics as well.
+    for (Cookfs_Pages *cur = p; cur != NULL; cur = (cur == p ?
+        p->dataAsidePages : NULL))
+    {
+        Cookfs_PagesStats *s = &cur->stats;
+        values[0] += Cookfs_CounterGet(&s->cacheHits);
+        values[1] += Cookfs_CounterGet(&s->cacheMisses);
+        values[2] += Cookfs_CounterGet(&s->pagesRead);
+        values[3] += Cookfs_CounterGet(&s->bytesRead);
+        values[4] += Cookfs_CounterGet(&s->hashTime);
+        values[5] += Cookfs_CounterGet(&s->dedupHits);
+        values[6] += Cookfs_CounterGet(&s->readaheadBytes);
+        for (int i = 0; i < COOKFS_PAGES_STATS_CODECS; i++) {
+            decompressBytes[i] += Cookfs_CounterGet(&s->decompressBytes[i]);
+            decompressTime[i] += Cookfs_CounterGet(&s->decompressTime[i]);
+        }
+    }
+
+    Tcl_Obj *result = Tcl_NewDictObj();
+    for (int i = 0; i < 7; i++) {
+        Tcl_DictObjPut(NULL, result, Tcl_NewStringObj(names[i], -1),
+            Tcl_NewWideIntObj(values[i]));
+    }
+
+    // Add decompression statistics for all available compression methods
+    // except "none"
+    Tcl_Obj *decompression = Tcl_NewDictObj();
+    for (int i = 0; cookfsCompressionOptionMap[i] != -1; i++) {
+        int codec = COOKFS_PAGES_STATS_CODEC(cookfsCompressionOptionMap[i]);
+        if (codec == COOKFS_COMPRESSION_NONE) {
+            continue;
+        }
+        Tcl_Obj *codecStats = Tcl_NewDictObj();
+        Tcl_DictObjPut(NULL, codecStats, Tcl_NewStringObj("bytes", -1),
+            Tcl_NewWideIntObj(decompressBytes[codec]));
+        Tcl_DictObjPut(NULL, codecStats, Tcl_NewStringObj("time", -1),
+            Tcl_NewWideIntObj(decompressTime[codec]));
+        Tcl_DictObjPut(NULL, decompression,
+            Tcl_NewStringObj(cookfsCompressionOptions[i], -1), codecStats);
+    }
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("decompression", -1),
+        decompression);
+
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesResetStats --
+ *
+ *      Resets runtime statistics of the pages object and its aside pages
+ *      object, if any
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesResetStats(Cookfs_Pages *p) {
+    Cookfs_PagesWantRead(p);
+    CookfsPagesStatsInit(&p->stats, 1);
+    if (p->dataAsidePages != NULL) {
+        CookfsPagesStatsInit(&p->dataAsidePages->stats, 1);
+    }
+}
+
 int Cookfs_PagesGetLength(Cookfs_Pages *p) {
     Cookfs_PagesWantRead(p);
     return Cookfs_PgIndexGetLength(p->pagesIndex);
@@ -255,7 +418,7 @@ Tcl_Obj *Cookfs_PagesGetPartObj(Cookfs_Pages *p,
     }
 
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxIO);
+    Cookfs_MutexLock(&p->mxIO, &p->statsIO);
 #endif /* TCL_THREADS */
 
     if (p->fileChannel == NULL) {
@@ -274,7 +437,7 @@ Tcl_Obj *Cookfs_PagesGetPartObj(Cookfs_Pages *p,
     }
 
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxIO);
+    Cookfs_MutexUnlock(&p->mxIO, &p->statsIO);
 #endif /* TCL_THREADS */
 
     return data;
@@ -294,7 +457,7 @@ Tcl_WideInt Cookfs_PagesPutPartToChannel(Cookfs_Pages *p,
     }
 
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxIO);
+    Cookfs_MutexLock(&p->mxIO, &p->statsIO);
 #endif /* TCL_THREADS */
 
     char *buf = NULL;
@@ -341,7 +504,7 @@ error:
 done:
 
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxIO);
+    Cookfs_MutexUnlock(&p->mxIO, &p->statsIO);
 #endif /* TCL_THREADS */
 
     if (p->fileChannel != NULL && buf != NULL) {
@@ -352,6 +515,257 @@ done:
 
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsPagesSendPage --
+ *
+ *      Copies a part of the page from the archive file to the file behind
+ *      the channel without passing the data through user space. This is
+ *      possible only on Linux, for pages stored without compression and
+ *      encryption, and for channels without stacked transformations.
+ *      The archive is copied by copy_file_range() or sendfile() when it
+ *      is read through a channel, and by write() from the mapped memory
+ *      when it is memory-mapped.
+ *
+ *      The page hash is not verified, as the data is never seen by us.
+ *
+ * Results:
+ *      The number of copied bytes. It can be less than the requested size
+ *      if the kernel-side copy is not possible or has failed. In this case,
+ *      the caller should copy the remaining bytes in the usual way.
+ *
+ * Side effects:
+ *      The channel is flushed. The page is counted in statistics only
+ *      if it was copied completely.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_WideInt CookfsPagesSendPage(Cookfs_Pages *p, int index,
+    int offset, int size, Tcl_Channel chan)
+{
+
+#ifdef __linux__
+
+    if (COOKFS_PAGES_ISASIDE(index)) {
+        if (p->dataPagesIsAside) {
+            index = index & COOKFS_PAGES_MASK;
+        } else if (p->dataAsidePages != NULL) {
+            if (!Cookfs_PagesLockRead(p->dataAsidePages, NULL)) {
+                return 0;
+            }
+            Tcl_WideInt rc = CookfsPagesSendPage(p->dataAsidePages, index,
+                offset, size, chan);
+            Cookfs_PagesUnlock(p->dataAsidePages);
+            return rc;
+        } else {
+            return 0;
+        }
+    }
+
+    if (index < 0 || index >= Cookfs_PagesGetLength(p) ||
+        Cookfs_PgIndexGetCompression(p->pagesIndex, index) !=
+        COOKFS_COMPRESSION_NONE ||
+        Cookfs_PgIndexGetEncryption(p->pagesIndex, index) ||
+        offset < 0 || size <= 0 ||
+        offset + size > Cookfs_PgIndexGetSizeUncompressed(p->pagesIndex,
+        index))
+    {
+        CookfsLog(printf("return: the page is not suitable"));
+        return 0;
+    }
+
+    // The data written directly to the file descriptor would bypass
+    // stacked channels.
+    if (Tcl_GetStackedChannel(chan) != NULL || Tcl_GetTopChannel(chan) != chan) {
+        CookfsLog(printf("return: the channel is stacked"));
+        return 0;
+    }
+
+    ClientData handle;
+    if (Tcl_GetChannelHandle(chan, TCL_WRITABLE, &handle) != TCL_OK) {
+        CookfsLog(printf("return: the channel has no file descriptor"));
+        return 0;
+    }
+    int outfd = (int)(intptr_t)handle;
+
+    if (Tcl_Flush(chan) != TCL_OK) {
+        CookfsLog(printf("return: failed to flush the channel"));
+        return 0;
+    }
+
+    Tcl_WideInt pageOffset = Cookfs_PagesGetPageOffset(p, index) + offset;
+    Tcl_WideInt copied = 0;
+    ssize_t count;
+
+    if (p->fileChannel == NULL) {
+
+        while (copied < size) {
+            count = write(outfd, &p->fileData[pageOffset + copied],
+                size - copied);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            copied += count;
+        }
+
+    } else {
+
+        if (Tcl_GetChannelHandle(p->fileChannel, TCL_READABLE, &handle)
+            != TCL_OK)
+        {
+            CookfsLog(printf("return: the archive has no file descriptor"));
+            return 0;
+        }
+        int infd = (int)(intptr_t)handle;
+
+#ifdef TCL_THREADS
+        Cookfs_MutexLock(&p->mxIO, &p->statsIO);
+#endif /* TCL_THREADS */
+
+        // Make sure that the kernel sees all pages written through
+        // the channel. The file position is not used by copy_file_range()
+        // and sendfile() when the offset is specified, so the channel
+        // position remains valid.
+        if (p->fileLastOp == COOKFS_LASTOP_WRITE) {
+            Tcl_Flush(p->fileChannel);
+        }
+
+        off_t off = pageOffset;
+
+#ifdef SYS_copy_file_range
+        // copy_file_range() can fail if the files are on different
+        // filesystems on older kernels, or if the destination is not
+        // a regular file. In this case, sendfile() is used.
+        while (copied < size) {
+            count = syscall(SYS_copy_file_range, infd, &off, outfd, NULL,
+                (size_t)(size - copied), 0);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            copied += count;
+        }
+#endif /* SYS_copy_file_range */
+
+        while (copied < size) {
+            count = sendfile(outfd, infd, &off, size - copied);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            copied += count;
+        }
+
+#ifdef TCL_THREADS
+        Cookfs_MutexUnlock(&p->mxIO, &p->statsIO);
+#endif /* TCL_THREADS */
+
+    }
+
+    // If the page is not copied completely, the caller reads it by
+    // Cookfs_PageGet(), which counts it.
+    if (copied >= size) {
+        Cookfs_CounterAdd(&p->stats.pagesRead, 1);
+        Cookfs_CounterAdd(&p->stats.bytesRead, copied);
+    }
+
+    CookfsLog(printf("return: copied %" TCL_LL_MODIFIER "d bytes of %d",
+        copied, size));
+    return copied;
+
+#else
+
+    UNUSED(p);
+    UNUSED(index);
+    UNUSED(offset);
+    UNUSED(size);
+    UNUSED(chan);
+    return 0;
+
+#endif /* __linux__ */
+
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesPutPageToChannel --
+ *
+ *      Writes size bytes from the specified offset of the page to
+ *      the channel. The channel must be in binary mode. Pages stored
+ *      without compression and encryption are copied by the kernel when
+ *      the channel is a file, other pages are obtained by Cookfs_PageGet()
+ *      with the specified weight and written with Tcl_Write().
+ *
+ *      The caller must hold a read lock on the pages object.
+ *
+ * Results:
+ *      TCL_OK on success or TCL_ERROR on failure. In case of a failure,
+ *      an error message is stored in err if it is not NULL.
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_PagesPutPageToChannel(Cookfs_Pages *p, int index, int weight,
+    int offset, int size, Tcl_Channel chan, Tcl_Obj **err)
+{
+    Cookfs_PagesWantRead(p);
+
+    CookfsLog(printf("index [%d] offset [%d] size [%d]", index, offset,
+        size));
+
+    if (size <= 0) {
+        return TCL_OK;
+    }
+
+    Tcl_WideInt copied = CookfsPagesSendPage(p, index, offset, size, chan);
+    if (copied >= size) {
+        // Cookfs_PageGet() records page access in other cases
+        if (p->traceActive) {
+            Cookfs_PagesTraceRecord(p, index);
+        }
+        return TCL_OK;
+    }
+
+    Cookfs_PageObj pageObj = Cookfs_PageGet(p, index, weight, err);
+    if (pageObj == NULL) {
+        CookfsLog(printf("return: ERROR (failed to get the page)"));
+        return TCL_ERROR;
+    }
+
+    int rc = TCL_OK;
+    if (offset + size > Cookfs_PageObjSize(pageObj)) {
+        CookfsLog(printf("return: ERROR (the page is too small)"));
+        SET_ERROR(Tcl_NewStringObj("the page is smaller than expected", -1));
+        rc = TCL_ERROR;
+    } else {
+        Tcl_Size want = size - copied;
+        if (Tcl_Write(chan, (const char *)pageObj->buf + offset + copied,
+            want) != want)
+        {
+            CookfsLog(printf("return: ERROR (failed to write)"));
+            SET_ERROR(Tcl_ObjPrintf("error writing data: %s",
+                Tcl_ErrnoMsg(Tcl_GetErrno())));
+            rc = TCL_ERROR;
+        }
+    }
+
+    Cookfs_PageObjDecrRefCount(pageObj);
+    return rc;
+}
+
 Tcl_Obj *Cookfs_PagesGetFilenameObj(Cookfs_Pages *p) {
     // We do not expect that the pages filename can be changed during
     // the life of the pages object. Thus, we don't require any locks.
@@ -744,6 +1158,8 @@ Cookfs_Pages *Cookfs_PagesInit(Tcl_Interp *interp, Tcl_Obj *fileName,
     rc->mxCache = NULL;
     rc->mxIO = NULL;
     rc->mxLockSoft = NULL;
+    Cookfs_LockStatsInit(&rc->statsCache);
+    Cookfs_LockStatsInit(&rc->statsIO);
     rc->threadId = Tcl_GetCurrentThread();
 #endif /* TCL_THREADS */
 
@@ -830,6 +1246,20 @@ Cookfs_Pages *Cookfs_PagesInit(Tcl_Interp *interp, Tcl_Obj *fileName,
     rc->cacheSize = 0;
     rc->cacheMaxAge = COOKFS_MAX_CACHE_AGE;
 
+    CookfsPagesStatsInit(&rc->stats, 0);
+
+    /* initialize access trace and prefetch */
+    rc->traceActive = 0;
+    rc->traceList = NULL;
+    rc->traceCount = 0;
+    rc->traceSize = 0;
+#ifdef TCL_THREADS
+    rc->prefetchThread = NULL;
+    rc->prefetchStop = 0;
+    rc->prefetchList = NULL;
+    rc->prefetchCount = 0;
+#endif /* TCL_THREADS */
+
     // initialize file
     const char *fileNameStr = Tcl_GetStringFromObj(fileName,
         &rc->fileNameLength);
@@ -1383,6 +1813,10 @@ void Cookfs_PagesFini(Cookfs_Pages *p) {
         return;
     }
 
+    // Ask the prefetch thread to stop before acquiring the exclusive lock
+    // so that it does not try to load any more pages.
+    Cookfs_PagesPrefetchStop(p);
+
     Cookfs_PagesLockExclusive(p);
 
     CookfsLog(printf("enter"));
@@ -1425,6 +1859,9 @@ void Cookfs_PagesFini(Cookfs_Pages *p) {
     }
 #endif /* COOKFS_USECALLBACKS */
 
+    /* clean up access trace */
+    Cookfs_PagesTraceFini(p);
+
     /* clean up compression information */
     Cookfs_PagesFiniCompr(p);
 
@@ -1458,6 +1895,10 @@ void Cookfs_PagesFini(Cookfs_Pages *p) {
     // read/write events. Let them go on and fail because of a dead object.
     Cookfs_PagesUnlock(p);
 
+    // The prefetch thread may be waiting for a lock. It was released above
+    // and the thread will terminate. Now we can wait for it.
+    Cookfs_PagesPrefetchJoin(p);
+
     if (p->lockSoft) {
         CookfsLog(printf("The page object is soft-locked"))
 #ifdef TCL_THREADS
@@ -1761,6 +2202,67 @@ int Cookfs_PageAddTclObj(Cookfs_Pages *p, Tcl_Obj *dataObj, Tcl_Obj **err) {
     return Cookfs_PageAddRaw(p, bytes, size, err);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PageAddIndexTclObj --
+ *
+ *      Same as Cookfs_PageAddTclObj, but the page contains fsindex data.
+ *      Such a page is encrypted only in COOKFS_ENCRYPT_KEY_INDEX mode,
+ *      in other modes it must be readable without a password in the same
+ *      way as the index stored in the archive suffix.
+ *
+ * Results:
+ *      Index that can be used in subsequent calls to Cookfs_PageGet()
+ *
+ * Side effects:
+ *      Waits until all pages queued for async compression are written
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_PageAddIndexTclObj(Cookfs_Pages *p, Tcl_Obj *dataObj,
+    Tcl_Obj **err)
+{
+#ifdef COOKFS_USECCRYPTO
+    Cookfs_PagesWantWrite(p);
+
+    if (p->dataAsidePages != NULL) {
+        CookfsLog(printf("Sending add command to asidePages"));
+        if (!Cookfs_PagesLockWrite(p->dataAsidePages, NULL)) {
+            return -1;
+        }
+        int rc = Cookfs_PageAddIndexTclObj(p->dataAsidePages, dataObj, err);
+        Cookfs_PagesUnlock(p->dataAsidePages);
+        return rc;
+    }
+
+    if (p->encryption == COOKFS_ENCRYPT_KEY_INDEX || !p->isEncryptionActive) {
+        return Cookfs_PageAddTclObj(p, dataObj, err);
+    }
+
+    CookfsLog(printf("disable encryption as it is not"
+        " COOKFS_ENCRYPT_KEY_INDEX"));
+
+#if defined(COOKFS_USECALLBACKS)
+    // Pages are encrypted when they are written. Make sure that pages
+    // queued before are encrypted and the index page is not.
+    while(Cookfs_AsyncCompressWait(p, 1)) {};
+#endif /* COOKFS_USECALLBACKS */
+
+    p->isEncryptionActive = 0;
+    int rc = Cookfs_PageAddTclObj(p, dataObj, err);
+#if defined(COOKFS_USECALLBACKS)
+    while(Cookfs_AsyncCompressWait(p, 1)) {};
+#endif /* COOKFS_USECALLBACKS */
+    p->isEncryptionActive = 1;
+
+    return rc;
+#else
+    return Cookfs_PageAddTclObj(p, dataObj, err);
+#endif /* COOKFS_USECCRYPTO */
+}
+
 void Cookfs_PagesCalculateHash(Cookfs_Pages *p, unsigned char *bytes,
     Tcl_Size size, unsigned char *output)
 {
@@ -1911,6 +2413,7 @@ int Cookfs_PageAddRaw(Cookfs_Pages *p, unsigned char *bytes, int objLength,
 
         if (isMatched) {
             CookfsLog(printf("Matched page (size=%d bytes) as %d", objLength, idx));
+            Cookfs_CounterAdd(&p->stats.dedupHits, 1);
             if (p->dataPagesIsAside) {
                 idx |= COOKFS_PAGES_ASIDE;
            }
@@ -2010,6 +2513,10 @@ Cookfs_PageObj Cookfs_PageGet(Cookfs_Pages *p, int index, int weight,
 
     CookfsLog(printf("index [%d] with weight [%d]", index, weight))
 
+    if (p->traceActive) {
+        Cookfs_PagesTraceRecord(p, index);
+    }
+
 #if defined(COOKFS_USECALLBACKS)
     int preloadIndex = index + 1;
     for (; preloadIndex < Cookfs_PagesGetLength(p) ; preloadIndex++) {
@@ -2023,6 +2530,7 @@ Cookfs_PageObj Cookfs_PageGet(Cookfs_Pages *p, int index, int weight,
 
     /* if cache is disabled, immediately get page */
     if (p->cacheSize <= 0) {
+        Cookfs_CounterAdd(&p->stats.cacheMisses, 1);
         rc = CookfsPagesPageGetInt(p, index, err);
         CookfsLog(printf("Returning directly [%p]", (void *)rc))
         goto done;
@@ -2039,30 +2547,33 @@ Cookfs_PageObj Cookfs_PageGet(Cookfs_Pages *p, int index, int weight,
 #endif /* COOKFS_USECALLBACKS */
 
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxCache);
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     rc = Cookfs_PageCacheGet(p, index, 1, weight);
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxCache);
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
 
     if (rc != NULL) {
+        Cookfs_CounterAdd(&p->stats.cacheHits, 1);
         Cookfs_PageObjIncrRefCount(rc);
         CookfsLog(printf("Returning from cache [%p]", (void *)rc));
         goto done;
     }
 
+    Cookfs_CounterAdd(&p->stats.cacheMisses, 1);
+
     /* get page and store it in cache */
     rc = CookfsPagesPageGetInt(p, index, err);
     CookfsLog(printf("Returning and caching [%p]", (void *)rc))
 
     if (rc != NULL) {
 #ifdef TCL_THREADS
-        Tcl_MutexLock(&p->mxCache);
+        Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
         Cookfs_PageCacheSet(p, index, rc, weight);
 #ifdef TCL_THREADS
-        Tcl_MutexUnlock(&p->mxCache);
+        Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     }
 
@@ -2264,7 +2775,7 @@ static void CookfsPagesPageCacheMoveToTop(Cookfs_Pages *p, int index) {
 
 int Cookfs_PagesTickTock(Cookfs_Pages *p) {
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxCache);
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     int maxAge = p->cacheMaxAge;
     for (int i = 0; i < p->cacheSize; i++) {
@@ -2273,7 +2784,7 @@ int Cookfs_PagesTickTock(Cookfs_Pages *p) {
         }
     }
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxCache);
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     return maxAge;
 }
@@ -2297,14 +2808,14 @@ int Cookfs_PagesTickTock(Cookfs_Pages *p) {
 
 int Cookfs_PagesSetMaxAge(Cookfs_Pages *p, int maxAge) {
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxCache);
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     if (maxAge >= 0) {
         p->cacheMaxAge = maxAge;
     }
     int ret = p->cacheMaxAge;
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxCache);
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     return ret;
 }
@@ -2355,7 +2866,7 @@ int Cookfs_PagesIsEncrypted(Cookfs_Pages *p, int index) {
 
 int Cookfs_PagesIsCached(Cookfs_Pages *p, int index) {
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxCache);
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     int ret = 0;
     for (int i = 0; i < p->cacheSize; i++) {
@@ -2365,7 +2876,7 @@ int Cookfs_PagesIsCached(Cookfs_Pages *p, int index) {
         }
     }
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxCache);
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     return ret;
 }
@@ -2633,7 +3144,7 @@ void Cookfs_PagesSetCacheSize(Cookfs_Pages *p, int size) {
     // p->mxCache mutex.
 
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxCache);
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
     if (size < 0) {
         size = 0;
@@ -2653,7 +3164,7 @@ void Cookfs_PagesSetCacheSize(Cookfs_Pages *p, int size) {
     }
     p->cacheSize = size;
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxCache);
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
 #endif /* TCL_THREADS */
 }
 
@@ -2827,6 +3338,167 @@ Tcl_WideInt Cookfs_PagesGetPageOffset(Cookfs_Pages *p, int idx) {
     return rc;
 }
 
+typedef struct CookfsPagesRange {
+    Tcl_WideInt start;
+    Tcl_WideInt end;
+} CookfsPagesRange;
+
+static int CookfsPagesRangeCompare(const void *a, const void *b) {
+    Tcl_WideInt startA = ((const CookfsPagesRange *)a)->start;
+    Tcl_WideInt startB = ((const CookfsPagesRange *)b)->start;
+    return (startA < startB ? -1 : (startA > startB ? 1 : 0));
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesReadahead --
+ *
+ *      Tells the operating system that the specified pages will be read
+ *      soon, so that it can start loading them from disk in the background
+ *      while the caller processes other pages. Pages that are adjacent
+ *      in the file or separated by less than COOKFS_READAHEAD_GAP bytes
+ *      are coalesced into a single range, so that the whole batch is
+ *      requested with a few calls.
+ *
+ *      For memory-mapped archives, posix_madvise(POSIX_MADV_WILLNEED) is
+ *      used. For archives opened as a channel, posix_fadvise() is used on
+ *      the channel's file descriptor. Where neither is available, this
+ *      function does nothing and pages are read synchronously when they
+ *      are requested.
+ *
+ *      Pages from add-aside archive and cached pages are skipped.
+ *
+ *      The caller must hold a lock on pages object.
+ *
+ * Results:
+ *      The number of bytes requested for readahead
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_WideInt Cookfs_PagesReadahead(Cookfs_Pages *p, const int *pages,
+    int count)
+{
+    Cookfs_PagesWantRead(p);
+
+#if defined(POSIX_MADV_WILLNEED) || defined(POSIX_FADV_WILLNEED)
+
+    int fd = -1;
+    if (p->fileData == NULL) {
+#ifdef POSIX_FADV_WILLNEED
+        ClientData handle;
+        if (p->fileChannel != NULL && Tcl_GetChannelHandle(p->fileChannel,
+            TCL_READABLE, &handle) == TCL_OK)
+        {
+            fd = (int)(intptr_t)handle;
+        }
+#endif /* POSIX_FADV_WILLNEED */
+        if (fd < 0) {
+            CookfsLog(printf("return: no file descriptor"));
+            return 0;
+        }
+    }
+#ifndef POSIX_MADV_WILLNEED
+    else {
+        CookfsLog(printf("return: madvise is not available"));
+        return 0;
+    }
+#endif /* POSIX_MADV_WILLNEED */
+
+    if (count < 1) {
+        return 0;
+    }
+
+    CookfsPagesRange *ranges =
+        (CookfsPagesRange *)ckalloc(sizeof(CookfsPagesRange) * count);
+    int rangesCount = 0;
+    int pagesCount = Cookfs_PagesGetLength(p);
+
+    for (int i = 0; i < count; i++) {
+        int index = pages[i];
+        if (COOKFS_PAGES_ISASIDE(index) || index < 0 || index >= pagesCount
+            || Cookfs_PagesIsCached(p, index))
+        {
+            continue;
+        }
+        int size = Cookfs_PgIndexGetSizeCompressed(p->pagesIndex, index);
+        if (size <= 0) {
+            continue;
+        }
+        ranges[rangesCount].start = Cookfs_PagesGetPageOffset(p, index);
+        ranges[rangesCount].end = ranges[rangesCount].start + size;
+        rangesCount++;
+    }
+
+    if (rangesCount > 1) {
+        qsort(ranges, rangesCount, sizeof(CookfsPagesRange),
+            CookfsPagesRangeCompare);
+    }
+
+    Tcl_WideInt pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0) {
+        pageSize = 4096;
+    }
+
+    Tcl_WideInt total = 0;
+    int i = 0;
+    while (i < rangesCount) {
+
+        Tcl_WideInt start = ranges[i].start;
+        Tcl_WideInt end = ranges[i].end;
+        for (i++; i < rangesCount &&
+            ranges[i].start <= end + COOKFS_READAHEAD_GAP; i++)
+        {
+            if (ranges[i].end > end) {
+                end = ranges[i].end;
+            }
+        }
+
+        // The address for posix_madvise() must be aligned to the size
+        // of a memory page
+        start -= start % pageSize;
+
+        int rc = -1;
+        if (p->fileData != NULL) {
+#ifdef POSIX_MADV_WILLNEED
+            if (end > p->fileSize) {
+                end = p->fileSize;
+            }
+            rc = posix_madvise(&p->fileData[start], end - start,
+                POSIX_MADV_WILLNEED);
+#endif /* POSIX_MADV_WILLNEED */
+        } else {
+#ifdef POSIX_FADV_WILLNEED
+            rc = posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+#endif /* POSIX_FADV_WILLNEED */
+        }
+
+        CookfsLog(printf("readahead %" TCL_LL_MODIFIER "d bytes at offset %"
+            TCL_LL_MODIFIER "d: %s", end - start, start,
+            (rc == 0 ? "ok" : "failed")));
+        if (rc == 0) {
+            total += end - start;
+        }
+
+    }
+
+    ckfree(ranges);
+
+    Cookfs_CounterAdd(&p->stats.readaheadBytes, total);
+    return total;
+
+#else
+    UNUSED(p);
+    UNUSED(pages);
+    UNUSED(count);
+    return 0;
+#endif /* POSIX_MADV_WILLNEED || POSIX_FADV_WILLNEED */
+}
+
 
 /* definitions of static and/or internal functions */
 
@@ -2895,7 +3567,17 @@ static Cookfs_PageObj CookfsPagesPageGetInt(Cookfs_Pages *p, int index,
 #endif /* COOKFS_USECALLBACKS */
 
 #ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mxIO);
+    // Pages of a memory-mapped archive are read without the IO mutex.
+    // There is no file position to share, and the archive cannot be
+    // remapped while pages are locked. So, threads can read and decompress
+    // different pages in parallel. Decompression by Tcl commands uses
+    // the interpreter and is still serialized.
+    int useIOMutex = (p->fileChannel != NULL ||
+        Cookfs_PgIndexGetCompression(p->pagesIndex, index) ==
+        COOKFS_COMPRESSION_CUSTOM);
+    if (useIOMutex) {
+        Cookfs_MutexLock(&p->mxIO, &p->statsIO);
+    }
 #endif /* TCL_THREADS */
     buffer = Cookfs_ReadPage(p,
         Cookfs_PagesGetPageOffset(p, index),
@@ -2907,7 +3589,9 @@ static Cookfs_PageObj CookfsPagesPageGetInt(Cookfs_Pages *p, int index,
         Cookfs_PgIndexGetEncryption(p->pagesIndex, index),
         err);
 #ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mxIO);
+    if (useIOMutex) {
+        Cookfs_MutexUnlock(&p->mxIO, &p->statsIO);
+    }
 #endif /* TCL_THREADS */
     if (buffer == NULL) {
         CookfsLog(printf("Unable to read page"))
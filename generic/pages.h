@@ -36,6 +36,7 @@ void Cookfs_PagesFini(Cookfs_Pages *p);
 int Cookfs_PageAddRaw(Cookfs_Pages *p, unsigned char *bytes, int objLength, Tcl_Obj **err);
 int Cookfs_PageAdd(Cookfs_Pages *p, Cookfs_PageObj dataObj, Tcl_Obj **err);
 int Cookfs_PageAddTclObj(Cookfs_Pages *p, Tcl_Obj *dataObj, Tcl_Obj **err);
+int Cookfs_PageAddIndexTclObj(Cookfs_Pages *p, Tcl_Obj *dataObj, Tcl_Obj **err);
 Cookfs_PageObj Cookfs_PageGet(Cookfs_Pages *p, int index, int weight, Tcl_Obj **err);
 Cookfs_PageObj Cookfs_PageCacheGet(Cookfs_Pages *p, int index, int update, int weight);
 void Cookfs_PageCacheSet(Cookfs_Pages *p, int idx, Cookfs_PageObj obj, int weight);
@@ -69,6 +70,11 @@ void Cookfs_PagesSetIndex(Cookfs_Pages *p, Cookfs_PageObj dataIndex);
 Cookfs_PageObj Cookfs_PagesGetIndex(Cookfs_Pages *p);
 
 Tcl_WideInt Cookfs_PagesGetPageOffset(Cookfs_Pages *p, int idx);
+Tcl_WideInt Cookfs_PagesReadahead(Cookfs_Pages *p, const int *pages,
+    int count);
+
+Tcl_Obj *Cookfs_PagesGetStatsObj(Cookfs_Pages *p);
+void Cookfs_PagesResetStats(Cookfs_Pages *p);
 
 int Cookfs_PagesSetMaxAge(Cookfs_Pages *p, int maxAge);
 int Cookfs_PagesTickTock(Cookfs_Pages *p);
@@ -97,6 +103,8 @@ Tcl_Obj *Cookfs_PagesGetPartObj(Cookfs_Pages *p,
     Cookfs_PagesPartsType part);
 Tcl_WideInt Cookfs_PagesPutPartToChannel(Cookfs_Pages *p,
     Cookfs_PagesPartsType part, Tcl_Channel chan);
+int Cookfs_PagesPutPageToChannel(Cookfs_Pages *p, int index, int weight,
+    int offset, int size, Tcl_Channel chan, Tcl_Obj **err);
 
 int Cookfs_PageAddStamp(Cookfs_Pages *p, Tcl_WideInt size);
 
@@ -124,6 +132,17 @@ int Cookfs_PagesUnlockSoft(Cookfs_Pages *p);
 
 void Cookfs_PagesLockExclusive(Cookfs_Pages *p);
 
+#ifdef TCL_THREADS
+typedef enum {
+    COOKFS_PAGES_LOCK_PAGES,
+    COOKFS_PAGES_LOCK_CACHE,
+    COOKFS_PAGES_LOCK_IO
+} Cookfs_PagesLockType;
+
+Cookfs_LockStats *Cookfs_PagesGetLockStats(Cookfs_Pages *p,
+    Cookfs_PagesLockType type);
+#endif /* TCL_THREADS */
+
 int Cookfs_HashFromObj(Tcl_Interp *interp, Tcl_Obj *obj,
     Cookfs_HashType *hashPtr);
 
@@ -495,7 +495,11 @@ Cookfs_PageObj Cookfs_ReadPage(Cookfs_Pages *p, Tcl_Size offset,
     int encrypted, Tcl_Obj **err)
 {
 
-    p->fileLastOp = COOKFS_LASTOP_READ;
+    // Memory-mapped archives can be read by multiple threads at the same
+    // time, don't touch the last operation in this case.
+    if (p->fileChannel != NULL) {
+        p->fileLastOp = COOKFS_LASTOP_READ;
+    }
 
     CookfsLog(printf("page with offset %" TCL_SIZE_MODIFIER "d compression:%d"
         " sizeCompressed:%d sizeUncompressed:%d decompress:%d encrypted:%d",
@@ -586,6 +590,9 @@ Cookfs_PageObj Cookfs_ReadPage(Cookfs_Pages *p, Tcl_Size offset,
 
 skipReading: ; // empty statement
 
+    Cookfs_CounterAdd(&p->stats.pagesRead, 1);
+    Cookfs_CounterAdd(&p->stats.bytesRead, sizeCompressed);
+
 #ifdef COOKFS_USECCRYPTO
 
     if (encrypted) {
@@ -633,6 +640,8 @@ decryptionFailed:
         *err = NULL;
     }
 
+    Tcl_WideInt startTime = Cookfs_CounterGetTime();
+
     switch (compression) {
     case COOKFS_COMPRESSION_ZLIB:
         rc = CookfsReadPageZlib(p, dataCompressed->buf, sizeCompressed,
@@ -675,6 +684,10 @@ decryptionFailed:
 
     Cookfs_PageObjBounceRefCount(dataCompressed);
 
+    int codec = COOKFS_PAGES_STATS_CODEC(compression);
+    Cookfs_CounterAdd(&p->stats.decompressTime[codec],
+        Cookfs_CounterGetTime() - startTime);
+
     if (rc != TCL_OK) {
         Cookfs_PageObjBounceRefCount(dataUncompressed);
         if (err == NULL) {
@@ -690,6 +703,8 @@ decryptionFailed:
         return NULL;
     }
 
+    Cookfs_CounterAdd(&p->stats.decompressBytes[codec], sizeUncompressed);
+
 skipUncompress: ; // empty statement
 
     if (!decompress) {
@@ -716,8 +731,11 @@ skipUncompress: ; // empty statement
         goto skipHashCheck;
     }
 
+    Tcl_WideInt hashStartTime = Cookfs_CounterGetTime();
     Cookfs_PagesCalculateHash(p, dataUncompressed->buf,
         Cookfs_PageObjSize(dataUncompressed), md5sum_current);
+    Cookfs_CounterAdd(&p->stats.hashTime,
+        Cookfs_CounterGetTime() - hashStartTime);
 
     if (memcmp(md5sum_current, md5hash, 16) != 0) {
         Cookfs_PageObjBounceRefCount(dataUncompressed);
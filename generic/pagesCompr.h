@@ -11,6 +11,11 @@
 /* let's gain at least 16 bytes and/or 5% to compress it */
 #define SHOULD_COMPRESS(p, origSize, size) ((p->alwaysCompress) || ((size < (origSize - 16)) && ((size) <= (origSize - (origSize / 20)))))
 
+/* names of available compression methods and their types, the list
+ * of types is terminated by -1 */
+extern const char *cookfsCompressionOptions[];
+extern const int cookfsCompressionOptionMap[];
+
 const char *Cookfs_CompressionGetName(Cookfs_CompressionType compression);
 
 Tcl_Obj *Cookfs_CompressionToObj(Cookfs_CompressionType compression,
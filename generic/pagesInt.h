@@ -55,6 +55,10 @@ enum {
 #define COOKFS_DEFAULT_CACHE_PAGES 4
 #define COOKFS_MAX_PRELOAD_PAGES 8
 #define COOKFS_MAX_CACHE_AGE 50
+#define COOKFS_MAX_TRACE_PAGES 4096
+// Pages separated by less than this number of bytes are requested
+// for readahead as a single range
+#define COOKFS_READAHEAD_GAP (64 * 1024)
 
 #define COOKFS_PAGES_MAX_ASYNC          64
 
@@ -63,6 +67,26 @@ typedef struct Cookfs_AsyncPage {
     Tcl_Obj *pageContents;
 } Cookfs_AsyncPage;
 
+// The number of compression types for which decompression statistics are
+// collected: none, zlib, bz2, lzma, zstd, brotli and custom
+#define COOKFS_PAGES_STATS_CODECS 7
+#define COOKFS_PAGES_STATS_CODEC(c) \
+    ((c) == COOKFS_COMPRESSION_CUSTOM ? COOKFS_PAGES_STATS_CODECS - 1 : (c))
+
+// Runtime statistics of pages, see Cookfs_PagesGetStatsObj(). Times are
+// in microseconds.
+typedef struct Cookfs_PagesStats {
+    Cookfs_Counter cacheHits;
+    Cookfs_Counter cacheMisses;
+    Cookfs_Counter pagesRead;
+    Cookfs_Counter bytesRead;
+    Cookfs_Counter hashTime;
+    Cookfs_Counter dedupHits;
+    Cookfs_Counter readaheadBytes;
+    Cookfs_Counter decompressBytes[COOKFS_PAGES_STATS_CODECS];
+    Cookfs_Counter decompressTime[COOKFS_PAGES_STATS_CODECS];
+} Cookfs_PagesStats;
+
 typedef struct Cookfs_CacheEntry {
     int pageIdx;
     int weight;
@@ -76,6 +100,8 @@ struct _Cookfs_Pages {
     Tcl_Mutex mxLockSoft;
     Tcl_Mutex mxCache;
     Tcl_Mutex mxIO;
+    Cookfs_LockStats statsCache;
+    Cookfs_LockStats statsIO;
     Tcl_ThreadId threadId;
 #endif /* TCL_THREADS */
     /* main interp */
@@ -162,6 +188,24 @@ struct _Cookfs_Pages {
     int cacheMaxAge;
     Cookfs_CacheEntry cache[COOKFS_MAX_CACHE_PAGES];
 
+    /* statistics */
+    Cookfs_PagesStats stats;
+
+    /* access trace */
+    int traceActive;
+    Tcl_Time traceDeadline;
+    int *traceList;
+    int traceCount;
+    int traceSize;
+
+#ifdef TCL_THREADS
+    /* prefetch */
+    Tcl_ThreadId prefetchThread;
+    int prefetchStop;
+    int *prefetchList;
+    int prefetchCount;
+#endif /* TCL_THREADS */
+
 #if defined(COOKFS_USECALLBACKS)
     /* async compress */
     Tcl_Obj *asyncCommandProcess;
@@ -0,0 +1,409 @@
+/*
+ * pagesTrace.c
+ *
+ * Provides functions for recording page access trace and prefetching
+ * pages according to previously recorded trace
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+#include "cookfs.h"
+#include "pagesTrace.h"
+#include "pagesInt.h"
+
+#define COOKFS_TRACE_INITIAL_SIZE 64
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesTraceStart --
+ *
+ *      Starts recording the order in which pages are accessed. Recording
+ *      stops automatically when the specified number of seconds has passed
+ *      or when COOKFS_MAX_TRACE_PAGES unique pages have been recorded.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Previously recorded trace is discarded
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesTraceStart(Cookfs_Pages *p, int seconds) {
+    CookfsLog(printf("start trace for %d seconds", seconds));
+#ifdef TCL_THREADS
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+    Tcl_GetTime(&p->traceDeadline);
+    p->traceDeadline.sec += seconds;
+    p->traceCount = 0;
+    p->traceActive = 1;
+#ifdef TCL_THREADS
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesTraceRecord --
+ *
+ *      Adds the specified page to the access trace if it is not already
+ *      there. Pages from add-aside archive are not recorded, since they
+ *      are not available on subsequent mounts.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Recording may be stopped if its deadline is reached or the trace
+ *      is full
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesTraceRecord(Cookfs_Pages *p, int index) {
+
+    if (COOKFS_PAGES_ISASIDE(index) || index < 0) {
+        return;
+    }
+
+#ifdef TCL_THREADS
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+
+    if (!p->traceActive) {
+        goto done;
+    }
+
+    Tcl_Time now;
+    Tcl_GetTime(&now);
+    if (now.sec > p->traceDeadline.sec || (now.sec == p->traceDeadline.sec
+        && now.usec >= p->traceDeadline.usec))
+    {
+        CookfsLog(printf("trace deadline reached, stop recording with"
+            " %d pages", p->traceCount));
+        p->traceActive = 0;
+        goto done;
+    }
+
+    for (int i = 0; i < p->traceCount; i++) {
+        if (p->traceList[i] == index) {
+            goto done;
+        }
+    }
+
+    if (p->traceCount == p->traceSize) {
+        int newSize = (p->traceSize ? p->traceSize * 2 :
+            COOKFS_TRACE_INITIAL_SIZE);
+        if (newSize > COOKFS_MAX_TRACE_PAGES) {
+            newSize = COOKFS_MAX_TRACE_PAGES;
+        }
+        p->traceList = (int *)ckrealloc(p->traceList,
+            sizeof(int) * newSize);
+        p->traceSize = newSize;
+    }
+
+    CookfsLog(printf("record page #%d at position %d", index,
+        p->traceCount));
+    p->traceList[p->traceCount++] = index;
+
+    if (p->traceCount == COOKFS_MAX_TRACE_PAGES) {
+        CookfsLog(printf("trace is full, stop recording"));
+        p->traceActive = 0;
+    }
+
+done:
+#ifdef TCL_THREADS
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+    return;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesTraceGetObj --
+ *
+ *      Returns the recorded access trace as a list of page indexes
+ *
+ * Results:
+ *      Tcl list object with zero refcount or NULL if nothing was recorded
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj *Cookfs_PagesTraceGetObj(Cookfs_Pages *p) {
+    Tcl_Obj *rc = NULL;
+#ifdef TCL_THREADS
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+    if (p->traceCount) {
+        rc = Tcl_NewListObj(0, NULL);
+        for (int i = 0; i < p->traceCount; i++) {
+            Tcl_ListObjAppendElement(NULL, rc,
+                Tcl_NewIntObj(p->traceList[i]));
+        }
+    }
+#ifdef TCL_THREADS
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
+#endif /* TCL_THREADS */
+    CookfsLog(printf("return: %s", rc == NULL ? "NULL" : "list"));
+    return rc;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesTraceFini --
+ *
+ *      Releases memory used by access trace
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesTraceFini(Cookfs_Pages *p) {
+    p->traceActive = 0;
+    if (p->traceList != NULL) {
+        ckfree(p->traceList);
+        p->traceList = NULL;
+    }
+    p->traceCount = 0;
+    p->traceSize = 0;
+}
+
+#ifdef TCL_THREADS
+
+static Tcl_ThreadCreateType CookfsPagesPrefetchThread(ClientData clientData) {
+
+    Cookfs_Pages *p = (Cookfs_Pages *)clientData;
+
+    CookfsLog(printf("prefetch thread started for %d pages",
+        p->prefetchCount));
+
+    for (int i = 0; i < p->prefetchCount; i++) {
+
+        Cookfs_MutexLock(&p->mxCache, &p->statsCache);
+        int isStop = p->prefetchStop;
+        Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
+
+        if (isStop) {
+            CookfsLog(printf("stop request received"));
+            break;
+        }
+
+        // This lock fails if pages object is being terminated
+        if (!Cookfs_PagesLockRead(p, NULL)) {
+            CookfsLog(printf("unable to lock pages"));
+            break;
+        }
+
+        int index = p->prefetchList[i];
+        if (!Cookfs_PagesIsCached(p, index)) {
+            CookfsLog(printf("prefetch page #%d", index));
+            Cookfs_PageObj pg = Cookfs_PageGet(p, index, 1, NULL);
+            if (pg != NULL) {
+                Cookfs_PageObjDecrRefCount(pg);
+            }
+        }
+
+        Cookfs_PagesUnlock(p);
+
+    }
+
+    CookfsLog(printf("prefetch thread finished"));
+
+    Tcl_ExitThread(TCL_OK);
+    TCL_THREAD_CREATE_RETURN;
+
+}
+
+#endif /* TCL_THREADS */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesPrefetchStart --
+ *
+ *      Starts a background thread that loads pages from the specified
+ *      access trace into the pages cache in the recorded order.
+ *
+ *      Prefetching is only possible when the archive is mapped to memory,
+ *      since the file channel cannot be shared between threads, and when
+ *      no Tcl callbacks are used for decompression. The number of pages
+ *      is limited to the cache size, as prefetching more pages would
+ *      only evict the ones already prefetched.
+ *
+ *      The caller must hold a lock on pages object.
+ *
+ * Results:
+ *      1 if the prefetch thread has been started; 0 otherwise
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_PagesPrefetchStart(Cookfs_Pages *p, Tcl_Obj *traceObj) {
+#ifdef TCL_THREADS
+
+    if (p->prefetchThread != NULL) {
+        CookfsLog(printf("return: prefetch thread is already running"));
+        return 0;
+    }
+
+    if (p->fileData == NULL) {
+        CookfsLog(printf("return: archive is not mapped to memory"));
+        return 0;
+    }
+
+#if defined(COOKFS_USECALLBACKS)
+    if (p->decompressCommandPtr != NULL
+        || p->asyncDecompressCommandPtr != NULL)
+    {
+        CookfsLog(printf("return: decompress callbacks are defined"));
+        return 0;
+    }
+#endif /* COOKFS_USECALLBACKS */
+
+    if (p->cacheSize <= 0) {
+        CookfsLog(printf("return: cache is disabled"));
+        return 0;
+    }
+
+    Tcl_Size traceCount;
+    Tcl_Obj **traceList;
+    if (Tcl_ListObjGetElements(NULL, traceObj, &traceCount, &traceList)
+        != TCL_OK)
+    {
+        CookfsLog(printf("return: malformed trace"));
+        return 0;
+    }
+
+    int pagesCount = Cookfs_PagesGetLength(p);
+    p->prefetchList = (int *)ckalloc(sizeof(int) * p->cacheSize);
+    p->prefetchCount = 0;
+
+    for (Tcl_Size i = 0; i < traceCount && p->prefetchCount < p->cacheSize;
+        i++)
+    {
+        int index;
+        if (Tcl_GetIntFromObj(NULL, traceList[i], &index) != TCL_OK
+            || index < 0 || index >= pagesCount)
+        {
+            CookfsLog(printf("skip malformed or unknown page in trace"));
+            continue;
+        }
+        p->prefetchList[p->prefetchCount++] = index;
+    }
+
+    if (!p->prefetchCount) {
+        CookfsLog(printf("return: no pages to prefetch"));
+        goto error;
+    }
+
+    // Request all pages at once, so the prefetch thread doesn't wait
+    // for the disk when it loads them one by one
+    Cookfs_PagesReadahead(p, p->prefetchList, p->prefetchCount);
+
+    p->prefetchStop = 0;
+    if (Tcl_CreateThread(&p->prefetchThread, CookfsPagesPrefetchThread, p,
+        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK)
+    {
+        CookfsLog(printf("return: failed to create a thread"));
+        p->prefetchThread = NULL;
+        goto error;
+    }
+
+    CookfsLog(printf("return: prefetch thread has been started"));
+    return 1;
+
+error:
+    ckfree(p->prefetchList);
+    p->prefetchList = NULL;
+    p->prefetchCount = 0;
+    return 0;
+
+#else
+    UNUSED(p);
+    UNUSED(traceObj);
+    return 0;
+#endif /* TCL_THREADS */
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesPrefetchStop --
+ *
+ *      Requests the prefetch thread to stop. It will stop before loading
+ *      the next page.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesPrefetchStop(Cookfs_Pages *p) {
+#ifdef TCL_THREADS
+    Cookfs_MutexLock(&p->mxCache, &p->statsCache);
+    p->prefetchStop = 1;
+    Cookfs_MutexUnlock(&p->mxCache, &p->statsCache);
+#else
+    UNUSED(p);
+#endif /* TCL_THREADS */
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PagesPrefetchJoin --
+ *
+ *      Waits for the prefetch thread to finish and releases its resources.
+ *
+ *      This function must not be called while the pages object is locked
+ *      by the current thread, as the prefetch thread may be waiting
+ *      for the lock.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void Cookfs_PagesPrefetchJoin(Cookfs_Pages *p) {
+#ifdef TCL_THREADS
+    if (p->prefetchThread == NULL) {
+        return;
+    }
+    CookfsLog(printf("wait for prefetch thread..."));
+    int result;
+    Tcl_JoinThread(p->prefetchThread, &result);
+    CookfsLog(printf("prefetch thread has been terminated"));
+    p->prefetchThread = NULL;
+    ckfree(p->prefetchList);
+    p->prefetchList = NULL;
+    p->prefetchCount = 0;
+#else
+    UNUSED(p);
+#endif /* TCL_THREADS */
+}
@@ -0,0 +1,21 @@
+/*
+   (c) 2024 Konstantin Kushnir
+*/
+
+#ifndef COOKFS_PAGESTRACE_H
+#define COOKFS_PAGESTRACE_H 1
+
+#include "pages.h"
+
+#define COOKFS_ACCESSTRACE_METADATA_KEY "cookfs.accesstrace"
+
+void Cookfs_PagesTraceStart(Cookfs_Pages *p, int seconds);
+void Cookfs_PagesTraceRecord(Cookfs_Pages *p, int index);
+Tcl_Obj *Cookfs_PagesTraceGetObj(Cookfs_Pages *p);
+void Cookfs_PagesTraceFini(Cookfs_Pages *p);
+
+int Cookfs_PagesPrefetchStart(Cookfs_Pages *p, Tcl_Obj *traceObj);
+void Cookfs_PagesPrefetchStop(Cookfs_Pages *p);
+void Cookfs_PagesPrefetchJoin(Cookfs_Pages *p);
+
+#endif /* COOKFS_PAGESTRACE_H */
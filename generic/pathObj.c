@@ -10,36 +10,19 @@
 
 void Cookfs_PathObjIncrRefCount(Cookfs_PathObj *p) {
     // CookfsLog(printf("%p", (void *)p));
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mx);
-#endif /* TCL_THREADS */
-    p->refCount++;
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mx);
-#endif /* TCL_THREADS */
+    Cookfs_RefCountIncr(&p->refCount);
 }
 
 void Cookfs_PathObjDecrRefCount(Cookfs_PathObj *p) {
     // CookfsLog(printf("%p", (void *)p));
-#ifdef TCL_THREADS
-    Tcl_MutexLock(&p->mx);
-#endif /* TCL_THREADS */
-    // We need to know what refCount value was at the time the mutex was
-    // locked. Thus, we make a local copy of this value. We cannot rely on
-    // the value of p->refCount after unlocking the mutex, because
-    // it is possible that another thread decreased p->refCount after we
-    // did the unlock, but before we check if p->refCount is 0.
-    // This will mean that these 2 threads will think that p->refCount is 0,
-    // and these 2 threads will try to free the path. This will cause memory
-    // to be double freed.
-    int refCount = --p->refCount;
-#ifdef TCL_THREADS
-    Tcl_MutexUnlock(&p->mx);
-#endif /* TCL_THREADS */
+    // We need to know what refCount value was at the time of decrement.
+    // We cannot rely on the value of p->refCount after that, because
+    // it is possible that another thread decreased p->refCount after us,
+    // but before we check if p->refCount is 0. This will mean that these
+    // 2 threads will think that p->refCount is 0, and these 2 threads will
+    // try to free the path. This will cause memory to be double freed.
+    int refCount = Cookfs_RefCountDecr(&p->refCount);
     if (!refCount) {
-#ifdef TCL_THREADS
-        Tcl_MutexFinalize(&p->mx);
-#endif /* TCL_THREADS */
         ckfree(p);
     }
 }
@@ -48,6 +31,34 @@ Tcl_Obj *Cookfs_PathObjGetFullnameObj(Cookfs_PathObj *p) {
     return Tcl_NewStringObj(p->fullName, p->fullNameLength);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_PathObjNameHash --
+ *
+ *      Calculates the hash of a path element (FNV-1a). Path objects store
+ *      hashes of their elements, and fsindex uses the same hash for names
+ *      of entries, so a path is hashed only once for lookups in all
+ *      directories.
+ *
+ * Results:
+ *      Hash value
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+unsigned int Cookfs_PathObjNameHash(const char *name, int length) {
+    unsigned int hash = 2166136261U;
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 Cookfs_PathObj *Cookfs_PathObjNewFromTclObj(Tcl_Obj *path) {
     Tcl_Size pathLength;
     const char *pathStr = Tcl_GetStringFromObj(path, &pathLength);
@@ -84,10 +95,9 @@ Cookfs_PathObj *Cookfs_PathObjNewFromStr(const char* pathStr,
     // We need to alloc our object now. We need the following buffer:
     //     Cookfs_PathObj +
     //     Cookfs_PathObjElement * elementCount +
-    //     file name + \0 +
-    //     filename0 + \0 (See comment about filename0 in pathObj.h)
+    //     file name + \0
     Cookfs_PathObj *rc = ckalloc(sizeof(Cookfs_PathObj) +
-        sizeof(Cookfs_PathObjElement) * elementCount + (pathLength + 1) * 2);
+        sizeof(Cookfs_PathObjElement) * elementCount + pathLength + 1);
     if (rc == NULL) {
         Tcl_Panic("failed to alloc pathObj");
         // Tcl_Panic will not return, but we have to return here something to
@@ -96,25 +106,16 @@ Cookfs_PathObj *Cookfs_PathObjNewFromStr(const char* pathStr,
     }
 
     // Fill general properties
-#ifdef TCL_THREADS
-    rc->mx = NULL;
-#endif /* TCL_THREADS */
-    rc->refCount = 0;
+    Cookfs_RefCountInit(&rc->refCount, 0);
     rc->fullName = (char *)rc + sizeof(Cookfs_PathObj) +
         sizeof(Cookfs_PathObjElement) * elementCount;
-    // See comment about filename0 in pathObj.h
-    rc->fullName0 = rc->fullName + pathLength + 1;
-    memcpy(rc->fullName0, pathStr, pathLength + 1);
     memcpy(rc->fullName, pathStr, pathLength + 1);
     rc->fullNameLength = pathLength;
     rc->elementCount = elementCount;
 
-    // See comment about name0 in pathObj.h
-
     if (pathLength) {
         // Fill elements
         char *lastElementStr = rc->fullName;
-        char *lastElementStr0 = rc->fullName0;
         int currentElement = 0;
         int currentElementLength = 0;
         for (i = 0; i < pathLength; i++) {
@@ -126,13 +127,12 @@ Cookfs_PathObj *Cookfs_PathObjNewFromStr(const char* pathStr,
             // Save information about the previous element
             // CookfsLog(printf("found element #%d length %d", currentElement,
             //     currentElementLength));
-            rc->fullName0[i] = '\0';
             rc->element[currentElement].name = lastElementStr;
-            rc->element[currentElement].name0 = lastElementStr0;
             rc->element[currentElement].length = currentElementLength;
+            rc->element[currentElement].hash = Cookfs_PathObjNameHash(
+                lastElementStr, currentElementLength);
             // Reset current element
             lastElementStr = &rc->fullName[i + 1];
-            lastElementStr0 = &rc->fullName0[i + 1];
             currentElement++;
             currentElementLength = 0;
         }
@@ -143,8 +143,9 @@ Cookfs_PathObj *Cookfs_PathObjNewFromStr(const char* pathStr,
         //     lastElementStr, currentElementLength));
         // Also, save information about the last element
         rc->element[currentElement].name = lastElementStr;
-        rc->element[currentElement].name0 = lastElementStr0;
         rc->element[currentElement].length = currentElementLength;
+        rc->element[currentElement].hash = Cookfs_PathObjNameHash(
+            lastElementStr, currentElementLength);
     } else {
         // CookfsLog(printf("the path is empty"));
         rc->tailName = rc->fullName;
@@ -14,21 +14,30 @@
 // of memory.
 #define COOKFS_PGINDEX_ALLOC_SIZE 256
 
+// Fields that are needed to read a page. They are kept apart from
+// the MD5 hash and the compression level, which are only used when adding
+// pages and exporting the index, so that a page lookup touches a single
+// entry of 24 bytes.
 struct Cookfs_PgIndexEntry {
-    Cookfs_CompressionType compression;
-    int compressionLevel;
-    int encryption;
-    unsigned char hashMD5[16];
+    Tcl_WideInt offset;
     int sizeCompressed;
     int sizeUncompressed;
-    Tcl_WideInt offset;
+    Cookfs_CompressionType compression;
+    int encryption;
 };
 
 struct _Cookfs_PgIndex {
     int pagesCount;
     int pagesAllocated;
+    // Number of pages at the beginning of the index with known offsets.
+    // Offsets are calculated as a prefix sum of compressed sizes as soon
+    // as the size of the previous page is known.
+    int offsetsCount;
     Cookfs_PgIndexEntry *data;
+    unsigned char (*hashMD5)[16];
+    int *compressionLevel;
     Cookfs_PgIndexEntry special[COOKFS_PGINDEX_SPECIAL_PAGE_TYPE_COUNT];
+    int specialCompressionLevel[COOKFS_PGINDEX_SPECIAL_PAGE_TYPE_COUNT];
 };
 
 TYPEDEF_ENUM_COUNT(Cookfs_PgIndexPageInfoKeys, COOKFS_PGINDEX_INFO_KEY_COUNT,
@@ -73,6 +82,7 @@ void CookfsPgIndexThreadExit(ClientData clientData) {
 Tcl_Obj *Cookfs_PgIndexGetInfo(Cookfs_PgIndex *pgi, int num) {
 
     Cookfs_PgIndexEntry *pge;
+    int compressionLevel;
     // initialize specialIndex to avoid compiler warning
     int specialIndex = 0;
 
@@ -85,6 +95,7 @@ Tcl_Obj *Cookfs_PgIndexGetInfo(Cookfs_PgIndex *pgi, int num) {
         CookfsLog(printf("info about page #%d", num));
         assert(num < pgi->pagesCount);
         pge = pgi->data + num;
+        compressionLevel = pgi->compressionLevel[num];
     } else {
 
         specialIndex = -1 - num;
@@ -100,6 +111,7 @@ Tcl_Obj *Cookfs_PgIndexGetInfo(Cookfs_PgIndex *pgi, int num) {
             specialIndex < COOKFS_PGINDEX_SPECIAL_PAGE_TYPE_COUNT);
 
         pge = &pgi->special[specialIndex];
+        compressionLevel = pgi->specialCompressionLevel[specialIndex];
 
     }
 
@@ -141,7 +153,7 @@ Tcl_Obj *Cookfs_PgIndexGetInfo(Cookfs_PgIndex *pgi, int num) {
             break;
         case COOKFS_PGINDEX_INFO_KEY_COMPRESSION:
             val = Cookfs_CompressionToObj(pge->compression,
-                pge->compressionLevel);
+                compressionLevel);
             break;
         case COOKFS_PGINDEX_INFO_KEY_INDEX:
             if (num < 0) {
@@ -163,8 +175,7 @@ Tcl_Obj *Cookfs_PgIndexGetInfo(Cookfs_PgIndex *pgi, int num) {
 
 unsigned char *Cookfs_PgIndexGetHashMD5(Cookfs_PgIndex *pgi, int num) {
     assert(num >= 0 && num < pgi->pagesCount);
-    Cookfs_PgIndexEntry *pge = pgi->data + num;
-    return pge->hashMD5;
+    return pgi->hashMD5[num];
 }
 
 Tcl_Obj *Cookfs_PgIndexGetCompressionObj(Cookfs_PgIndex *pgi,
@@ -172,7 +183,8 @@ Tcl_Obj *Cookfs_PgIndexGetCompressionObj(Cookfs_PgIndex *pgi,
 {
     assert(num >= 0 && num < pgi->pagesCount);
     Cookfs_PgIndexEntry *pge = pgi->data + num;
-    return Cookfs_CompressionToObj(pge->compression, pge->compressionLevel);
+    return Cookfs_CompressionToObj(pge->compression,
+        pgi->compressionLevel[num]);
 }
 
 Cookfs_CompressionType Cookfs_PgIndexGetCompression(Cookfs_PgIndex *pgi,
@@ -191,8 +203,7 @@ int Cookfs_PgIndexGetEncryption(Cookfs_PgIndex *pgi, int num) {
 
 int Cookfs_PgIndexGetCompressionLevel(Cookfs_PgIndex *pgi, int num) {
     assert(num >= 0 && num < pgi->pagesCount);
-    Cookfs_PgIndexEntry *pge = pgi->data + num;
-    return pge->compressionLevel;
+    return pgi->compressionLevel[num];
 }
 
 int Cookfs_PgIndexGetSizeCompressed(Cookfs_PgIndex *pgi, int num) {
@@ -219,29 +230,40 @@ Tcl_WideInt Cookfs_PgIndexGetEndOffset(Cookfs_PgIndex *pgi, int num) {
 
 Tcl_WideInt Cookfs_PgIndexGetStartOffset(Cookfs_PgIndex *pgi, int num) {
     assert(num >= 0 && num <= pgi->pagesCount);
+    if (num < pgi->offsetsCount) {
+        return pgi->data[num].offset;
+    }
     // If we want to get the offset of the first page, it is always 0.
     // Also, this case will work if the total number of pages is zero and
     // we want to get the 0th page offset.
     if (num == 0) {
         return 0;
     }
-    Cookfs_PgIndexEntry *pge = pgi->data + num;
-    // If we want to get an offset beyond the available pages, that means we
-    // want to get the offset of the end of the last page. If we want to get
-    // the offset of an existing page, but it is not yet known, we will
-    // calculate it based on the previous page.
-    if (num >= pgi->pagesCount || pge->offset < 0) {
-        Tcl_WideInt offsetEndPrevious = Cookfs_PgIndexGetEndOffset(pgi, num - 1);
-        // If we want to get an offset beyond the available pages, just return
-        // the offset of the end of the last page.
-        if (num >= pgi->pagesCount) {
-            return offsetEndPrevious;
+    // If we are here, then the size of the page preceding the first page
+    // with unknown offset is unknown, or we want to get the offset beyond
+    // the available pages, i.e. the offset of the end of the last page.
+    // Cookfs_PgIndexGetEndOffset() will return the end offset if
+    // the size of the last page is known and will panic otherwise.
+    return Cookfs_PgIndexGetEndOffset(pgi, num > pgi->offsetsCount ?
+        pgi->offsetsCount - 1 : num - 1);
+}
+
+static void CookfsPgIndexUpdateOffsets(Cookfs_PgIndex *pgi) {
+    if (pgi->offsetsCount == 0) {
+        if (pgi->pagesCount == 0) {
+            return;
         }
-        // If we are here, that means we are getting an offset of an existing
-        // page. We have to update it in the page entry.
-        pge->offset = offsetEndPrevious;
+        pgi->data[0].offset = 0;
+        pgi->offsetsCount = 1;
+    }
+    Cookfs_PgIndexEntry *pge = pgi->data + pgi->offsetsCount;
+    while (pgi->offsetsCount < pgi->pagesCount &&
+        pge[-1].sizeCompressed >= 0)
+    {
+        pge->offset = pge[-1].offset + pge[-1].sizeCompressed;
+        pgi->offsetsCount++;
+        pge++;
     }
-    return pge->offset;
 }
 
 void Cookfs_PgIndexSetCompression(Cookfs_PgIndex *pgi, int num,
@@ -252,7 +274,7 @@ void Cookfs_PgIndexSetCompression(Cookfs_PgIndex *pgi, int num,
     CookfsLog(printf("page#%d: set compression %d, compression level %d",
         num, compression, compressionLevel));
     pge->compression = compression;
-    pge->compressionLevel = compressionLevel;
+    pgi->compressionLevel[num] = compressionLevel;
 }
 
 void Cookfs_PgIndexSetEncryption(Cookfs_PgIndex *pgi, int num, int encryption) {
@@ -265,10 +287,17 @@ void Cookfs_PgIndexSetEncryption(Cookfs_PgIndex *pgi, int num, int encryption) {
 void Cookfs_PgIndexSetSizeCompressed(Cookfs_PgIndex *pgi, int num,
     int sizeCompressed)
 {
+    assert(num >= 0 && num < pgi->pagesCount);
     Cookfs_PgIndexEntry *pge = pgi->data + num;
     CookfsLog(printf("page#%d: set compressed size %d", num,
         sizeCompressed));
     pge->sizeCompressed = sizeCompressed;
+    // Offsets of the following pages depend on the size of this page.
+    // Forget them and calculate them again.
+    if (pgi->offsetsCount > num + 1) {
+        pgi->offsetsCount = num + 1;
+    }
+    CookfsPgIndexUpdateOffsets(pgi);
 }
 
 int Cookfs_PgIndexSearchByMD5(Cookfs_PgIndex *pgi, unsigned char *hashMD5,
@@ -278,7 +307,7 @@ int Cookfs_PgIndexSearchByMD5(Cookfs_PgIndex *pgi, unsigned char *hashMD5,
     Cookfs_PgIndexEntry *pge = pgi->data + currentIndex;
     while (currentIndex < pgi->pagesCount) {
         if (pge->sizeUncompressed == sizeUncompressed &&
-            memcmp(pge->hashMD5, hashMD5, 16) == 0)
+            memcmp(pgi->hashMD5[currentIndex], hashMD5, 16) == 0)
         {
             *index = currentIndex;
             return 1;
@@ -310,18 +339,32 @@ Cookfs_PgIndex *Cookfs_PgIndexInit(unsigned int initialPagesCount) {
 
     pgi->data = (Cookfs_PgIndexEntry *)ckalloc(sizeof(Cookfs_PgIndexEntry)
         * allocPagesCount);
-    if (pgi->data == NULL) {
+    pgi->hashMD5 = (unsigned char (*)[16])ckalloc(16 * allocPagesCount);
+    pgi->compressionLevel = (int *)ckalloc(sizeof(int) * allocPagesCount);
+    if (pgi->data == NULL || pgi->hashMD5 == NULL ||
+        pgi->compressionLevel == NULL)
+    {
         CookfsLog(printf("ERROR: failed to alloc Cookfs_PgIndex->data"));
+        if (pgi->data != NULL) {
+            ckfree(pgi->data);
+        }
+        if (pgi->hashMD5 != NULL) {
+            ckfree(pgi->hashMD5);
+        }
+        if (pgi->compressionLevel != NULL) {
+            ckfree(pgi->compressionLevel);
+        }
         ckfree(pgi);
         return NULL;
     }
 
     pgi->pagesCount = initialPagesCount;
     pgi->pagesAllocated = allocPagesCount;
+    pgi->offsetsCount = 0;
 
     for (int i = 0; i < COOKFS_PGINDEX_SPECIAL_PAGE_TYPE_COUNT; i++) {
         pgi->special[i].compression = COOKFS_COMPRESSION_NONE;
-        pgi->special[i].compressionLevel = 0;
+        pgi->specialCompressionLevel[i] = 0;
         pgi->special[i].encryption = 0;
         pgi->special[i].sizeCompressed = -1;
         pgi->special[i].sizeUncompressed = -1;
@@ -336,6 +379,8 @@ Cookfs_PgIndex *Cookfs_PgIndexInit(unsigned int initialPagesCount) {
 void Cookfs_PgIndexFini(Cookfs_PgIndex *pgi) {
     CookfsLog(printf("release [%p]", (void *)pgi));
     ckfree(pgi->data);
+    ckfree(pgi->hashMD5);
+    ckfree(pgi->compressionLevel);
     ckfree(pgi);
 }
 
@@ -354,7 +399,7 @@ void Cookfs_PgIndexAddPageSpecial(Cookfs_PgIndex *pgi,
         "UNKNOWN"));
 
     pgi->special[type].compression = compression;
-    pgi->special[type].compressionLevel = compressionLevel;
+    pgi->specialCompressionLevel[type] = compressionLevel;
     pgi->special[type].encryption = encryption;
     pgi->special[type].sizeCompressed = sizeCompressed;
     pgi->special[type].sizeUncompressed = sizeUncompressed;
@@ -381,36 +426,40 @@ int Cookfs_PgIndexAddPage(Cookfs_PgIndex *pgi,
 
         pgi->data = (Cookfs_PgIndexEntry *)ckrealloc(pgi->data,
             sizeof(Cookfs_PgIndexEntry) * pgi->pagesAllocated);
+        pgi->hashMD5 = (unsigned char (*)[16])ckrealloc(pgi->hashMD5,
+            16 * pgi->pagesAllocated);
+        pgi->compressionLevel = (int *)ckrealloc(pgi->compressionLevel,
+            sizeof(int) * pgi->pagesAllocated);
 
-        if (pgi->data == NULL) {
+        if (pgi->data == NULL || pgi->hashMD5 == NULL ||
+            pgi->compressionLevel == NULL)
+        {
             Tcl_Panic("Cookfs_PgIndexAddPage() failed to alloc");
             return -1;
         }
 
     }
 
-    Cookfs_PgIndexEntry *pge = pgi->data + pgi->pagesCount;
+    int num = pgi->pagesCount;
+    Cookfs_PgIndexEntry *pge = pgi->data + num;
 
     pge->compression = compression;
-    pge->compressionLevel = compressionLevel;
     pge->encryption = encryption;
     pge->sizeCompressed = sizeCompressed;
     pge->sizeUncompressed = sizeUncompressed;
+    // The actual offset will be set by CookfsPgIndexUpdateOffsets() when
+    // the size of the previous page is known.
+    pge->offset = -1;
 
-    if (pgi->pagesCount == 0) {
-        pge->offset = 0;
-    } else {
-        // The actual offset will be calculated later when it is needed.
-        pge->offset = -1;
-    }
+    pgi->compressionLevel[num] = compressionLevel;
+    memcpy(pgi->hashMD5[num], hashMD5, 16);
 
-    memcpy(pge->hashMD5, hashMD5, 16);
+    pgi->pagesCount++;
+    CookfsPgIndexUpdateOffsets(pgi);
 
-    CookfsLog(printf("return: ok - page#%d", pgi->pagesCount));
+    CookfsLog(printf("return: ok - page#%d", num));
 
-    // Return the current value of pagesCount as the page index, and then
-    // increment the total number of pages.
-    return pgi->pagesCount++;
+    return num;
 
 }
 
@@ -476,11 +525,11 @@ not_malformed: ; // empty statement
     for (unsigned int i = 0; i < pagesCount; i++, pge++) {
 
         pge->compression = (Cookfs_CompressionType)bytes[0 + i];
-        pge->compressionLevel = bytes[(1 * pagesCount) + i];
+        pgi->compressionLevel[i] = bytes[(1 * pagesCount) + i];
         pge->encryption = bytes[(2 * pagesCount) + i];
         Cookfs_Binary2Int(&bytes[(3 * pagesCount) + (i * 4)], &pge->sizeCompressed, 1);
         Cookfs_Binary2Int(&bytes[(7 * pagesCount) + (i * 4)], &pge->sizeUncompressed, 1);
-        memcpy(pge->hashMD5, &bytes[(11 * pagesCount) + (i * 16)], 16);
+        memcpy(pgi->hashMD5[i], &bytes[(11 * pagesCount) + (i * 16)], 16);
 
         pge->offset = offset;
         offset += pge->sizeCompressed;
@@ -488,11 +537,13 @@ not_malformed: ; // empty statement
         CookfsLog(printf("import entry #%u - compression: %d, level: %d,"
             " encryption: %d, sizeCompressed: %d, sizeUncompressed: %d,"
             " MD5[" PRINTF_MD5_FORMAT "]", i, (int)pge->compression,
-            pge->compressionLevel, pge->encryption, pge->sizeCompressed,
-            pge->sizeUncompressed, PRINTF_MD5_VAR(pge->hashMD5)));
+            pgi->compressionLevel[i], pge->encryption, pge->sizeCompressed,
+            pge->sizeUncompressed, PRINTF_MD5_VAR(pgi->hashMD5[i])));
 
     }
 
+    pgi->offsetsCount = pagesCount;
+
     CookfsLog(printf("return: ok"));
 
     return pgi;
@@ -530,17 +581,17 @@ Cookfs_PageObj Cookfs_PgIndexExport(Cookfs_PgIndex *pgi) {
     Cookfs_PgIndexEntry *pge = pgi->data;
     for (unsigned int i = 0; i < pagesCount; i++, pge++) {
         buf[0 + i] = (unsigned char)pge->compression;
-        buf[idxCompressionLevel + i] = pge->compressionLevel;
+        buf[idxCompressionLevel + i] = pgi->compressionLevel[i];
         buf[idxEncryption + i] = pge->encryption;
         Cookfs_Int2Binary(&pge->sizeCompressed, &buf[idxSizeCompressed + (i * 4)], 1);
         Cookfs_Int2Binary(&pge->sizeUncompressed, &buf[idxSizeUncompressed + (i * 4)], 1);
-        memcpy(&buf[idxHash + (i * 16)], pge->hashMD5, 16);
+        memcpy(&buf[idxHash + (i * 16)], pgi->hashMD5[i], 16);
 
         CookfsLog(printf("export entry #%u - compression: %d, level: %d,"
             " encryption: %d, sizeCompressed: %d, sizeUncompressed: %d,"
             " MD5[" PRINTF_MD5_FORMAT "]", i, (int)pge->compression,
-            pge->compressionLevel, pge->encryption, pge->sizeCompressed,
-            pge->sizeUncompressed, PRINTF_MD5_VAR(pge->hashMD5)));
+            pgi->compressionLevel[i], pge->encryption, pge->sizeCompressed,
+            pge->sizeUncompressed, PRINTF_MD5_VAR(pgi->hashMD5[i])));
     }
 
     CookfsLog(printf("return: ok"));
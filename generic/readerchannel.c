@@ -42,7 +42,7 @@ static Tcl_ChannelType cookfsReaderChannel = {
 
 Tcl_Channel Cookfs_CreateReaderchannel(Cookfs_Pages *pages,
     Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry,
-    Tcl_Interp *interp, char **channelNamePtr)
+    Cookfs_Latency *latency, Tcl_Interp *interp, char **channelNamePtr)
 {
 
     CookfsLog(printf("welcome"))
@@ -51,7 +51,8 @@ Tcl_Channel Cookfs_CreateReaderchannel(Cookfs_Pages *pages,
 
     CookfsLog(printf("alloc..."));
     Cookfs_ReaderChannelInstData *instData =
-        Cookfs_CreateReaderchannelAlloc(pages, fsindex, entry);
+        Cookfs_CreateReaderchannelAlloc(pages, fsindex, entry,
+        latency);
 
     if (instData == NULL) {
         CookfsLog(printf("failed to alloc"));
@@ -75,13 +76,43 @@ Tcl_Channel Cookfs_CreateReaderchannel(Cookfs_Pages *pages,
         goto error;
     }
 
-    if (Cookfs_FsindexEntryGetBlockCount(entry) < 1) {
+    // Take a copy of the block table. The entry is locked by the channel,
+    // so it is not released while the channel is open. Its blocks do not
+    // change either: overwriting the file creates a new entry. Thus, the
+    // reads do not need to look up blocks in fsindex.
+    int blockCount = Cookfs_FsindexEntryGetBlockCount(entry);
+    if (blockCount > 1) {
+        instData->blocks = (int *)ckalloc(sizeof(int) * 3 * blockCount);
+    }
+    for (int i = 0; i < blockCount; i++) {
+        Cookfs_FsindexEntryGetBlock(entry, i, &instData->blocks[i * 3],
+            &instData->blocks[i * 3 + 1], &instData->blocks[i * 3 + 2]);
+    }
+    instData->blockCount = (blockCount < 0 ? 0 : blockCount);
+    instData->fileSize = Cookfs_FsindexEntryGetFilesize(entry);
+
+    if (blockCount < 1) {
         CookfsLog(printf("skip encryption check, block count < 1"));
         goto doneAndUnlock;
     }
 
-    int pageIndex;
-    Cookfs_FsindexEntryGetBlock(entry, 0, &pageIndex, NULL, NULL);
+    // If the file is stored in several pages, then it is likely to be read
+    // completely. Request readahead for all its pages.
+    if (blockCount > 1) {
+        if (!Cookfs_PagesLockRead(pages, &err)) {
+            CookfsLog(printf("ERROR: failed to lock pages"));
+            goto errorAndUnlock;
+        }
+        int *pageList = (int *)ckalloc(sizeof(int) * blockCount);
+        for (int i = 0; i < blockCount; i++) {
+            pageList[i] = instData->blocks[i * 3];
+        }
+        Cookfs_PagesReadahead(pages, pageList, blockCount);
+        ckfree(pageList);
+        Cookfs_PagesUnlock(pages);
+    }
+
+    int pageIndex = instData->blocks[0];
 
     if (pageIndex < 0) {
         CookfsLog(printf("skip encryption check, pageIndex < 0"));
@@ -181,7 +212,7 @@ int Cookfs_CreateReaderchannelCreate(Cookfs_ReaderChannelInstData *instData, Tcl
     return TCL_OK;
 }
 
-Cookfs_ReaderChannelInstData *Cookfs_CreateReaderchannelAlloc(Cookfs_Pages *pages, Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry) {
+Cookfs_ReaderChannelInstData *Cookfs_CreateReaderchannelAlloc(Cookfs_Pages *pages, Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry, Cookfs_Latency *latency) {
     Cookfs_ReaderChannelInstData *result;
 
     result = (Cookfs_ReaderChannelInstData *) ckalloc(sizeof(Cookfs_ReaderChannelInstData));
@@ -194,6 +225,14 @@ Cookfs_ReaderChannelInstData *Cookfs_CreateReaderchannelAlloc(Cookfs_Pages *page
     Cookfs_FsindexLockSoft(fsindex);
     result->entry = entry;
     Cookfs_FsindexEntryLock(entry);
+    result->latency = latency;
+    if (latency != NULL) {
+        Cookfs_LatencyIncrRefCount(latency);
+    }
+
+    result->blockCount = 0;
+    result->blocks = result->blocksStatic;
+    result->fileSize = 0;
 
     result->currentOffset = 0;
     result->currentBlock = 0;
@@ -216,8 +255,14 @@ void Cookfs_CreateReaderchannelFree(Cookfs_ReaderChannelInstData *instData) {
     if (instData->cachedPageObj != NULL) {
         Cookfs_PageObjDecrRefCount(instData->cachedPageObj);
     }
+    if (instData->blocks != instData->blocksStatic) {
+        ckfree(instData->blocks);
+    }
     Cookfs_FsindexEntryUnlock(instData->entry);
     Cookfs_FsindexUnlockSoft(instData->fsindex);
     Cookfs_PagesUnlockSoft(instData->pages);
+    if (instData->latency != NULL) {
+        Cookfs_LatencyDecrRefCount(instData->latency);
+    }
     ckfree((void *) instData);
 }
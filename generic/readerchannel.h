@@ -24,6 +24,16 @@ typedef struct Cookfs_ReaderChannelInstData {
     Cookfs_Fsindex *fsindex;
     Cookfs_FsindexEntry *entry;
 
+    /* a copy of the entry's block table taken when the channel is opened,
+     * 3 values for each block: page index, offset and size */
+    int blockCount;
+    int *blocks;
+    int blocksStatic[3];
+    Tcl_WideInt fileSize;
+
+    /* latency histograms of the mount, can be NULL */
+    Cookfs_Latency *latency;
+
     Tcl_WideInt currentOffset;
     int currentBlock;
     int currentBlockOffset;
@@ -35,11 +45,12 @@ typedef struct Cookfs_ReaderChannelInstData {
 } Cookfs_ReaderChannelInstData;
 
 Tcl_Channel Cookfs_CreateReaderchannel(Cookfs_Pages *pages,
-    Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry, Tcl_Interp *interp,
-    char **channelNamePtr);
+    Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry,
+    Cookfs_Latency *latency, Tcl_Interp *interp, char **channelNamePtr);
 
 Cookfs_ReaderChannelInstData *Cookfs_CreateReaderchannelAlloc(Cookfs_Pages *pages,
-    Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry);
+    Cookfs_Fsindex *fsindex, Cookfs_FsindexEntry *entry,
+    Cookfs_Latency *latency);
 
 int Cookfs_CreateReaderchannelCreate(Cookfs_ReaderChannelInstData *instData,
     Tcl_Interp *interp);
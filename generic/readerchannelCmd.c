@@ -65,7 +65,8 @@ static int CookfsCreateReaderchannelCmd(ClientData clientData, Tcl_Interp *inter
         goto error;
     }
 
-    channel = Cookfs_CreateReaderchannel(pages, fsindex, entry, interp, &channelName);
+    channel = Cookfs_CreateReaderchannel(pages, fsindex, entry, NULL, interp,
+        &channelName);
 
     if (channel == NULL) {
         goto error;
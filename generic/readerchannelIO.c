@@ -28,45 +28,110 @@ int Cookfs_Readerchannel_Close2(ClientData instanceData, Tcl_Interp *interp, int
     return EINVAL;
 }
 
-int Cookfs_Readerchannel_Input(ClientData instanceData, char *buf, int bufSize, int *errorCodePtr) {
-    Cookfs_ReaderChannelInstData *instData = (Cookfs_ReaderChannelInstData *) instanceData;
-    int bytesRead = 0;
-    int bytesLeft;
-    int blockLeft;
-    int blockRead;
+// Loads the specified page into instData->cachedPageObj. Returns 1 on
+// success and 0 in case of an error.
+static int Cookfs_Readerchannel_LoadPage(
+    Cookfs_ReaderChannelInstData *instData, int pageIndex)
+{
+
+    if (instData->cachedPageObj != NULL) {
+        Cookfs_PageObjDecrRefCount(instData->cachedPageObj);
+        instData->cachedPageObj = NULL;
+    }
 
-    CookfsLog(printf("===> read %d, current offset: %" TCL_LL_MODIFIER "d",
-        bufSize, instData->currentOffset));
+    // fsindex is only locked here, on page boundaries, to get the page
+    // usage. Reads inside an already loaded page do not need it. The file
+    // can be removed by another thread while the channel is open. Its blocks
+    // were copied when the channel was opened and pages are not removed
+    // from a mounted archive, so the file can still be read in this case.
+    //
+    // A sealed fsindex is not changed, the file cannot be removed from it.
+    // The page usage is read without locking fsindex, while pages are locked.
+    // This ensures that the VFS is not terminated at this moment, as
+    // termination requires an exclusive lock on pages.
+    int isSealed = Cookfs_FsindexIsSealed(instData->fsindex);
+    int pageUsage = 0;
+
+    if (!isSealed) {
+
+        if (!Cookfs_FsindexLockRead(instData->fsindex, NULL)) {
+            return 0;
+        }
+
+        pageUsage = Cookfs_FsindexGetBlockUsage(instData->fsindex,
+            pageIndex);
+        Cookfs_FsindexUnlock(instData->fsindex);
 
-    if (!Cookfs_FsindexLockRead(instData->fsindex, NULL)) {
-        return 0;
     }
 
-    int blockCount = Cookfs_FsindexEntryGetBlockCount(instData->entry);
-    if (blockCount < 0) {
-        CookfsLog(printf("stalled fsindex entry"));
-        Cookfs_FsindexUnlock(instData->fsindex);
+    if (!Cookfs_PagesLockRead(instData->pages, NULL)) {
         return 0;
     }
 
-tryagain:
+    if (isSealed) {
+        pageUsage = Cookfs_FsindexGetBlockUsage(instData->fsindex,
+            pageIndex);
+    }
+
+    CookfsLog(printf("reading page index#%d", pageIndex));
+    /* If page contains only one file, set its weight to 0. Otherwise, set its weight to 1. */
+    int pageWeight = (pageUsage <= 1) ? 0 : 1;
 
-    if (instData->currentBlock >= blockCount) {
-        CookfsLog(printf("<=== bytesRead=%d (EOF)", bytesRead));
-        Cookfs_FsindexUnlock(instData->fsindex);
-        return bytesRead;
+    /*
+       Check if we need to do a tick-tock on the page cache. This should only be done when
+       we are reading a file for the first time. This will avoid tick-tocks when reading
+       a large file with multiple pages.
+    */
+    if (instData->firstTimeRead) {
+        /*
+           Check to see if the page we are interested in is cached. This will avoid tick-tocks
+           when reading multiple small files from one page, or when one file is requested
+           multiple times.
+        */
+        if (!Cookfs_PagesIsCached(instData->pages, pageIndex)) {
+            Cookfs_PagesTickTock(instData->pages);
+        }
+        instData->firstTimeRead = 0;
+    }
+    // TODO: pass a pointer to err variable instead of NULL and handle
+    // possible error message from Cookfs_PageGet()
+    instData->cachedPageObj = Cookfs_PageGet(instData->pages, pageIndex,
+        pageWeight, NULL);
+    // Do not increate refcount for cachedPageObj as Cookfs_PageGet() returns
+    // pages with refcount=1.
+    Cookfs_PagesUnlock(instData->pages);
+
+    CookfsLog(printf("got the page: %p", (void *)instData->cachedPageObj))
+    if (instData->cachedPageObj == NULL) {
+        return 0;
     }
+    instData->cachedPageNum = pageIndex;
+    return 1;
+
+}
+
+static int Cookfs_Readerchannel_InputInt(Cookfs_ReaderChannelInstData *instData, char *buf, int bufSize, int *errorCodePtr) {
+    int bytesRead = 0;
+    int bytesLeft;
+    int blockLeft;
+    int blockRead;
+
+    CookfsLog(printf("===> read %d, current offset: %" TCL_LL_MODIFIER "d",
+        bufSize, instData->currentOffset));
 
     while (bytesRead < bufSize) {
-        int pageIndex, pageOffset, pageSize;
-        bytesLeft = bufSize - bytesRead;
-        if (!Cookfs_FsindexEntryGetBlock(instData->entry, instData->currentBlock,
-            &pageIndex, &pageOffset, &pageSize))
-        {
-            CookfsLog(printf("stalled fsindex entry"));
-            Cookfs_FsindexUnlock(instData->fsindex);
-            return 0;
+
+        if (instData->currentBlock >= instData->blockCount) {
+            CookfsLog(printf("<=== bytesRead=%d (EOF)", bytesRead));
+            return bytesRead;
         }
+
+        const int *block = &instData->blocks[instData->currentBlock * 3];
+        int pageIndex = block[0];
+        int pageOffset = block[1];
+        int pageSize = block[2];
+
+        bytesLeft = bufSize - bytesRead;
         blockLeft = pageSize - instData->currentBlockOffset;
         CookfsLog(printf("blockLeft = %d, bytesRead = %d", blockLeft, bytesRead))
 
@@ -74,7 +139,7 @@ tryagain:
             instData->currentBlock++;
             instData->currentBlockOffset = 0;
             CookfsLog(printf("move to the next block %d", instData->currentBlock));
-            goto tryagain;
+            continue;
         }
 
         /* read as many bytes as left in chunk, or as many as requested */
@@ -84,60 +149,29 @@ tryagain:
             blockRead = bytesLeft;
         }
 
-        if (instData->cachedPageObj != NULL) {
-            if (instData->cachedPageNum == pageIndex) {
-                CookfsLog(printf("use the previously retrieved page index#%d",
-                    pageIndex));
-                goto gotPage;
-            }
-            Cookfs_PageObjDecrRefCount(instData->cachedPageObj);
-        }
-
-        CookfsLog(printf("reading page index#%d", pageIndex));
-        int pageUsage = Cookfs_FsindexGetBlockUsage(instData->fsindex, pageIndex);
-        /* If page contains only one file, set its weight to 0. Otherwise, set its weight to 1. */
-        int pageWeight = (pageUsage <= 1) ? 0 : 1;
-        /*
-           Check if we need to do a tick-tock on the page cache. This should only be done when
-           we are reading a file for the first time. This will avoid tick-tocks when reading
-           a large file with multiple pages.
-        */
-        if (!Cookfs_PagesLockRead(instData->pages, NULL)) {
-            goto error;
-        }
-        if (instData->firstTimeRead) {
-            /*
-               Check to see if the page we are interested in is cached. This will avoid tick-tocks
-               when reading multiple small files from one page, or when one file is requested
-               multiple times.
-            */
-            if (!Cookfs_PagesIsCached(instData->pages, pageIndex)) {
-                Cookfs_PagesTickTock(instData->pages);
+        if (instData->cachedPageObj != NULL
+            && instData->cachedPageNum == pageIndex)
+        {
+            CookfsLog(printf("use the previously retrieved page index#%d",
+                pageIndex));
+        } else {
+            if (!Cookfs_Readerchannel_LoadPage(instData, pageIndex)) {
+                goto error;
             }
-            instData->firstTimeRead = 0;
         }
-        // TODO: pass a pointer to err variable instead of NULL and handle
-        // possible error message from Cookfs_PageGet()
-        instData->cachedPageObj = Cookfs_PageGet(instData->pages, pageIndex,
-            pageWeight, NULL);
-        // Do not increate refcount for cachedPageObj as Cookfs_PageGet() returns
-        // pages with refcount=1.
-
-        Cookfs_PagesUnlock(instData->pages);
-        CookfsLog(printf("got the page: %p", (void *)instData->cachedPageObj))
-        if (instData->cachedPageObj == NULL) {
-            goto error;
-        }
-        instData->cachedPageNum = pageIndex;
-
-gotPage:
 
         CookfsLog(printf("copying %d+%d", pageOffset, instData->currentBlockOffset))
         // validate enough data is available in the buffer
         if (Cookfs_PageObjSize(instData->cachedPageObj) < (pageOffset + instData->currentBlockOffset + blockRead)) {
             goto error;
         }
+        // The page can refer to the memory-mapped archive file. Lock pages
+        // to make sure that the archive is not unmapped while copying.
+        if (!Cookfs_PagesLockRead(instData->pages, NULL)) {
+            goto error;
+        }
         memcpy(buf + bytesRead, instData->cachedPageObj->buf + pageOffset + instData->currentBlockOffset, blockRead);
+        Cookfs_PagesUnlock(instData->pages);
         instData->currentBlockOffset += blockRead;
         bytesRead += blockRead;
         instData->currentOffset += blockRead;
@@ -153,17 +187,23 @@ gotPage:
         }
     }
 
-    Cookfs_FsindexUnlock(instData->fsindex);
-
     CookfsLog(printf("<=== bytesRead=%d", bytesRead))
     return bytesRead;
 
 error:
-    Cookfs_FsindexUnlock(instData->fsindex);
     *errorCodePtr = EIO;
     return -1;
 }
 
+int Cookfs_Readerchannel_Input(ClientData instanceData, char *buf, int bufSize, int *errorCodePtr) {
+    Cookfs_ReaderChannelInstData *instData = (Cookfs_ReaderChannelInstData *) instanceData;
+    Tcl_WideInt start = Cookfs_LatencyStart();
+    int rc = Cookfs_Readerchannel_InputInt(instData, buf, bufSize,
+        errorCodePtr);
+    Cookfs_LatencyStop(instData->latency, COOKFS_LATENCY_READ, start);
+    return rc;
+}
+
 int Cookfs_Readerchannel_Output(ClientData instanceData, const char *buf, int toWrite, int *errorCodePtr) {
     UNUSED(instanceData);
     UNUSED(buf);
@@ -177,21 +217,9 @@ Tcl_WideInt Cookfs_Readerchannel_WideSeek(ClientData instanceData, Tcl_WideInt o
 
     CookfsLog(printf("current=%d offset=%d mode=%d", ((int) instData->currentOffset), ((int) offset), seekMode))
 
-    if (!Cookfs_FsindexLockRead(instData->fsindex, NULL)) {
-        *errorCodePtr = ENODEV; // inappropriate use of device
-        return -1;
-    }
-
-    Tcl_WideInt fileSize = Cookfs_FsindexEntryGetFilesize(instData->entry);
-    if (fileSize < 0) {
-        CookfsLog(printf("stalled fsindex entry"));
-        *errorCodePtr = ENODEV; // inappropriate use of device
-        Cookfs_FsindexUnlock(instData->fsindex);
-        return -1;
-    }
-    // We read-locked fsindex, so we don't expect the entry to become invalid,
-    // and we don't check for errors here.
-    int blockCount = Cookfs_FsindexEntryGetBlockCount(instData->entry);
+    // The block table is a copy made when the channel was opened, so
+    // fsindex is not locked here.
+    Tcl_WideInt fileSize = instData->fileSize;
 
     if (seekMode == SEEK_CUR) {
         offset += instData->currentOffset;
@@ -214,12 +242,8 @@ Tcl_WideInt Cookfs_Readerchannel_WideSeek(ClientData instanceData, Tcl_WideInt o
         instData->currentBlock = 0;
         instData->currentBlockOffset = 0;
 
-        while (bytesLeft > 0) {
-            int pageIndex, pageOffset, pageSize;
-            // We read-locked fsindex, so we don't expect the entry to become invalid,
-            // and we don't check for errors here.
-            Cookfs_FsindexEntryGetBlock(instData->entry, instData->currentBlock,
-                &pageIndex, &pageOffset, &pageSize);
+        while (bytesLeft > 0 && instData->currentBlock < instData->blockCount) {
+            int pageSize = instData->blocks[instData->currentBlock * 3 + 2];
 
             /* either block is larger than left bytes or not */
             CookfsLog(printf("compare %d < %d", pageSize, (int) bytesLeft))
@@ -228,9 +252,6 @@ Tcl_WideInt Cookfs_Readerchannel_WideSeek(ClientData instanceData, Tcl_WideInt o
                 bytesLeft -= pageSize;
                 instData->currentOffset += pageSize;
                 instData->currentBlock++;
-                if (instData->currentBlock >= blockCount) {
-                    break;
-                }
             }  else  {
                 instData->currentBlockOffset += bytesLeft;
                 instData->currentOffset += bytesLeft;
@@ -240,7 +261,6 @@ Tcl_WideInt Cookfs_Readerchannel_WideSeek(ClientData instanceData, Tcl_WideInt o
 
         CookfsLog(printf("end offset: block=%d blockoffset=%d offset=%d", instData->currentBlock, instData->currentBlockOffset, ((int) instData->currentOffset)))
     }
-    Cookfs_FsindexUnlock(instData->fsindex);
     *errorCodePtr = 0;
     return instData->currentOffset;
 }
@@ -0,0 +1,77 @@
+/*
+   (c) 2024 Konstantin Kushnir
+*/
+
+#ifndef COOKFS_REFCOUNT_H
+#define COOKFS_REFCOUNT_H 1
+
+// Reference counters that are shared between threads. C11 atomics are used
+// when available, then compiler builtins. If none of them are available,
+// counters are protected by a global mutex (see Cookfs_RefCountAdd() in
+// threads.c).
+//
+// Cookfs_RefCountDecr() returns the new value of the counter. The caller
+// must use this value to decide whether the object should be released,
+// since the counter may be changed by another thread immediately after
+// the operation.
+
+#ifndef TCL_THREADS
+
+typedef int Cookfs_RefCount;
+
+#define Cookfs_RefCountInit(p, v) (*(p) = (v))
+#define Cookfs_RefCountGet(p)     (*(p))
+#define Cookfs_RefCountIncr(p)    ((void)++(*(p)))
+#define Cookfs_RefCountDecr(p)    (--(*(p)))
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+typedef atomic_int Cookfs_RefCount;
+
+#define Cookfs_RefCountInit(p, v) atomic_init((p), (v))
+#define Cookfs_RefCountGet(p) atomic_load_explicit((p), memory_order_acquire)
+#define Cookfs_RefCountIncr(p) \
+    ((void)atomic_fetch_add_explicit((p), 1, memory_order_relaxed))
+#define Cookfs_RefCountDecr(p) \
+    (atomic_fetch_sub_explicit((p), 1, memory_order_acq_rel) - 1)
+
+#elif defined(__GNUC__)
+
+typedef int Cookfs_RefCount;
+
+#define Cookfs_RefCountInit(p, v) (*(p) = (v))
+#define Cookfs_RefCountGet(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define Cookfs_RefCountIncr(p) \
+    ((void)__atomic_add_fetch((p), 1, __ATOMIC_RELAXED))
+#define Cookfs_RefCountDecr(p)    __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+typedef volatile long Cookfs_RefCount;
+
+#define Cookfs_RefCountInit(p, v) (*(p) = (v))
+#define Cookfs_RefCountGet(p)     ((int)_InterlockedOr((p), 0))
+#define Cookfs_RefCountIncr(p)    ((void)_InterlockedIncrement(p))
+#define Cookfs_RefCountDecr(p)    ((int)_InterlockedDecrement(p))
+
+#else
+
+#define COOKFS_REFCOUNT_USEMUTEX 1
+
+typedef int Cookfs_RefCount;
+
+int Cookfs_RefCountAdd(Cookfs_RefCount *p, int delta);
+
+#define Cookfs_RefCountInit(p, v) (*(p) = (v))
+#define Cookfs_RefCountGet(p)     Cookfs_RefCountAdd((p), 0)
+#define Cookfs_RefCountIncr(p)    ((void)Cookfs_RefCountAdd((p), 1))
+#define Cookfs_RefCountDecr(p)    Cookfs_RefCountAdd((p), -1)
+
+#endif /* TCL_THREADS */
+
+#endif /* COOKFS_REFCOUNT_H */
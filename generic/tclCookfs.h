@@ -41,7 +41,12 @@ typedef enum {
     COOKFS_PROP_PASSWORD,
     COOKFS_PROP_ENCRYPTKEY,
     COOKFS_PROP_ENCRYPTLEVEL,
-    COOKFS_PROP_FILESET
+    COOKFS_PROP_FILESET,
+    COOKFS_PROP_ACCESSTRACE,
+    COOKFS_PROP_NOPREFETCH,
+    COOKFS_PROP_JOURNAL,
+    COOKFS_PROP_SEALED,
+    COOKFS_PROP_COMPACTINDEX
 } Cookfs_VfsPropertiesType;
 
 typedef enum {
@@ -102,7 +107,7 @@ static inline void Cookfs_VfsPropSetNoCommand(Cookfs_VfsProps *p,
 }
 
 static inline void Cookfs_VfsPropSetCompression(Cookfs_VfsProps *p,
-    Cookfs_VfsPropertiesType v)
+    Cookfs_CompressionType v)
 {
     Cookfs_VfsPropSet(p, COOKFS_PROP_COMPRESSION, (intptr_t)v);
 }
@@ -245,6 +250,36 @@ static inline void Cookfs_VfsPropSetFileset(Cookfs_VfsProps *p,
     Cookfs_VfsPropSet(p, COOKFS_PROP_FILESET, (intptr_t)v);
 }
 
+static inline void Cookfs_VfsPropSetAccessTrace(Cookfs_VfsProps *p,
+    int v)
+{
+    Cookfs_VfsPropSet(p, COOKFS_PROP_ACCESSTRACE, (intptr_t)v);
+}
+
+static inline void Cookfs_VfsPropSetNoPrefetch(Cookfs_VfsProps *p,
+    int v)
+{
+    Cookfs_VfsPropSet(p, COOKFS_PROP_NOPREFETCH, (intptr_t)v);
+}
+
+static inline void Cookfs_VfsPropSetJournal(Cookfs_VfsProps *p,
+    int v)
+{
+    Cookfs_VfsPropSet(p, COOKFS_PROP_JOURNAL, (intptr_t)v);
+}
+
+static inline void Cookfs_VfsPropSetSealed(Cookfs_VfsProps *p,
+    int v)
+{
+    Cookfs_VfsPropSet(p, COOKFS_PROP_SEALED, (intptr_t)v);
+}
+
+static inline void Cookfs_VfsPropSetCompactIndex(Cookfs_VfsProps *p,
+    int v)
+{
+    Cookfs_VfsPropSet(p, COOKFS_PROP_COMPACTINDEX, (intptr_t)v);
+}
+
 int Cookfs_Mount(Tcl_Interp *interp, Tcl_Obj *archive, Tcl_Obj *local,
     Cookfs_VfsProps *props);
 
@@ -10,18 +10,243 @@
 
 #ifdef TCL_THREADS
 
+// Readers register themselves in one of COOKFS_RWMUTEX_SLOTS counters
+// selected by the current thread, so that threads taking read locks
+// simultaneously do not modify the same cache line. A reader takes the lock
+// without the mutex if there are no writers. Writers increment the writers
+// counter under the mutex and wait until the sum of reader counters becomes
+// zero. Both sides first modify their counter and then check the other one
+// with sequentially consistent operations, so either the reader sees
+// the writer, or the writer sees the reader.
+
+#define COOKFS_RWMUTEX_SLOTS_BITS 4
+#define COOKFS_RWMUTEX_SLOTS (1 << COOKFS_RWMUTEX_SLOTS_BITS)
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+
+typedef atomic_int Cookfs_RWMutexCounter;
+
+#define CookfsRWMutexCounterAdd(p, v) atomic_fetch_add((p), (v))
+#define CookfsRWMutexCounterGet(p)    atomic_load(p)
+
+#elif defined(__GNUC__)
+
+typedef int Cookfs_RWMutexCounter;
+
+#define CookfsRWMutexCounterAdd(p, v) \
+    __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define CookfsRWMutexCounterGet(p)    __atomic_load_n((p), __ATOMIC_SEQ_CST)
+
+#elif defined(_MSC_VER)
+
+typedef volatile long Cookfs_RWMutexCounter;
+
+#define CookfsRWMutexCounterAdd(p, v) ((int)_InterlockedExchangeAdd((p), (v)))
+#define CookfsRWMutexCounterGet(p)    ((int)_InterlockedOr((p), 0))
+
+#else
+
+// Counters are protected by the global mutex of reference counters.
+typedef Cookfs_RefCount Cookfs_RWMutexCounter;
+
+#define CookfsRWMutexCounterAdd(p, v) (Cookfs_RefCountAdd((p), (v)) - (v))
+#define CookfsRWMutexCounterGet(p)    Cookfs_RefCountAdd((p), 0)
+
+#endif
+
+// Statistics are updated with relaxed atomic operations where possible,
+// and under a global mutex otherwise.
+
+#if defined(__GNUC__)
+
+#define CookfsLockStatsAdd(p, v) \
+    ((void)__atomic_fetch_add((p), (v), __ATOMIC_RELAXED))
+#define CookfsLockStatsGet(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define CookfsLockStatsSet(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define CookfsLockStatsCas(p, o, n) \
+    __atomic_compare_exchange_n((p), &(o), (n), 1, __ATOMIC_RELAXED, \
+    __ATOMIC_RELAXED)
+
+#elif defined(_MSC_VER)
+
+#define CookfsLockStatsAdd(p, v) \
+    ((void)_InterlockedExchangeAdd64((volatile __int64 *)(p), (v)))
+#define CookfsLockStatsGet(p) _InterlockedOr64((volatile __int64 *)(p), 0)
+#define CookfsLockStatsSet(p, v) \
+    ((void)_InterlockedExchange64((volatile __int64 *)(p), (v)))
+#define CookfsLockStatsCas(p, o, n) \
+    (_InterlockedCompareExchange64((volatile __int64 *)(p), (n), (o)) == (o))
+
+#else
+
+#define COOKFS_LOCKSTATS_USEMUTEX 1
+
+static Tcl_Mutex lockStatsMutex = NULL;
+
+#endif
+
+typedef struct Cookfs_RWMutexSlot {
+    Cookfs_RWMutexCounter readers;
+    char padding[64 - sizeof(Cookfs_RWMutexCounter)];
+} Cookfs_RWMutexSlot;
+
 struct _Cookfs_RWMutex {
+    Cookfs_RWMutexSlot slots[COOKFS_RWMUTEX_SLOTS];
+    // The number of threads that hold or wait for the write lock. It is
+    // not decremented when the mutex is locked exclusively.
+    Cookfs_RWMutexCounter writers;
     Tcl_Mutex mx;
     Tcl_Condition condWrite;
     Tcl_Condition condRead;
     int numRWait;
     int numWWait;
+    // -1 if the mutex is locked for writing, 0 otherwise. Readers are
+    // counted in slots.
     int numLocks;
     Tcl_ThreadId threadId;
+    Cookfs_LockStats stats;
 };
 
+static inline Tcl_WideInt CookfsLockStatsNow(void) {
+    Tcl_Time now;
+    Tcl_GetTime(&now);
+    return (Tcl_WideInt)now.sec * 1000000 + now.usec;
+}
+
+static void CookfsLockStatsUpdate(Cookfs_LockStats *s, int contended,
+    Tcl_WideInt waitTime)
+{
+#ifdef COOKFS_LOCKSTATS_USEMUTEX
+    Tcl_MutexLock(&lockStatsMutex);
+    s->acquisitions++;
+    if (contended) {
+        s->contended++;
+        s->waitTime += waitTime;
+        if (waitTime > s->maxWaitTime) {
+            s->maxWaitTime = waitTime;
+        }
+    }
+    Tcl_MutexUnlock(&lockStatsMutex);
+#else
+    CookfsLockStatsAdd(&s->acquisitions, 1);
+    if (contended) {
+        CookfsLockStatsAdd(&s->contended, 1);
+        CookfsLockStatsAdd(&s->waitTime, waitTime);
+        Tcl_WideInt maxWaitTime = CookfsLockStatsGet(&s->maxWaitTime);
+        while (waitTime > maxWaitTime) {
+            if (CookfsLockStatsCas(&s->maxWaitTime, maxWaitTime, waitTime)) {
+                break;
+            }
+            maxWaitTime = CookfsLockStatsGet(&s->maxWaitTime);
+        }
+    }
+#endif /* COOKFS_LOCKSTATS_USEMUTEX */
+}
+
+void Cookfs_LockStatsInit(Cookfs_LockStats *s) {
+    s->enabled = 0;
+    s->held = 0;
+    s->acquisitions = 0;
+    s->contended = 0;
+    s->waitTime = 0;
+    s->maxWaitTime = 0;
+}
+
+void Cookfs_LockStatsSetEnabled(Cookfs_LockStats *s, int enabled) {
+    s->held = 0;
+    s->enabled = enabled;
+}
+
+void Cookfs_LockStatsReset(Cookfs_LockStats *s) {
+#ifdef COOKFS_LOCKSTATS_USEMUTEX
+    Tcl_MutexLock(&lockStatsMutex);
+    s->acquisitions = 0;
+    s->contended = 0;
+    s->waitTime = 0;
+    s->maxWaitTime = 0;
+    Tcl_MutexUnlock(&lockStatsMutex);
+#else
+    CookfsLockStatsSet(&s->acquisitions, 0);
+    CookfsLockStatsSet(&s->contended, 0);
+    CookfsLockStatsSet(&s->waitTime, 0);
+    CookfsLockStatsSet(&s->maxWaitTime, 0);
+#endif /* COOKFS_LOCKSTATS_USEMUTEX */
+}
+
+Tcl_Obj *Cookfs_LockStatsGetObj(Cookfs_LockStats *s) {
+    Tcl_WideInt values[4];
+#ifdef COOKFS_LOCKSTATS_USEMUTEX
+    Tcl_MutexLock(&lockStatsMutex);
+    values[0] = s->acquisitions;
+    values[1] = s->contended;
+    values[2] = s->waitTime;
+    values[3] = s->maxWaitTime;
+    Tcl_MutexUnlock(&lockStatsMutex);
+#else
+    values[0] = CookfsLockStatsGet(&s->acquisitions);
+    values[1] = CookfsLockStatsGet(&s->contended);
+    values[2] = CookfsLockStatsGet(&s->waitTime);
+    values[3] = CookfsLockStatsGet(&s->maxWaitTime);
+#endif /* COOKFS_LOCKSTATS_USEMUTEX */
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(NULL, result,
+        Tcl_NewStringObj("acquisitions", -1));
+    Tcl_ListObjAppendElement(NULL, result, Tcl_NewWideIntObj(values[0]));
+    Tcl_ListObjAppendElement(NULL, result,
+        Tcl_NewStringObj("contended", -1));
+    Tcl_ListObjAppendElement(NULL, result, Tcl_NewWideIntObj(values[1]));
+    Tcl_ListObjAppendElement(NULL, result,
+        Tcl_NewStringObj("waittime", -1));
+    Tcl_ListObjAppendElement(NULL, result, Tcl_NewWideIntObj(values[2]));
+    Tcl_ListObjAppendElement(NULL, result,
+        Tcl_NewStringObj("maxwaittime", -1));
+    Tcl_ListObjAppendElement(NULL, result, Tcl_NewWideIntObj(values[3]));
+    return result;
+}
+
+void Cookfs_MutexLockStats(Tcl_Mutex *mx, Cookfs_LockStats *s) {
+    // We can't try to lock a Tcl_Mutex without waiting. Consider
+    // the mutex contended if it is held by another thread.
+    if (!s->held) {
+        Tcl_MutexLock(mx);
+        s->held = 1;
+        CookfsLockStatsUpdate(s, 0, 0);
+        return;
+    }
+    Tcl_WideInt start = CookfsLockStatsNow();
+    Tcl_MutexLock(mx);
+    s->held = 1;
+    CookfsLockStatsUpdate(s, 1, CookfsLockStatsNow() - start);
+}
+
+void Cookfs_MutexUnlockStats(Tcl_Mutex *mx, Cookfs_LockStats *s) {
+    s->held = 0;
+    Tcl_MutexUnlock(mx);
+}
+
+static inline Cookfs_RWMutexCounter *CookfsRWMutexSlot(Cookfs_RWMutex mx) {
+    size_t id = (size_t)Tcl_GetCurrentThread();
+    // Thread ids are usually addresses of thread structures, which are
+    // aligned. Mix the bits above the alignment.
+    unsigned int hash = (unsigned int)((id >> 6) ^ (id >> 16)) * 2654435761U;
+    return &mx->slots[hash >> (32 - COOKFS_RWMUTEX_SLOTS_BITS)].readers;
+}
+
+static int CookfsRWMutexGetReaders(Cookfs_RWMutex mx) {
+    int count = 0;
+    for (int i = 0; i < COOKFS_RWMUTEX_SLOTS; i++) {
+        count += CookfsRWMutexCounterGet(&mx->slots[i].readers);
+    }
+    return count;
+}
+
 Cookfs_RWMutex Cookfs_RWMutexInit(void) {
     Cookfs_RWMutex mx = ckalloc(sizeof(struct _Cookfs_RWMutex));
+    for (int i = 0; i < COOKFS_RWMUTEX_SLOTS; i++) {
+        mx->slots[i].readers = 0;
+    }
+    mx->writers = 0;
     mx->numRWait = 0;
     mx->numWWait = 0;
     mx->numLocks = 0;
@@ -29,16 +254,24 @@ Cookfs_RWMutex Cookfs_RWMutexInit(void) {
     mx->condWrite = NULL;
     mx->condRead = NULL;
     mx->threadId = NULL;
+    Cookfs_LockStatsInit(&mx->stats);
     return mx;
 }
 
 int Cookfs_RWMutexGetLocks(Cookfs_RWMutex mx) {
-    return mx->numLocks;
+    return mx->numLocks == -1 ? -1 : CookfsRWMutexGetReaders(mx);
+}
+
+Cookfs_LockStats *Cookfs_RWMutexGetStats(Cookfs_RWMutex mx) {
+    return &mx->stats;
 }
 
+#ifndef NDEBUG
+
 void Cookfs_RWMutexWantRead(Cookfs_RWMutex mx) {
     Tcl_MutexLock(&mx->mx);
-    assert((mx->threadId != NULL || mx->numLocks != 0) && "Want read or write lock");
+    assert((mx->threadId != NULL || mx->numLocks != 0 ||
+        CookfsRWMutexGetReaders(mx) != 0) && "Want read or write lock");
     assert((mx->threadId == NULL || mx->threadId == Tcl_GetCurrentThread()) && "Wrong threadId");
     Tcl_MutexUnlock(&mx->mx);
 }
@@ -50,6 +283,8 @@ void Cookfs_RWMutexWantWrite(Cookfs_RWMutex mx) {
     Tcl_MutexUnlock(&mx->mx);
 }
 
+#endif /* NDEBUG */
+
 void Cookfs_RWMutexFini(Cookfs_RWMutex mx) {
     Tcl_ConditionFinalize(&mx->condWrite);
     Tcl_ConditionFinalize(&mx->condRead);
@@ -58,8 +293,23 @@ void Cookfs_RWMutexFini(Cookfs_RWMutex mx) {
 }
 
 int Cookfs_RWMutexLockRead(Cookfs_RWMutex mx) {
+    Cookfs_RWMutexCounter *readers = CookfsRWMutexSlot(mx);
+    // Fast path: register as a reader and check that there are no writers.
+    CookfsRWMutexCounterAdd(readers, 1);
+    if (CookfsRWMutexCounterGet(&mx->writers) == 0) {
+        if (mx->stats.enabled) {
+            CookfsLockStatsUpdate(&mx->stats, 0, 0);
+        }
+        return 1;
+    }
+    CookfsRWMutexCounterAdd(readers, -1);
     int ret = 1;
+    Tcl_WideInt start = mx->stats.enabled ? CookfsLockStatsNow() : 0;
     Tcl_MutexLock(&mx->mx);
+    // A writer can wait for this reader to leave.
+    if (mx->numWWait) {
+        Tcl_ConditionNotify(&mx->condWrite);
+    }
     if (mx->threadId != NULL) {
         // If mutex is exclusively locked, then allow all if threadId matches,
         // and disallow all for other threads.
@@ -79,15 +329,23 @@ int Cookfs_RWMutexLockRead(Cookfs_RWMutex mx) {
                 goto done;
             }
         }
-        mx->numLocks++;
+        // Writers check the number of readers while holding the mutex,
+        // so the reader registered here will be seen by them.
+        CookfsRWMutexCounterAdd(readers, 1);
     }
 done:
     Tcl_MutexUnlock(&mx->mx);
+    if (ret && mx->stats.enabled) {
+        CookfsLockStatsUpdate(&mx->stats, 1, start == 0 ? 0 :
+            CookfsLockStatsNow() - start);
+    }
     return ret;
 }
 
 int Cookfs_RWMutexLockWrite(Cookfs_RWMutex mx) {
     int ret = 1;
+    int contended = 0;
+    Tcl_WideInt start = mx->stats.enabled ? CookfsLockStatsNow() : 0;
     Tcl_MutexLock(&mx->mx);
     if (mx->threadId != NULL) {
         // If mutex is exclusively locked, then allow all if threadId matches,
@@ -96,7 +354,11 @@ int Cookfs_RWMutexLockWrite(Cookfs_RWMutex mx) {
             ret = 0;
         }
     } else {
-        while (mx->numLocks != 0) {
+        // Stop readers on the fast path and wait until the current readers
+        // and the writer leave.
+        CookfsRWMutexCounterAdd(&mx->writers, 1);
+        while (mx->numLocks != 0 || CookfsRWMutexGetReaders(mx) != 0) {
+            contended = 1;
             mx->numWWait++;
             Tcl_ConditionWait(&mx->condWrite, &mx->mx, NULL);
             mx->numWWait--;
@@ -104,6 +366,10 @@ int Cookfs_RWMutexLockWrite(Cookfs_RWMutex mx) {
         mx->numLocks = -1;
     }
     Tcl_MutexUnlock(&mx->mx);
+    if (ret && mx->stats.enabled) {
+        CookfsLockStatsUpdate(&mx->stats, contended,
+            contended && start != 0 ? CookfsLockStatsNow() - start : 0);
+    }
     return ret;
 }
 
@@ -117,18 +383,35 @@ int Cookfs_RWMutexLockExclusive(Cookfs_RWMutex mx) {
 }
 
 void Cookfs_RWMutexUnlock(Cookfs_RWMutex mx) {
+    // If there are no writers, then the current thread holds a read lock
+    // and can release it without the mutex.
+    if (CookfsRWMutexCounterGet(&mx->writers) == 0) {
+        CookfsRWMutexCounterAdd(CookfsRWMutexSlot(mx), -1);
+        if (CookfsRWMutexCounterGet(&mx->writers) == 0) {
+            return;
+        }
+        // A writer has appeared and can wait for this reader to leave.
+        Tcl_MutexLock(&mx->mx);
+        if (mx->numWWait) {
+            Tcl_ConditionNotify(&mx->condWrite);
+        }
+        Tcl_MutexUnlock(&mx->mx);
+        return;
+    }
     Tcl_MutexLock(&mx->mx);
-    // The mutex should be readlocked (numLocks >= 1) or writelocked
-    // (numLocks == -1). All other cases mean an error. For example, when
-    // Unlock() is called on not locked mutex.
-    assert(mx->numLocks > 0 || mx->numLocks == -1 || mx->threadId != NULL);
     // Allow to call Unlock() on an exclusively locked mutex only for thread
     // that owns thix mutex.
     assert((mx->threadId == NULL || mx->threadId == Tcl_GetCurrentThread()) && "Wrong threadId");
-    if (mx->numLocks <= 0) {
+    if (mx->threadId != NULL) {
         mx->numLocks = 0;
+    } else if (mx->numLocks == -1) {
+        mx->numLocks = 0;
+        CookfsRWMutexCounterAdd(&mx->writers, -1);
     } else {
-        mx->numLocks--;
+        // The mutex should be readlocked. All other cases mean an error.
+        // For example, when Unlock() is called on not locked mutex.
+        assert(CookfsRWMutexGetReaders(mx) > 0);
+        CookfsRWMutexCounterAdd(CookfsRWMutexSlot(mx), -1);
     }
     if (mx->numWWait) {
         Tcl_ConditionNotify(&mx->condWrite);
@@ -138,4 +421,52 @@ void Cookfs_RWMutexUnlock(Cookfs_RWMutex mx) {
     Tcl_MutexUnlock(&mx->mx);
 }
 
+#ifdef COOKFS_REFCOUNT_USEMUTEX
+
+static Tcl_Mutex refCountMutex = NULL;
+
+int Cookfs_RefCountAdd(Cookfs_RefCount *p, int delta) {
+    Tcl_MutexLock(&refCountMutex);
+    int rc = (*p += delta);
+    Tcl_MutexUnlock(&refCountMutex);
+    return rc;
+}
+
+#endif /* COOKFS_REFCOUNT_USEMUTEX */
+
+#ifdef COOKFS_COUNTER_USEMUTEX
+
+static Tcl_Mutex counterMutex = NULL;
+
+Tcl_WideInt Cookfs_CounterAddInt(Cookfs_Counter *p, Tcl_WideInt delta,
+    int reset)
+{
+    Tcl_MutexLock(&counterMutex);
+    Tcl_WideInt rc = (reset ? (*p = 0) : (*p += delta));
+    Tcl_MutexUnlock(&counterMutex);
+    return rc;
+}
+
+#endif /* COOKFS_COUNTER_USEMUTEX */
+
+#ifdef COOKFS_ATOMICS_USEMUTEX
+
+static Tcl_Mutex atomicsMutex = NULL;
+
+int Cookfs_AtomicIntAccess(int *p, int v, int store) {
+    Tcl_MutexLock(&atomicsMutex);
+    int rc = (store ? (*p = v) : *p);
+    Tcl_MutexUnlock(&atomicsMutex);
+    return rc;
+}
+
+void *Cookfs_AtomicPtrAccess(void **p, void *v, int store) {
+    Tcl_MutexLock(&atomicsMutex);
+    void *rc = (store ? (*p = v) : *p);
+    Tcl_MutexUnlock(&atomicsMutex);
+    return rc;
+}
+
+#endif /* COOKFS_ATOMICS_USEMUTEX */
+
 #endif /* TCL_THREADS */
@@ -7,6 +7,45 @@
 
 typedef struct _Cookfs_RWMutex *Cookfs_RWMutex;
 
+// Statistics of lock acquisitions. They are collected only when enabled,
+// otherwise the only cost is a check of the enabled flag. The enabled and
+// held flags are hints, races on them make the statistics slightly
+// inaccurate, but do not affect locking. Times are in microseconds.
+typedef struct Cookfs_LockStats {
+    volatile int enabled;
+    // set while a Tcl_Mutex with statistics is locked
+    volatile int held;
+    Tcl_WideInt acquisitions;
+    Tcl_WideInt contended;
+    Tcl_WideInt waitTime;
+    Tcl_WideInt maxWaitTime;
+} Cookfs_LockStats;
+
+void Cookfs_LockStatsInit(Cookfs_LockStats *s);
+void Cookfs_LockStatsSetEnabled(Cookfs_LockStats *s, int enabled);
+void Cookfs_LockStatsReset(Cookfs_LockStats *s);
+Tcl_Obj *Cookfs_LockStatsGetObj(Cookfs_LockStats *s);
+
+void Cookfs_MutexLockStats(Tcl_Mutex *mx, Cookfs_LockStats *s);
+void Cookfs_MutexUnlockStats(Tcl_Mutex *mx, Cookfs_LockStats *s);
+
+// Lock/unlock a Tcl_Mutex and collect statistics if they are enabled
+#define Cookfs_MutexLock(mx, s) { \
+    if ((s)->enabled) { \
+        Cookfs_MutexLockStats((mx), (s)); \
+    } else { \
+        Tcl_MutexLock(mx); \
+    } \
+}
+
+#define Cookfs_MutexUnlock(mx, s) { \
+    if ((s)->enabled) { \
+        Cookfs_MutexUnlockStats((mx), (s)); \
+    } else { \
+        Tcl_MutexUnlock(mx); \
+    } \
+}
+
 Cookfs_RWMutex Cookfs_RWMutexInit(void);
 void Cookfs_RWMutexFini(Cookfs_RWMutex mx);
 
@@ -16,9 +55,16 @@ void Cookfs_RWMutexUnlock(Cookfs_RWMutex mx);
 
 int Cookfs_RWMutexLockExclusive(Cookfs_RWMutex mx);
 
+// The checks that the mutex is locked are only performed in debug builds
+#ifdef NDEBUG
+#define Cookfs_RWMutexWantRead(mx) {}
+#define Cookfs_RWMutexWantWrite(mx) {}
+#else
 void Cookfs_RWMutexWantRead(Cookfs_RWMutex mx);
 void Cookfs_RWMutexWantWrite(Cookfs_RWMutex mx);
+#endif /* NDEBUG */
 
 int Cookfs_RWMutexGetLocks(Cookfs_RWMutex mx);
+Cookfs_LockStats *Cookfs_RWMutexGetStats(Cookfs_RWMutex mx);
 
 #endif /* COOKFS_THREADS_H */
@@ -10,13 +10,25 @@
 #include "vfs.h"
 #include "fsindexIO.h"
 #include "pagesCmd.h"
+#include "pagesTrace.h"
 #include "fsindex.h"
 #include "fsindexCmd.h"
 
+// Journal descriptor format:
+//   <8:header>
+//   <4:numPages>
+//   <4*numPages:pageIndex>
+// The first page contains the full fsindex export, the other pages contain
+// fsindex deltas in the order they should be applied.
+#define COOKFS_VFS_JOURNAL_HEADERSTRING "CFS2.2J0"
+#define COOKFS_VFS_JOURNAL_HEADERLENGTH 8
+// The maximum number of deltas after which the full index is written again
+#define COOKFS_VFS_JOURNAL_MAX_DELTAS 32
+
 Cookfs_Vfs *Cookfs_VfsInit(Tcl_Interp* interp, Tcl_Obj* mountPoint,
     int isVolume, int isCurrentDirTime, int isReadonly, int isShared,
-    Cookfs_Pages *pages, Cookfs_Fsindex *index,
-    Cookfs_Writer *writer)
+    int isJournal, int isCompactIndex, Cookfs_Pages *pages,
+    Cookfs_Fsindex *index, Cookfs_Writer *writer)
 {
 
     CookfsLog(printf("init mount in interp [%p]; pages:%p index:%p writer:%p"
@@ -59,11 +71,16 @@ Cookfs_Vfs *Cookfs_VfsInit(Tcl_Interp* interp, Tcl_Obj* mountPoint,
     vfs->isVolume = isVolume;
     vfs->isCurrentDirTime = isCurrentDirTime;
     vfs->isReadonly = isReadonly;
+    vfs->isJournal = isJournal;
+    vfs->isCompactIndex = isCompactIndex;
 
     vfs->pages = pages;
     vfs->index = index;
     vfs->writer = writer;
 
+    vfs->latency = Cookfs_LatencyInit();
+    Cookfs_WriterSetLatency(writer, vfs->latency);
+
     CookfsLog(printf("ok [%p]", (void *)vfs));
     return vfs;
 
@@ -113,6 +130,21 @@ int Cookfs_VfsFini(Tcl_Interp *interp, Cookfs_Vfs *vfs,
         return TCL_ERROR;
     }
 
+    // Store recorded access trace in metadata. This will increase
+    // the changecount in fsindex, and the index will be saved below.
+    if (vfs->pages != NULL && !Cookfs_VfsIsReadonly(vfs)
+        && !Cookfs_WriterGetWritetomemory(vfs->writer))
+    {
+        Tcl_Obj *traceObj = Cookfs_PagesTraceGetObj(vfs->pages);
+        if (traceObj != NULL) {
+            CookfsLog(printf("store access trace in metadata"));
+            Tcl_IncrRefCount(traceObj);
+            Cookfs_FsindexSetMetadata(vfs->index,
+                COOKFS_ACCESSTRACE_METADATA_KEY, traceObj);
+            Tcl_DecrRefCount(traceObj);
+        }
+    }
+
     Tcl_WideInt changecount = Cookfs_FsindexIncrChangeCount(vfs->index, 0);
     CookfsLog(printf("changecount from index: %" TCL_LL_MODIFIER "d",
         changecount));
@@ -135,28 +167,12 @@ int Cookfs_VfsFini(Tcl_Interp *interp, Cookfs_Vfs *vfs,
     }
 
     // If we are here, then we need to store index
-    CookfsLog(printf("dump index..."));
-    Tcl_Obj *exportObjTcl = Cookfs_FsindexToObject(vfs->index);
-    if (exportObjTcl == NULL) {
-        CookfsLog(printf("failed to get index dump"));
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to get index"
-            " dump", -1));
-        return TCL_ERROR;
-    }
-    Tcl_IncrRefCount(exportObjTcl);
-    Cookfs_PageObj exportObj = Cookfs_PageObjNewFromByteArray(exportObjTcl);
-    Tcl_DecrRefCount(exportObjTcl);
-    if (exportObj == NULL) {
-        CookfsLog(printf("failed to convert index dump"));
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to convert index"
-            " dump", -1));
+    CookfsLog(printf("store index..."));
+    if (Cookfs_VfsIndexExport(interp, vfs->pages, vfs->index,
+        vfs->isJournal, vfs->isCompactIndex) != TCL_OK)
+    {
         return TCL_ERROR;
     }
-    Cookfs_PageObjIncrRefCount(exportObj);
-
-    CookfsLog(printf("store index..."));
-    Cookfs_PagesSetIndex(vfs->pages, exportObj);
-    Cookfs_PageObjDecrRefCount(exportObj);
 
 skipSavingIndex:
 
@@ -199,6 +215,7 @@ skipPages:
 
     // Cleanup own fields
     CookfsLog(printf("cleanup own fields"));
+    Cookfs_LatencyDecrRefCount(vfs->latency);
     ckfree((char *)vfs->mountStr);
     ckfree((char *)vfs);
 
@@ -206,6 +223,314 @@ skipPages:
     return TCL_OK;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_VfsIndexGetJournalPages --
+ *
+ *      Gets the list of pages referenced by the index journal descriptor
+ *      in the specified index data. The list is allocated with ckalloc()
+ *      and must be freed by the caller.
+ *
+ * Results:
+ *      The number of pages in the journal, 0 if the index data is not
+ *      a journal descriptor, or -1 if the descriptor is corrupted
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_VfsIndexGetJournalPages(Cookfs_PageObj indexDataObj,
+    int **pageListPtr)
+{
+
+    unsigned char *bytes = indexDataObj->buf;
+    Tcl_Size size = Cookfs_PageObjSize(indexDataObj);
+
+    *pageListPtr = NULL;
+
+    if (size < COOKFS_VFS_JOURNAL_HEADERLENGTH || memcmp(bytes,
+        COOKFS_VFS_JOURNAL_HEADERSTRING, COOKFS_VFS_JOURNAL_HEADERLENGTH))
+    {
+        return 0;
+    }
+
+    int count = 0;
+    if (size >= COOKFS_VFS_JOURNAL_HEADERLENGTH + 4) {
+        Cookfs_Binary2Int(bytes + COOKFS_VFS_JOURNAL_HEADERLENGTH, &count, 1);
+    }
+    if (count < 1 || size < (COOKFS_VFS_JOURNAL_HEADERLENGTH + 4 +
+        (Tcl_Size)count * 4))
+    {
+        CookfsLog(printf("the journal descriptor is corrupted"));
+        return -1;
+    }
+
+    int *pageList = (int *)ckalloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++) {
+        Cookfs_Binary2Int(bytes + COOKFS_VFS_JOURNAL_HEADERLENGTH + 4 + i * 4,
+            &pageList[i], 1);
+    }
+
+    *pageListPtr = pageList;
+    return count;
+
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_VfsIndexImport --
+ *
+ *      Creates fsindex from the index data stored in pages. The index data
+ *      may contain the full fsindex export or the index journal descriptor.
+ *      In the latter case, the full fsindex and its deltas are read from
+ *      the pages listed in the descriptor.
+ *
+ *      If fsindex is not NULL, it is replaced with the imported data.
+ *      The caller must hold a lock on pages and on fsindex, if specified.
+ *
+ * Results:
+ *      Pointer to fsindex; NULL in case of error
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Cookfs_Fsindex *Cookfs_VfsIndexImport(Tcl_Interp *interp, Cookfs_Pages *pages,
+    Cookfs_Fsindex *fsindex, Cookfs_PageObj indexDataObj)
+{
+
+    int *pageList;
+    int count = Cookfs_VfsIndexGetJournalPages(indexDataObj, &pageList);
+
+    if (count == 0) {
+        CookfsLog(printf("import the full index"));
+        return Cookfs_FsindexFromBytes(interp, fsindex, indexDataObj->buf,
+            Cookfs_PageObjSize(indexDataObj));
+    }
+
+    if (count < 0) {
+        return NULL;
+    }
+
+    CookfsLog(printf("import the index journal with %d pages", count));
+
+    // Let the OS start reading all journal pages while the first ones
+    // are being decompressed and applied
+    Cookfs_PagesReadahead(pages, pageList, count);
+
+    Cookfs_Fsindex *result = NULL;
+    for (int i = 0; i < count; i++) {
+
+        int pageIndex = pageList[i];
+
+        CookfsLog(printf("read page #%d", pageIndex));
+        Cookfs_PageObj pageObj = Cookfs_PageGet(pages, pageIndex, 0, NULL);
+        if (pageObj == NULL) {
+            CookfsLog(printf("failed to read page"));
+            goto error;
+        }
+
+        if (i == 0) {
+            result = Cookfs_FsindexFromBytes(interp, fsindex, pageObj->buf,
+                Cookfs_PageObjSize(pageObj));
+            Cookfs_PageObjDecrRefCount(pageObj);
+            if (result == NULL) {
+                CookfsLog(printf("failed to import the full index"));
+                ckfree(pageList);
+                return NULL;
+            }
+            continue;
+        }
+
+        int isOk;
+        if (fsindex == NULL) {
+            Cookfs_FsindexLockWrite(result, NULL);
+            isOk = Cookfs_FsindexApplyDelta(result, pageObj->buf,
+                Cookfs_PageObjSize(pageObj));
+            Cookfs_FsindexUnlock(result);
+        } else {
+            isOk = Cookfs_FsindexApplyDelta(result, pageObj->buf,
+                Cookfs_PageObjSize(pageObj));
+        }
+        Cookfs_PageObjDecrRefCount(pageObj);
+
+        if (!isOk) {
+            CookfsLog(printf("failed to apply the delta"));
+            goto error;
+        }
+
+    }
+
+    ckfree(pageList);
+    CookfsLog(printf("ok"));
+    return result;
+
+error:
+
+    ckfree(pageList);
+    if (result != NULL && fsindex == NULL) {
+        Cookfs_FsindexFini(result);
+    }
+    return NULL;
+
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cookfs_VfsIndexExport --
+ *
+ *      Stores fsindex in pages. If isJournal is true, only the directories
+ *      changed since the previous export are added to pages as a new page,
+ *      and the index journal descriptor is stored as the index data.
+ *      The full fsindex is added as a new page when there is no journal
+ *      yet, or when the journal has become too long or too large compared
+ *      to the full fsindex.
+ *
+ *      If isCompactIndex is true, the full fsindex is stored in the compact
+ *      format. Otherwise, the previous format is used, which can be read
+ *      by older versions of cookfs.
+ *
+ *      The caller must hold a write lock on pages and on fsindex.
+ *
+ * Results:
+ *      TCL_OK on success; TCL_ERROR otherwise
+ *
+ * Side effects:
+ *      Resets the change counter in fsindex
+ *
+ *----------------------------------------------------------------------
+ */
+
+int Cookfs_VfsIndexExport(Tcl_Interp *interp, Cookfs_Pages *pages,
+    Cookfs_Fsindex *fsindex, int isJournal, int isCompactIndex)
+{
+
+    Cookfs_PageObj exportObj;
+
+    if (!isJournal) {
+        CookfsLog(printf("dump the full index..."));
+        Tcl_Obj *exportObjTcl = Cookfs_FsindexToObject(fsindex,
+            isCompactIndex);
+        if (exportObjTcl == NULL) {
+            CookfsLog(printf("failed to get index dump"));
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to get index"
+                " dump", -1));
+            return TCL_ERROR;
+        }
+        Tcl_IncrRefCount(exportObjTcl);
+        exportObj = Cookfs_PageObjNewFromByteArray(exportObjTcl);
+        Tcl_DecrRefCount(exportObjTcl);
+        if (exportObj == NULL) {
+            CookfsLog(printf("failed to convert index dump"));
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to convert"
+                " index dump", -1));
+            return TCL_ERROR;
+        }
+        goto setIndex;
+    }
+
+    // Get the current journal from the index data
+    int count = 0;
+    unsigned char *journal = NULL;
+    Cookfs_PageObj currentObj = Cookfs_PagesGetIndex(pages);
+    if (currentObj != NULL && Cookfs_PageObjSize(currentObj) >=
+        (COOKFS_VFS_JOURNAL_HEADERLENGTH + 4) && !memcmp(currentObj->buf,
+        COOKFS_VFS_JOURNAL_HEADERSTRING, COOKFS_VFS_JOURNAL_HEADERLENGTH))
+    {
+        Cookfs_Binary2Int(currentObj->buf + COOKFS_VFS_JOURNAL_HEADERLENGTH,
+            &count, 1);
+        journal = currentObj->buf + COOKFS_VFS_JOURNAL_HEADERLENGTH + 4;
+    }
+
+    // Compare the size of existing deltas with the size of the full index
+    int isFull = 1;
+    if (count > 0 && count <= COOKFS_VFS_JOURNAL_MAX_DELTAS) {
+        int pageIndex;
+        Cookfs_Binary2Int(journal, &pageIndex, 1);
+        Tcl_WideInt fullSize = Cookfs_PagesGetPageSize(pages, pageIndex);
+        Tcl_WideInt deltaSize = 0;
+        for (int i = 1; i < count; i++) {
+            Cookfs_Binary2Int(journal + i * 4, &pageIndex, 1);
+            deltaSize += Cookfs_PagesGetPageSize(pages, pageIndex);
+        }
+        CookfsLog(printf("journal has %d pages, full index: %"
+            TCL_LL_MODIFIER "d bytes, deltas: %" TCL_LL_MODIFIER "d bytes",
+            count, fullSize, deltaSize));
+        if (deltaSize <= fullSize / 2) {
+            isFull = 0;
+        }
+    }
+
+    CookfsLog(printf("dump the %s index...", (isFull ? "full" : "delta")));
+    Tcl_Obj *exportObjTcl = (isFull ?
+        Cookfs_FsindexToObject(fsindex, isCompactIndex) :
+        Cookfs_FsindexToDeltaObject(fsindex));
+    if (exportObjTcl == NULL) {
+        CookfsLog(printf("failed to get index dump"));
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to get index"
+            " dump", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *err = NULL;
+    Tcl_IncrRefCount(exportObjTcl);
+    int pageIndex = Cookfs_PageAddIndexTclObj(pages, exportObjTcl, &err);
+    Tcl_DecrRefCount(exportObjTcl);
+    if (pageIndex < 0) {
+        CookfsLog(printf("failed to add index page"));
+        if (err == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to add index"
+                " page", -1));
+        } else {
+            Tcl_SetObjResult(interp, err);
+        }
+        return TCL_ERROR;
+    }
+
+    if (isFull) {
+        count = 0;
+    }
+
+    CookfsLog(printf("the index is stored in page #%d, journal size: %d",
+        pageIndex, count + 1));
+
+    exportObj = Cookfs_PageObjAlloc(COOKFS_VFS_JOURNAL_HEADERLENGTH + 4 +
+        (count + 1) * 4);
+    if (exportObj == NULL) {
+        CookfsLog(printf("failed to alloc journal descriptor"));
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to alloc index"
+            " journal", -1));
+        return TCL_ERROR;
+    }
+    memcpy(exportObj->buf, COOKFS_VFS_JOURNAL_HEADERSTRING,
+        COOKFS_VFS_JOURNAL_HEADERLENGTH);
+    if (count) {
+        memcpy(exportObj->buf + COOKFS_VFS_JOURNAL_HEADERLENGTH + 4, journal,
+            count * 4);
+    }
+    Cookfs_Int2Binary(&pageIndex, exportObj->buf +
+        COOKFS_VFS_JOURNAL_HEADERLENGTH + 4 + count * 4, 1);
+    count++;
+    Cookfs_Int2Binary(&count, exportObj->buf +
+        COOKFS_VFS_JOURNAL_HEADERLENGTH, 1);
+
+setIndex:
+
+    Cookfs_PageObjIncrRefCount(exportObj);
+    Cookfs_PagesSetIndex(pages, exportObj);
+    Cookfs_PageObjDecrRefCount(exportObj);
+
+    return TCL_OK;
+
+}
+
 #ifdef COOKFS_USETCLCMDS
 
 void Cookfs_VfsUnregisterInTclvfs(Cookfs_Vfs *vfs) {
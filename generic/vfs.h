@@ -29,21 +29,33 @@ typedef struct Cookfs_Vfs {
     int isVolume;
     int isReadonly;
     int isShared;
+    int isJournal;
+    int isCompactIndex;
 
     Cookfs_Pages *pages;
     Cookfs_Fsindex *index;
     Cookfs_Writer *writer;
 
+    Cookfs_Latency *latency;
+
 } Cookfs_Vfs;
 
 Cookfs_Vfs *Cookfs_VfsInit(Tcl_Interp* interp, Tcl_Obj* mountPoint,
     int isVolume, int isCurrentDirTime, int isReadonly, int isShared,
-    Cookfs_Pages *pages, Cookfs_Fsindex *index,
+    int isJournal, int isCompactIndex, Cookfs_Pages *pages,
+    Cookfs_Fsindex *index,
     Cookfs_Writer *writer);
 
 int Cookfs_VfsFini(Tcl_Interp *interp, Cookfs_Vfs *vfs,
     Tcl_WideInt *pagesCloseOffset);
 
+int Cookfs_VfsIndexGetJournalPages(Cookfs_PageObj indexDataObj,
+    int **pageListPtr);
+Cookfs_Fsindex *Cookfs_VfsIndexImport(Tcl_Interp *interp, Cookfs_Pages *pages,
+    Cookfs_Fsindex *fsindex, Cookfs_PageObj indexDataObj);
+int Cookfs_VfsIndexExport(Tcl_Interp *interp, Cookfs_Pages *pages,
+    Cookfs_Fsindex *fsindex, int isJournal, int isCompactIndex);
+
 const char *Cookfs_VfsFilesetGetActive(Cookfs_Vfs *vfs);
 Tcl_Obj *Cookfs_VfsFilesetGet(Cookfs_Vfs *vfs);
 int Cookfs_VfsFilesetSelect(Cookfs_Vfs *vfs, Tcl_Obj *fileset,
@@ -62,6 +62,7 @@ static const int attr_arr_vfs[] = {
     COOKFS_VFS_ATTRIBUTE_ENCRYPTLEVEL,
 #endif /* COOKFS_USECCRYPTO */
     COOKFS_VFS_ATTRIBUTE_PARTS,
+    COOKFS_VFS_ATTRIBUTE_STATS,
     COOKFS_VFS_ATTRIBUTE_RELATIVE,
     -1
 };
@@ -741,6 +742,83 @@ done:
 
 }
 
+static int Cookfs_AttrGet_Stats(Tcl_Interp *interp, Cookfs_Vfs *vfs,
+    Cookfs_VfsAttributeSetType entry_type, Cookfs_FsindexEntry *entry,
+    Tcl_Obj **result_ptr)
+{
+
+    UNUSED(interp);
+    assert(entry_type == COOKFS_VFS_ATTRIBUTE_SET_VFS);
+    UNUSED(entry_type);
+    UNUSED(entry);
+
+    Tcl_Obj *pagesStats;
+    if (vfs->pages == NULL) {
+        pagesStats = Tcl_NewDictObj();
+    } else {
+        if (!Cookfs_PagesLockRead(vfs->pages, NULL)) {
+            return TCL_ERROR;
+        }
+        pagesStats = Cookfs_PagesGetStatsObj(vfs->pages);
+        Cookfs_PagesUnlock(vfs->pages);
+    }
+
+    Tcl_Obj *result = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("pages", -1), pagesStats);
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("writer", -1),
+        Cookfs_WriterGetStatsObj(vfs->writer));
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("fsindex", -1),
+        Cookfs_FsindexGetStatsObj(vfs->index));
+
+    *result_ptr = result;
+
+    return TCL_OK;
+
+}
+
+static int Cookfs_AttrSet_Stats(Tcl_Interp *interp, Cookfs_Vfs *vfs,
+    Cookfs_VfsAttributeSetType entry_type, Cookfs_FsindexEntry *entry,
+    Tcl_Obj *value)
+{
+
+    static const char *const actions[] = { "reset", NULL };
+
+    int action;
+    if (Tcl_GetIndexFromObj(interp, value, actions, "action", 0,
+        &action) != TCL_OK)
+    {
+        return TCL_ERROR;
+    }
+
+    // Return the statistics collected before the reset
+    Tcl_Obj *result = NULL;
+    if (interp != NULL && Cookfs_AttrGet_Stats(interp, vfs, entry_type,
+        entry, &result) != TCL_OK)
+    {
+        return TCL_ERROR;
+    }
+
+    if (vfs->pages != NULL) {
+        if (!Cookfs_PagesLockRead(vfs->pages, NULL)) {
+            if (result != NULL) {
+                Tcl_BounceRefCount(result);
+            }
+            return TCL_ERROR;
+        }
+        Cookfs_PagesResetStats(vfs->pages);
+        Cookfs_PagesUnlock(vfs->pages);
+    }
+    Cookfs_WriterResetStats(vfs->writer);
+    Cookfs_FsindexResetStats(vfs->index);
+
+    if (result != NULL) {
+        Tcl_SetObjResult(interp, result);
+    }
+
+    return TCL_OK;
+
+}
+
 static int Cookfs_AttrGet_Vfs(Tcl_Interp *interp, Cookfs_Vfs *vfs,
     Cookfs_VfsAttributeSetType entry_type, Cookfs_FsindexEntry *entry,
     Tcl_Obj **result_ptr)
@@ -1255,6 +1333,9 @@ static const struct {
     },
     [COOKFS_VFS_ATTRIBUTE_PARTS] = {
         "-parts",     Cookfs_AttrGet_Parts,     Cookfs_AttrSet_Parts
+    },
+    [COOKFS_VFS_ATTRIBUTE_STATS] = {
+        "-stats",     Cookfs_AttrGet_Stats,     Cookfs_AttrSet_Stats
     }
 };
 
@@ -49,7 +49,8 @@ TYPEDEF_ENUM_COUNT(Cookfs_VfsAttribute, COOKFS_VFS_ATTRIBUTE_COUNT,
     COOKFS_VFS_ATTRIBUTE_RELATIVE,
     COOKFS_CFS_ATTRIBUTE_THREADS
     COOKFS_CFS_ATTRIBUTE_CRYPTO
-    COOKFS_VFS_ATTRIBUTE_PARTS
+    COOKFS_VFS_ATTRIBUTE_PARTS,
+    COOKFS_VFS_ATTRIBUTE_STATS
 );
 
 Cookfs_VfsAttribute Cookfs_VfsAttributeGetFromSet(
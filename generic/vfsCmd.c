@@ -16,6 +16,9 @@
 #include "pagesCmd.h"
 #include "fsindexCmd.h"
 #include "writerCmd.h"
+#include "pagesTrace.h"
+
+#include <utime.h>
 
 #define COOKFS_PROP_DEFAULT_PAGESIZE        262144
 #define COOKFS_PROP_DEFAULT_SMALLFILESIZE   32768
@@ -64,6 +67,12 @@ struct _Cookfs_VfsProps {
 
     Tcl_Obj *fileset;
 
+    int accesstrace;
+    int noprefetch;
+    int journal;
+    int compactindex;
+    int sealed;
+
 };
 
 typedef int (Cookfs_MountHandleCommandProc)(Cookfs_Vfs *vfs,
@@ -144,6 +153,11 @@ Cookfs_VfsProps *Cookfs_VfsPropsInit(void) {
     p->pagehash = COOKFS_HASH_DEFAULT;
     // p->shared = 0;
     // p->fileset = NULL;
+    // p->accesstrace = 0;
+    // p->noprefetch = 0;
+    // p->journal = 0;
+    // p->compactindex = 0;
+    // p->sealed = 0;
 
     // p->password = NULL;
     p->encryptlevel = -1;
@@ -248,6 +262,21 @@ void Cookfs_VfsPropSet(Cookfs_VfsProps *p, Cookfs_VfsPropertiesType type,
     case COOKFS_PROP_FILESET:
         p->fileset = (Tcl_Obj *)value;
         break;
+    case COOKFS_PROP_ACCESSTRACE:
+        p->accesstrace = value;
+        break;
+    case COOKFS_PROP_NOPREFETCH:
+        p->noprefetch = value;
+        break;
+    case COOKFS_PROP_JOURNAL:
+        p->journal = value;
+        break;
+    case COOKFS_PROP_COMPACTINDEX:
+        p->compactindex = value;
+        break;
+    case COOKFS_PROP_SEALED:
+        p->sealed = value;
+        break;
     }
 }
 
@@ -301,6 +330,7 @@ static int CookfsMountCmd(ClientData clientData, Tcl_Interp *interp,
         "-setmetadata", "-readonly", "-writetomemory", "-pagesize",
         "-pagecachesize", "-volume", "-smallfilesize", "-smallfilebuffer",
         "-nodirectorymtime", "-pagehash", "-shared", "-fileset",
+        "-accesstrace", "-noprefetch", "-journal", "-sealed", "-compactindex",
         NULL
     };
 
@@ -319,7 +349,9 @@ static int CookfsMountCmd(ClientData clientData, Tcl_Interp *interp,
         OPT_NOCOMMAND, OPT_COMPRESSION, OPT_ALWAYSCOMPRESS, OPT_ENDOFFSET,
         OPT_SETMETADATA, OPT_READONLY, OPT_WRITETOMEMORY, OPT_PAGESIZE,
         OPT_PAGECACHESIZE, OPT_VOLUME, OPT_SMALLFILESIZE, OPT_SMALLFILEBUFFER,
-        OPT_NODIRECTORYMTIME, OPT_PAGEHASH, OPT_SHARED, OPT_FILESET
+        OPT_NODIRECTORYMTIME, OPT_PAGEHASH, OPT_SHARED, OPT_FILESET,
+        OPT_ACCESSTRACE, OPT_NOPREFETCH, OPT_JOURNAL, OPT_SEALED,
+        OPT_COMPACTINDEX
     };
 
     Cookfs_VfsProps *props = Cookfs_VfsPropsInit();
@@ -372,6 +404,10 @@ static int CookfsMountCmd(ClientData clientData, Tcl_Interp *interp,
         PROCESS_OPT_SWITCH(OPT_VOLUME, props->volume);
         PROCESS_OPT_SWITCH(OPT_NODIRECTORYMTIME, props->nodirectorymtime);
         PROCESS_OPT_SWITCH(OPT_SHARED, props->shared);
+        PROCESS_OPT_SWITCH(OPT_NOPREFETCH, props->noprefetch);
+        PROCESS_OPT_SWITCH(OPT_JOURNAL, props->journal);
+        PROCESS_OPT_SWITCH(OPT_COMPACTINDEX, props->compactindex);
+        PROCESS_OPT_SWITCH(OPT_SEALED, props->sealed);
 
         // Other options require a single argument
         if (++idx == objc) {
@@ -399,9 +435,9 @@ static int CookfsMountCmd(ClientData clientData, Tcl_Interp *interp,
         PROCESS_OPT_OBJ(OPT_PAGEHASH, pagehash);
         PROCESS_OPT_OBJ(OPT_FILESET, props->fileset);
 
-        // OPT_ASYNCDECOMPRESSQUEUESIZE / OPT_PAGECACHESIZE - are unsigned int
-        // values
-        if (opt == OPT_PAGECACHESIZE
+        // OPT_ASYNCDECOMPRESSQUEUESIZE / OPT_PAGECACHESIZE / OPT_ACCESSTRACE
+        // - are unsigned int values
+        if (opt == OPT_PAGECACHESIZE || opt == OPT_ACCESSTRACE
 #if defined(COOKFS_USECALLBACKS)
             || opt == OPT_ASYNCDECOMPRESSQUEUESIZE
 #endif /* COOKFS_USECALLBACKS */
@@ -421,6 +457,7 @@ static int CookfsMountCmd(ClientData clientData, Tcl_Interp *interp,
             PROCESS_OPT_INT(OPT_ASYNCDECOMPRESSQUEUESIZE, props->asyncdecompressqueuesize);
 #endif /* COOKFS_USECALLBACKS */
             PROCESS_OPT_INT(OPT_PAGECACHESIZE, props->pagecachesize);
+            PROCESS_OPT_INT(OPT_ACCESSTRACE, props->accesstrace);
 
         }
 
@@ -590,8 +627,14 @@ int Cookfs_Mount(Tcl_Interp *interp, Tcl_Obj *archive, Tcl_Obj *local,
     }
 #endif /* COOKFS_USECALLBACKS */
 
+    if (props->sealed && props->writetomemory) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("sealed and writetomemory"
+            " options cannot be used together", -1));
+        goto error;
+    }
+
     // if write to memory option was selected, open archive as read only anyway
-    if (props->writetomemory) {
+    if (props->writetomemory || props->sealed) {
         props->readonly = 1;
     }
 
@@ -750,8 +793,7 @@ skipPages:
         if (indexDataObj == NULL) {
             index = Cookfs_FsindexInit(interp, NULL);
         } else {
-            index = Cookfs_FsindexFromBytes(interp, NULL, indexDataObj->buf,
-                Cookfs_PageObjSize(indexDataObj));
+            index = Cookfs_VfsIndexImport(interp, pages, NULL, indexDataObj);
             Cookfs_PageObjDecrRefCount(indexDataObj);
         }
         if (index == NULL) {
@@ -1000,6 +1042,34 @@ skipPagesBootstrap:
         }
     }
 
+    if (pages == NULL) {
+        goto skipAccessTrace;
+    }
+
+    if (props->accesstrace > 0) {
+        CookfsLog(printf("start recording access trace for %d seconds",
+            props->accesstrace));
+        Cookfs_PagesTraceStart(pages, props->accesstrace);
+    } else if (!props->noprefetch) {
+        Tcl_Obj *traceObj = Cookfs_FsindexGetMetadata(index,
+            COOKFS_ACCESSTRACE_METADATA_KEY);
+        if (traceObj == NULL) {
+            CookfsLog(printf("metadata doesn't contain access trace"));
+        } else {
+            CookfsLog(printf("start prefetching pages from access trace"));
+            Tcl_IncrRefCount(traceObj);
+            Cookfs_PagesPrefetchStart(pages, traceObj);
+            Tcl_DecrRefCount(traceObj);
+        }
+    }
+
+skipAccessTrace:
+
+    if (props->sealed) {
+        CookfsLog(printf("seal the fsindex"));
+        Cookfs_FsindexSeal(index);
+    }
+
     CookfsLog(printf("creating the writer object"));
     writer = Cookfs_WriterInit(interp, pages, index, props->smallfilebuffer,
          props->smallfilesize, props->pagesize, props->writetomemory);
@@ -1014,7 +1084,7 @@ skipPagesBootstrap:
     vfs = Cookfs_VfsInit(interp, localActual, props->volume,
         (props->nodirectorymtime ? 0 : 1),
         ((!props->writetomemory && props->readonly) ? 1 : 0), props->shared,
-        pages, index, writer);
+        props->journal, props->compactindex, pages, index, writer);
     if (vfs == NULL) {
         CookfsLog(printf("failed to create the vfs object"));
         Tcl_SetObjResult(interp, Tcl_NewStringObj("Unable to create"
@@ -1289,6 +1359,11 @@ static Cookfs_MountHandleCommandProc CookfsMountHandleCommandSmallfilebuffersize
 static Cookfs_MountHandleCommandProc CookfsMountHandleCommandCompression;
 static Cookfs_MountHandleCommandProc CookfsMountHandleCommandWritefiles;
 static Cookfs_MountHandleCommandProc CookfsMountHandleCommandOptimizelist;
+static Cookfs_MountHandleCommandProc CookfsMountHandleCommandExtract;
+#ifdef TCL_THREADS
+static Cookfs_MountHandleCommandProc CookfsMountHandleCommandLockstats;
+#endif /* TCL_THREADS */
+static Cookfs_MountHandleCommandProc CookfsMountHandleCommandLatency;
 
 static int CookfsMountHandleCmd(ClientData clientData, Tcl_Interp *interp,
     int objc, Tcl_Obj *const objv[])
@@ -1305,6 +1380,11 @@ static int CookfsMountHandleCmd(ClientData clientData, Tcl_Interp *interp,
 #endif /* COOKFS_USECCRYPTO */
         "getmetadata", "setmetadata", "aside", "writetomemory", "filesize",
         "smallfilebuffersize", "compression", "writeFiles", "optimizelist",
+        "extract",
+#ifdef TCL_THREADS
+        "lockstats",
+#endif /* TCL_THREADS */
+        "latency",
         NULL
     };
     enum commands {
@@ -1315,7 +1395,12 @@ static int CookfsMountHandleCmd(ClientData clientData, Tcl_Interp *interp,
         cmdPassword,
 #endif /* COOKFS_USECCRYPTO */
         cmdGetmetadata, cmdSetmetadata, cmdAside, cmdWritetomemory, cmdFilesize,
-        cmdSmallfilebuffersize, cmdCompression, cmdWritefiles, cmdOptimizelist
+        cmdSmallfilebuffersize, cmdCompression, cmdWritefiles, cmdOptimizelist,
+        cmdExtract,
+#ifdef TCL_THREADS
+        cmdLockstats,
+#endif /* TCL_THREADS */
+        cmdLatency
     };
 
     if (objc < 2) {
@@ -1361,6 +1446,14 @@ static int CookfsMountHandleCmd(ClientData clientData, Tcl_Interp *interp,
         return CookfsMountHandleCommandWritefiles(vfs, interp, objc, objv);
     case cmdOptimizelist:
         return CookfsMountHandleCommandOptimizelist(vfs, interp, objc, objv);
+    case cmdExtract:
+        return CookfsMountHandleCommandExtract(vfs, interp, objc, objv);
+#ifdef TCL_THREADS
+    case cmdLockstats:
+        return CookfsMountHandleCommandLockstats(vfs, interp, objc, objv);
+#endif /* TCL_THREADS */
+    case cmdLatency:
+        return CookfsMountHandleCommandLatency(vfs, interp, objc, objv);
     }
 
     return TCL_OK;
@@ -1483,7 +1576,8 @@ failedToLock:
             CookfsLog(printf("index was not changed, not need to update it"));
         } else {
             CookfsLog(printf("dump index..."));
-            Tcl_Obj *exportObjTcl = Cookfs_FsindexToObject(vfs->index);
+            Tcl_Obj *exportObjTcl = Cookfs_FsindexToObject(vfs->index,
+                vfs->isCompactIndex);
             if (exportObjTcl == NULL) {
                 CookfsLog(printf("failed to get index dump"));
             } else {
@@ -1531,10 +1625,10 @@ failedToLock:
 
     CookfsLog(printf("refresh index..."));
     Cookfs_PageObj indexDataObj = NULL;
-    if (Cookfs_PagesLockRead(vfs->pages, NULL)) {
-        indexDataObj = Cookfs_PagesGetIndex(vfs->pages);
-        Cookfs_PagesUnlock(vfs->pages);
+    if (!Cookfs_PagesLockRead(vfs->pages, NULL)) {
+        goto error;
     }
+    indexDataObj = Cookfs_PagesGetIndex(vfs->pages);
     if (indexDataObj == NULL) {
         CookfsLog(printf("got NULL as index data"));
     } else {
@@ -1547,10 +1641,11 @@ failedToLock:
         }
     }
     if (indexDataObj == NULL) {
+        Cookfs_PagesUnlock(vfs->pages);
         Cookfs_FsindexCleanup(vfs->index);
     } else {
-        Cookfs_FsindexFromBytes(interp, vfs->index, indexDataObj->buf,
-            Cookfs_PageObjSize(indexDataObj));
+        Cookfs_VfsIndexImport(interp, vfs->pages, vfs->index, indexDataObj);
+        Cookfs_PagesUnlock(vfs->pages);
         Cookfs_PageObjDecrRefCount(indexDataObj);
         if (fileset_activeObj != NULL) {
             // TODO: we should not ignore possible error when setting
@@ -1588,6 +1683,11 @@ static int CookfsMountHandleCommandWritetomemory(Cookfs_Vfs *vfs,
         Tcl_WrongNumArgs(interp, 2, objv, NULL);
         return TCL_ERROR;
     }
+    if (Cookfs_FsindexIsSealed(vfs->index)) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to enable"
+            " writetomemory mode for a sealed VFS", -1));
+        return TCL_ERROR;
+    }
     if (!Cookfs_WriterLockWrite(vfs->writer, NULL)) {
         return TCL_ERROR;
     }
@@ -1879,3 +1979,315 @@ done:
     Cookfs_FsindexUnlock(index);
     return rc;
 }
+
+#define COOKFS_EXTRACT_CHUNK 65536
+
+// Copies the pending file from the small file buffer. Such files are not
+// stored in pages yet, so they are read through the mount point as usual.
+static int CookfsMountHandleExtractPending(Cookfs_Vfs *vfs, Tcl_Interp *interp,
+    Tcl_Obj *source, Tcl_Channel dest, Tcl_WideInt *bytes)
+{
+    Tcl_Obj *mountObj = Tcl_NewStringObj(vfs->mountStr, vfs->mountLen);
+    Tcl_IncrRefCount(mountObj);
+    Tcl_Obj *sourcePath = Tcl_FSJoinToPath(mountObj, 1, &source);
+    Tcl_IncrRefCount(sourcePath);
+    Tcl_DecrRefCount(mountObj);
+
+    Tcl_Channel chan = Tcl_FSOpenFileChannel(interp, sourcePath, "r", 0);
+    Tcl_DecrRefCount(sourcePath);
+    if (chan == NULL) {
+        return TCL_ERROR;
+    }
+
+    int rc = TCL_OK;
+    char *buf = ckalloc(COOKFS_EXTRACT_CHUNK);
+
+    if (Tcl_SetChannelOption(interp, chan, "-translation", "binary")
+        != TCL_OK)
+    {
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    for (;;) {
+        Tcl_Size count = Tcl_Read(chan, buf, COOKFS_EXTRACT_CHUNK);
+        if (count < 0) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("error reading \"%s\":"
+                " %s", Tcl_GetString(source), Tcl_PosixError(interp)));
+            rc = TCL_ERROR;
+            goto done;
+        }
+        if (count == 0) {
+            break;
+        }
+        if (Tcl_Write(dest, buf, count) != count) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("error writing data: %s",
+                Tcl_PosixError(interp)));
+            rc = TCL_ERROR;
+            goto done;
+        }
+        *bytes += count;
+    }
+
+done:
+    ckfree(buf);
+    Tcl_Close(NULL, chan);
+    return rc;
+}
+
+static int CookfsMountHandleExtractFile(Cookfs_Vfs *vfs, Tcl_Interp *interp,
+    Tcl_Obj *source, Tcl_Obj *dest, Tcl_WideInt *bytes)
+{
+
+    CookfsLog(printf("extract [%s] to [%s]", Tcl_GetString(source),
+        Tcl_GetString(dest)));
+
+    Cookfs_Pages *pages = vfs->pages;
+    Cookfs_Fsindex *index = vfs->index;
+
+    if (!Cookfs_FsindexLockRead(index, NULL)) {
+        return TCL_ERROR;
+    }
+
+    Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromTclObj(source);
+    Cookfs_PathObjIncrRefCount(pathObj);
+    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, pathObj);
+    Cookfs_PathObjDecrRefCount(pathObj);
+
+    if (entry == NULL) {
+        Cookfs_FsindexUnlock(index);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("error extracting \"%s\":"
+            " no such file or directory", Tcl_GetString(source)));
+        return TCL_ERROR;
+    }
+
+    if (Cookfs_FsindexEntryIsDirectory(entry)) {
+        Cookfs_FsindexUnlock(index);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("error extracting \"%s\":"
+            " illegal operation on a directory", Tcl_GetString(source)));
+        return TCL_ERROR;
+    }
+
+    // Take a snapshot of the entry, as it can be changed by other threads
+    // after the fsindex is unlocked. Pages are never removed from
+    // the archive while it is mounted, so the blocks remain valid.
+    int isPending = Cookfs_FsindexEntryIsPending(entry);
+    int blockCount = Cookfs_FsindexEntryGetBlockCount(entry);
+    Tcl_WideInt mtime = Cookfs_FsindexEntryGetFileTime(entry);
+    int *blocks = NULL;
+    if (!isPending && blockCount > 0) {
+        blocks = ckalloc(sizeof(int) * 3 * blockCount);
+        for (int i = 0; i < blockCount; i++) {
+            Cookfs_FsindexEntryGetBlock(entry, i, &blocks[i * 3],
+                &blocks[i * 3 + 1], &blocks[i * 3 + 2]);
+        }
+    }
+
+    Cookfs_FsindexUnlock(index);
+
+    int rc = TCL_OK;
+
+    Tcl_Channel chan = Tcl_FSOpenFileChannel(interp, dest, "w", 0666);
+    if (chan == NULL) {
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    if (Tcl_SetChannelOption(interp, chan, "-translation", "binary")
+        != TCL_OK)
+    {
+        Tcl_Close(NULL, chan);
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    if (isPending) {
+        CookfsLog(printf("the file is in a pending state"));
+        rc = CookfsMountHandleExtractPending(vfs, interp, source, chan, bytes);
+    } else if (blockCount > 0) {
+        if (!Cookfs_PagesLockRead(pages, NULL)) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("failed to lock"
+                " pages", -1));
+            rc = TCL_ERROR;
+        } else {
+            for (int i = 0; i < blockCount; i++) {
+                Tcl_Obj *err = NULL;
+                if (Cookfs_PagesPutPageToChannel(pages, blocks[i * 3], 0,
+                    blocks[i * 3 + 1], blocks[i * 3 + 2], chan, &err)
+                    != TCL_OK)
+                {
+                    Tcl_SetObjResult(interp, Tcl_ObjPrintf("error extracting"
+                        " \"%s\": %s", Tcl_GetString(source),
+                        (err == NULL ? "unable to read page" :
+                        Tcl_GetString(err))));
+                    if (err != NULL) {
+                        Tcl_BounceRefCount(err);
+                    }
+                    rc = TCL_ERROR;
+                    break;
+                }
+                *bytes += blocks[i * 3 + 2];
+            }
+            Cookfs_PagesUnlock(pages);
+        }
+    }
+
+    if (rc != TCL_OK) {
+        Tcl_Close(NULL, chan);
+        goto done;
+    }
+
+    if (Tcl_Close(interp, chan) != TCL_OK) {
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    // Keep the modification time as "file copy" does
+    struct utimbuf tval;
+    tval.actime = mtime;
+    tval.modtime = mtime;
+    Tcl_FSUtime(dest, &tval);
+
+done:
+    if (blocks != NULL) {
+        ckfree(blocks);
+    }
+    return rc;
+
+}
+
+static int CookfsMountHandleCommandExtract(Cookfs_Vfs *vfs,
+    Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+
+    CookfsLog(printf("enter; objc: %d", objc));
+
+    if (objc < 4 || objc % 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "source destination"
+            " ?source destination ...?");
+        return TCL_ERROR;
+    }
+
+    Tcl_WideInt bytes = 0;
+    for (int i = 2; i < objc; i += 2) {
+        if (CookfsMountHandleExtractFile(vfs, interp, objv[i], objv[i + 1],
+            &bytes) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+    }
+
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(bytes));
+    return TCL_OK;
+
+}
+
+#ifdef TCL_THREADS
+
+static int CookfsMountHandleCommandLockstats(Cookfs_Vfs *vfs,
+    Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+
+    static const char *const actions[] = {
+        "enable", "disable", "reset", NULL
+    };
+    enum actions {
+        actionEnable, actionDisable, actionReset
+    };
+
+    static const char *const names[] = {
+        "fsindex", "pages", "cache", "io", "writer"
+    };
+
+    if (objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?enable|disable|reset?");
+        return TCL_ERROR;
+    }
+
+    Cookfs_LockStats *stats[] = {
+        Cookfs_FsindexGetLockStats(vfs->index),
+        Cookfs_PagesGetLockStats(vfs->pages, COOKFS_PAGES_LOCK_PAGES),
+        Cookfs_PagesGetLockStats(vfs->pages, COOKFS_PAGES_LOCK_CACHE),
+        Cookfs_PagesGetLockStats(vfs->pages, COOKFS_PAGES_LOCK_IO),
+        Cookfs_WriterGetLockStats(vfs->writer)
+    };
+
+    size_t i;
+
+    if (objc == 3) {
+        int action;
+        if (Tcl_GetIndexFromObj(interp, objv[2], actions, "action", 0,
+            &action) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+        for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+            switch ((enum actions) action) {
+            case actionEnable:
+                Cookfs_LockStatsSetEnabled(stats[i], 1);
+                break;
+            case actionDisable:
+                Cookfs_LockStatsSetEnabled(stats[i], 0);
+                break;
+            case actionReset:
+                Cookfs_LockStatsReset(stats[i]);
+                break;
+            }
+        }
+        return TCL_OK;
+    }
+
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+        Tcl_ListObjAppendElement(NULL, result, Tcl_NewStringObj(names[i], -1));
+        Tcl_ListObjAppendElement(NULL, result,
+            Cookfs_LockStatsGetObj(stats[i]));
+    }
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+
+}
+
+#endif /* TCL_THREADS */
+
+static int CookfsMountHandleCommandLatency(Cookfs_Vfs *vfs,
+    Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+
+    static const char *const actions[] = {
+        "enable", "disable", "reset", NULL
+    };
+    enum actions {
+        actionEnable, actionDisable, actionReset
+    };
+
+    if (objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?enable|disable|reset?");
+        return TCL_ERROR;
+    }
+
+    if (objc == 3) {
+        int action;
+        if (Tcl_GetIndexFromObj(interp, objv[2], actions, "action", 0,
+            &action) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+        switch ((enum actions) action) {
+        case actionEnable:
+            Cookfs_LatencySetEnabled(vfs->latency, 1);
+            break;
+        case actionDisable:
+            Cookfs_LatencySetEnabled(vfs->latency, 0);
+            break;
+        case actionReset:
+            Cookfs_LatencyReset(vfs->latency);
+            break;
+        }
+        return TCL_OK;
+    }
+
+    Tcl_SetObjResult(interp, Cookfs_LatencyGetObj(vfs->latency));
+    return TCL_OK;
+
+}
@@ -38,10 +38,14 @@
 #include <fcntl.h>
 #include <errno.h>
 
-// Cached internal representation of a cookfs entry
+// Cached internal representation of a cookfs entry. The fsindex entry
+// found for the path (or NULL if the path doesn't exist) is cached along
+// with the fsindex generation at the time of the lookup, see CookfsGetEntry().
 typedef struct cookfsInternalRep {
     Cookfs_Vfs *vfs;
     Cookfs_PathObj *pathObj;
+    Cookfs_FsindexEntry *entry;
+    Tcl_WideInt entryGeneration;
 } cookfsInternalRep;
 
 static Tcl_FSPathInFilesystemProc CookfsPathInFilesystem;
@@ -130,6 +134,8 @@ static int CookfsPathInFilesystem(Tcl_Obj *pathPtr,
 
     internalRep->vfs = vfs;
     internalRep->pathObj = pathObj;
+    internalRep->entry = NULL;
+    internalRep->entryGeneration = -1;
     Cookfs_PathObjIncrRefCount(internalRep->pathObj);
 
     *clientDataPtr = (ClientData)internalRep;
@@ -146,6 +152,8 @@ static ClientData CookfsDupInternalRep(ClientData clientData) {
     if (internalCopyRep != NULL) {
         internalCopyRep->vfs = internalRep->vfs;
         internalCopyRep->pathObj = internalRep->pathObj;
+        internalCopyRep->entry = internalRep->entry;
+        internalCopyRep->entryGeneration = internalRep->entryGeneration;
         Cookfs_PathObjIncrRefCount(internalRep->pathObj);
     }
     CookfsLog(printf("copy from [%p] to [%p]", (void *)internalRep,
@@ -201,7 +209,11 @@ static int CookfsValidatePathAndLockFsindex(Tcl_Obj *pathPtr,
         goto error;
     }
 
-    if (lockType == COOKFS_LOCK_WRITE && Cookfs_VfsIsReadonly(vfs)) {
+    // Sealed fsindex cannot be locked for writing, even to change
+    // attributes that are allowed for readonly VFS.
+    if ((lockType == COOKFS_LOCK_WRITE && Cookfs_VfsIsReadonly(vfs)) ||
+        (lockType != COOKFS_LOCK_READ && Cookfs_FsindexIsSealed(vfs->index)))
+    {
         CookfsLog(printf("filesystem is in readonly mode, return an error"));
         Cookfs_CookfsVfsUnlock(vfs);
         Tcl_SetErrno(EROFS);
@@ -229,9 +241,25 @@ error:
     return 0;
 }
 
+// Returns the fsindex entry for the path of the internal representation.
+// The result of the previous lookup is reused if fsindex has not been
+// changed since then. The fsindex must be locked by the caller.
+static Cookfs_FsindexEntry *CookfsGetEntry(cookfsInternalRep *ir) {
+    Cookfs_Fsindex *index = ir->vfs->index;
+    Tcl_WideInt generation = Cookfs_FsindexGetGeneration(index);
+    if (ir->entryGeneration != generation) {
+        ir->entry = Cookfs_FsindexGet(index, ir->pathObj);
+        ir->entryGeneration = generation;
+    } else {
+        CookfsLog(printf("use cached entry [%p]", (void *)ir->entry));
+    }
+    return ir->entry;
+}
+
 static int CookfsStat(Tcl_Obj *pathPtr, Tcl_StatBuf *bufPtr) {
     CookfsLog(printf("path [%s]", Tcl_GetString(pathPtr)));
 
+    Tcl_WideInt start = Cookfs_LatencyStart();
     cookfsInternalRep *ir;
 
     if (!CookfsValidatePathAndLockFsindex(pathPtr, COOKFS_LOCK_READ, &ir)) {
@@ -242,7 +270,7 @@ static int CookfsStat(Tcl_Obj *pathPtr, Tcl_StatBuf *bufPtr) {
     Cookfs_Fsindex *index = ir->vfs->index;
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     if (entry == NULL) {
         CookfsLog(printf("could not find the entry, return an error"));
@@ -278,6 +306,7 @@ static int CookfsStat(Tcl_Obj *pathPtr, Tcl_StatBuf *bufPtr) {
     bufPtr->st_nlink = 1;
 
 done:
+    Cookfs_LatencyStop(ir->vfs->latency, COOKFS_LATENCY_STAT, start);
     Cookfs_FsindexUnlock(index);
     return rc;
 }
@@ -285,6 +314,7 @@ done:
 static int CookfsAccess(Tcl_Obj *pathPtr, int mode) {
     CookfsLog(printf("path [%s] mode [%d]", Tcl_GetString(pathPtr), mode));
 
+    Tcl_WideInt start = Cookfs_LatencyStart();
     cookfsInternalRep *ir;
 
     if (!CookfsValidatePathAndLockFsindex(pathPtr, COOKFS_LOCK_READ, &ir)) {
@@ -305,7 +335,7 @@ static int CookfsAccess(Tcl_Obj *pathPtr, int mode) {
     }
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     // The entry has been found
     if (entry != NULL) {
@@ -327,6 +357,7 @@ static int CookfsAccess(Tcl_Obj *pathPtr, int mode) {
     }
 
 done:
+    Cookfs_LatencyStop(vfs->latency, COOKFS_LATENCY_ACCESS, start);
     Cookfs_FsindexUnlock(index);
     return rc;
 }
@@ -340,8 +371,10 @@ static Tcl_Channel CookfsOpenFileChannel(Tcl_Interp *interp, Tcl_Obj *pathPtr,
     CookfsLog(printf("interp [%p] path [%s] mode [%d] permissions [%d]",
         (void *)interp, Tcl_GetString(pathPtr), mode, permissions));
 
+    Tcl_WideInt start = Cookfs_LatencyStart();
     cookfsInternalRep *ir;
     Cookfs_Fsindex *index = NULL;
+    Cookfs_Latency *latency = NULL;
 
     Tcl_Channel channel = NULL;
 
@@ -352,11 +385,12 @@ static Tcl_Channel CookfsOpenFileChannel(Tcl_Interp *interp, Tcl_Obj *pathPtr,
     Cookfs_Vfs *vfs = ir->vfs;
     Cookfs_Pages *pages = vfs->pages;
     index = vfs->index;
+    latency = vfs->latency;
 
     int isVFSReadonly = Cookfs_VfsIsReadonly(vfs);
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     if (entry != NULL) {
         // The entry already exists
@@ -384,7 +418,7 @@ static Tcl_Channel CookfsOpenFileChannel(Tcl_Interp *interp, Tcl_Obj *pathPtr,
                 CookfsLog(printf("the file is NOT in a pending state,"
                     " open it using readerchannel"));
                 channel = Cookfs_CreateReaderchannel(pages, index, entry,
-                    interp, NULL);
+                    latency, interp, NULL);
             }
 
             if (channel == NULL) {
@@ -493,12 +527,68 @@ interperror:
 
 ret:
     if (index != NULL) {
+        Cookfs_LatencyStop(latency, COOKFS_LATENCY_OPEN, start);
         Cookfs_FsindexUnlock(index);
     }
     CookfsLog(printf("return: %p", (void *)channel));
     return channel;
 }
 
+typedef struct {
+    int wanted;
+    Tcl_Obj *pathPtr;
+    Tcl_Obj *returnPtr;
+    Tcl_Obj *prefix;
+} CookfsMatchContext;
+
+static void CookfsMatchInDirectoryProc(Cookfs_FsindexEntry *entryCur,
+    ClientData clientData)
+{
+    CookfsMatchContext *ctx = (CookfsMatchContext *)clientData;
+
+    // Check for child entry type. The name has already been matched
+    // against the pattern.
+    int isChildDirectory = Cookfs_FsindexEntryIsDirectory(entryCur);
+    unsigned char fileNameLen;
+    const char *fileName = Cookfs_FsindexEntryGetFileName(entryCur,
+        &fileNameLen);
+    if (
+        !(((ctx->wanted & TCL_GLOB_TYPE_DIR) && isChildDirectory) ||
+        ((ctx->wanted & TCL_GLOB_TYPE_FILE) && !isChildDirectory)))
+    {
+        CookfsLog(printf("child entry [%s] has wrong type", fileName));
+        return;
+    }
+
+    CookfsLog(printf("child entry [%s] is OK", fileName));
+
+    // Prepare an object to be used as a prefix for the retrieved records.
+    // It should be pathPtr + filesystem separator '/'. However, we
+    // should not add another file system separator if pathPtr already
+    // contains one at the end. This case is possible for mounted volumes
+    // like 'mount:/'. And in this case we will use pathPtr as a prefix.
+    if (ctx->prefix == NULL) {
+        Tcl_Size pathLen;
+        const char *pathStr = Tcl_GetStringFromObj(ctx->pathPtr, &pathLen);
+        if (pathLen > 0 && pathStr[pathLen - 1] != VFS_SEPARATOR) {
+            ctx->prefix = Tcl_DuplicateObj(ctx->pathPtr);
+            Tcl_IncrRefCount(ctx->prefix);
+            char sep = VFS_SEPARATOR;
+            Tcl_AppendToObj(ctx->prefix, &sep, 1);
+        } else {
+            ctx->prefix = ctx->pathPtr;
+        }
+        CookfsLog(printf("use common prefix for all matches: [%s]",
+            Tcl_GetString(ctx->prefix)));
+    }
+
+    // Join prefix + current entry and add it to the results
+    Tcl_Obj *obj = Tcl_DuplicateObj(ctx->prefix);
+    Tcl_AppendToObj(obj, fileName, fileNameLen);
+    Tcl_ListObjAppendElement(NULL, ctx->returnPtr, obj);
+    CookfsLog(printf("add file to results: [%s]", Tcl_GetString(obj)));
+}
+
 // cppcheck-suppress-begin constParameterCallback
 static int CookfsMatchInDirectory(Tcl_Interp *interp, Tcl_Obj *returnPtr,
     Tcl_Obj *pathPtr, const char *pattern, Tcl_GlobTypeData *types)
@@ -541,6 +631,7 @@ static int CookfsMatchInDirectory(Tcl_Interp *interp, Tcl_Obj *returnPtr,
         return TCL_OK;
     }
 
+    Tcl_WideInt start = Cookfs_LatencyStart();
     cookfsInternalRep *ir;
 
     if (!CookfsValidatePathAndLockFsindex(pathPtr, COOKFS_LOCK_READ, &ir)) {
@@ -550,7 +641,7 @@ static int CookfsMatchInDirectory(Tcl_Interp *interp, Tcl_Obj *returnPtr,
     Cookfs_Fsindex *index = ir->vfs->index;
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     // We could not find the file entry, just return empty result
     if (entry == NULL) {
@@ -586,74 +677,23 @@ static int CookfsMatchInDirectory(Tcl_Interp *interp, Tcl_Obj *returnPtr,
         goto done;
     }
 
-    int foundCount;
-    Cookfs_FsindexEntry **foundList = Cookfs_FsindexListEntry(entry,
-        &foundCount);
-
-    Tcl_Obj *prefix = NULL;
-
-    for (int i = 0; i < foundCount; i++) {
-
-        Cookfs_FsindexEntry *entryCur = foundList[i];
-
-        // First check for child entry type
-        int isChildDirectory = Cookfs_FsindexEntryIsDirectory(entryCur);
-        unsigned char fileNameLen;
-        const char *fileName = Cookfs_FsindexEntryGetFileName(entryCur, &fileNameLen);
-        if (
-            !(((wanted & TCL_GLOB_TYPE_DIR) && isChildDirectory) ||
-            ((wanted & TCL_GLOB_TYPE_FILE) && !isChildDirectory)))
-        {
-            CookfsLog(printf("child entry [%s] has wrong type", fileName));
-            continue;
-        }
-
-        // Now check if child entry matches the pattern
-        if (!Tcl_StringCaseMatch(fileName, pattern, 0)) {
-            CookfsLog(printf("child entry [%s] doesn't match pattern",
-                fileName));
-            continue;
-        }
-
-        CookfsLog(printf("child entry [%s] is OK", fileName));
-
-        // Prepare an object to be used as a prefix for the retrieved records.
-        // It should be pathPtr + filesystem separator '/'. However, we
-        // should not add another file system separator if pathPtr already
-        // contains one at the end. This case is possible for mounted volumes
-        // like 'mount:/'. And in this case we will use pathPtr as a prefix.
-        if (prefix == NULL) {
-            Tcl_Size pathLen;
-            const char *pathStr = Tcl_GetStringFromObj(pathPtr, &pathLen);
-            if (pathLen > 0 && pathStr[pathLen - 1] != VFS_SEPARATOR) {
-                prefix = Tcl_DuplicateObj(pathPtr);
-                Tcl_IncrRefCount(prefix);
-                char sep = VFS_SEPARATOR;
-                Tcl_AppendToObj(prefix, &sep, 1);
-            } else {
-                prefix = pathPtr;
-            }
-            CookfsLog(printf("use common prefix for all matches: [%s]",
-                Tcl_GetString(prefix)));
-        }
-
-        // Join prefix + current entry and add it to the results
-        Tcl_Obj *obj = Tcl_DuplicateObj(prefix);
-        Tcl_AppendToObj(obj, fileName, fileNameLen);
-        Tcl_ListObjAppendElement(NULL, returnPtr, obj);
-        CookfsLog(printf("add file to results: [%s]",
-            Tcl_GetString(obj)));
+    CookfsMatchContext ctx;
+    ctx.wanted = wanted;
+    ctx.pathPtr = pathPtr;
+    ctx.returnPtr = returnPtr;
+    ctx.prefix = NULL;
 
-    }
+    Cookfs_FsindexEntryMatch(entry, pattern, CookfsMatchInDirectoryProc,
+        (ClientData)&ctx);
 
     // Release the prefix only if we created it and it is not the same object
     // as pathPtr.
-    if (prefix != NULL && prefix != pathPtr) {
-        Tcl_DecrRefCount(prefix);
+    if (ctx.prefix != NULL && ctx.prefix != pathPtr) {
+        Tcl_DecrRefCount(ctx.prefix);
     }
-    Cookfs_FsindexListFree(foundList);
 
 done:
+    Cookfs_LatencyStop(ir->vfs->latency, COOKFS_LATENCY_MATCH, start);
     Cookfs_FsindexUnlock(index);
     CookfsLog(printf("ok"));
     return TCL_OK;
@@ -675,7 +715,7 @@ static int CookfsUtime(Tcl_Obj *pathPtr, struct utimbuf *tval) {
     Cookfs_Fsindex *index = ir->vfs->index;
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     if (entry == NULL) {
         CookfsLog(printf("could not find the entry, return an error"));
@@ -759,7 +799,7 @@ static int CookfsRemoveDirectory(Tcl_Obj *pathPtr, int recursive,
     Cookfs_Fsindex *index = ir->vfs->index;
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     if (entry == NULL) {
         CookfsLog(printf("could not find the entry, return an error"));
@@ -821,7 +861,7 @@ static int CookfsDeleteFile(Tcl_Obj *pathPtr) {
     Cookfs_Fsindex *index = vfs->index;
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
 
     if (entry == NULL) {
         CookfsLog(printf("could not find the entry, return an error"));
@@ -983,8 +1023,7 @@ static Cookfs_VfsAttributeSetType CookfsAttrGetType(cookfsInternalRep *ir,
     }
 
     // Try to find the file entry
-    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(ir->vfs->index,
-        ir->pathObj);
+    Cookfs_FsindexEntry *entry = CookfsGetEntry(ir);
     if (entry != NULL && !Cookfs_FsindexEntryIsDirectory(entry)) {
         if (entry_ptr != NULL) {
             *entry_ptr = entry;
@@ -0,0 +1,1178 @@
+/*
+ * vfsOptimize.c
+ *
+ * Provides commands for rewriting an archive so that files read
+ * together are stored together in access order, and for compacting
+ * an archive by removing unused pages
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+#include "cookfs.h"
+#include "vfs.h"
+#include "vfsVfs.h"
+#include "vfsOptimize.h"
+#include "pagesCompr.h"
+#include "pagesTrace.h"
+
+typedef struct CookfsOptimizeFile {
+    Tcl_Obj *path;
+    int pageIndex;
+    int pageOffset;
+    int position;
+    int rank;
+} CookfsOptimizeFile;
+
+typedef struct CookfsOptimizeState {
+    Tcl_Obj *dirs;
+    CookfsOptimizeFile *files;
+    int fileCount;
+    int fileSize;
+} CookfsOptimizeState;
+
+typedef struct CookfsCompactState {
+    Tcl_WideInt *liveBytes;
+    int pagesCount;
+} CookfsCompactState;
+
+static Tcl_ObjCmdProc CookfsOptimizeCmd;
+static Tcl_ObjCmdProc CookfsCompactCmd;
+
+int Cookfs_InitVfsOptimizeCmd(Tcl_Interp *interp) {
+
+    Tcl_CreateObjCommand(interp, "::cookfs::c::Optimize", CookfsOptimizeCmd,
+        (ClientData) NULL, NULL);
+
+    Tcl_CreateAlias(interp, "::cookfs::Optimize", interp,
+        "::cookfs::c::Optimize", 0, NULL);
+
+    Tcl_CreateObjCommand(interp, "::cookfs::c::Compact", CookfsCompactCmd,
+        (ClientData) NULL, NULL);
+
+    Tcl_CreateAlias(interp, "::cookfs::Compact", interp,
+        "::cookfs::c::Compact", 0, NULL);
+
+    return TCL_OK;
+
+}
+
+static int CookfsOptimizeSortFunc(const void *a, const void *b) {
+    const CookfsOptimizeFile *fa = (const CookfsOptimizeFile *)a;
+    const CookfsOptimizeFile *fb = (const CookfsOptimizeFile *)b;
+    if (fa->rank != fb->rank) {
+        return fa->rank < fb->rank ? -1 : 1;
+    }
+    if (fa->pageOffset != fb->pageOffset) {
+        return fa->pageOffset < fb->pageOffset ? -1 : 1;
+    }
+    return fa->position < fb->position ? -1 :
+        (fa->position > fb->position ? 1 : 0);
+}
+
+static void CookfsOptimizeWalk(CookfsOptimizeState *s,
+    Cookfs_FsindexEntry **items, int itemCount, Tcl_Obj *prefix)
+{
+
+    for (int i = 0; i < itemCount; i++) {
+
+        Cookfs_FsindexEntry *e = items[i];
+
+        unsigned char nameLen;
+        const char *name = Cookfs_FsindexEntryGetFileName(e, &nameLen);
+
+        Tcl_Obj *path;
+        if (prefix == NULL) {
+            path = Tcl_NewStringObj(name, nameLen);
+        } else {
+            path = Tcl_DuplicateObj(prefix);
+            Tcl_AppendToObj(path, "/", 1);
+            Tcl_AppendToObj(path, name, nameLen);
+        }
+
+        if (Cookfs_FsindexEntryIsDirectory(e)) {
+
+            CookfsLog(printf("add directory [%s]", Tcl_GetString(path)));
+            // Directories are stored as a flat list of path/mtime pairs.
+            // Since we walk the tree from the top, parent directories are
+            // always stored before their children.
+            Tcl_ListObjAppendElement(NULL, s->dirs, path);
+            Tcl_ListObjAppendElement(NULL, s->dirs,
+                Tcl_NewWideIntObj(Cookfs_FsindexEntryGetFileTime(e)));
+
+            int childCount;
+            Cookfs_FsindexEntry **children = Cookfs_FsindexListEntry(e,
+                &childCount);
+            if (children != NULL) {
+                CookfsOptimizeWalk(s, children, childCount, path);
+                Cookfs_FsindexListFree(children);
+            }
+
+            continue;
+
+        }
+
+        if (s->fileCount == s->fileSize) {
+            s->fileSize = (s->fileSize ? s->fileSize * 2 : 64);
+            s->files = (CookfsOptimizeFile *)ckrealloc(s->files,
+                sizeof(CookfsOptimizeFile) * s->fileSize);
+        }
+
+        CookfsOptimizeFile *f = &s->files[s->fileCount];
+        f->path = path;
+        Tcl_IncrRefCount(f->path);
+        f->position = s->fileCount;
+        f->rank = -1;
+        f->pageIndex = -1;
+        f->pageOffset = -1;
+        if (Cookfs_FsindexEntryGetBlockCount(e) > 0) {
+            int pageSize;
+            Cookfs_FsindexEntryGetBlock(e, 0, &f->pageIndex, &f->pageOffset,
+                &pageSize);
+        }
+
+        CookfsLog(printf("add file [%s] page: %d offset: %d",
+            Tcl_GetString(path), f->pageIndex, f->pageOffset));
+
+        s->fileCount++;
+
+    }
+
+}
+
+static int CookfsOptimizeUnmount(Tcl_Interp *interp, Cookfs_Vfs *vfs) {
+    vfs = Cookfs_CookfsRemoveVfs(interp, vfs);
+    if (vfs == NULL) {
+        return TCL_ERROR;
+    }
+    Tcl_WideInt pagesCloseOffset;
+    return Cookfs_VfsFini(interp, vfs, &pagesCloseOffset);
+}
+
+static Cookfs_Vfs *CookfsOptimizeMount(Tcl_Interp *interp, Tcl_Obj *path,
+    Cookfs_VfsProps *props)
+{
+    Cookfs_VfsPropSetNoCommand(props, 1);
+    Cookfs_VfsPropSetNoPrefetch(props, 1);
+#ifdef COOKFS_USETCLCMDS
+    Cookfs_VfsPropSetNoRegister(props, 1);
+#endif /* COOKFS_USETCLCMDS */
+    int rc = Cookfs_Mount(interp, path, path, props);
+    Cookfs_VfsPropsFree(props);
+    if (rc != TCL_OK) {
+        return NULL;
+    }
+    return Cookfs_CookfsFindVfs(path, -1);
+}
+
+static int CookfsOptimizeAddFile(Cookfs_Writer *w, Tcl_Obj *sourcePath,
+    Tcl_Obj *path, Tcl_Obj **err)
+{
+    CookfsLog(printf("add file [%s]", Tcl_GetString(path)));
+    Tcl_Obj *filePath = Tcl_FSJoinToPath(sourcePath, 1, &path);
+    Tcl_IncrRefCount(filePath);
+    Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromTclObj(path);
+    Cookfs_PathObjIncrRefCount(pathObj);
+    int rc = Cookfs_WriterAddFile(w, pathObj, NULL,
+        COOKFS_WRITER_SOURCE_FILE, filePath, -1, err);
+    Cookfs_PathObjDecrRefCount(pathObj);
+    Tcl_DecrRefCount(filePath);
+    return rc;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsOptimizeRewrite --
+ *
+ *      Creates a new archive with the same contents as the source archive,
+ *      but stores the files from the specified order (or from the access
+ *      trace recorded in the source archive) first, in the same order.
+ *      Thus, files that are read together at startup are packed into
+ *      the same small-file pages, and their pages are located next to each
+ *      other at the beginning of the archive. The remaining files are
+ *      stored after them in the usual way. Pages that are no longer used
+ *      by any file in the source archive are not copied.
+ *
+ *      The access trace for the new archive is calculated from the pages
+ *      of the ordered files, so the prefetch on the next mount will load
+ *      them.
+ *
+ *      If headObj is not NULL, it is written to the beginning of the new
+ *      archive.
+ *
+ * Results:
+ *      TCL_OK or TCL_ERROR. The number of files stored in access order
+ *      is returned in orderedCountPtr.
+ *
+ * Side effects:
+ *      Creates the destination archive. If an error occurs, the partially
+ *      created destination archive is removed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsOptimizeRewrite(Tcl_Interp *interp, Tcl_Obj *srcPath,
+    Tcl_Obj *dstPath, Tcl_Obj *order, Tcl_Obj *compression,
+    int isOrderRequired, Tcl_Obj *headObj, int *orderedCountPtr)
+{
+
+    CookfsLog(printf("rewrite [%s] to [%s]", Tcl_GetString(srcPath),
+        Tcl_GetString(dstPath)));
+
+    Cookfs_CompressionType compressionType = COOKFS_COMPRESSION_DEFAULT;
+    int compressionLevel = -1;
+    if (compression != NULL && Cookfs_CompressionFromObj(interp,
+        compression, &compressionType, &compressionLevel) != TCL_OK)
+    {
+        return TCL_ERROR;
+    }
+
+    Tcl_Size orderCount = 0;
+    Tcl_Obj **orderList = NULL;
+    if (order != NULL && Tcl_ListObjGetElements(interp, order, &orderCount,
+        &orderList) != TCL_OK)
+    {
+        return TCL_ERROR;
+    }
+
+    int rc = TCL_OK;
+    int orderedCount = 0;
+    int isDestinationCreated = 0;
+    Cookfs_Vfs *srcVfs = NULL;
+    Cookfs_Vfs *dstVfs = NULL;
+    Tcl_Obj *traceObj = NULL;
+    Tcl_Obj *metadataKeys = NULL;
+    Tcl_Obj *err = NULL;
+    Cookfs_PathObj *rootPathObj = NULL;
+    Tcl_WideInt pagesize = -1;
+    Tcl_WideInt smallfilesize = -1;
+    Tcl_WideInt smallfilebuffer = -1;
+    Cookfs_HashType pagehash = COOKFS_HASH_DEFAULT;
+
+    Tcl_HashTable rankMap;
+    int isRankMapInitialized = 0;
+
+    CookfsOptimizeState s;
+    s.dirs = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(s.dirs);
+    s.files = NULL;
+    s.fileCount = 0;
+    s.fileSize = 0;
+
+    // Mount the source archive
+
+    CookfsLog(printf("mount source archive [%s]", Tcl_GetString(srcPath)));
+    Cookfs_VfsProps *props = Cookfs_VfsPropsInit();
+    Cookfs_VfsPropSetReadonly(props, 1);
+    srcVfs = CookfsOptimizeMount(interp, srcPath, props);
+    if (srcVfs == NULL) {
+        goto error;
+    }
+
+    if (!Cookfs_FsindexLockRead(srcVfs->index, &err)) {
+        goto errorWithErr;
+    }
+
+    if (Cookfs_FsindexHasFileset(srcVfs->index)) {
+        Cookfs_FsindexUnlock(srcVfs->index);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("archives with filesets"
+            " are not supported", -1));
+        goto error;
+    }
+
+    rootPathObj = Cookfs_PathObjNewFromStr("", 0);
+    Cookfs_PathObjIncrRefCount(rootPathObj);
+    int itemCount;
+    Cookfs_FsindexEntry **items = Cookfs_FsindexList(srcVfs->index,
+        rootPathObj, &itemCount);
+    if (items != NULL) {
+        CookfsOptimizeWalk(&s, items, itemCount, NULL);
+        Cookfs_FsindexListFree(items);
+    }
+
+    // Keep the parameters of the source archive
+
+    Tcl_Obj *tmpObj;
+    tmpObj = Cookfs_FsindexGetMetadata(srcVfs->index, "cookfs.pagesize");
+    if (tmpObj != NULL) {
+        if (Tcl_GetWideIntFromObj(NULL, tmpObj, &pagesize) != TCL_OK) {
+            pagesize = -1;
+        }
+        Tcl_BounceRefCount(tmpObj);
+    }
+    tmpObj = Cookfs_FsindexGetMetadata(srcVfs->index, "cookfs.smallfilesize");
+    if (tmpObj != NULL) {
+        if (Tcl_GetWideIntFromObj(NULL, tmpObj, &smallfilesize) != TCL_OK) {
+            smallfilesize = -1;
+        }
+        Tcl_BounceRefCount(tmpObj);
+    }
+    tmpObj = Cookfs_FsindexGetMetadata(srcVfs->index,
+        "cookfs.smallfilebuffer");
+    if (tmpObj != NULL) {
+        if (Tcl_GetWideIntFromObj(NULL, tmpObj, &smallfilebuffer) != TCL_OK) {
+            smallfilebuffer = -1;
+        }
+        Tcl_BounceRefCount(tmpObj);
+    }
+    tmpObj = Cookfs_FsindexGetMetadata(srcVfs->index, "cookfs.pagehash");
+    if (tmpObj != NULL) {
+        if (Cookfs_HashFromObj(NULL, tmpObj, &pagehash) != TCL_OK) {
+            pagehash = COOKFS_HASH_DEFAULT;
+        }
+        Tcl_BounceRefCount(tmpObj);
+    }
+
+    if (order == NULL) {
+        traceObj = Cookfs_FsindexGetMetadata(srcVfs->index,
+            COOKFS_ACCESSTRACE_METADATA_KEY);
+        if (traceObj != NULL) {
+            Tcl_IncrRefCount(traceObj);
+        }
+    }
+
+    metadataKeys = Cookfs_FsindexGetMetadataAllKeys(srcVfs->index);
+    Tcl_IncrRefCount(metadataKeys);
+
+    Cookfs_FsindexUnlock(srcVfs->index);
+
+    if (compression == NULL) {
+        if (!Cookfs_PagesLockRead(srcVfs->pages, &err)) {
+            goto errorWithErr;
+        }
+        compressionType = Cookfs_PagesGetCompression(srcVfs->pages,
+            &compressionLevel);
+        Cookfs_PagesUnlock(srcVfs->pages);
+    }
+
+    // Rank the files according to the requested order
+
+    if (order != NULL) {
+
+        CookfsLog(printf("use the specified order of %" TCL_SIZE_MODIFIER
+            "d files", orderCount));
+
+        Tcl_InitHashTable(&rankMap, TCL_STRING_KEYS);
+        isRankMapInitialized = 1;
+
+        for (int i = 0; i < s.fileCount; i++) {
+            int isNew;
+            Tcl_HashEntry *hashEntry = Tcl_CreateHashEntry(&rankMap,
+                Tcl_GetString(s.files[i].path), &isNew);
+            Tcl_SetHashValue(hashEntry, &s.files[i]);
+        }
+
+        for (Tcl_Size i = 0; i < orderCount; i++) {
+            Tcl_HashEntry *hashEntry = Tcl_FindHashEntry(&rankMap,
+                Tcl_GetString(orderList[i]));
+            if (hashEntry == NULL) {
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("file \"%s\" is"
+                    " not found in the source archive",
+                    Tcl_GetString(orderList[i])));
+                goto error;
+            }
+            CookfsOptimizeFile *f = Tcl_GetHashValue(hashEntry);
+            // Ignore duplicate files in the order
+            if (f->rank < 0) {
+                f->rank = i;
+                orderedCount++;
+            }
+        }
+
+    } else if (traceObj != NULL) {
+
+        Tcl_Size traceCount;
+        Tcl_Obj **traceList;
+        if (Tcl_ListObjGetElements(NULL, traceObj, &traceCount, &traceList)
+            != TCL_OK)
+        {
+            traceCount = 0;
+        }
+
+        CookfsLog(printf("use the access trace of %" TCL_SIZE_MODIFIER
+            "d pages", traceCount));
+
+        Tcl_InitHashTable(&rankMap, TCL_ONE_WORD_KEYS);
+        isRankMapInitialized = 1;
+
+        for (Tcl_Size i = 0; i < traceCount; i++) {
+            int pageIndex;
+            if (Tcl_GetIntFromObj(NULL, traceList[i], &pageIndex) != TCL_OK) {
+                CookfsLog(printf("skip malformed page in trace"));
+                continue;
+            }
+            int isNew;
+            Tcl_HashEntry *hashEntry = Tcl_CreateHashEntry(&rankMap,
+                INT2PTR(pageIndex), &isNew);
+            if (isNew) {
+                Tcl_SetHashValue(hashEntry, INT2PTR(i));
+            }
+        }
+
+        for (int i = 0; i < s.fileCount; i++) {
+            if (s.files[i].pageIndex < 0) {
+                continue;
+            }
+            Tcl_HashEntry *hashEntry = Tcl_FindHashEntry(&rankMap,
+                INT2PTR(s.files[i].pageIndex));
+            if (hashEntry != NULL) {
+                s.files[i].rank = PTR2INT(Tcl_GetHashValue(hashEntry));
+                orderedCount++;
+            }
+        }
+
+    } else if (isOrderRequired) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("the source archive has"
+            " no access trace and no file order is specified", -1));
+        goto error;
+    }
+
+    // Files that are not in the order get the maximum rank, so they
+    // will be placed after the ordered files in their original order.
+    for (int i = 0; i < s.fileCount; i++) {
+        if (s.files[i].rank < 0) {
+            s.files[i].rank = INT_MAX;
+        }
+    }
+
+    if (s.fileCount > 1) {
+        qsort(s.files, s.fileCount, sizeof(CookfsOptimizeFile),
+            CookfsOptimizeSortFunc);
+    }
+
+    CookfsLog(printf("got %d files in access order and %d other files",
+        orderedCount, s.fileCount - orderedCount));
+
+    // Create the destination archive
+
+    CookfsLog(printf("create destination archive [%s]",
+        Tcl_GetString(dstPath)));
+    props = Cookfs_VfsPropsInit();
+    Cookfs_VfsPropSetCompression(props, compressionType);
+    Cookfs_VfsPropSetCompressionLevel(props, compressionLevel);
+    if (pagesize > 0) {
+        Cookfs_VfsPropSetPageSize(props, pagesize);
+    }
+    if (smallfilesize > 0) {
+        Cookfs_VfsPropSetSmallFileSize(props, smallfilesize);
+    }
+    if (smallfilebuffer > 0) {
+        Cookfs_VfsPropSetSmallFileBuffer(props, smallfilebuffer);
+    }
+    if (pagehash != COOKFS_HASH_DEFAULT) {
+        Cookfs_VfsPropSetPageHash(props, pagehash);
+    }
+    isDestinationCreated = 1;
+    // Keep the data located before the source archive, e.g. an executable
+    // file with the attached archive. The new archive will be appended
+    // to this data.
+    if (headObj != NULL) {
+        Tcl_Channel chan = Tcl_FSOpenFileChannel(interp, dstPath, "wb", 0666);
+        if (chan == NULL) {
+            Cookfs_VfsPropsFree(props);
+            goto error;
+        }
+        Tcl_Size headSize = Tcl_WriteObj(chan, headObj);
+        if (Tcl_Close(interp, chan) != TCL_OK || headSize < 0) {
+            Cookfs_VfsPropsFree(props);
+            goto error;
+        }
+    }
+    dstVfs = CookfsOptimizeMount(interp, dstPath, props);
+    if (dstVfs == NULL) {
+        goto error;
+    }
+
+    // Create the directories and copy user metadata. The metadata
+    // with "cookfs." prefix is maintained by the archive itself.
+
+    if (!Cookfs_FsindexLockWrite(dstVfs->index, &err)) {
+        goto errorWithErr;
+    }
+
+    Tcl_Size dirCount;
+    Tcl_Obj **dirList;
+    Tcl_ListObjGetElements(NULL, s.dirs, &dirCount, &dirList);
+    for (Tcl_Size i = 0; i < dirCount; i += 2) {
+        Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromTclObj(dirList[i]);
+        Cookfs_PathObjIncrRefCount(pathObj);
+        Cookfs_FsindexEntry *e = Cookfs_FsindexSetDirectory(dstVfs->index,
+            pathObj);
+        Cookfs_PathObjDecrRefCount(pathObj);
+        if (e == NULL) {
+            Cookfs_FsindexUnlock(dstVfs->index);
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("unable to create"
+                " directory \"%s\"", Tcl_GetString(dirList[i])));
+            goto error;
+        }
+        Tcl_WideInt mtime;
+        Tcl_GetWideIntFromObj(NULL, dirList[i + 1], &mtime);
+        Cookfs_FsindexEntrySetFileTime(e, mtime);
+    }
+
+    Tcl_Size keyCount;
+    Tcl_Obj **keyList;
+    Tcl_ListObjGetElements(NULL, metadataKeys, &keyCount, &keyList);
+    if (keyCount && !Cookfs_FsindexLockRead(srcVfs->index, &err)) {
+        Cookfs_FsindexUnlock(dstVfs->index);
+        goto errorWithErr;
+    }
+    for (Tcl_Size i = 0; i < keyCount; i++) {
+        const char *key = Tcl_GetString(keyList[i]);
+        if (strncmp(key, "cookfs.", 7) == 0) {
+            continue;
+        }
+        tmpObj = Cookfs_FsindexGetMetadata(srcVfs->index, key);
+        if (tmpObj != NULL) {
+            Tcl_IncrRefCount(tmpObj);
+            Cookfs_FsindexSetMetadata(dstVfs->index, key, tmpObj);
+            Tcl_DecrRefCount(tmpObj);
+        }
+    }
+    if (keyCount) {
+        Cookfs_FsindexUnlock(srcVfs->index);
+    }
+
+    Cookfs_FsindexUnlock(dstVfs->index);
+
+    // Add the files. The files in access order are added in ordered mode,
+    // and the small file buffer is purged after them, so that they are
+    // not mixed with other files.
+
+    if (!Cookfs_WriterLockWrite(dstVfs->writer, &err)) {
+        goto errorWithErr;
+    }
+
+    Cookfs_WriterSetOrdered(dstVfs->writer, 1);
+
+    int i;
+    for (i = 0; i < orderedCount; i++) {
+        if (CookfsOptimizeAddFile(dstVfs->writer, srcPath, s.files[i].path,
+            &err) != TCL_OK)
+        {
+            goto writerError;
+        }
+    }
+
+    if (Cookfs_WriterPurge(dstVfs->writer, 1, &err) != TCL_OK) {
+        goto writerError;
+    }
+
+    Cookfs_WriterSetOrdered(dstVfs->writer, 0);
+
+    for (; i < s.fileCount; i++) {
+        if (CookfsOptimizeAddFile(dstVfs->writer, srcPath, s.files[i].path,
+            &err) != TCL_OK)
+        {
+            goto writerError;
+        }
+    }
+
+    Cookfs_WriterUnlock(dstVfs->writer);
+
+    // Calculate the access trace for the new archive from the pages used
+    // by the ordered files
+
+    if (!Cookfs_FsindexLockWrite(dstVfs->index, &err)) {
+        goto errorWithErr;
+    }
+
+    Tcl_Obj *newTraceObj = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(newTraceObj);
+    Tcl_HashTable seenPages;
+    Tcl_InitHashTable(&seenPages, TCL_ONE_WORD_KEYS);
+    for (i = 0; i < orderedCount; i++) {
+        Cookfs_PathObj *pathObj = Cookfs_PathObjNewFromTclObj(
+            s.files[i].path);
+        Cookfs_PathObjIncrRefCount(pathObj);
+        Cookfs_FsindexEntry *e = Cookfs_FsindexGet(dstVfs->index, pathObj);
+        Cookfs_PathObjDecrRefCount(pathObj);
+        if (e == NULL) {
+            continue;
+        }
+        int blockCount = Cookfs_FsindexEntryGetBlockCount(e);
+        for (int j = 0; j < blockCount; j++) {
+            int pageIndex, pageOffset, pageSize;
+            Cookfs_FsindexEntryGetBlock(e, j, &pageIndex, &pageOffset,
+                &pageSize);
+            int isNew;
+            Tcl_CreateHashEntry(&seenPages, INT2PTR(pageIndex), &isNew);
+            if (isNew) {
+                Tcl_ListObjAppendElement(NULL, newTraceObj,
+                    Tcl_NewIntObj(pageIndex));
+            }
+        }
+    }
+    Tcl_DeleteHashTable(&seenPages);
+
+    Tcl_Size newTraceCount;
+    Tcl_ListObjLength(NULL, newTraceObj, &newTraceCount);
+    if (newTraceCount) {
+        CookfsLog(printf("store the access trace of %" TCL_SIZE_MODIFIER
+            "d pages", newTraceCount));
+        Cookfs_FsindexSetMetadata(dstVfs->index,
+            COOKFS_ACCESSTRACE_METADATA_KEY, newTraceObj);
+    }
+    Tcl_DecrRefCount(newTraceObj);
+
+    Cookfs_FsindexUnlock(dstVfs->index);
+
+    // Unmount the destination archive first, since it reads the files
+    // from the source archive
+
+    Cookfs_Vfs *vfs = dstVfs;
+    dstVfs = NULL;
+    if (CookfsOptimizeUnmount(interp, vfs) != TCL_OK) {
+        goto error;
+    }
+
+    *orderedCountPtr = orderedCount;
+    goto done;
+
+writerError:
+
+    Cookfs_WriterSetOrdered(dstVfs->writer, 0);
+    Cookfs_WriterUnlock(dstVfs->writer);
+
+errorWithErr:
+
+    if (err == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unknown error", -1));
+    } else {
+        Tcl_SetObjResult(interp, err);
+    }
+
+error:
+
+    rc = TCL_ERROR;
+
+done:
+
+    if (rc == TCL_ERROR) {
+        // Keep the error message, since unmounting can change
+        // the interp result
+        Tcl_Obj *result = Tcl_GetObjResult(interp);
+        Tcl_IncrRefCount(result);
+        if (dstVfs != NULL) {
+            CookfsOptimizeUnmount(interp, dstVfs);
+        }
+        if (srcVfs != NULL) {
+            CookfsOptimizeUnmount(interp, srcVfs);
+        }
+        if (isDestinationCreated) {
+            Tcl_FSDeleteFile(dstPath);
+        }
+        Tcl_SetObjResult(interp, result);
+        Tcl_DecrRefCount(result);
+    } else if (srcVfs != NULL) {
+        Tcl_Obj *result = Tcl_GetObjResult(interp);
+        Tcl_IncrRefCount(result);
+        CookfsOptimizeUnmount(interp, srcVfs);
+        Tcl_SetObjResult(interp, result);
+        Tcl_DecrRefCount(result);
+    }
+
+    if (isRankMapInitialized) {
+        Tcl_DeleteHashTable(&rankMap);
+    }
+    for (int j = 0; j < s.fileCount; j++) {
+        Tcl_DecrRefCount(s.files[j].path);
+    }
+    if (s.files != NULL) {
+        ckfree(s.files);
+    }
+    Tcl_DecrRefCount(s.dirs);
+    if (rootPathObj != NULL) {
+        Cookfs_PathObjDecrRefCount(rootPathObj);
+    }
+    if (metadataKeys != NULL) {
+        Tcl_DecrRefCount(metadataKeys);
+    }
+    if (traceObj != NULL) {
+        Tcl_DecrRefCount(traceObj);
+    }
+
+    CookfsLog(printf("return: %s", rc == TCL_OK ? "ok" : "ERROR"));
+    return rc;
+
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsOptimizeCmd --
+ *
+ *      Implements the ::cookfs::Optimize command. See
+ *      CookfsOptimizeRewrite() for details.
+ *
+ * Results:
+ *      TCL_OK and the number of files stored in access order or TCL_ERROR
+ *
+ * Side effects:
+ *      Creates the destination archive
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsOptimizeCmd(ClientData clientData, Tcl_Interp *interp,
+    int objc, Tcl_Obj *const objv[])
+{
+
+    UNUSED(clientData);
+
+    CookfsLog(printf("ENTER"));
+
+    static const char *const options[] = {
+        "-order", "-compression", NULL
+    };
+
+    enum options {
+        OPT_ORDER, OPT_COMPRESSION
+    };
+
+    Tcl_Obj *order = NULL;
+    Tcl_Obj *compression = NULL;
+    Tcl_Obj *source = NULL;
+    Tcl_Obj *destination = NULL;
+
+    for (int idx = 1; idx < objc; idx++) {
+
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[idx], options, "option",
+            TCL_EXACT, &opt) != TCL_OK)
+        {
+            // If the current argument is not an option but starts
+            // with '-' - consider it a misspelled argument.
+            if (Tcl_GetString(objv[idx])[0] == '-') {
+                return TCL_ERROR;
+            }
+            Tcl_ResetResult(interp);
+            if (source == NULL) {
+                source = objv[idx];
+            } else if (destination == NULL) {
+                destination = objv[idx];
+            } else {
+                goto wrongArgNum;
+            }
+            continue;
+        }
+
+        if (++idx == objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing argument to"
+                " %s option", options[opt]));
+            return TCL_ERROR;
+        }
+
+        if (opt == OPT_ORDER) {
+            order = objv[idx];
+        } else {
+            compression = objv[idx];
+        }
+
+    }
+
+    if (destination == NULL) {
+wrongArgNum:
+        Tcl_WrongNumArgs(interp, 1, objv, "?-order fileList?"
+            " ?-compression compression? source destination");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *srcPath = Tcl_FSGetNormalizedPath(interp, source);
+    Tcl_Obj *dstPath = Tcl_FSGetNormalizedPath(interp, destination);
+    if (srcPath == NULL || dstPath == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not normalize"
+            " archive path \"%s\"", Tcl_GetString(srcPath == NULL ?
+            source : destination)));
+        return TCL_ERROR;
+    }
+    // Normalized paths are owned by the source objects. Keep our own
+    // references, since the source objects may lose their internal rep.
+    srcPath = Tcl_DuplicateObj(srcPath);
+    Tcl_IncrRefCount(srcPath);
+    dstPath = Tcl_DuplicateObj(dstPath);
+    Tcl_IncrRefCount(dstPath);
+
+    int rc;
+    int orderedCount;
+
+    Tcl_StatBuf *sb = Tcl_AllocStatBuf();
+    int isExists = (Tcl_FSStat(dstPath, sb) == 0);
+    ckfree(sb);
+    if (isExists) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("destination archive \"%s\""
+            " already exists", Tcl_GetString(destination)));
+        rc = TCL_ERROR;
+    } else {
+        rc = CookfsOptimizeRewrite(interp, srcPath, dstPath, order,
+            compression, 1, NULL, &orderedCount);
+    }
+
+    if (rc == TCL_OK) {
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(orderedCount));
+    }
+
+    Tcl_DecrRefCount(srcPath);
+    Tcl_DecrRefCount(dstPath);
+
+    CookfsLog(printf("return: %s", rc == TCL_OK ? "ok" : "ERROR"));
+    return rc;
+
+}
+
+static void CookfsCompactForeachProc(Cookfs_FsindexEntry *e,
+    ClientData clientData)
+{
+    CookfsCompactState *cs = (CookfsCompactState *)clientData;
+    if (Cookfs_FsindexEntryIsDirectory(e)) {
+        return;
+    }
+    int blockCount = Cookfs_FsindexEntryGetBlockCount(e);
+    for (int i = 0; i < blockCount; i++) {
+        int pageIndex, pageOffset, pageSize;
+        Cookfs_FsindexEntryGetBlock(e, i, &pageIndex, &pageOffset,
+            &pageSize);
+        if (pageIndex >= 0 && pageIndex < cs->pagesCount) {
+            cs->liveBytes[pageIndex] += pageSize;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsCompactAnalyze --
+ *
+ *      Checks the pages of the specified archive and counts the pages that
+ *      are not used by any file, and the pages where the amount of data
+ *      used by files is less than the specified percentage of the page
+ *      size. Such pages remain in the archive after files are deleted
+ *      or overwritten.
+ *
+ *      Since identical files share the same data in the page, the amount
+ *      of used data may be overestimated. This only makes the check
+ *      more conservative.
+ *
+ * Results:
+ *      TCL_OK or TCL_ERROR. The number of unused and sparse pages, and
+ *      the data located before the archive are returned in the specified
+ *      pointers.
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsCompactAnalyze(Tcl_Interp *interp, Tcl_Obj *path,
+    int threshold, int *unusedCountPtr, int *sparseCountPtr,
+    Tcl_Obj **headObjPtr)
+{
+
+    Cookfs_VfsProps *props = Cookfs_VfsPropsInit();
+    Cookfs_VfsPropSetReadonly(props, 1);
+    Cookfs_Vfs *vfs = CookfsOptimizeMount(interp, path, props);
+    if (vfs == NULL) {
+        return TCL_ERROR;
+    }
+
+    int rc = TCL_OK;
+    Tcl_Obj *err = NULL;
+    CookfsCompactState cs;
+    cs.liveBytes = NULL;
+    cs.pagesCount = 0;
+    int *journalPages = NULL;
+    int journalCount = 0;
+
+    if (!Cookfs_PagesLockRead(vfs->pages, &err)) {
+        goto errorWithErr;
+    }
+    cs.pagesCount = Cookfs_PagesGetLength(vfs->pages);
+    *headObjPtr = Cookfs_PageGetHead(vfs->pages);
+    // Pages of the index journal are not used by files, but they are
+    // still needed to read the index
+    Cookfs_PageObj indexDataObj = Cookfs_PagesGetIndex(vfs->pages);
+    if (indexDataObj != NULL) {
+        journalCount = Cookfs_VfsIndexGetJournalPages(indexDataObj,
+            &journalPages);
+    }
+    Cookfs_PagesUnlock(vfs->pages);
+
+    if (*headObjPtr == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unable to read the data"
+            " before the archive", -1));
+        goto error;
+    }
+    Tcl_IncrRefCount(*headObjPtr);
+
+    if (cs.pagesCount) {
+        cs.liveBytes = (Tcl_WideInt *)ckalloc(sizeof(Tcl_WideInt)
+            * cs.pagesCount);
+        memset(cs.liveBytes, 0, sizeof(Tcl_WideInt) * cs.pagesCount);
+    }
+
+    if (!Cookfs_FsindexLockRead(vfs->index, &err)) {
+        goto errorWithErr;
+    }
+    if (Cookfs_FsindexHasFileset(vfs->index)) {
+        Cookfs_FsindexUnlock(vfs->index);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("archives with filesets"
+            " are not supported", -1));
+        goto error;
+    }
+    Cookfs_FsindexForeach(vfs->index, CookfsCompactForeachProc, &cs);
+    Cookfs_FsindexUnlock(vfs->index);
+
+    *unusedCountPtr = 0;
+    *sparseCountPtr = 0;
+    for (int i = 0; i < cs.pagesCount; i++) {
+        int isJournalPage = 0;
+        for (int j = 0; j < journalCount; j++) {
+            if (journalPages[j] == i) {
+                isJournalPage = 1;
+                break;
+            }
+        }
+        if (isJournalPage) {
+            CookfsLog(printf("page #%d is used by the index journal", i));
+            continue;
+        }
+        Tcl_WideInt pageSize = Cookfs_PagesGetPageSize(vfs->pages, i);
+        if (!cs.liveBytes[i]) {
+            CookfsLog(printf("page #%d is unused", i));
+            (*unusedCountPtr)++;
+        } else if (cs.liveBytes[i] * 100 < pageSize * threshold) {
+            CookfsLog(printf("page #%d is sparse: %" TCL_LL_MODIFIER "d of %"
+                TCL_LL_MODIFIER "d bytes are used", i, cs.liveBytes[i],
+                pageSize));
+            (*sparseCountPtr)++;
+        }
+    }
+
+    CookfsLog(printf("got %d unused and %d sparse pages of %d",
+        *unusedCountPtr, *sparseCountPtr, cs.pagesCount));
+
+    goto done;
+
+errorWithErr:
+
+    if (err == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("unknown error", -1));
+    } else {
+        Tcl_SetObjResult(interp, err);
+    }
+
+error:
+
+    rc = TCL_ERROR;
+    if (*headObjPtr != NULL) {
+        Tcl_DecrRefCount(*headObjPtr);
+        *headObjPtr = NULL;
+    }
+
+done:
+
+    if (cs.liveBytes != NULL) {
+        ckfree(cs.liveBytes);
+    }
+    if (journalPages != NULL) {
+        ckfree(journalPages);
+    }
+
+    Tcl_Obj *result = Tcl_GetObjResult(interp);
+    Tcl_IncrRefCount(result);
+    CookfsOptimizeUnmount(interp, vfs);
+    Tcl_SetObjResult(interp, result);
+    Tcl_DecrRefCount(result);
+
+    return rc;
+
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CookfsCompactCmd --
+ *
+ *      Implements the ::cookfs::Compact command. If the archive contains
+ *      unused or sparse pages, it rewrites the archive into a temporary
+ *      file next to it and then replaces the archive with that file.
+ *      The data located before the archive is kept. The files from
+ *      the recorded access trace remain in access order.
+ *
+ *      The archive must not be mounted while it is being compacted.
+ *
+ * Results:
+ *      TCL_OK and the number of reclaimed bytes or TCL_ERROR
+ *
+ * Side effects:
+ *      Replaces the archive file
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int CookfsCompactCmd(ClientData clientData, Tcl_Interp *interp,
+    int objc, Tcl_Obj *const objv[])
+{
+
+    UNUSED(clientData);
+
+    CookfsLog(printf("ENTER"));
+
+    static const char *const options[] = {
+        "-threshold", NULL
+    };
+
+    enum options {
+        OPT_THRESHOLD
+    };
+
+    Tcl_Obj *archive = NULL;
+    int threshold = 50;
+
+    for (int idx = 1; idx < objc; idx++) {
+
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[idx], options, "option",
+            TCL_EXACT, &opt) != TCL_OK)
+        {
+            // If the current argument is not an option but starts
+            // with '-' - consider it a misspelled argument.
+            if (Tcl_GetString(objv[idx])[0] == '-') {
+                return TCL_ERROR;
+            }
+            Tcl_ResetResult(interp);
+            if (archive == NULL) {
+                archive = objv[idx];
+            } else {
+                goto wrongArgNum;
+            }
+            continue;
+        }
+
+        if (++idx == objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing argument to"
+                " %s option", options[opt]));
+            return TCL_ERROR;
+        }
+
+        if (Tcl_GetIntFromObj(NULL, objv[idx], &threshold) != TCL_OK
+            || threshold < 0 || threshold > 100)
+        {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("integer argument from"
+                " 0 to 100 is expected for %s option, but got \"%s\"",
+                options[opt], Tcl_GetString(objv[idx])));
+            return TCL_ERROR;
+        }
+
+    }
+
+    if (archive == NULL) {
+wrongArgNum:
+        Tcl_WrongNumArgs(interp, 1, objv, "?-threshold percent? archive");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *path = Tcl_FSGetNormalizedPath(interp, archive);
+    if (path == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not normalize"
+            " archive path \"%s\"", Tcl_GetString(archive)));
+        return TCL_ERROR;
+    }
+    path = Tcl_DuplicateObj(path);
+    Tcl_IncrRefCount(path);
+
+    int rc = TCL_OK;
+    Tcl_Obj *headObj = NULL;
+    Tcl_Obj *tmpPath = NULL;
+    Tcl_StatBuf *sb = Tcl_AllocStatBuf();
+
+    if (Cookfs_CookfsFindVfs(path, -1) != NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("archive \"%s\" is mounted",
+            Tcl_GetString(archive)));
+        goto error;
+    }
+
+    int unusedCount, sparseCount;
+    if (CookfsCompactAnalyze(interp, path, threshold, &unusedCount,
+        &sparseCount, &headObj) != TCL_OK)
+    {
+        goto error;
+    }
+
+    if (!unusedCount && !sparseCount) {
+        CookfsLog(printf("nothing to compact"));
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(0));
+        goto done;
+    }
+
+    if (Tcl_FSStat(path, sb) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not get size of"
+            " archive \"%s\"", Tcl_GetString(archive)));
+        goto error;
+    }
+    Tcl_WideInt sizeBefore = Tcl_GetSizeFromStat(sb);
+
+    // Use a temporary file in the same directory, so that it can be
+    // renamed to the archive.
+    tmpPath = Tcl_DuplicateObj(path);
+    Tcl_IncrRefCount(tmpPath);
+    Tcl_AppendToObj(tmpPath, ".compact", -1);
+    if (Tcl_FSStat(tmpPath, sb) == 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("temporary file \"%s\""
+            " already exists", Tcl_GetString(tmpPath)));
+        goto error;
+    }
+
+    int orderedCount;
+    if (CookfsOptimizeRewrite(interp, path, tmpPath, NULL, NULL, 0,
+        (Tcl_GetCharLength(headObj) ? headObj : NULL), &orderedCount)
+        != TCL_OK)
+    {
+        goto error;
+    }
+
+    if (Tcl_FSStat(tmpPath, sb) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not get size of"
+            " file \"%s\"", Tcl_GetString(tmpPath)));
+        Tcl_FSDeleteFile(tmpPath);
+        goto error;
+    }
+    Tcl_WideInt sizeAfter = Tcl_GetSizeFromStat(sb);
+
+    // Replace the archive. Tcl replaces an existing target on all
+    // platforms. If the rename fails, the archive is left untouched.
+    if (Tcl_FSRenameFile(tmpPath, path) != TCL_OK) {
+        CookfsLog(printf("rename failed"));
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not replace"
+            " archive \"%s\" with compacted file \"%s\": %s",
+            Tcl_GetString(archive), Tcl_GetString(tmpPath),
+            Tcl_PosixError(interp)));
+        Tcl_FSDeleteFile(tmpPath);
+        goto error;
+    }
+
+    CookfsLog(printf("archive size: %" TCL_LL_MODIFIER "d -> %"
+        TCL_LL_MODIFIER "d", sizeBefore, sizeAfter));
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(sizeBefore - sizeAfter));
+    goto done;
+
+error:
+
+    rc = TCL_ERROR;
+
+done:
+
+    ckfree(sb);
+    if (headObj != NULL) {
+        Tcl_DecrRefCount(headObj);
+    }
+    if (tmpPath != NULL) {
+        Tcl_DecrRefCount(tmpPath);
+    }
+    Tcl_DecrRefCount(path);
+
+    CookfsLog(printf("return: %s", rc == TCL_OK ? "ok" : "ERROR"));
+    return rc;
+
+}
@@ -0,0 +1,10 @@
+/* (c) 2024 Konstantin Kushnir */
+
+#ifndef COOKFS_VFSOPTIMIZE_H
+#define COOKFS_VFSOPTIMIZE_H 1
+
+/* Tcl public API */
+
+int Cookfs_InitVfsOptimizeCmd(Tcl_Interp *interp);
+
+#endif /* COOKFS_VFSOPTIMIZE_H */
@@ -17,6 +17,7 @@ typedef struct Cookfs_VfsEntry {
     Tcl_Interp *interp;
     char *mountStr;
     Tcl_Size mountLen;
+    unsigned int mountHash;
     struct Cookfs_VfsEntry *next;
 } Cookfs_VfsEntry;
 
@@ -29,6 +30,11 @@ typedef struct ThreadSpecificData {
     Cookfs_VfsEntry *vfsListCached;
     Tcl_Obj *volumeListObjCached;
 
+    // Open addressing hash table of cached mount points. It is NULL if
+    // there are no mount points.
+    Cookfs_VfsEntry **mountTable;
+    unsigned int mountTableMask;
+
 } ThreadSpecificData;
 
 static Tcl_ThreadDataKey dataKeyCookfs;
@@ -69,6 +75,12 @@ static struct {
 };
 #endif /* TCL_THREADS */
 
+// FNV-1a hash of mount points. Cookfs_CookfsSplitWithVfs() calculates it
+// incrementally for all prefixes of a path.
+#define COOKFS_MOUNT_HASH_INIT 2166136261U
+#define COOKFS_MOUNT_HASH_STEP(h, c) \
+    (((h) ^ (unsigned char)(c)) * 16777619U)
+
 // Forward declarations
 static Tcl_InterpDeleteProc Cookfs_CookfsUnregister;
 static Tcl_ExitProc Cookfs_CookfsExitProc;
@@ -115,6 +127,11 @@ static void Cookfs_CookfsFillCache(Cookfs_VfsEntry **vfsListToPtr,
         newEntryVfs->mountStr = (char *)newEntryVfs + sizeof(Cookfs_VfsEntry);
         memcpy(newEntryVfs->mountStr, vfsListFrom->vfs->mountStr,
             newEntryVfs->mountLen + 1);
+        unsigned int hash = COOKFS_MOUNT_HASH_INIT;
+        for (Tcl_Size i = 0; i < newEntryVfs->mountLen; i++) {
+            hash = COOKFS_MOUNT_HASH_STEP(hash, newEntryVfs->mountStr[i]);
+        }
+        newEntryVfs->mountHash = hash;
         newEntryVfs->vfs = vfsListFrom->vfs;
         newEntryVfs->next = *vfsListToPtr;
         *vfsListToPtr = newEntryVfs;
@@ -142,6 +159,76 @@ static void Cookfs_CookfsFillCache(Cookfs_VfsEntry **vfsListToPtr,
     CookfsLog(printf("ok"));
 }
 
+static void Cookfs_CookfsBuildMountTable(ThreadSpecificData *tsdPtr) {
+
+    if (tsdPtr->mountTable != NULL) {
+        ckfree(tsdPtr->mountTable);
+        tsdPtr->mountTable = NULL;
+        tsdPtr->mountTableMask = 0;
+    }
+
+    unsigned int count = 0;
+    Cookfs_VfsEntry *e;
+    for (e = tsdPtr->vfsListCached; e != NULL; e = e->next) {
+        count++;
+    }
+
+    if (count == 0) {
+        CookfsLog(printf("no mount points"));
+        return;
+    }
+
+    // Keep the table at most half full
+    unsigned int size = 8;
+    while (size < count * 2) {
+        size *= 2;
+    }
+
+    CookfsLog(printf("create a table of %u slots for %u mount points",
+        size, count));
+
+    tsdPtr->mountTable = ckalloc(sizeof(Cookfs_VfsEntry *) * size);
+    memset(tsdPtr->mountTable, 0, sizeof(Cookfs_VfsEntry *) * size);
+    tsdPtr->mountTableMask = size - 1;
+
+    for (e = tsdPtr->vfsListCached; e != NULL; e = e->next) {
+        unsigned int idx = e->mountHash & tsdPtr->mountTableMask;
+        Cookfs_VfsEntry **slot = &tsdPtr->mountTable[idx];
+        while (*slot != NULL) {
+            // If there are several VFS with the same mount point, then
+            // the last one in the list is used. This is how
+            // Cookfs_CookfsSplitWithVfs() worked when scanning the list.
+            if ((*slot)->mountHash == e->mountHash &&
+                (*slot)->mountLen == e->mountLen &&
+                memcmp((*slot)->mountStr, e->mountStr, e->mountLen) == 0)
+            {
+                break;
+            }
+            idx = (idx + 1) & tsdPtr->mountTableMask;
+            slot = &tsdPtr->mountTable[idx];
+        }
+        *slot = e;
+    }
+
+}
+
+static Cookfs_VfsEntry *Cookfs_CookfsLookupMount(
+    const ThreadSpecificData *tsdPtr, const char *str, Tcl_Size len,
+    unsigned int hash)
+{
+    unsigned int idx = hash & tsdPtr->mountTableMask;
+    Cookfs_VfsEntry *e;
+    while ((e = tsdPtr->mountTable[idx]) != NULL) {
+        if (e->mountHash == hash && e->mountLen == len &&
+            memcmp(e->mountStr, str, len) == 0)
+        {
+            return e;
+        }
+        idx = (idx + 1) & tsdPtr->mountTableMask;
+    }
+    return NULL;
+}
+
 static void Cookfs_CookfsUpdateThreadSpecificData(ThreadSpecificData *tsdPtr) {
 
     CookfsLog(printf("enter"));
@@ -177,6 +264,8 @@ static void Cookfs_CookfsUpdateThreadSpecificData(ThreadSpecificData *tsdPtr) {
     Tcl_MutexUnlock(&global.mx);
 #endif /* TCL_THREADS */
 
+    Cookfs_CookfsBuildMountTable(tsdPtr);
+
     CookfsLog(printf("ok"));
     return;
 
@@ -531,17 +620,19 @@ Cookfs_Vfs *Cookfs_CookfsFindVfs(Tcl_Obj *path, Tcl_Size len) {
     }
     // CookfsLog(printf("ENTER [%s]", searchStr));
 
-    Cookfs_VfsEntry *e = tsdPtr->vfsListCached;
-    while (e != NULL) {
-        if (e->mountLen == len && strncmp(e->mountStr, searchStr,
-            (size_t)len) == 0)
-        {
-            return e->vfs;
-        }
-        e = e->next;
+    if (tsdPtr->mountTable == NULL) {
+        return NULL;
     }
 
-    return NULL;
+    unsigned int hash = COOKFS_MOUNT_HASH_INIT;
+    for (Tcl_Size i = 0; i < len; i++) {
+        hash = COOKFS_MOUNT_HASH_STEP(hash, searchStr[i]);
+    }
+
+    Cookfs_VfsEntry *e = Cookfs_CookfsLookupMount(tsdPtr, searchStr, len,
+        hash);
+
+    return (e == NULL ? NULL : e->vfs);
 }
 
 Cookfs_Vfs *Cookfs_CookfsSplitWithVfs(Tcl_Obj *path,
@@ -557,46 +648,58 @@ Cookfs_Vfs *Cookfs_CookfsSplitWithVfs(Tcl_Obj *path,
     // Here we want to find the longest mount path that matches a given path.
     // This is necessary because we can have vfs mount points inside
     // another vfs.
+    //
+    // A mount point matches if the search string is the VFS mount point,
+    // or if the search string has a filesystem separator at the point
+    // after the end of the VFS mount. This will prevent files like
+    // '/foo/mount.bar' from being considered as belonging to the mount
+    // point '/foo/mount'. Here we expect a normalized input path with
+    // the internal Tcl file system separator '/'. Thus, we don't check
+    // for '\' on Windows and '/' on Unix.
+    //
+    // However, we also should consider a case where mount point contains
+    // a filesystem separator at the end. For example, if we have a mount
+    // point like 'mount://'. Such a mount point matches the prefix of
+    // the search string that ends with the separator.
+    //
+    // Thus, only prefixes that end before or after a separator, and
+    // the whole search string can be mount points. We calculate hash
+    // of the search string incrementally and look up these prefixes in
+    // the table of mount points. The last found prefix is the longest one.
+
+    if (tsdPtr->mountTable == NULL) {
+        // CookfsLog(printf("return NULL (no mount points)"));
+        return NULL;
+    }
 
     Tcl_Size foundSize = 0;
     Cookfs_VfsEntry *foundEntry = NULL;
-
     Cookfs_VfsEntry *e;
-    for (e = tsdPtr->vfsListCached; e != NULL; e = e->next) {
-        Tcl_Size mountLen = e->mountLen;
-        // If we already found a mount point longer then the current one, or
-        // if the current mount point is longer than the search path, or
-        // if the current mount point doesn't match the search path,
-        // then continue
-        if (foundSize > mountLen ||
-            mountLen > searchLen ||
-            memcmp(e->mountStr, searchStr, mountLen) != 0)
-        {
-            continue;
-        }
-        // Also, we check that we have filesystem separator in the search
-        // string at the point after the end of the VFS mount or the search
-        // string is the VFS mount point (they are the same length).
-        // This will prevent files like '/foo/mount.bar' from being considered
-        // as belonging to the mount point '/foo/mount'. Here we expect
-        // a normalized input path with the internal Tcl file system
-        // separator '/'. Thus, we don't check for '\' on Windows and '/'
-        // on Unix.
-        //
-        // However, we also should consider a case where mount point contains
-        // a filesystem separator at the end. For example, if we have a mount
-        // point like 'mount://'. In this case, we don't need to perform
-        // the above check because we have already verified that the start
-        // of the search string matches the VFS mount point.
-        if (e->mountStr[mountLen - 1] != VFS_SEPARATOR &&
-            mountLen != searchLen &&
-            searchStr[mountLen] != VFS_SEPARATOR)
-        {
-            continue;
-        }
 
-        // We found matching the mount point.
-        foundSize = mountLen;
+    unsigned int hash = COOKFS_MOUNT_HASH_INIT;
+    for (Tcl_Size i = 0; i < searchLen; i++) {
+        if (searchStr[i] == VFS_SEPARATOR) {
+            if (i > 0 && (e = Cookfs_CookfsLookupMount(tsdPtr, searchStr, i,
+                hash)) != NULL)
+            {
+                foundSize = i;
+                foundEntry = e;
+            }
+            hash = COOKFS_MOUNT_HASH_STEP(hash, searchStr[i]);
+            if ((e = Cookfs_CookfsLookupMount(tsdPtr, searchStr, i + 1,
+                hash)) != NULL)
+            {
+                foundSize = i + 1;
+                foundEntry = e;
+            }
+        } else {
+            hash = COOKFS_MOUNT_HASH_STEP(hash, searchStr[i]);
+        }
+    }
+    if ((e = Cookfs_CookfsLookupMount(tsdPtr, searchStr, searchLen,
+        hash)) != NULL)
+    {
+        foundSize = searchLen;
         foundEntry = e;
     }
 
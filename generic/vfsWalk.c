@@ -0,0 +1,284 @@
+/*
+ * vfsWalk.c
+ *
+ * Provides a command that lists all entries in a directory of a mounted
+ * archive recursively, along with their metadata, in a single call
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+#include "cookfs.h"
+#include "vfs.h"
+#include "vfsVfs.h"
+#include "vfsWalk.h"
+
+typedef enum {
+    COOKFS_WALK_TYPE_ANY,
+    COOKFS_WALK_TYPE_FILE,
+    COOKFS_WALK_TYPE_DIRECTORY
+} CookfsWalkType;
+
+typedef struct CookfsWalkState {
+    Tcl_DString path;
+    Tcl_Obj *result;
+    const char *pattern;
+    CookfsWalkType type;
+    int withPages;
+    /* shared objects for keys and values of entry info */
+    Tcl_Obj *keyType;
+    Tcl_Obj *keySize;
+    Tcl_Obj *keyMtime;
+    Tcl_Obj *keyPages;
+    Tcl_Obj *valueFile;
+    Tcl_Obj *valueDirectory;
+} CookfsWalkState;
+
+static Tcl_ObjCmdProc CookfsWalkCmd;
+
+int Cookfs_InitVfsWalkCmd(Tcl_Interp *interp) {
+
+    Tcl_CreateObjCommand(interp, "::cookfs::c::Walk", CookfsWalkCmd,
+        (ClientData) NULL, NULL);
+
+    Tcl_CreateAlias(interp, "::cookfs::Walk", interp,
+        "::cookfs::c::Walk", 0, NULL);
+
+    return TCL_OK;
+
+}
+
+static Tcl_Obj *CookfsWalkEntryInfo(CookfsWalkState *s,
+    Cookfs_FsindexEntry *e, int isDirectory)
+{
+    Tcl_Obj *info = Tcl_NewListObj(0, NULL);
+
+    Tcl_ListObjAppendElement(NULL, info, s->keyType);
+    Tcl_ListObjAppendElement(NULL, info, isDirectory ? s->valueDirectory :
+        s->valueFile);
+    Tcl_ListObjAppendElement(NULL, info, s->keySize);
+    Tcl_ListObjAppendElement(NULL, info, Tcl_NewWideIntObj(isDirectory ? 0 :
+        Cookfs_FsindexEntryGetFilesize(e)));
+    Tcl_ListObjAppendElement(NULL, info, s->keyMtime);
+    Tcl_ListObjAppendElement(NULL, info,
+        Tcl_NewWideIntObj(Cookfs_FsindexEntryGetFileTime(e)));
+
+    if (s->withPages && !isDirectory) {
+        int blockCount = Cookfs_FsindexEntryGetBlockCount(e);
+        Tcl_Obj *pages = Tcl_NewListObj(0, NULL);
+        for (int i = 0; i < blockCount; i++) {
+            int pageIndex, pageOffset, pageSize;
+            Cookfs_FsindexEntryGetBlock(e, i, &pageIndex, &pageOffset,
+                &pageSize);
+            Tcl_ListObjAppendElement(NULL, pages, Tcl_NewIntObj(pageIndex));
+            Tcl_ListObjAppendElement(NULL, pages, Tcl_NewIntObj(pageOffset));
+            Tcl_ListObjAppendElement(NULL, pages, Tcl_NewIntObj(pageSize));
+        }
+        Tcl_ListObjAppendElement(NULL, info, s->keyPages);
+        Tcl_ListObjAppendElement(NULL, info, pages);
+    }
+
+    return info;
+}
+
+static void CookfsWalkProc(Cookfs_FsindexEntry *e, ClientData clientData) {
+    CookfsWalkState *s = (CookfsWalkState *)clientData;
+
+    unsigned char nameLen;
+    const char *name = Cookfs_FsindexEntryGetFileName(e, &nameLen);
+
+    Tcl_Size prefixLen = Tcl_DStringLength(&s->path);
+    Tcl_DStringAppend(&s->path, name, nameLen);
+
+    int isDirectory = Cookfs_FsindexEntryIsDirectory(e);
+
+    if ((s->type == COOKFS_WALK_TYPE_ANY ||
+        (s->type == COOKFS_WALK_TYPE_DIRECTORY) == isDirectory) &&
+        (s->pattern == NULL ||
+        Tcl_StringCaseMatch(Tcl_DStringValue(&s->path), s->pattern, 0)))
+    {
+        CookfsLog(printf("add entry [%s]", Tcl_DStringValue(&s->path)));
+        Tcl_ListObjAppendElement(NULL, s->result,
+            Tcl_NewStringObj(Tcl_DStringValue(&s->path),
+            Tcl_DStringLength(&s->path)));
+        Tcl_ListObjAppendElement(NULL, s->result,
+            CookfsWalkEntryInfo(s, e, isDirectory));
+    }
+
+    if (isDirectory) {
+        Tcl_DStringAppend(&s->path, "/", 1);
+        Cookfs_FsindexEntryMatch(e, "*", CookfsWalkProc, clientData);
+    }
+
+    Tcl_DStringSetLength(&s->path, prefixLen);
+}
+
+static int CookfsWalkCmd(ClientData clientData, Tcl_Interp *interp,
+    int objc, Tcl_Obj *const objv[])
+{
+
+    UNUSED(clientData);
+
+    CookfsLog(printf("ENTER"));
+
+    static const char *const options[] = {
+        "-pattern", "-type", "-pages", NULL
+    };
+
+    enum options {
+        OPT_PATTERN, OPT_TYPE, OPT_PAGES
+    };
+
+    static const char *const types[] = {
+        "file", "directory", NULL
+    };
+
+    Tcl_Obj *dir = NULL;
+    const char *pattern = NULL;
+    CookfsWalkType type = COOKFS_WALK_TYPE_ANY;
+    int withPages = 0;
+
+    for (int idx = 1; idx < objc; idx++) {
+
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[idx], options, "option",
+            TCL_EXACT, &opt) != TCL_OK)
+        {
+            // If the current argument is not an option but starts
+            // with '-' - consider it a misspelled argument.
+            if (Tcl_GetString(objv[idx])[0] == '-') {
+                return TCL_ERROR;
+            }
+            Tcl_ResetResult(interp);
+            if (dir == NULL) {
+                dir = objv[idx];
+            } else {
+                goto wrongArgNum;
+            }
+            continue;
+        }
+
+        if (opt == OPT_PAGES) {
+            withPages = 1;
+            continue;
+        }
+
+        if (++idx == objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing argument to"
+                " %s option", options[opt]));
+            return TCL_ERROR;
+        }
+
+        if (opt == OPT_PATTERN) {
+            pattern = Tcl_GetString(objv[idx]);
+        } else {
+            int typeIdx;
+            if (Tcl_GetIndexFromObj(interp, objv[idx], types, "type", 0,
+                &typeIdx) != TCL_OK)
+            {
+                return TCL_ERROR;
+            }
+            type = (typeIdx == 0 ? COOKFS_WALK_TYPE_FILE :
+                COOKFS_WALK_TYPE_DIRECTORY);
+        }
+
+    }
+
+    if (dir == NULL) {
+wrongArgNum:
+        Tcl_WrongNumArgs(interp, 1, objv, "?-pattern pattern? ?-type type?"
+            " ?-pages? path");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *normPath = Tcl_FSGetNormalizedPath(interp, dir);
+    if (normPath == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("could not normalize"
+            " path \"%s\"", Tcl_GetString(dir)));
+        return TCL_ERROR;
+    }
+
+    Cookfs_PathObj *pathObj;
+    Cookfs_Vfs *vfs = Cookfs_CookfsSplitWithVfs(normPath, &pathObj);
+    if (vfs == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("path \"%s\" is not"
+            " in a mounted cookfs archive", Tcl_GetString(dir)));
+        return TCL_ERROR;
+    }
+    Cookfs_PathObjIncrRefCount(pathObj);
+
+    if (!Cookfs_CookfsVfsLock(vfs)) {
+        Cookfs_PathObjDecrRefCount(pathObj);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("path \"%s\" is not"
+            " in a mounted cookfs archive", Tcl_GetString(dir)));
+        return TCL_ERROR;
+    }
+
+    Cookfs_Fsindex *index = vfs->index;
+    Tcl_Obj *err = NULL;
+    int lockResult = Cookfs_FsindexLockRead(index, &err);
+
+    Cookfs_CookfsVfsUnlock(vfs);
+
+    if (!lockResult) {
+        Cookfs_PathObjDecrRefCount(pathObj);
+        if (err != NULL) {
+            Tcl_SetObjResult(interp, err);
+        }
+        return TCL_ERROR;
+    }
+
+    int rc = TCL_OK;
+
+    Cookfs_FsindexEntry *entry = Cookfs_FsindexGet(index, pathObj);
+    if (entry == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't walk \"%s\":"
+            " no such file or directory", Tcl_GetString(dir)));
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    if (!Cookfs_FsindexEntryIsDirectory(entry)) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't walk \"%s\":"
+            " not a directory", Tcl_GetString(dir)));
+        rc = TCL_ERROR;
+        goto done;
+    }
+
+    CookfsWalkState s;
+    Tcl_DStringInit(&s.path);
+    s.result = Tcl_NewListObj(0, NULL);
+    s.pattern = pattern;
+    s.type = type;
+    s.withPages = withPages;
+    s.keyType = Tcl_NewStringObj("type", -1);
+    s.keySize = Tcl_NewStringObj("size", -1);
+    s.keyMtime = Tcl_NewStringObj("mtime", -1);
+    s.keyPages = Tcl_NewStringObj("pages", -1);
+    s.valueFile = Tcl_NewStringObj("file", -1);
+    s.valueDirectory = Tcl_NewStringObj("directory", -1);
+    Tcl_IncrRefCount(s.keyType);
+    Tcl_IncrRefCount(s.keySize);
+    Tcl_IncrRefCount(s.keyMtime);
+    Tcl_IncrRefCount(s.keyPages);
+    Tcl_IncrRefCount(s.valueFile);
+    Tcl_IncrRefCount(s.valueDirectory);
+
+    Cookfs_FsindexEntryMatch(entry, "*", CookfsWalkProc, (ClientData)&s);
+
+    Tcl_DecrRefCount(s.keyType);
+    Tcl_DecrRefCount(s.keySize);
+    Tcl_DecrRefCount(s.keyMtime);
+    Tcl_DecrRefCount(s.keyPages);
+    Tcl_DecrRefCount(s.valueFile);
+    Tcl_DecrRefCount(s.valueDirectory);
+    Tcl_DStringFree(&s.path);
+
+    Tcl_SetObjResult(interp, s.result);
+
+done:
+    Cookfs_FsindexUnlock(index);
+    Cookfs_PathObjDecrRefCount(pathObj);
+    CookfsLog(printf("return: %s", (rc == TCL_OK ? "ok" : "ERROR")));
+    return rc;
+
+}
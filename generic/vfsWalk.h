@@ -0,0 +1,10 @@
+/* (c) 2024 Konstantin Kushnir */
+
+#ifndef COOKFS_VFSWALK_H
+#define COOKFS_VFSWALK_H 1
+
+/* Tcl public API */
+
+int Cookfs_InitVfsWalkCmd(Tcl_Interp *interp);
+
+#endif /* COOKFS_VFSWALK_H */
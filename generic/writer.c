@@ -109,6 +109,39 @@ void Cookfs_WriterLockExclusive(Cookfs_Writer *w) {
 #endif /* TCL_THREADS */
 }
 
+#ifdef TCL_THREADS
+Cookfs_LockStats *Cookfs_WriterGetLockStats(Cookfs_Writer *w) {
+    return Cookfs_RWMutexGetStats(w->mx);
+}
+#endif /* TCL_THREADS */
+
+Tcl_Obj *Cookfs_WriterGetStatsObj(Cookfs_Writer *w) {
+    Tcl_Obj *result = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("deduphits", -1),
+        Tcl_NewWideIntObj(Cookfs_CounterGet(&w->statsDedupHits)));
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("purges", -1),
+        Tcl_NewWideIntObj(Cookfs_CounterGet(&w->statsPurges)));
+    Tcl_DictObjPut(NULL, result, Tcl_NewStringObj("purgedfiles", -1),
+        Tcl_NewWideIntObj(Cookfs_CounterGet(&w->statsPurgedFiles)));
+    return result;
+}
+
+void Cookfs_WriterResetStats(Cookfs_Writer *w) {
+    Cookfs_CounterReset(&w->statsDedupHits);
+    Cookfs_CounterReset(&w->statsPurges);
+    Cookfs_CounterReset(&w->statsPurgedFiles);
+}
+
+void Cookfs_WriterSetLatency(Cookfs_Writer *w, Cookfs_Latency *latency) {
+    if (latency != NULL) {
+        Cookfs_LatencyIncrRefCount(latency);
+    }
+    if (w->latency != NULL) {
+        Cookfs_LatencyDecrRefCount(w->latency);
+    }
+    w->latency = latency;
+}
+
 static Cookfs_WriterBuffer *Cookfs_WriterWriterBufferAlloc(
     Cookfs_PathObj *pathObj, Tcl_WideInt mtime)
 {
@@ -186,6 +219,7 @@ Cookfs_Writer *Cookfs_WriterInit(Tcl_Interp* interp,
     Cookfs_FsindexLockSoft(index);
 
     w->isWriteToMemory = writetomemory;
+    // w->isOrdered = 0;
     w->smallFileSize = smallfilesize;
     w->maxBufferSize = smallfilebuffer;
     w->pageSize = pagesize;
@@ -198,6 +232,12 @@ Cookfs_Writer *Cookfs_WriterInit(Tcl_Interp* interp,
     // w->pageMapByPage = NULL;
     // w->pageMapBySize = NULL;
 
+    // w->statsDedupHits = 0;
+    // w->statsPurges = 0;
+    // w->statsPurgedFiles = 0;
+
+    // w->latency = NULL;
+
     CookfsLog(printf("ok [%p]", (void *)w));
     return w;
 
@@ -211,6 +251,9 @@ static void Cookfs_WriterFree(Cookfs_Writer *w) {
     Tcl_MutexUnlock(&w->mxLockSoft);
     Tcl_MutexFinalize(&w->mxLockSoft);
 #endif /* TCL_THREADS */
+    if (w->latency != NULL) {
+        Cookfs_LatencyDecrRefCount(w->latency);
+    }
     /* clean up storage */
     ckfree((void *)w);
 }
@@ -708,6 +751,7 @@ static int Cookfs_WriterCheckDuplicate(Cookfs_Writer *w, void *buffer,
 
         if (cmp == 0) {
             CookfsLog(printf("duplicate has been found"));
+            Cookfs_CounterAdd(&w->statsDedupHits, 1);
             Cookfs_FsindexEntrySetBlock(entry, 0, pme->pageNum, pme->pageOffset,
                 bufferSize);
             rc = 1;
@@ -1166,6 +1210,18 @@ int Cookfs_WriterAddFile(Cookfs_Writer *w, Cookfs_PathObj *pathObj,
 
         CookfsLog(printf("write big file"));
 
+        // In ordered mode, the pages must follow the order in which
+        // the files were added. Thus, flush the small files added before
+        // this file first.
+        if (w->isOrdered && w->bufferCount) {
+            CookfsLog(printf("ordered mode, purge small file buffer"));
+            result = Cookfs_WriterPurge(w, 1, err);
+            if (result != TCL_OK) {
+                CookfsLog(printf("ERROR: failed to purge"));
+                goto error;
+            }
+        }
+
         if (dataType == COOKFS_WRITER_SOURCE_CHANNEL ||
             dataType == COOKFS_WRITER_SOURCE_FILE)
         {
@@ -1345,15 +1401,22 @@ static int Cookfs_WriterPurgeSortFunc(const void *a, const void *b) {
     return rc;
 }
 
-int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
+static int Cookfs_WriterPurgeOrderedSortFunc(const void *a, const void *b) {
+    Cookfs_WriterBuffer *wba = *(Cookfs_WriterBuffer **)a;
+    Cookfs_WriterBuffer *wbb = *(Cookfs_WriterBuffer **)b;
+    if (wba->sortOrder != wbb->sortOrder) {
+        return wba->sortOrder < wbb->sortOrder ? -1 : 1;
+    }
+    return wba->sortPosition < wbb->sortPosition ? -1 :
+        (wba->sortPosition > wbb->sortPosition ? 1 : 0);
+}
 
-    Cookfs_WriterWantWrite(w);
+static int Cookfs_WriterPurgeInt(Cookfs_Writer *w, int lockIndex,
+    Tcl_Obj **err)
+{
 
-    CookfsLog(printf("enter [%p]", (void *)w));
-    if (w->bufferCount == 0) {
-        CookfsLog(printf("nothing to purge"));
-        return TCL_OK;
-    }
+    Cookfs_CounterAdd(&w->statsPurges, 1);
+    Cookfs_CounterAdd(&w->statsPurgedFiles, w->bufferCount);
 
     int result = TCL_OK;
     unsigned char *pageBuffer = NULL;
@@ -1387,6 +1450,12 @@ int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
     //
     // To solve this problem, we will check the buffers and if they are
     // identical, then we will use the same sort key for those buffers.
+    //
+    // If the writer is in ordered mode, the files should be stored in
+    // the order in which they were added. In this case, the buffers are
+    // sorted by the position of the first identical buffer, and then by
+    // their own position. This keeps the insertion order, but identical
+    // buffers are still placed next to each other.
 
     CookfsLog(printf("have total %d entries", w->bufferCount));
     // Create array for all our entries
@@ -1403,6 +1472,8 @@ int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
         CookfsLog(printf("add buffer [%p] size %" TCL_LL_MODIFIER "d to"
             " sort buffer at #%d", (void *)wb->buffer, wb->bufferSize, i));
         sortedWB[i] = wb;
+        wb->sortOrder = i;
+        wb->sortPosition = i;
 
         // If we have less than 3 buffers, then we will not sort them
         if (w->bufferCount < 3) {
@@ -1440,6 +1511,7 @@ int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
                     Cookfs_PathObjIncrRefCount(wb->sortKey);
                     wb->sortKeyExt = wbc->sortKeyExt;
                     wb->sortKeyExtLen = wbc->sortKeyExtLen;
+                    wb->sortOrder = wbc->sortOrder;
                     // Stop processing
                     break;
                 }
@@ -1497,7 +1569,8 @@ int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
         );
         CookfsLog(printf("sort buffers..."));
         qsort(sortedWB, w->bufferCount, sizeof(Cookfs_WriterBuffer *),
-            Cookfs_WriterPurgeSortFunc);
+            (w->isOrdered ? Cookfs_WriterPurgeOrderedSortFunc :
+            Cookfs_WriterPurgeSortFunc));
         CookfsLog( \
             printf("== entries ===========> \n"); \
             for (i = 0; i < w->bufferCount; i++) { \
@@ -1548,6 +1621,7 @@ int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
                     wb->pageBlock = prevWB->pageBlock;
                     wb->pageOffset = prevWB->pageOffset;
                     found = 1;
+                    Cookfs_CounterAdd(&w->statsDedupHits, 1);
                 }
                 // We don't need the previous buffer and free it now
                 // to optimize memory usage.
@@ -1705,6 +1779,23 @@ done:
     return result;
 }
 
+int Cookfs_WriterPurge(Cookfs_Writer *w, int lockIndex, Tcl_Obj **err) {
+
+    Cookfs_WriterWantWrite(w);
+
+    CookfsLog(printf("enter [%p]", (void *)w));
+    if (w->bufferCount == 0) {
+        CookfsLog(printf("nothing to purge"));
+        return TCL_OK;
+    }
+
+    Tcl_WideInt start = Cookfs_LatencyStart();
+    int result = Cookfs_WriterPurgeInt(w, lockIndex, err);
+    Cookfs_LatencyStop(w->latency, COOKFS_LATENCY_PURGE, start);
+
+    return result;
+}
+
 const void *Cookfs_WriterGetBuffer(Cookfs_Writer *w, int blockNumber,
     Tcl_WideInt *blockSize)
 {
@@ -1761,6 +1852,16 @@ void Cookfs_WriterSetWritetomemory(Cookfs_Writer *w, int status) {
     return;
 }
 
+int Cookfs_WriterGetOrdered(Cookfs_Writer *w) {
+    return w->isOrdered;
+}
+
+void Cookfs_WriterSetOrdered(Cookfs_Writer *w, int status) {
+    Cookfs_WriterWantWrite(w);
+    w->isOrdered = status;
+    return;
+}
+
 Tcl_WideInt Cookfs_WriterGetSmallfilebuffersize(Cookfs_Writer *w) {
     Cookfs_WriterWantRead(w);
     return w->bufferSize;
@@ -41,6 +41,9 @@ int Cookfs_WriterRemoveFile(Cookfs_Writer *w, Cookfs_FsindexEntry *entry);
 int Cookfs_WriterGetWritetomemory(Cookfs_Writer *w);
 void Cookfs_WriterSetWritetomemory(Cookfs_Writer *w, int status);
 
+int Cookfs_WriterGetOrdered(Cookfs_Writer *w);
+void Cookfs_WriterSetOrdered(Cookfs_Writer *w, int status);
+
 Tcl_WideInt Cookfs_WriterGetSmallfilebuffersize(Cookfs_Writer *w);
 
 int Cookfs_WriterUnlockSoft(Cookfs_Writer *w);
@@ -53,4 +56,12 @@ int Cookfs_WriterLockRW(int isWrite, Cookfs_Writer *w, Tcl_Obj **err);
 
 void Cookfs_WriterLockExclusive(Cookfs_Writer *w);
 
+Tcl_Obj *Cookfs_WriterGetStatsObj(Cookfs_Writer *w);
+void Cookfs_WriterResetStats(Cookfs_Writer *w);
+void Cookfs_WriterSetLatency(Cookfs_Writer *w, Cookfs_Latency *latency);
+
+#ifdef TCL_THREADS
+Cookfs_LockStats *Cookfs_WriterGetLockStats(Cookfs_Writer *w);
+#endif /* TCL_THREADS */
+
 #endif /* COOKFS_WRITER_H */
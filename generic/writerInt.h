@@ -13,6 +13,8 @@ typedef struct Cookfs_WriterBuffer {
     Cookfs_PathObj *sortKey;
     char *sortKeyExt;
     Tcl_Size sortKeyExtLen;
+    int sortOrder;
+    int sortPosition;
 
     int pageBlock;
     int pageOffset;
@@ -37,6 +39,7 @@ struct _Cookfs_Writer {
     Cookfs_Fsindex *index;
 
     int isWriteToMemory;
+    int isOrdered;
     Tcl_WideInt smallFileSize;
     Tcl_WideInt maxBufferSize;
     Tcl_WideInt pageSize;
@@ -49,6 +52,14 @@ struct _Cookfs_Writer {
     Tcl_WideInt bufferSize;
     int bufferCount;
 
+    /* statistics, see Cookfs_WriterGetStatsObj() */
+    Cookfs_Counter statsDedupHits;
+    Cookfs_Counter statsPurges;
+    Cookfs_Counter statsPurgedFiles;
+
+    /* latency histograms of the mount, can be NULL */
+    Cookfs_Latency *latency;
+
 };
 
 #ifdef TCL_THREADS
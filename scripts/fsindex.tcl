@@ -192,15 +192,113 @@ proc cookfs::tcl::fsindex::cleanup {name} {
 
 proc cookfs::tcl::fsindex::import {name data} {
     upvar #0 $name c
-    if {[string range $data 0 7] != "CFS2.200"} {
-         error "Unable to create index object"
+    switch -- [string range $data 0 7] {
+        "CFS2.200" {
+             set data [string range $data 8 end]
+             importPath $name {} data
+        }
+        "CFS2.300" {
+             set pos 8
+             importTablesV3 $name data pos
+             importPathV3 $name {} data pos
+             set data [string range $data $pos end]
+        }
+        default {
+             error "Unable to create index object"
+        }
     }
-    set data [string range $data 8 end]
-    importPath $name {} data
     importMetadata $name data
     resetChangeCount $name
 }
 
+proc cookfs::tcl::fsindex::readVarint {varname posname} {
+    upvar 1 $varname data
+    upvar 1 $posname pos
+    set value 0
+    set shift 0
+    while {1} {
+         if {[binary scan $data @${pos}cu byte] != 1} {
+             error "Unable to create index object"
+         }
+         incr pos
+         set value [expr {$value | (($byte & 0x7f) << $shift)}]
+         if {!($byte & 0x80)} {
+             return $value
+         }
+         incr shift 7
+    }
+}
+
+proc cookfs::tcl::fsindex::readZigzag {varname posname} {
+    upvar 1 $varname data
+    upvar 1 $posname pos
+    set value [readVarint data pos]
+    if {$value & 1} {
+         return [expr {-($value >> 1) - 1}]
+    }
+    return [expr {$value >> 1}]
+}
+
+proc cookfs::tcl::fsindex::importTablesV3 {name varname posname} {
+    upvar 1 $varname data
+    upvar 1 $posname pos
+    # block usage is calculated from the imported files
+    set count [readVarint data pos]
+    for {set i 0} {$i < $count} {incr i} {
+         readVarint data pos
+    }
+    # directory records are read sequentially in pre-order,
+    # the table of directories is not needed
+    set count [readVarint data pos]
+    for {set i 0} {$i < $count * 2} {incr i} {
+         readVarint data pos
+    }
+}
+
+proc cookfs::tcl::fsindex::importPathV3 {name path varname posname} {
+    upvar #0 $name c
+    upvar 1 $varname data
+    upvar 1 $posname pos
+    set numitems [readVarint data pos]
+    set c($path) {}
+    set un ""
+    set time 0
+    set chunk 0
+    set dirs [list]
+    for {set i 0} {$i < $numitems} {incr i} {
+         set prefix [readVarint data pos]
+         set suffix [readVarint data pos]
+         set un [string range $un 0 [expr {$prefix - 1}]][string range $data $pos [expr {$pos + $suffix - 1}]]
+         incr pos $suffix
+         if {[string length $un] != $prefix + $suffix} {
+             error "Unable to create index object"
+         }
+         set filename [encoding convertfrom utf-8 $un]
+         set time [expr {$time + [readZigzag data pos]}]
+         set numblocks [expr {[readVarint data pos] - 1}]
+         if {$numblocks == -1} {
+             lappend dirs $filename
+             lappend c($path) $filename [list $time]
+         }  else  {
+             set bosdata [list]
+             set size 0
+             for {set j 0} {$j < $numblocks} {incr j} {
+                  incr chunk [readZigzag data pos]
+                  set offset [readVarint data pos]
+                  set cs [readVarint data pos]
+                  lappend bosdata $chunk $offset $cs
+                  incr size $cs
+                  incrBlockUsage $name $chunk
+             }
+             lappend c($path) $filename [list $time $size $bosdata]
+         }
+    }
+    # records of child directories follow the current one
+    foreach filename $dirs {
+         importPathV3 $name [_normalizePath [file join $path $filename]] data pos
+    }
+}
+
 proc cookfs::tcl::fsindex::importPath {name path varname} {
     upvar #0 $name c
     upvar 1 $varname data
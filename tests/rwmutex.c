@@ -0,0 +1,271 @@
+/*
+ * rwmutex.c
+ *
+ * Stress test of the readers-writer mutex (see threads.c). This is
+ * a standalone program that is linked with cookfs objects directly.
+ *
+ * Reader and writer threads take the lock in a loop. Writers modify two
+ * shared values one after another, and readers check that they always see
+ * equal values. Both sides also count the threads that are inside the lock
+ * and check that a writer never runs together with another writer or with
+ * a reader. Then the main thread takes an exclusive lock and checks that
+ * other threads can't take the lock anymore.
+ *
+ * The test is most useful when the package is built with
+ * -fsanitize=thread, as it then also reports unordered accesses to
+ * the shared values.
+ *
+ * Usage: make test-rwmutex [RWMUTEX_ARGS="?-readers <count>?
+ *     ?-writers <count>? ?-iterations <count>?"]
+ *
+ * (c) 2024 Konstantin Kushnir
+ */
+
+// The test driver calls Tcl directly, while cookfs objects use
+// the stubs table initialized in Cookfs_Init().
+#undef USE_TCL_STUBS
+
+#include "cookfs.h"
+
+#ifdef TCL_THREADS
+
+typedef struct CookfsTestRWMutexData {
+    Cookfs_RWMutex mx;
+    int iterations;
+    // Modified only under the write lock
+    Tcl_WideInt valueA;
+    Tcl_WideInt valueB;
+    int writerInside;
+    // Readers that are inside the lock, and 1 minus the number of writers
+    // that are inside the lock
+    Cookfs_RefCount readersInside;
+    Cookfs_RefCount writersFree;
+    Cookfs_RefCount errors;
+    // Set by the thread that tries to take an exclusively locked mutex
+    int lockReadResult;
+    int lockWriteResult;
+} CookfsTestRWMutexData;
+
+static void CookfsTestRWMutexError(CookfsTestRWMutexData *d,
+    const char *message)
+{
+    // Report only the first few errors, the rest are counted
+    if (Cookfs_RefCountGet(&d->errors) < 10) {
+        fprintf(stderr, "ERROR: %s\n", message);
+    }
+    Cookfs_RefCountIncr(&d->errors);
+}
+
+static void CookfsTestRWMutexWork(int count, int sleep) {
+    // Give other threads a chance to run while the lock is held. Sleep
+    // from time to time, so that the threads overlap even on a single CPU.
+    if (sleep) {
+        Tcl_Sleep(1);
+        return;
+    }
+    volatile int x = 0;
+    for (int i = 0; i < count; i++) {
+        x += i;
+    }
+    (void)x;
+}
+
+static Tcl_ThreadCreateType CookfsTestRWMutexReader(void *clientData) {
+    CookfsTestRWMutexData *d = (CookfsTestRWMutexData *)clientData;
+    for (int i = 0; i < d->iterations; i++) {
+        if (!Cookfs_RWMutexLockRead(d->mx)) {
+            CookfsTestRWMutexError(d, "failed to take read lock");
+            continue;
+        }
+        Cookfs_RefCountIncr(&d->readersInside);
+        if (Cookfs_RefCountGet(&d->writersFree) != 1) {
+            CookfsTestRWMutexError(d, "reader runs together with writer");
+        }
+        Tcl_WideInt a = d->valueA;
+        CookfsTestRWMutexWork(i % 64, i % 8192 == 0);
+        if (d->writerInside || d->valueB != a) {
+            CookfsTestRWMutexError(d, "reader sees incomplete update");
+        }
+        (void)Cookfs_RefCountDecr(&d->readersInside);
+        Cookfs_RWMutexUnlock(d->mx);
+    }
+    TCL_THREAD_CREATE_RETURN;
+}
+
+static Tcl_ThreadCreateType CookfsTestRWMutexWriter(void *clientData) {
+    CookfsTestRWMutexData *d = (CookfsTestRWMutexData *)clientData;
+    // Writers take the lock less often than readers
+    int iterations = d->iterations / 16;
+    for (int i = 0; i < iterations; i++) {
+        if (!Cookfs_RWMutexLockWrite(d->mx)) {
+            CookfsTestRWMutexError(d, "failed to take write lock");
+            continue;
+        }
+        if (Cookfs_RefCountDecr(&d->writersFree) != 0) {
+            CookfsTestRWMutexError(d, "writer runs together with writer");
+        }
+        if (Cookfs_RefCountGet(&d->readersInside) != 0) {
+            CookfsTestRWMutexError(d, "writer runs together with reader");
+        }
+        d->writerInside = 1;
+        d->valueA++;
+        CookfsTestRWMutexWork(64, i % 256 == 0);
+        d->valueB++;
+        d->writerInside = 0;
+        if (Cookfs_RefCountGet(&d->readersInside) != 0) {
+            CookfsTestRWMutexError(d, "reader entered while writer runs");
+        }
+        Cookfs_RefCountIncr(&d->writersFree);
+        Cookfs_RWMutexUnlock(d->mx);
+    }
+    TCL_THREAD_CREATE_RETURN;
+}
+
+static Tcl_ThreadCreateType CookfsTestRWMutexLocked(void *clientData) {
+    CookfsTestRWMutexData *d = (CookfsTestRWMutexData *)clientData;
+    d->lockReadResult = Cookfs_RWMutexLockRead(d->mx);
+    d->lockWriteResult = Cookfs_RWMutexLockWrite(d->mx);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+static void CookfsTestRWMutexRun(CookfsTestRWMutexData *d, int readers,
+    int writers)
+{
+    int count = readers + writers;
+    Tcl_ThreadId *threads = (Tcl_ThreadId *)ckalloc(sizeof(Tcl_ThreadId)
+        * count);
+
+    // Start writers in the middle, so that they interrupt running readers
+    for (int i = 0; i < count; i++) {
+        int isWriter = (i >= readers / 2 && i < readers / 2 + writers);
+        if (Tcl_CreateThread(&threads[i], isWriter ?
+            CookfsTestRWMutexWriter : CookfsTestRWMutexReader, d,
+            TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK)
+        {
+            fprintf(stderr, "ERROR: failed to create thread\n");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        int result;
+        Tcl_JoinThread(threads[i], &result);
+    }
+
+    ckfree(threads);
+}
+
+static int CookfsTestRWMutex(int readers, int writers, int iterations) {
+
+    CookfsTestRWMutexData d;
+    d.mx = Cookfs_RWMutexInit();
+    d.iterations = iterations;
+    d.valueA = 0;
+    d.valueB = 0;
+    d.writerInside = 0;
+    Cookfs_RefCountInit(&d.readersInside, 0);
+    Cookfs_RefCountInit(&d.writersFree, 1);
+    Cookfs_RefCountInit(&d.errors, 0);
+
+    // Tcl allocates a Tcl_Mutex on first use without ordering it with
+    // later unlocked accesses, which ThreadSanitizer reports as a race.
+    // Lock the mutex once before the threads are started.
+    Cookfs_RWMutexLockWrite(d.mx);
+    Cookfs_RWMutexUnlock(d.mx);
+
+    // Run the test without and with lock statistics, as the lock functions
+    // have separate code for them
+    CookfsTestRWMutexRun(&d, readers, writers);
+    Cookfs_LockStatsSetEnabled(Cookfs_RWMutexGetStats(d.mx), 1);
+    CookfsTestRWMutexRun(&d, readers, writers);
+
+    Tcl_WideInt expected = (Tcl_WideInt)writers * (iterations / 16) * 2;
+    if (d.valueA != expected || d.valueB != expected) {
+        fprintf(stderr, "ERROR: expected %" TCL_LL_MODIFIER "d updates,"
+            " got %" TCL_LL_MODIFIER "d and %" TCL_LL_MODIFIER "d\n",
+            expected, d.valueA, d.valueB);
+        Cookfs_RefCountIncr(&d.errors);
+    }
+    if (Cookfs_RWMutexGetLocks(d.mx) != 0) {
+        fprintf(stderr, "ERROR: the mutex is still locked\n");
+        Cookfs_RefCountIncr(&d.errors);
+    }
+
+    // Other threads can't take an exclusively locked mutex
+    if (!Cookfs_RWMutexLockExclusive(d.mx)) {
+        fprintf(stderr, "ERROR: failed to take exclusive lock\n");
+        Cookfs_RefCountIncr(&d.errors);
+    } else {
+        Tcl_ThreadId thread;
+        int result;
+        Tcl_CreateThread(&thread, CookfsTestRWMutexLocked, &d,
+            TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE);
+        Tcl_JoinThread(thread, &result);
+        if (d.lockReadResult || d.lockWriteResult) {
+            fprintf(stderr, "ERROR: other thread locked exclusively locked"
+                " mutex\n");
+            Cookfs_RefCountIncr(&d.errors);
+        }
+        Cookfs_RWMutexUnlock(d.mx);
+    }
+
+    Cookfs_RWMutexFini(d.mx);
+
+    int errors = Cookfs_RefCountGet(&d.errors);
+    printf("rwmutex: %d readers, %d writers, %d iterations: %s\n", readers,
+        writers, iterations, (errors ? "FAILED" : "ok"));
+    return errors == 0;
+
+}
+
+#endif /* TCL_THREADS */
+
+int main(int argc, char **argv) {
+
+    int readers = 8;
+    int writers = 2;
+    int iterations = 200000;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "ERROR: option \"%s\" requires a value\n",
+                argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-readers") == 0) {
+            readers = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-writers") == 0) {
+            writers = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-iterations") == 0) {
+            iterations = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "ERROR: unknown option \"%s\": must be -readers,"
+                " -writers or -iterations\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Tcl_FindExecutable(argv[0]);
+    Tcl_Interp *interp = Tcl_CreateInterp();
+    if (Cookfs_Init(interp) != TCL_OK) {
+        fprintf(stderr, "ERROR: failed to initialize cookfs: %s\n",
+            Tcl_GetStringResult(interp));
+        return 1;
+    }
+
+    int ok = 1;
+#ifdef TCL_THREADS
+    ok = CookfsTestRWMutex(readers, writers, iterations);
+#else
+    (void)readers;
+    (void)writers;
+    (void)iterations;
+    printf("rwmutex: skipped, threads are not enabled\n");
+#endif /* TCL_THREADS */
+
+    Tcl_DeleteInterp(interp);
+    Tcl_Finalize();
+
+    return ok ? 0 : 1;
+
+}